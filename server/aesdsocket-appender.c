@@ -0,0 +1,496 @@
+ /**********************************************************************************
+ * @file    aesdsocket-appender.c
+ * @brief   Single-writer append log for the aesdsocket data file.
+ *
+ *          Producers push complete records onto a lock-free multi-producer,
+ *          single-consumer queue. One appender thread is the only writer of
+ *          the history store, pops whatever has accumulated and hands it to
+ *          the store in one call (a single writev() for the fd backends,
+ *          group commit), then syncs according to the fsync policy. Only a
+ *          producer that asked for the end offset waits, and only for the
+ *          batch holding its own record. An event loop does not wait at all,
+ *          it keeps the record as a ticket and is told through its eventfd
+ *          once the batch is in.
+ *
+ *          A batch that fails half way keeps only the records that reached
+ *          the store whole, the offsets go on from the length the store
+ *          reports. The fd backends take back what a failed write left of
+ *          a record; one that stays cut short is ended with a newline ahead
+ *          of the next batch, so the next record does not run into it.
+ *
+ * @author        <Li-Huan Lu>
+ * @date          <10/16/2026>
+ * @reference     https://www.1024cores.net/home/lock-free-algorithms/queues/intrusive-mpsc-node-based-queue
+ *                https://man7.org/linux/man-pages/man2/writev.2.html
+ ***********************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+// Pthread
+#include <pthread.h>
+
+#include "aesdsocket.h"
+#include "aesdsocket-appender.h"
+#include "aesdsocket-log.h"
+#include "aesdsocket-metrics.h"
+#include "aesdsocket-store.h"
+#include "aesdsocket-timeindex.h"
+
+#define APPEND_BATCH_MAX 64     // records per writev(), well under IOV_MAX
+#define APPEND_IDLE_MS   1000   // wake up at least this often when idle
+
+typedef struct append_rec_s {
+	struct append_rec_s *next;  // queue link, must be first
+	size_t len;
+	off_t end_off;              // history length right after this record
+	int waiter;                 // producer waits or polls, and frees the record
+	int notify_fd;              // eventfd of a polling producer, or -1
+	int done;                   // 1 written, -1 failed, under commit_mutex
+	int stamped;                // a timestamp line for wall time stamp
+	time_t stamp;
+	char data[];
+} append_rec_t;
+
+// Vyukov intrusive MPSC queue, producers swap q_head, the appender owns q_tail
+static append_rec_t q_stub;
+static append_rec_t *q_head = &q_stub;
+static append_rec_t *q_tail = &q_stub;
+
+static pthread_t appender_id;
+static int appender_running;
+static off_t appender_size;
+static int appender_torn;       // the history ends inside a record, appender only
+static off_t committed_len;     // published after each batch, readers never lock
+static fsync_policy_t appender_policy;
+static int appender_interval_ms;
+static volatile int appender_stopping;
+
+// Sleep/wake for the appender, producers only lock when it is idle
+static pthread_mutex_t idle_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t idle_cond = PTHREAD_COND_INITIALIZER;
+static int appender_idle;
+
+// Completion for producers waiting on their own record
+static pthread_mutex_t commit_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t commit_cond = PTHREAD_COND_INITIALIZER;
+
+/**********************************************************************************
+ * @name       queue_push()
+ **********************************************************************************/
+static void queue_push(append_rec_t *rec)
+{
+	append_rec_t *prev;
+
+	__atomic_store_n(&rec->next, NULL, __ATOMIC_RELAXED);
+	prev = __atomic_exchange_n(&q_head, rec, __ATOMIC_ACQ_REL);
+	__atomic_store_n(&prev->next, rec, __ATOMIC_RELEASE);
+}
+
+/**********************************************************************************
+ * @name       queue_pop()
+ *
+ * @brief      { Consumer side. May return NULL while a producer is between its
+ *               exchange and link, the record shows up on a later call. }
+ **********************************************************************************/
+static append_rec_t *queue_pop(void)
+{
+	append_rec_t *tail = q_tail;
+	append_rec_t *next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+	append_rec_t *head;
+
+	if (tail == &q_stub){
+		if (!next) return NULL;
+		q_tail = next;
+		tail = next;
+		next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+	}
+	if (next){
+		q_tail = next;
+		return tail;
+	}
+	head = __atomic_load_n(&q_head, __ATOMIC_ACQUIRE);
+	if (tail != head) return NULL;
+
+	queue_push(&q_stub);
+	next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+	if (next){
+		q_tail = next;
+		return tail;
+	}
+	return NULL;
+}
+
+/**********************************************************************************
+ * @name       queue_empty()
+ **********************************************************************************/
+static int queue_empty(void)
+{
+	return q_tail == &q_stub && __atomic_load_n(&q_stub.next, __ATOMIC_ACQUIRE) == NULL &&
+	       __atomic_load_n(&q_head, __ATOMIC_ACQUIRE) == &q_stub;
+}
+
+/**********************************************************************************
+ * @name       now_ms()
+ **********************************************************************************/
+static long long now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**********************************************************************************
+ * @name       appender_wait()
+ *
+ * @brief      { Sleeps until a producer pushes or timeout_ms passes. The idle
+ *               flag and the queue are both seq_cst, so either the producer
+ *               sees the flag and signals, or we see its record and skip. }
+ **********************************************************************************/
+static void appender_wait(int timeout_ms)
+{
+	struct timespec ts;
+
+	pthread_mutex_lock(&idle_mutex);
+	__atomic_store_n(&appender_idle, 1, __ATOMIC_SEQ_CST);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (queue_empty() && !appender_stopping){
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_sec += timeout_ms / 1000;
+		ts.tv_nsec += (long)(timeout_ms % 1000) * 1000000;
+		if (ts.tv_nsec >= 1000000000){
+			ts.tv_sec++;
+			ts.tv_nsec -= 1000000000;
+		}
+		pthread_cond_timedwait(&idle_cond, &idle_mutex, &ts);
+	}
+	__atomic_store_n(&appender_idle, 0, __ATOMIC_SEQ_CST);
+	pthread_mutex_unlock(&idle_mutex);
+}
+
+/**********************************************************************************
+ * @name       appender_settle()
+ *
+ * @brief      { After a failed append, finds which records of the batch made
+ *               it whole into a store now size bytes long, and sets their end
+ *               offsets. Only a STORE_STABLE store can tell, any other one is
+ *               taken to have kept none and to end inside a record.
+ *               commit_mutex held. }
+ *
+ * @param[in]  term { 1 when the batch started with a newline ending a record
+ *                    an earlier failure cut short }
+ *
+ * @return     Number of leading records written
+ **********************************************************************************/
+static int appender_settle(append_rec_t **batch, int n, int term, off_t size)
+{
+	off_t pos = appender_size;
+	int i = 0;
+
+	if (store_flags() & STORE_STABLE){
+		if (term && pos < size){
+			pos++;
+			appender_torn = 0;
+		}
+		if (!appender_torn){
+			for (; i < n && pos + (off_t)batch[i]->len <= size; i++){
+				pos += batch[i]->len;
+				batch[i]->end_off = pos;
+			}
+		}
+		if (pos < size) appender_torn = 1;
+	}
+	else
+		appender_torn = 1;
+
+	appender_size = size;
+	log_post(LOGC_SERVER, LOG_ERR, "append failed, %d of %d records written%s", i, n,
+	         appender_torn ? ", the last one cut short" : "");
+	return i;
+}
+
+/**********************************************************************************
+ * @name       appender_thread()
+ **********************************************************************************/
+static void *appender_thread(void *arg)
+{
+	append_rec_t *batch[APPEND_BATCH_MAX];
+	struct iovec iov[APPEND_BATCH_MAX + 1];
+	int notify[APPEND_BATCH_MAX];
+	long long last_sync = now_ms();
+	int dirty = 0, waiters, nnotify, status, written, term, n, i, j;
+	uint64_t one = 1;
+	append_rec_t *rec;
+	off_t size = 0;
+
+	(void)arg;
+	for (;;){
+		// A record cut short by a failed append is ended first
+		term = appender_torn;
+		if (term){
+			iov[0].iov_base = (void *)"\n";
+			iov[0].iov_len = 1;
+		}
+		for (n = 0; n < APPEND_BATCH_MAX && (rec = queue_pop()) != NULL; n++){
+			batch[n] = rec;
+			iov[term + n].iov_base = rec->data;
+			iov[term + n].iov_len = rec->len;
+		}
+
+		if (n == 0){
+			if (appender_stopping && queue_empty()) break;
+			if (dirty && appender_policy == FSYNC_INTERVAL &&
+			    now_ms() - last_sync >= appender_interval_ms){
+				store_sync();
+				dirty = 0;
+				last_sync = now_ms();
+			}
+			appender_wait(appender_policy == FSYNC_INTERVAL && dirty ?
+			              appender_interval_ms : APPEND_IDLE_MS);
+			continue;
+		}
+
+		status = store_append(iov, term + n) ? -1 : 1;
+		written = n;
+		if (status == -1) size = store_size();
+
+		pthread_mutex_lock(&commit_mutex);
+		if (status == 1){
+			appender_size += term;
+			appender_torn = 0;
+			for (i = 0; i < n; i++){
+				appender_size += batch[i]->len;
+				batch[i]->end_off = appender_size;
+			}
+		}
+		else {
+			written = appender_settle(batch, n, term, size);
+			for (i = written; i < n; i++) batch[i]->end_off = appender_size;
+		}
+		pthread_mutex_unlock(&commit_mutex);
+
+		if (written){
+			status = 1;
+			dirty = 1;
+			if (appender_policy == FSYNC_RECORD ||
+			    (appender_policy == FSYNC_INTERVAL && now_ms() - last_sync >= appender_interval_ms)){
+				if (store_sync() == -1 && errno != EINVAL){
+					perror("fdatasync");
+					syslog(LOG_ERR, "fdatasync: %s", strerror(errno));
+					if (appender_policy == FSYNC_RECORD) status = -1;
+				}
+				dirty = 0;
+				last_sync = now_ms();
+			}
+		}
+
+		// Hand out end offsets in queue order, free fire-and-forget records
+		waiters = nnotify = 0;
+		pthread_mutex_lock(&commit_mutex);
+		if (status == 1 || written < n) __atomic_store_n(&committed_len, appender_size, __ATOMIC_RELEASE);
+		for (i = 0; i < n; i++){
+			// Indexed once committed, a lookup never points past committed_len
+			if (batch[i]->stamped && status == 1 && i < written)
+				timeindex_add(batch[i]->stamp, batch[i]->end_off - (off_t)batch[i]->len);
+			if (!batch[i]->waiter){
+				free(batch[i]);
+				continue;
+			}
+			batch[i]->done = i < written ? status : -1;
+			if (batch[i]->notify_fd == -1){
+				waiters = 1;
+				continue;
+			}
+			for (j = 0; j < nnotify && notify[j] != batch[i]->notify_fd; j++);
+			if (j == nnotify) notify[nnotify++] = batch[i]->notify_fd;
+		}
+		if (waiters) pthread_cond_broadcast(&commit_cond);
+		pthread_mutex_unlock(&commit_mutex);
+
+		// One wake up per loop, however many of its records were in the batch
+		for (j = 0; j < nnotify; j++){
+			if (write(notify[j], &one, sizeof(one)) == -1 && errno != EAGAIN)
+				syslog(LOG_ERR, "appender notify: %s", strerror(errno));
+		}
+	}
+
+	if (dirty && appender_policy != FSYNC_NONE) store_sync();
+	return NULL;
+}
+
+/**********************************************************************************
+ * @name       append_record()
+ *
+ * @brief      { Queues one record, timestamp lines carry their wall time. A
+ *               ticket is returned instead of waiting when asked for. }
+ **********************************************************************************/
+static int append_record(const char *buf, size_t len, off_t *end_off, int stamped, time_t stamp,
+                         int notify_fd, append_rec_t **ticket)
+{
+	append_rec_t *rec;
+	uint64_t t_wait;
+	int status;
+
+	if (len == 0){
+		if (end_off){
+			pthread_mutex_lock(&commit_mutex);
+			*end_off = appender_size;
+			pthread_mutex_unlock(&commit_mutex);
+		}
+		return 0;
+	}
+
+	rec = (append_rec_t *) malloc(sizeof(append_rec_t) + len);
+	if (!rec){
+		log_post(LOGC_SERVER, LOG_ERR, "Out of memory, dropping %zu byte record", len);
+		return -1;
+	}
+	memcpy(rec->data, buf, len);
+	rec->len = len;
+	rec->waiter = end_off != NULL || ticket != NULL;
+	rec->notify_fd = ticket ? notify_fd : -1;
+	rec->done = 0;
+	rec->stamped = stamped;
+	rec->stamp = stamp;
+
+	queue_push(rec);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&appender_idle, __ATOMIC_SEQ_CST)){
+		pthread_mutex_lock(&idle_mutex);
+		pthread_cond_signal(&idle_cond);
+		pthread_mutex_unlock(&idle_mutex);
+	}
+
+	if (ticket) *ticket = rec;
+	if (!end_off) return 0;
+
+	t_wait = metrics_now();
+	pthread_mutex_lock(&commit_mutex);
+	while (rec->done == 0)
+		pthread_cond_wait(&commit_cond, &commit_mutex);
+	status = rec->done;
+	*end_off = rec->end_off;
+	pthread_mutex_unlock(&commit_mutex);
+	if (t_wait) metrics_commit_wait(metrics_now() - t_wait);
+
+	free(rec);
+	return status == 1 ? 0 : -1;
+}
+
+/**********************************************************************************
+ * @name       appender_append()
+ **********************************************************************************/
+int appender_append(const char *buf, size_t len, off_t *end_off)
+{
+	return append_record(buf, len, end_off, 0, 0, -1, NULL);
+}
+
+/**********************************************************************************
+ * @name       appender_append_async()
+ **********************************************************************************/
+int appender_append_async(const char *buf, size_t len, int notify_fd, append_rec_t **ticket)
+{
+	*ticket = NULL;
+	if (len == 0) return -1;
+	return append_record(buf, len, NULL, 0, 0, notify_fd, ticket);
+}
+
+/**********************************************************************************
+ * @name       appender_poll()
+ **********************************************************************************/
+int appender_poll(append_rec_t *ticket, off_t *end_off)
+{
+	int status;
+
+	pthread_mutex_lock(&commit_mutex);
+	status = ticket->done;
+	*end_off = ticket->end_off;
+	pthread_mutex_unlock(&commit_mutex);
+
+	if (status) free(ticket);
+	return status;
+}
+
+/**********************************************************************************
+ * @name       appender_cancel()
+ **********************************************************************************/
+void appender_cancel(append_rec_t *ticket)
+{
+	int done;
+
+	pthread_mutex_lock(&commit_mutex);
+	done = ticket->done;
+	ticket->waiter = 0;   // the appender frees it once written
+	pthread_mutex_unlock(&commit_mutex);
+
+	if (done) free(ticket);
+}
+
+/**********************************************************************************
+ * @name       appender_append_stamp()
+ **********************************************************************************/
+int appender_append_stamp(const char *buf, size_t len, time_t t)
+{
+	return append_record(buf, len, NULL, 1, t, -1, NULL);
+}
+
+/**********************************************************************************
+ * @name       appender_start()
+ **********************************************************************************/
+int appender_start(fsync_policy_t policy, int interval_ms)
+{
+	char last;
+
+	appender_size = store_size();
+	committed_len = appender_size;
+
+	// History reused after a crash may end inside a record
+	appender_torn = (store_flags() & STORE_STABLE) && appender_size > 0 &&
+	                store_read(&last, 1, appender_size - 1) == 1 && last != '\n';
+	if (appender_torn)
+		syslog(LOG_WARNING, "history ends inside a record, ending it before the next one");
+
+	appender_policy = policy;
+	appender_interval_ms = interval_ms > 0 ? interval_ms : 1;
+	appender_stopping = 0;
+
+	if (pthread_create(&appender_id, NULL, appender_thread, NULL)){
+		perror("pthread_create");
+		syslog(LOG_ERR, "pthread_create failed for appender");
+		return -1;
+	}
+	appender_running = 1;
+	return 0;
+}
+
+/**********************************************************************************
+ * @name       appender_stop()
+ **********************************************************************************/
+void appender_stop(void)
+{
+	if (!appender_running) return;
+
+	pthread_mutex_lock(&idle_mutex);
+	appender_stopping = 1;
+	pthread_cond_signal(&idle_cond);
+	pthread_mutex_unlock(&idle_mutex);
+
+	pthread_join(appender_id, NULL);
+	appender_running = 0;
+}
+
+/**********************************************************************************
+ * @name       appender_committed_len()
+ **********************************************************************************/
+off_t appender_committed_len(void)
+{
+	return __atomic_load_n(&committed_len, __ATOMIC_ACQUIRE);
+}
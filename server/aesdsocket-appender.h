@@ -0,0 +1,114 @@
+ /**********************************************************************************
+ * @file    aesdsocket-appender.h
+ * @brief   Single-writer append log for the aesdsocket history.
+ *
+ * @author        <Li-Huan Lu>
+ * @date          <10/16/2026>
+ ***********************************************************************************/
+#ifndef AESDSOCKET_APPENDER_H
+#define AESDSOCKET_APPENDER_H
+
+#include <stddef.h>
+#include <time.h>
+#include <sys/types.h>
+
+typedef enum {
+	FSYNC_NONE = 0,             // leave write-back to the kernel
+	FSYNC_INTERVAL,             // sync the store at most every interval_ms
+	FSYNC_RECORD,               // sync the store each batch before it is acknowledged
+} fsync_policy_t;
+
+struct append_rec_s;
+
+/**********************************************************************************
+ * @name       appender_start()
+ *
+ * @brief      { Starts the appender thread on the opened history store. }
+ *
+ * @param[in]  policy      { When to sync the store }
+ * @param[in]  interval_ms { Period for FSYNC_INTERVAL }
+ *
+ * @return     0 on success, -1 on failure
+ **********************************************************************************/
+int appender_start(fsync_policy_t policy, int interval_ms);
+
+/**********************************************************************************
+ * @name       appender_stop()
+ *
+ * @brief      { Writes out everything queued and stops the thread. Call once no
+ *               producer is left. }
+ **********************************************************************************/
+void appender_stop(void);
+
+/**********************************************************************************
+ * @name       appender_append()
+ *
+ * @brief      { Queues one record for the appender. Never takes a lock shared
+ *               with other producers. }
+ *
+ * @param[in]  buf     { Record bytes, copied before returning }
+ * @param[in]  len     { Record length }
+ * @param[out] end_off { NULL to return at once. Otherwise waits for the batch
+ *                       holding this record to be written (and synced, per
+ *                       policy) and stores the history length right after
+ *                       it, exact only for a STORE_STABLE store. }
+ *
+ * @return     0 on success, -1 on failure
+ **********************************************************************************/
+int appender_append(const char *buf, size_t len, off_t *end_off);
+
+/**********************************************************************************
+ * @name       appender_append_async()
+ *
+ * @brief      { Queues one record like appender_append() with end_off, but
+ *               returns at once with a ticket for it. Once the batch holding
+ *               the record is written, 1 is added to notify_fd, an eventfd,
+ *               and appender_poll() hands out the end offset. }
+ *
+ * @param[in]  len    { Record length, not 0 }
+ * @param[out] ticket { Owned by the caller until appender_poll() reports the
+ *                      record done or appender_cancel() gives it up }
+ *
+ * @return     0 on success, -1 on failure
+ **********************************************************************************/
+int appender_append_async(const char *buf, size_t len, int notify_fd, struct append_rec_s **ticket);
+
+/**********************************************************************************
+ * @name       appender_poll()
+ *
+ * @brief      { Checks a ticket. Once done the ticket is freed and end_off
+ *               holds the history length right after the record. }
+ *
+ * @return     0 while pending, 1 once written, -1 when the write failed
+ **********************************************************************************/
+int appender_poll(struct append_rec_s *ticket, off_t *end_off);
+
+/**********************************************************************************
+ * @name       appender_cancel()
+ *
+ * @brief      { Gives up a ticket, e.g. for a connection that closes. The
+ *               record is still written, nobody is told. }
+ **********************************************************************************/
+void appender_cancel(struct append_rec_s *ticket);
+
+/**********************************************************************************
+ * @name       appender_append_stamp()
+ *
+ * @brief      { Queues a timestamp line for wall time t, which goes into the
+ *               time index at the offset it lands on once written. Returns at
+ *               once. }
+ *
+ * @return     0 on success, -1 on failure
+ **********************************************************************************/
+int appender_append_stamp(const char *buf, size_t len, time_t t);
+
+/**********************************************************************************
+ * @name       appender_committed_len()
+ *
+ * @brief      { History length covered by completed batches. With a
+ *               STORE_STABLE store bytes below it never change, so a reader
+ *               may send up to it without a lock. }
+ **********************************************************************************/
+off_t appender_committed_len(void);
+
+#endif /* AESDSOCKET_APPENDER_H */
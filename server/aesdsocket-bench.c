@@ -0,0 +1,817 @@
+ /**********************************************************************************
+ * @file    aesdsocket-bench.c
+ * @brief   Load generator and benchmark client for aesdsocket.
+ *
+ *          Opens N connections to the server and sends newline terminated
+ *          records, optionally split over several sends and mixed with
+ *          AESDCHAR_IOCSEEKTO commands, on the main history or spread over
+ *          named channels. Closed loop keeps a fixed number of
+ *          requests outstanding per connection; open loop sends on a fixed
+ *          schedule no matter how fast replies come back and measures
+ *          latency from the scheduled time, so a slow server cannot hide its
+ *          queueing delay.
+ *
+ *          Every record starts with a token unique to the run, and its reply
+ *          is complete once the record has come back in the reply stream.
+ *          A seekto is followed by a marker record and timed up to the
+ *          marker's reply. All randomness comes from the seed, so the same
+ *          options send the same bytes.
+ *
+ * @author        <Li-Huan Lu>
+ * @date          <10/16/2026>
+ * @reference     Gil Tene, "How NOT to Measure Latency" (coordinated omission)
+ ***********************************************************************************/
+#define _GNU_SOURCE     // memmem()
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <getopt.h>
+#include <fcntl.h>
+#include <time.h>
+
+// Socket
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+// Pthread
+#include <pthread.h>
+
+#define BENCH_MAX_EVENTS 64
+#define BENCH_PEND_MAX   1024   // requests outstanding per connection
+#define BENCH_TOKEN_MAX  48
+#define BENCH_RECV_SIZE  (256 << 10)
+#define LAT_LINEAR       16     // microseconds counted exactly
+#define LAT_SUB_BITS     3      // 8 buckets per power of two above that
+#define LAT_BUCKETS      (LAT_LINEAR + (40 - 4 + 1) * (1 << LAT_SUB_BITS))
+
+typedef struct bench_opts_s {
+	const char *host;
+	int port;
+	int conns;
+	int threads;
+	double duration;            // seconds, 0 with a request count
+	long long requests;         // total, 0 for duration only
+	size_t size_min, size_max;  // record size range
+	double newline_ratio;       // share of sends that end a record
+	double seekto_ratio;        // share of requests that are seekto commands
+	unsigned int seek_cmd, seek_off;
+	double rate;                // open loop requests/s, 0 for closed loop
+	int depth;                  // closed loop requests outstanding per connection
+	int tail;                   // ask for tail replies
+	int channels;               // connection i writes to channel bench<i % channels>, 0 for none
+	unsigned long long seed;
+} bench_opts_t;
+
+typedef struct bench_req_s {
+	char token[BENCH_TOKEN_MAX];
+	size_t token_len;
+	size_t record_len;
+	uint64_t t0;                // ns, scheduled or sent
+	int seekto;
+} bench_req_t;
+
+typedef struct bench_stats_s {
+	long long requests, seektos, errors;
+	long long skipped;          // open loop arrivals with the connection backlog full
+	unsigned long long bytes_out, bytes_in;
+	uint64_t latency[LAT_BUCKETS];
+	uint64_t lat_min, lat_max;
+} bench_stats_t;
+
+typedef struct bench_conn_s {
+	int fd;
+	int index;
+	uint64_t rng;
+	unsigned long long seq;
+	uint64_t next_send;         // open loop schedule, ns
+
+	char *out;                  // bytes the socket did not take yet
+	size_t out_len, out_sent, out_cap;
+	int want_out;
+
+	bench_req_t pend[BENCH_PEND_MAX];
+	size_t pend_head, pend_count;
+	int found;                  // token of pend[pend_head] seen
+	size_t need;                // bytes of its record still to come
+	char carry[BENCH_TOKEN_MAX];// stream tail, for tokens split across reads
+	size_t carry_len;
+} bench_conn_t;
+
+typedef struct bench_thread_s {
+	pthread_t thread_id;
+	int index;
+	int epfd;
+	int timer_fd;               // open loop, fires at the next scheduled send
+	bench_conn_t *conns;
+	int nconns;
+	long long quota;            // requests this thread still starts, -1 unlimited
+	bench_stats_t stats;
+	char *record;               // the record being sent, record_cap bytes
+	size_t record_cap;
+	char *recv_buf;             // BENCH_RECV_SIZE bytes
+} bench_thread_t;
+
+static bench_opts_t opts = {
+	.host = "127.0.0.1",
+	.port = 9000,
+	.conns = 16,
+	.threads = 1,
+	.duration = 10,
+	.size_min = 64,
+	.size_max = 64,
+	.newline_ratio = 1.0,
+	.depth = 1,
+	.seed = 1,
+};
+static struct sockaddr_in server_addr;
+static uint64_t t_start, t_stop;
+
+/**********************************************************************************
+ * @name       now_ns()
+ **********************************************************************************/
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/**********************************************************************************
+ * @name       rng_next()
+ *
+ * @brief      { xorshift64*, one stream per connection. }
+ **********************************************************************************/
+static uint64_t rng_next(uint64_t *s)
+{
+	*s ^= *s >> 12;
+	*s ^= *s << 25;
+	*s ^= *s >> 27;
+	return *s * 2685821657736338717ull;
+}
+
+static double rng_unit(uint64_t *s)
+{
+	return (rng_next(s) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/**********************************************************************************
+ * @name       latency_bucket() / latency_upper()
+ *
+ * @brief      { Same log-linear buckets as the server metrics. }
+ **********************************************************************************/
+static int latency_bucket(uint64_t us)
+{
+	int e;
+
+	if (us < LAT_LINEAR) return (int)us;
+	e = 63 - __builtin_clzll(us);
+	if (e > 40) return LAT_BUCKETS - 1;
+	return LAT_LINEAR + (e - 4) * (1 << LAT_SUB_BITS) +
+	       (int)((us >> (e - LAT_SUB_BITS)) & ((1 << LAT_SUB_BITS) - 1));
+}
+
+static uint64_t latency_upper(int idx)
+{
+	int e, sub;
+
+	if (idx < LAT_LINEAR) return idx;
+	e = (idx - LAT_LINEAR) / (1 << LAT_SUB_BITS) + 4;
+	sub = (idx - LAT_LINEAR) % (1 << LAT_SUB_BITS);
+	return ((uint64_t)((1 << LAT_SUB_BITS) + sub + 1) << (e - LAT_SUB_BITS)) - 1;
+}
+
+/**********************************************************************************
+ * @name       conn_open()
+ *
+ * @brief      { Connects (blocking, then switches to nonblocking), joins its
+ *               channel and asks for tail replies if requested. }
+ *
+ * @return     0 on success, -1 on failure
+ **********************************************************************************/
+static int conn_open(bench_thread_t *th, bench_conn_t *c)
+{
+	static const char tail_cmd[] = "AESDSOCKET_TAIL:1\n";
+	struct epoll_event ev;
+	char chan_cmd[64];
+	int len, one = 1;
+
+	c->fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (c->fd == -1) return -1;
+	if (connect(c->fd, (struct sockaddr *)&server_addr, sizeof(server_addr)) == -1){
+		perror("connect");
+		close(c->fd);
+		c->fd = -1;
+		return -1;
+	}
+	setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	if (opts.channels){
+		len = snprintf(chan_cmd, sizeof(chan_cmd), "AESDSOCKET_CHANNEL:bench%d\n", c->index % opts.channels);
+		if (send(c->fd, chan_cmd, len, MSG_NOSIGNAL) == -1){
+			perror("send");
+			close(c->fd);
+			c->fd = -1;
+			return -1;
+		}
+	}
+	if (opts.tail && send(c->fd, tail_cmd, sizeof(tail_cmd) - 1, MSG_NOSIGNAL) == -1){
+		perror("send");
+		close(c->fd);
+		c->fd = -1;
+		return -1;
+	}
+	fcntl(c->fd, F_SETFL, fcntl(c->fd, F_GETFL, 0) | O_NONBLOCK);
+
+	c->out_len = c->out_sent = 0;
+	c->want_out = 0;
+	c->pend_head = c->pend_count = 0;
+	c->found = 0;
+	c->carry_len = 0;
+
+	ev.events = EPOLLIN;
+	ev.data.ptr = c;
+	if (epoll_ctl(th->epfd, EPOLL_CTL_ADD, c->fd, &ev) == -1){
+		perror("epoll_ctl");
+		close(c->fd);
+		c->fd = -1;
+		return -1;
+	}
+	return 0;
+}
+
+/**********************************************************************************
+ * @name       conn_fail()
+ *
+ * @brief      { Counts an error and reconnects; outstanding requests are lost. }
+ **********************************************************************************/
+static void conn_fail(bench_thread_t *th, bench_conn_t *c)
+{
+	th->stats.errors++;
+	if (c->fd != -1){
+		epoll_ctl(th->epfd, EPOLL_CTL_DEL, c->fd, NULL);
+		close(c->fd);
+		c->fd = -1;
+	}
+	conn_open(th, c);
+}
+
+/**********************************************************************************
+ * @name       conn_interest()
+ **********************************************************************************/
+static void conn_interest(bench_thread_t *th, bench_conn_t *c, int want_out)
+{
+	struct epoll_event ev;
+
+	if (c->want_out == want_out) return;
+	ev.events = EPOLLIN | (want_out ? EPOLLOUT : 0);
+	ev.data.ptr = c;
+	epoll_ctl(th->epfd, EPOLL_CTL_MOD, c->fd, &ev);
+	c->want_out = want_out;
+}
+
+/**********************************************************************************
+ * @name       conn_write()
+ *
+ * @brief      { One send() of buf, queueing what does not fit. Once anything is
+ *               queued, later writes queue behind it to keep the order. }
+ *
+ * @return     0 on success, -1 on failure
+ **********************************************************************************/
+static int conn_write(bench_thread_t *th, bench_conn_t *c, const char *buf, size_t len)
+{
+	ssize_t ret = 0;
+
+	if (c->out_sent == c->out_len){
+		c->out_len = c->out_sent = 0;
+		ret = send(c->fd, buf, len, MSG_NOSIGNAL);
+		if (ret == -1){
+			if (errno != EAGAIN && errno != EWOULDBLOCK) return -1;
+			ret = 0;
+		}
+		th->stats.bytes_out += ret;
+		if ((size_t)ret == len) return 0;
+	}
+
+	len -= ret;
+	if (c->out_len + len > c->out_cap){
+		size_t cap = c->out_cap ? c->out_cap : 4096;
+		char *grown;
+
+		while (cap < c->out_len + len) cap *= 2;
+		grown = (char *) realloc(c->out, cap);
+		if (!grown) return -1;
+		c->out = grown;
+		c->out_cap = cap;
+	}
+	memcpy(c->out + c->out_len, buf + ret, len);
+	c->out_len += len;
+	conn_interest(th, c, 1);
+	return 0;
+}
+
+/**********************************************************************************
+ * @name       conn_flush()
+ **********************************************************************************/
+static int conn_flush(bench_thread_t *th, bench_conn_t *c)
+{
+	ssize_t ret;
+
+	while (c->out_sent < c->out_len){
+		ret = send(c->fd, c->out + c->out_sent, c->out_len - c->out_sent, MSG_NOSIGNAL);
+		if (ret == -1){
+			if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+			return -1;
+		}
+		c->out_sent += ret;
+		th->stats.bytes_out += ret;
+	}
+	conn_interest(th, c, 0);
+	return 0;
+}
+
+/**********************************************************************************
+ * @name       send_request()
+ *
+ * @brief      { Builds the next record (after a seekto command, per the mix) and
+ *               sends it in as many pieces as the newline ratio asks for. }
+ *
+ * @return     0 on success, -1 on failure
+ **********************************************************************************/
+static int send_request(bench_thread_t *th, bench_conn_t *c, uint64_t t0)
+{
+	bench_req_t *req;
+	size_t size, i, left, piece;
+	char cmd[64];
+	int cmd_len;
+
+	if (c->pend_count == BENCH_PEND_MAX){
+		th->stats.skipped++;
+		return 0;
+	}
+	req = &c->pend[(c->pend_head + c->pend_count) % BENCH_PEND_MAX];
+
+	req->seekto = opts.seekto_ratio > 0 && rng_unit(&c->rng) < opts.seekto_ratio;
+	if (req->seekto){
+		cmd_len = snprintf(cmd, sizeof(cmd), "AESDCHAR_IOCSEEKTO:%u,%u\n", opts.seek_cmd, opts.seek_off);
+		if (conn_write(th, c, cmd, cmd_len)) return -1;
+	}
+
+	req->token_len = snprintf(req->token, sizeof(req->token), "bench:%d.%llu:", c->index, c->seq++);
+	size = opts.size_min;
+	if (opts.size_max > opts.size_min) size += rng_next(&c->rng) % (opts.size_max - opts.size_min + 1);
+	if (size < req->token_len + 1) size = req->token_len + 1;
+	req->record_len = size;
+	req->t0 = t0;
+
+	memcpy(th->record, req->token, req->token_len);
+	for (i = req->token_len; i < size - 1; i++) th->record[i] = 'a' + i % 26;
+	th->record[size - 1] = '\n';
+
+	// Only the last piece carries the newline
+	for (i = 0; i < size; i += piece){
+		left = size - i;
+		piece = left;
+		if (left > 1 && rng_unit(&c->rng) >= opts.newline_ratio)
+			piece = 1 + rng_next(&c->rng) % (left - 1);
+		if (conn_write(th, c, th->record + i, piece)) return -1;
+	}
+	c->pend_count++;
+	if (th->quota > 0) th->quota--;
+	return 0;
+}
+
+/**********************************************************************************
+ * @name       complete_head()
+ **********************************************************************************/
+static void complete_head(bench_thread_t *th, bench_conn_t *c, uint64_t now)
+{
+	bench_req_t *req = &c->pend[c->pend_head];
+	uint64_t us = now > req->t0 ? (now - req->t0) / 1000 : 0;
+
+	th->stats.latency[latency_bucket(us)]++;
+	if (!th->stats.requests || us < th->stats.lat_min) th->stats.lat_min = us;
+	if (us > th->stats.lat_max) th->stats.lat_max = us;
+	th->stats.requests++;
+	if (req->seekto) th->stats.seektos++;
+
+	c->pend_head = (c->pend_head + 1) % BENCH_PEND_MAX;
+	c->pend_count--;
+	c->found = 0;
+}
+
+/**********************************************************************************
+ * @name       scan_reply()
+ *
+ * @brief      { Walks received bytes looking for the oldest outstanding token,
+ *               then counts off the rest of its record. }
+ **********************************************************************************/
+static void scan_reply(bench_thread_t *th, bench_conn_t *c, const char *data, size_t len, uint64_t now)
+{
+	bench_req_t *req;
+	const char *hit;
+	char joint[2 * BENCH_TOKEN_MAX];
+	size_t pos = 0, n, joint_len;
+
+	while (pos < len && c->pend_count){
+		req = &c->pend[c->pend_head];
+
+		if (c->found){
+			n = len - pos < c->need ? len - pos : c->need;
+			c->need -= n;
+			pos += n;
+			if (!c->need){
+				complete_head(th, c, now);
+				c->carry_len = 0;
+			}
+			continue;
+		}
+
+		// A token straddling the previous read
+		if (c->carry_len){
+			n = len - pos < req->token_len - 1 ? len - pos : req->token_len - 1;
+			memcpy(joint, c->carry, c->carry_len);
+			memcpy(joint + c->carry_len, data + pos, n);
+			joint_len = c->carry_len + n;
+			c->carry_len = 0;
+			hit = (const char *) memmem(joint, joint_len, req->token, req->token_len);
+			if (hit){
+				size_t used = (hit - joint) + req->token_len - (joint_len - n);
+
+				c->found = 1;
+				c->need = req->record_len - req->token_len;
+				pos += used;
+				if (!c->need) complete_head(th, c, now);
+				continue;
+			}
+		}
+
+		hit = (const char *) memmem(data + pos, len - pos, req->token, req->token_len);
+		if (hit){
+			c->found = 1;
+			c->need = req->record_len - req->token_len;
+			pos = hit - data + req->token_len;
+			if (!c->need) complete_head(th, c, now);
+			continue;
+		}
+
+		// Keep just enough to spot a token split by the next read
+		n = len - pos < req->token_len - 1 ? len - pos : req->token_len - 1;
+		memcpy(c->carry, data + len - n, n);
+		c->carry_len = n;
+		break;
+	}
+}
+
+/**********************************************************************************
+ * @name       conn_readable()
+ *
+ * @return     0 on success, -1 when the connection broke
+ **********************************************************************************/
+static int conn_readable(bench_thread_t *th, bench_conn_t *c)
+{
+	ssize_t ret;
+
+	for (;;){
+		ret = recv(c->fd, th->recv_buf, BENCH_RECV_SIZE, 0);
+		if (ret == 0) return -1;
+		if (ret == -1) return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+		th->stats.bytes_in += ret;
+		scan_reply(th, c, th->recv_buf, ret, now_ns());
+	}
+}
+
+/**********************************************************************************
+ * @name       bench_thread()
+ **********************************************************************************/
+static void *bench_thread(void *arg)
+{
+	bench_thread_t *th = (bench_thread_t *)arg;
+	struct epoll_event events[BENCH_MAX_EVENTS];
+	struct itimerspec its = { .it_interval = { 0, 0 } };
+	struct epoll_event ev = { .events = EPOLLIN, .data.ptr = NULL };
+	uint64_t now, interval = 0, next_due, expirations;
+	int nfds, i, timeout;
+	bench_conn_t *c;
+
+	if (opts.rate > 0){
+		interval = (uint64_t)(1e9 * opts.conns / opts.rate);
+		th->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+		if (th->timer_fd == -1 || epoll_ctl(th->epfd, EPOLL_CTL_ADD, th->timer_fd, &ev) == -1){
+			perror("timerfd");
+			return NULL;
+		}
+	}
+
+	// A record is never shorter than its token and newline
+	th->record_cap = opts.size_max > BENCH_TOKEN_MAX ? opts.size_max : BENCH_TOKEN_MAX;
+	th->record = (char *) malloc(th->record_cap);
+	th->recv_buf = (char *) malloc(BENCH_RECV_SIZE);
+	if (!th->record || !th->recv_buf){
+		perror("malloc");
+		free(th->record);
+		free(th->recv_buf);
+		return NULL;
+	}
+
+	for (i = 0; i < th->nconns; i++){
+		c = &th->conns[i];
+		// Spread the open loop schedule so connections do not fire together
+		c->next_send = t_start + (interval ? rng_next(&c->rng) % interval : 0);
+	}
+
+	for (;;){
+		now = now_ns();
+		if (now >= t_stop) break;
+
+		// Start whatever is due
+		next_due = t_stop;
+		for (i = 0; i < th->nconns; i++){
+			c = &th->conns[i];
+			if (c->fd == -1 && conn_open(th, c)) continue;
+
+			if (interval){
+				while (c->next_send <= now && th->quota != 0){
+					if (send_request(th, c, c->next_send)){
+						conn_fail(th, c);
+						break;
+					}
+					c->next_send += interval;
+				}
+				if (c->next_send < next_due) next_due = c->next_send;
+			}
+			else {
+				while (c->pend_count < (size_t)opts.depth && th->quota != 0){
+					if (send_request(th, c, now_ns())){
+						conn_fail(th, c);
+						break;
+					}
+				}
+			}
+		}
+		if (th->quota == 0){
+			int idle = 1;
+
+			for (i = 0; i < th->nconns; i++)
+				if (th->conns[i].pend_count) idle = 0;
+			if (idle) break;
+		}
+
+		// Millisecond epoll timeouts would add up to 1 ms to every open loop send
+		timeout = 100;
+		if (interval){
+			its.it_value.tv_sec = next_due / 1000000000ull;
+			its.it_value.tv_nsec = next_due % 1000000000ull;
+			timerfd_settime(th->timer_fd, TFD_TIMER_ABSTIME, &its, NULL);
+		}
+
+		nfds = epoll_wait(th->epfd, events, BENCH_MAX_EVENTS, timeout);
+		for (i = 0; i < nfds; i++){
+			c = (bench_conn_t *)events[i].data.ptr;
+			if (!c){
+				if (read(th->timer_fd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN)
+					perror("timerfd");
+				continue;
+			}
+			if (c->fd == -1) continue;
+			if ((events[i].events & EPOLLOUT) && conn_flush(th, c)){
+				conn_fail(th, c);
+				continue;
+			}
+			if ((events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) && conn_readable(th, c))
+				conn_fail(th, c);
+		}
+	}
+
+	for (i = 0; i < th->nconns; i++){
+		if (th->conns[i].fd != -1) close(th->conns[i].fd);
+		free(th->conns[i].out);
+	}
+	free(th->record);
+	free(th->recv_buf);
+	if (th->timer_fd != -1) close(th->timer_fd);
+	return NULL;
+}
+
+/**********************************************************************************
+ * @name       report()
+ **********************************************************************************/
+static void report(const bench_stats_t *st, double secs)
+{
+	static const double quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+	uint64_t rows[64], cum, seen, rank, bound;
+	size_t q;
+	int i, e;
+
+	printf("connections %d, threads %d, %s loop", opts.conns, opts.threads, opts.rate > 0 ? "open" : "closed");
+	if (opts.rate > 0) printf(" at %.0f req/s", opts.rate);
+	else printf(", depth %d", opts.depth);
+	if (opts.channels) printf(", %d channels", opts.channels);
+	printf(", seed %llu\n", opts.seed);
+	printf("records %zu-%zu B, newline ratio %.2f, seekto ratio %.2f%s\n",
+	       opts.size_min, opts.size_max, opts.newline_ratio, opts.seekto_ratio,
+	       opts.tail ? ", tail replies" : "");
+	printf("duration   %.3f s\n", secs);
+	printf("requests   %lld (%.1f/s), seekto %lld, errors %lld, skipped %lld\n",
+	       st->requests, st->requests / secs, st->seektos, st->errors, st->skipped);
+	printf("sent       %.3f MB (%.3f MB/s)\n", st->bytes_out / 1e6, st->bytes_out / 1e6 / secs);
+	printf("received   %.3f MB (%.3f MB/s)\n", st->bytes_in / 1e6, st->bytes_in / 1e6 / secs);
+	if (!st->requests) return;
+
+	printf("latency us min %llu", (unsigned long long)st->lat_min);
+	for (q = 0; q < sizeof(quantiles) / sizeof(quantiles[0]); q++){
+		rank = (uint64_t)(quantiles[q] * st->requests + 0.5);
+		if (rank == 0) rank = 1;
+		for (i = 0, seen = 0; i < LAT_BUCKETS - 1; i++){
+			seen += st->latency[i];
+			if (seen >= rank) break;
+		}
+		bound = latency_upper(i);
+		printf("  p%g %llu", quantiles[q] * 100, (unsigned long long)(bound < st->lat_max ? bound : st->lat_max));
+	}
+	printf("  max %llu\n", (unsigned long long)st->lat_max);
+
+	// One row per power of two keeps the histogram short
+	memset(rows, 0, sizeof(rows));
+	for (i = 0; i < LAT_BUCKETS; i++)
+		rows[63 - __builtin_clzll(latency_upper(i) | 1)] += st->latency[i];
+
+	printf("histogram  <= us        count      cum%%\n");
+	for (e = 0, cum = 0; e < 64 && cum < (uint64_t)st->requests; e++){
+		cum += rows[e];
+		if (!cum) continue;
+		printf("  %12llu %12llu %9.3f\n", (unsigned long long)((2ull << e) - 1),
+		       (unsigned long long)rows[e], 100.0 * cum / st->requests);
+	}
+}
+
+/**********************************************************************************
+ * @name       usage()
+ **********************************************************************************/
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [options]\n"
+	                "  -H, --host ADDR       server address (default: 127.0.0.1)\n"
+	                "  -p, --port N          server port (default: 9000)\n"
+	                "  -c, --conns N         concurrent connections (default: 16)\n"
+	                "  -t, --threads N       client threads (default: 1)\n"
+	                "  -d, --duration S      run time in seconds (default: 10)\n"
+	                "  -n, --requests N      stop after N requests (no time limit unless -d)\n"
+	                "  -s, --size MIN[-MAX]  record size in bytes (default: 64)\n"
+	                "  -l, --newline R       share of sends ending a record, 0-1 (default: 1)\n"
+	                "  -k, --seekto R        share of requests that are seekto commands (default: 0)\n"
+	                "  -K, --seek CMD,OFF    seekto arguments (default: 0,0)\n"
+	                "  -r, --rate N          open loop at N requests/s in total (default: closed loop)\n"
+	                "  -q, --depth N         closed loop requests outstanding per connection (default: 1)\n"
+	                "  -T, --tail            ask for tail replies instead of the whole history\n"
+	                "  -C, --channels N      spread connections over N named channels (default: 0, main history)\n"
+	                "  -S, --seed N          random seed (default: 1)\n",
+	                prog);
+}
+
+/**********************************************************************************
+ * Main functions
+ **********************************************************************************/
+int main(int argc, char **argv)
+{
+	static const struct option long_options[] = {
+		{"host",     required_argument, NULL, 'H'},
+		{"port",     required_argument, NULL, 'p'},
+		{"conns",    required_argument, NULL, 'c'},
+		{"threads",  required_argument, NULL, 't'},
+		{"duration", required_argument, NULL, 'd'},
+		{"requests", required_argument, NULL, 'n'},
+		{"size",     required_argument, NULL, 's'},
+		{"newline",  required_argument, NULL, 'l'},
+		{"seekto",   required_argument, NULL, 'k'},
+		{"seek",     required_argument, NULL, 'K'},
+		{"rate",     required_argument, NULL, 'r'},
+		{"depth",    required_argument, NULL, 'q'},
+		{"tail",     no_argument,       NULL, 'T'},
+		{"channels", required_argument, NULL, 'C'},
+		{"seed",     required_argument, NULL, 'S'},
+		{NULL, 0, NULL, 0}
+	};
+	bench_thread_t *threads;
+	bench_stats_t total;
+	uint64_t seed_state;
+	int opt, i, j, n, duration_set = 0;
+	char *end;
+
+	while ((opt = getopt_long(argc, argv, "H:p:c:t:d:n:s:l:k:K:r:q:TC:S:", long_options, NULL)) != -1){
+		switch (opt){
+			case 'H': opts.host = optarg; break;
+			case 'p': opts.port = atoi(optarg); break;
+			case 'c': opts.conns = atoi(optarg); break;
+			case 't': opts.threads = atoi(optarg); break;
+			case 'd': opts.duration = atof(optarg); duration_set = 1; break;
+			case 'n': opts.requests = atoll(optarg); break;
+			case 's':
+				opts.size_min = opts.size_max = strtoul(optarg, &end, 10);
+				if (*end == '-') opts.size_max = strtoul(end + 1, NULL, 10);
+				break;
+			case 'l': opts.newline_ratio = atof(optarg); break;
+			case 'k': opts.seekto_ratio = atof(optarg); break;
+			case 'K':
+				if (sscanf(optarg, "%u,%u", &opts.seek_cmd, &opts.seek_off) != 2){
+					usage(argv[0]);
+					exit(1);
+				}
+				break;
+			case 'r': opts.rate = atof(optarg); break;
+			case 'q': opts.depth = atoi(optarg); break;
+			case 'T': opts.tail = 1; break;
+			case 'C': opts.channels = atoi(optarg); break;
+			case 'S': opts.seed = strtoull(optarg, NULL, 10); break;
+			default:
+				usage(argv[0]);
+				exit(1);
+		}
+	}
+	if (opts.conns <= 0 || opts.threads <= 0 || opts.depth <= 0 || opts.depth > BENCH_PEND_MAX ||
+	    opts.size_max < opts.size_min || opts.newline_ratio <= 0 || opts.newline_ratio > 1 ||
+	    opts.seekto_ratio < 0 || opts.seekto_ratio > 1 || opts.rate < 0 || opts.channels < 0 ||
+	    (opts.duration <= 0 && opts.requests <= 0)){
+		usage(argv[0]);
+		exit(1);
+	}
+	if (opts.threads > opts.conns) opts.threads = opts.conns;
+	if (opts.requests > 0 && !duration_set) opts.duration = 0;
+
+	memset(&server_addr, 0, sizeof(server_addr));
+	server_addr.sin_family = AF_INET;
+	server_addr.sin_port = htons(opts.port);
+	if (inet_pton(AF_INET, opts.host, &server_addr.sin_addr) != 1){
+		fprintf(stderr, "bad address %s\n", opts.host);
+		exit(1);
+	}
+
+	threads = (bench_thread_t *) calloc(opts.threads, sizeof(bench_thread_t));
+	if (!threads){
+		perror("calloc");
+		exit(1);
+	}
+
+	// Connections are dealt round-robin, each with its own seeded stream
+	for (i = 0; i < opts.threads; i++){
+		bench_thread_t *th = &threads[i];
+
+		th->index = i;
+		th->timer_fd = -1;
+		th->nconns = opts.conns / opts.threads + (i < opts.conns % opts.threads);
+		th->quota = opts.requests > 0 ? opts.requests / opts.threads + (i < opts.requests % opts.threads) : -1;
+		th->conns = (bench_conn_t *) calloc(th->nconns, sizeof(bench_conn_t));
+		th->epfd = epoll_create1(EPOLL_CLOEXEC);
+		if (!th->conns || th->epfd == -1){
+			perror("setup");
+			exit(1);
+		}
+		for (j = 0; j < th->nconns; j++){
+			bench_conn_t *c = &th->conns[j];
+
+			c->fd = -1;
+			c->index = j * opts.threads + i;
+			seed_state = opts.seed * 0x9e3779b97f4a7c15ull + c->index + 1;
+			c->rng = rng_next(&seed_state) | 1;
+		}
+	}
+
+	t_start = now_ns();
+	t_stop = opts.duration > 0 ? t_start + (uint64_t)(opts.duration * 1e9) : UINT64_MAX;
+
+	for (i = 0, n = 0; i < opts.threads; i++, n++){
+		if (pthread_create(&threads[i].thread_id, NULL, bench_thread, &threads[i])){
+			perror("pthread_create");
+			break;
+		}
+	}
+
+	memset(&total, 0, sizeof(total));
+	for (i = 0; i < n; i++){
+		bench_stats_t *st = &threads[i].stats;
+
+		pthread_join(threads[i].thread_id, NULL);
+		close(threads[i].epfd);
+		if (st->requests && (!total.requests || st->lat_min < total.lat_min)) total.lat_min = st->lat_min;
+		if (st->lat_max > total.lat_max) total.lat_max = st->lat_max;
+		total.requests += st->requests;
+		total.seektos += st->seektos;
+		total.errors += st->errors;
+		total.skipped += st->skipped;
+		total.bytes_out += st->bytes_out;
+		total.bytes_in += st->bytes_in;
+		for (j = 0; j < LAT_BUCKETS; j++) total.latency[j] += st->latency[j];
+		free(threads[i].conns);
+	}
+	free(threads);
+
+	report(&total, (now_ns() - t_start) / 1e9);
+	return total.requests ? 0 : 1;
+}
@@ -0,0 +1,173 @@
+ /**********************************************************************************
+ * @file    aesdsocket-cache.c
+ * @brief   In-memory segment cache of the aesdsocket history.
+ *
+ *          The history is cut into CACHE_SEG_SIZE segments, each a read-only
+ *          MAP_SHARED window onto the data file. The file is append-only, so a
+ *          mapped segment only ever grows as the appender commits more bytes,
+ *          and every reply covering it reads the same pages. Segments are
+ *          refcounted by the replies sending from them; when the cap is
+ *          reached an idle segment is unmapped, and when none is idle the
+ *          caller goes back to reading the file.
+ *
+ * @author        <Li-Huan Lu>
+ * @date          <10/16/2026>
+ * @reference     https://man7.org/linux/man-pages/man2/mmap.2.html
+ ***********************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+
+// Pthread
+#include <pthread.h>
+
+#include "aesdsocket.h"
+#include "aesdsocket-appender.h"
+#include "aesdsocket-cache.h"
+#include "aesdsocket-store.h"
+
+static pthread_mutex_t cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+static cache_seg_t **segs;      // indexed by offset / CACHE_SEG_SIZE
+static size_t nsegs;
+static size_t cache_cap;        // 0 when disabled
+static size_t cache_mapped;     // bytes currently mapped
+static unsigned long cache_clock;
+
+/**********************************************************************************
+ * @name       cache_init()
+ **********************************************************************************/
+int cache_init(size_t cap_bytes)
+{
+	// Segments map the store and are only valid while bytes stay put
+	if (cap_bytes && !(store_flags() & STORE_STABLE)){
+		syslog(LOG_INFO, "history cache disabled for %s", store_name());
+		cap_bytes = 0;
+	}
+	cache_cap = cap_bytes;
+	return 0;
+}
+
+/**********************************************************************************
+ * @name       cache_destroy()
+ **********************************************************************************/
+void cache_destroy(void)
+{
+	size_t i;
+
+	pthread_mutex_lock(&cache_mutex);
+	for (i = 0; i < nsegs; i++){
+		if (!segs[i]) continue;
+		munmap((void *)segs[i]->data, CACHE_SEG_SIZE);
+		free(segs[i]);
+	}
+	free(segs);
+	segs = NULL;
+	nsegs = 0;
+	cache_mapped = 0;
+	pthread_mutex_unlock(&cache_mutex);
+}
+
+/**********************************************************************************
+ * @name       cache_enabled()
+ **********************************************************************************/
+int cache_enabled(void)
+{
+	return cache_cap != 0;
+}
+
+/**********************************************************************************
+ * @name       cache_evict_one()
+ *
+ * @brief      { Unmaps the least recently used segment no reply holds. Caller
+ *               holds cache_mutex. }
+ *
+ * @return     0 when a segment was freed, -1 when all are in use
+ **********************************************************************************/
+static int cache_evict_one(void)
+{
+	cache_seg_t *victim = NULL;
+	size_t i, victim_idx = 0;
+
+	for (i = 0; i < nsegs; i++){
+		if (!segs[i] || __atomic_load_n(&segs[i]->refs, __ATOMIC_ACQUIRE)) continue;
+		if (!victim || segs[i]->last_use < victim->last_use){
+			victim = segs[i];
+			victim_idx = i;
+		}
+	}
+	if (!victim) return -1;
+
+	munmap((void *)victim->data, CACHE_SEG_SIZE);
+	free(victim);
+	segs[victim_idx] = NULL;
+	cache_mapped -= CACHE_SEG_SIZE;
+	return 0;
+}
+
+/**********************************************************************************
+ * @name       cache_get()
+ **********************************************************************************/
+cache_seg_t *cache_get(off_t off)
+{
+	size_t idx = off / CACHE_SEG_SIZE;
+	cache_seg_t *seg = NULL;
+	void *map;
+
+	if (!cache_cap || off < 0) return NULL;
+
+	pthread_mutex_lock(&cache_mutex);
+	if (idx >= nsegs){
+		size_t new_n = nsegs ? nsegs : 16;
+		cache_seg_t **grown;
+
+		while (new_n <= idx) new_n *= 2;
+		grown = (cache_seg_t **) realloc(segs, new_n * sizeof(*segs));
+		if (!grown) goto out;
+		memset(grown + nsegs, 0, (new_n - nsegs) * sizeof(*segs));
+		segs = grown;
+		nsegs = new_n;
+	}
+
+	seg = segs[idx];
+	if (!seg){
+		if (cache_mapped + CACHE_SEG_SIZE > cache_cap && cache_evict_one()) goto out;
+
+		seg = (cache_seg_t *) calloc(1, sizeof(cache_seg_t));
+		if (!seg) goto out;
+
+		// Pages past the end of the file are never touched, see committed length
+		map = store_map((off_t)idx * CACHE_SEG_SIZE, CACHE_SEG_SIZE);
+		if (!map){
+			perror("mmap");
+			syslog(LOG_ERR, "mmap history segment: %s", strerror(errno));
+			free(seg);
+			seg = NULL;
+			goto out;
+		}
+		seg->base = (off_t)idx * CACHE_SEG_SIZE;
+		seg->data = (const char *)map;
+		segs[idx] = seg;
+		cache_mapped += CACHE_SEG_SIZE;
+	}
+	__atomic_add_fetch(&seg->refs, 1, __ATOMIC_ACQ_REL);
+	seg->last_use = ++cache_clock;
+
+out:
+	pthread_mutex_unlock(&cache_mutex);
+	return seg;
+}
+
+/**********************************************************************************
+ * @name       cache_put()
+ *
+ * @brief      { Drops a reference. No lock: references are only taken under
+ *               cache_mutex, so eviction never sees a count go back up. }
+ **********************************************************************************/
+void cache_put(cache_seg_t *seg)
+{
+	if (seg) __atomic_sub_fetch(&seg->refs, 1, __ATOMIC_ACQ_REL);
+}
@@ -0,0 +1,62 @@
+ /**********************************************************************************
+ * @file    aesdsocket-cache.h
+ * @brief   In-memory segment cache of the aesdsocket history.
+ *
+ * @author        <Li-Huan Lu>
+ * @date          <10/16/2026>
+ ***********************************************************************************/
+#ifndef AESDSOCKET_CACHE_H
+#define AESDSOCKET_CACHE_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#define CACHE_SEG_SIZE (1 << 20)    // history bytes per segment, page aligned
+
+typedef struct cache_seg_s {
+	off_t base;                 // history offset of data[0]
+	const char *data;           // CACHE_SEG_SIZE bytes, valid below the committed length
+	int refs;                   // replies currently sending from the segment
+	unsigned long last_use;     // for eviction, under the cache lock
+} cache_seg_t;
+
+/**********************************************************************************
+ * @name       cache_init()
+ *
+ * @brief      { Enables the cache with a memory cap. A cap of 0 leaves it off,
+ *               and it stays off unless the store is STORE_STABLE and can
+ *               map its history. Call after store_open(). }
+ *
+ * @return     0 on success, -1 on failure
+ **********************************************************************************/
+int cache_init(size_t cap_bytes);
+
+/**********************************************************************************
+ * @name       cache_destroy()
+ *
+ * @brief      { Unmaps every segment. No reply may hold one any more. }
+ **********************************************************************************/
+void cache_destroy(void);
+
+/**********************************************************************************
+ * @name       cache_enabled()
+ **********************************************************************************/
+int cache_enabled(void);
+
+/**********************************************************************************
+ * @name       cache_get()
+ *
+ * @brief      { Returns the segment holding history offset off with a reference
+ *               taken, mapping it on first use. Replies in flight at the same
+ *               time share one segment. }
+ *
+ * @return     Segment, or NULL when it would exceed the cap; read the file then
+ **********************************************************************************/
+cache_seg_t *cache_get(off_t off);
+
+/**********************************************************************************
+ * @name       cache_put()
+ **********************************************************************************/
+void cache_put(cache_seg_t *seg);
+
+#endif /* AESDSOCKET_CACHE_H */
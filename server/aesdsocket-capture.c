@@ -0,0 +1,165 @@
+ /**********************************************************************************
+ * @file    aesdsocket-capture.c
+ * @brief   Traffic capture of the aesdsocket server.
+ *
+ *          Records what every connection sends and is sent, with the time it
+ *          happened, for aesdsocket-replay to play back against another
+ *          build. Events go through one buffered stream under a mutex, in
+ *          the order they are stamped. The buffer is written out at least
+ *          every CAPTURE_FLUSH_MS as connections close, so a capture of a
+ *          server that dies loses little. Off unless asked for, it is a
+ *          diagnostic mode and costs a lock per event.
+ *
+ * @author        <Li-Huan Lu>
+ * @date          <10/16/2026>
+ * @reference     https://wiki.wireshark.org/Development/LibpcapFileFormat
+ ***********************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <time.h>
+#include <errno.h>
+
+// Pthread
+#include <pthread.h>
+
+#include "aesdsocket-capture.h"
+
+#define CAPTURE_BUFF     (1 << 20)
+#define CAPTURE_FLUSH_MS 1000
+
+static FILE *capture_file;
+static pthread_mutex_t capture_mutex = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t capture_start_ns;
+static uint64_t capture_flushed_ns;
+static uint32_t capture_conns;
+static int capture_failed;      // a write failed, recording stopped
+
+/**********************************************************************************
+ * @name       capture_clock()
+ **********************************************************************************/
+static uint64_t capture_clock(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/**********************************************************************************
+ * @name       capture_write()
+ *
+ * @brief      { Appends one event, capture_mutex held. The first failure is
+ *               logged and ends the capture, the file stays readable up to
+ *               the last whole event written. }
+ **********************************************************************************/
+static void capture_write(uint32_t conn, cap_type_t type, const void *buf, size_t len, uint64_t now)
+{
+	aesd_cap_rec_t rec;
+
+	if (capture_failed || !capture_file) return;
+
+	memset(&rec, 0, sizeof(rec));
+	rec.t_us = (now - capture_start_ns) / 1000;
+	rec.conn = conn;
+	rec.len = (uint32_t)len;
+	rec.type = type;
+	if (fwrite(&rec, sizeof(rec), 1, capture_file) != 1 ||
+	    (len && fwrite(buf, len, 1, capture_file) != 1)){
+		syslog(LOG_ERR, "capture write failed: %s, capture stopped", strerror(errno));
+		capture_failed = 1;
+	}
+}
+
+/**********************************************************************************
+ * @name       capture_start()
+ **********************************************************************************/
+int capture_start(const char *path)
+{
+	aesd_cap_file_t hdr;
+
+	capture_file = fopen(path, "we");
+	if (!capture_file){
+		perror("fopen");
+		syslog(LOG_ERR, "capture %s: %s", path, strerror(errno));
+		return -1;
+	}
+	setvbuf(capture_file, NULL, _IOFBF, CAPTURE_BUFF);
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, AESD_CAP_MAGIC, sizeof(hdr.magic));
+	hdr.start_sec = (uint64_t)time(NULL);
+	if (fwrite(&hdr, sizeof(hdr), 1, capture_file) != 1){
+		perror("fwrite");
+		syslog(LOG_ERR, "capture %s: %s", path, strerror(errno));
+		fclose(capture_file);
+		capture_file = NULL;
+		return -1;
+	}
+	capture_start_ns = capture_flushed_ns = capture_clock();
+	syslog(LOG_INFO, "capturing traffic to %s", path);
+	return 0;
+}
+
+/**********************************************************************************
+ * @name       capture_stop()
+ **********************************************************************************/
+void capture_stop(void)
+{
+	if (!capture_file) return;
+
+	pthread_mutex_lock(&capture_mutex);
+	if (fclose(capture_file) && !capture_failed)
+		syslog(LOG_ERR, "capture close failed: %s", strerror(errno));
+	capture_file = NULL;
+	pthread_mutex_unlock(&capture_mutex);
+}
+
+/**********************************************************************************
+ * @name       capture_open()
+ **********************************************************************************/
+uint32_t capture_open(const char *client)
+{
+	uint32_t conn;
+
+	if (!capture_file) return 0;
+
+	pthread_mutex_lock(&capture_mutex);
+	conn = ++capture_conns;
+	capture_write(conn, CAP_OPEN, client, strlen(client), capture_clock());
+	pthread_mutex_unlock(&capture_mutex);
+	return conn;
+}
+
+/**********************************************************************************
+ * @name       capture_data()
+ **********************************************************************************/
+void capture_data(uint32_t conn, cap_type_t type, const void *buf, size_t len)
+{
+	if (!conn || !len) return;
+
+	pthread_mutex_lock(&capture_mutex);
+	capture_write(conn, type, buf, len, capture_clock());
+	pthread_mutex_unlock(&capture_mutex);
+}
+
+/**********************************************************************************
+ * @name       capture_close()
+ **********************************************************************************/
+void capture_close(uint32_t conn, int by_client)
+{
+	uint8_t why = by_client ? CAP_BY_CLIENT : CAP_BY_SERVER;
+	uint64_t now;
+
+	if (!conn) return;
+
+	pthread_mutex_lock(&capture_mutex);
+	now = capture_clock();
+	capture_write(conn, CAP_CLOSE, &why, sizeof(why), now);
+	if (capture_file && now - capture_flushed_ns >= (uint64_t)CAPTURE_FLUSH_MS * 1000000){
+		fflush(capture_file);
+		capture_flushed_ns = now;
+	}
+	pthread_mutex_unlock(&capture_mutex);
+}
@@ -0,0 +1,94 @@
+ /**********************************************************************************
+ * @file    aesdsocket-capture.h
+ * @brief   Traffic capture of the aesdsocket server, and the file format
+ *          aesdsocket-replay reads it back with.
+ *
+ * A capture file is an aesd_cap_file_t, then one aesd_cap_rec_t per event,
+ * each followed by len bytes of data, in the order the server saw them.
+ * Fields are in host byte order, replay on a machine of the same kind.
+ *
+ * @author        <Li-Huan Lu>
+ * @date          <10/16/2026>
+ ***********************************************************************************/
+#ifndef AESDSOCKET_CAPTURE_H
+#define AESDSOCKET_CAPTURE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define AESD_CAP_MAGIC "AESDCAP1"
+
+typedef enum {
+	CAP_OPEN = 1,               // connection accepted, data is the client address
+	CAP_IN,                     // bytes received from the client
+	CAP_OUT,                    // bytes sent to the client
+	CAP_CLOSE,                  // connection closed, data is one cap_close_t byte
+} cap_type_t;
+
+// Who ended a connection, the CAP_CLOSE data, absent in older captures
+typedef enum {
+	CAP_BY_SERVER = 0,          // dropped by the server, or after its client's last reply
+	CAP_BY_CLIENT,              // the client closed or reset it first
+} cap_close_t;
+
+typedef struct aesd_cap_file_s {
+	char magic[8];              // AESD_CAP_MAGIC, no terminator
+	uint64_t start_sec;         // wall clock time the capture started
+} aesd_cap_file_t;
+
+typedef struct aesd_cap_rec_s {
+	uint64_t t_us;              // since the capture started
+	uint32_t conn;              // connection number, from 1
+	uint32_t len;               // data bytes that follow
+	uint8_t type;               // cap_type_t
+	uint8_t reserved[7];
+} aesd_cap_rec_t;
+
+_Static_assert(sizeof(aesd_cap_file_t) == 16, "aesd_cap_file_t must have no padding");
+_Static_assert(sizeof(aesd_cap_rec_t) == 24, "aesd_cap_rec_t must have no padding");
+
+/**********************************************************************************
+ * @name       capture_start()
+ *
+ * @brief      { Starts recording every connection opened from now on into
+ *               path, truncated first. }
+ *
+ * @return     0 on success, -1 on failure
+ **********************************************************************************/
+int capture_start(const char *path);
+
+/**********************************************************************************
+ * @name       capture_stop()
+ *
+ * @brief      { Writes out what is buffered and closes the file. Call once no
+ *               connection is left. }
+ **********************************************************************************/
+void capture_stop(void);
+
+/**********************************************************************************
+ * @name       capture_open()
+ *
+ * @brief      { Records a new connection. }
+ *
+ * @return     Connection number for the other calls, 0 when not capturing
+ **********************************************************************************/
+uint32_t capture_open(const char *client);
+
+/**********************************************************************************
+ * @name       capture_data()
+ *
+ * @brief      { Records len bytes received (CAP_IN) or sent (CAP_OUT) on
+ *               connection conn. Does nothing for connection 0. }
+ **********************************************************************************/
+void capture_data(uint32_t conn, cap_type_t type, const void *buf, size_t len);
+
+/**********************************************************************************
+ * @name       capture_close()
+ *
+ * @brief      { Records the end of a connection, by_client when the client
+ *               went first, so a replay knows it did not wait for the rest
+ *               of its replies. }
+ **********************************************************************************/
+void capture_close(uint32_t conn, int by_client);
+
+#endif /* AESDSOCKET_CAPTURE_H */
@@ -0,0 +1,316 @@
+ /**********************************************************************************
+ * @file    aesdsocket-channel.c
+ * @brief   Named history channels of the aesdsocket server.
+ *
+ *          Next to the main history a client may pick a named channel, each
+ *          one a flat append-only file PREFIX-NAME with its own lock and its
+ *          own committed length. Writers of different channels share
+ *          nothing, so independent tenants scale with the number of
+ *          channels instead of queueing behind the one appender. A reply
+ *          covers its channel up to the committed length and reads it with
+ *          pread() or sendfile() without the lock.
+ *
+ *          Channels live until the server exits, the table only grows, so
+ *          a channel pointer or id stays valid for every connection.
+ *
+ * @author        <Li-Huan Lu>
+ * @date          <10/16/2026>
+ ***********************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/sendfile.h>
+
+// Pthread
+#include <pthread.h>
+
+#include "aesdsocket-channel.h"
+#include "aesdsocket-metrics.h"
+#include "aesdsocket-store.h"
+
+#define CHAN_SCAN_CHUNK (16 * 1024)
+
+typedef struct chan_s {
+	uint16_t id;
+	char name[CHAN_NAME_MAX + 1];
+	char path[PATH_MAX];
+	pthread_mutex_t lock;       // serializes appends to this channel only
+	int writer_fd;
+	int reader_fd;              // shared by every reply, pread/sendfile only
+	off_t len;                  // committed length, written under lock
+	long long last_sync;        // ms, under lock
+	int dirty;                  // written since the last sync, under lock
+} chan_t;
+
+static chan_t *chans[CHAN_MAX]; // id - 1, published once open
+static int chan_count;          // under chans_mutex
+static pthread_mutex_t chans_mutex = PTHREAD_MUTEX_INITIALIZER;
+static const char *chan_prefix = "/var/tmp/aesdsocketdata";
+static fsync_policy_t chan_policy;
+static int chan_interval_ms;
+
+/**********************************************************************************
+ * @name       now_ms()
+ **********************************************************************************/
+static long long now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**********************************************************************************
+ * @name       chan_name_ok()
+ **********************************************************************************/
+static int chan_name_ok(const char *name)
+{
+	size_t len = strspn(name, "abcdefghijklmnopqrstuvwxyz"
+	                          "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+	                          "0123456789_-");
+
+	return len > 0 && len <= CHAN_NAME_MAX && name[len] == '\0';
+}
+
+/**********************************************************************************
+ * @name       chan_create()
+ *
+ * @brief      { Opens the channel file, keeping what an earlier run left. }
+ *
+ * @return     Channel, or NULL on failure
+ **********************************************************************************/
+static chan_t *chan_create(const char *name, uint16_t id)
+{
+	struct stat st;
+	chan_t *chan;
+
+	chan = (chan_t *) calloc(1, sizeof(chan_t));
+	if (!chan){
+		syslog(LOG_ERR, "Out of memory");
+		return NULL;
+	}
+	chan->id = id;
+	strcpy(chan->name, name);
+	if (snprintf(chan->path, sizeof(chan->path), "%s-%s", chan_prefix, name) >= (int)sizeof(chan->path)){
+		syslog(LOG_ERR, "channel path too long for %s", name);
+		free(chan);
+		return NULL;
+	}
+
+	chan->writer_fd = open(chan->path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0664);
+	chan->reader_fd = chan->writer_fd == -1 ? -1 : open(chan->path, O_RDONLY | O_CLOEXEC);
+	if (chan->reader_fd == -1 || fstat(chan->reader_fd, &st) == -1){
+		perror("open");
+		syslog(LOG_ERR, "open %s: %s", chan->path, strerror(errno));
+		if (chan->reader_fd != -1) close(chan->reader_fd);
+		if (chan->writer_fd != -1) close(chan->writer_fd);
+		free(chan);
+		return NULL;
+	}
+	chan->len = st.st_size;
+	chan->last_sync = now_ms();
+	pthread_mutex_init(&chan->lock, NULL);
+	syslog(LOG_INFO, "channel %s opened at %s", name, chan->path);
+	return chan;
+}
+
+/**********************************************************************************
+ * @name       chan_init()
+ **********************************************************************************/
+void chan_init(const char *prefix, fsync_policy_t policy, int interval_ms)
+{
+	if (prefix) chan_prefix = prefix;
+	chan_policy = policy;
+	chan_interval_ms = interval_ms;
+}
+
+/**********************************************************************************
+ * @name       chan_destroy()
+ **********************************************************************************/
+void chan_destroy(void)
+{
+	chan_t *chan;
+	int i;
+
+	for (i = 0; i < chan_count; i++){
+		chan = chans[i];
+		if (chan->dirty && chan_policy != FSYNC_NONE) fdatasync(chan->writer_fd);
+		close(chan->reader_fd);
+		close(chan->writer_fd);
+		if (remove(chan->path)){
+			perror("remove");
+			syslog(LOG_ERR, "remove %s failed.", chan->path);
+		}
+		pthread_mutex_destroy(&chan->lock);
+		free(chan);
+		chans[i] = NULL;
+	}
+	chan_count = 0;
+}
+
+/**********************************************************************************
+ * @name       chan_open()
+ **********************************************************************************/
+int chan_open(const char *name, chan_t **chan)
+{
+	int i, id = -1;
+
+	*chan = NULL;
+	if (strcmp(name, CHAN_DEFAULT) == 0) return 0;
+	if (!chan_name_ok(name)) return -1;
+
+	pthread_mutex_lock(&chans_mutex);
+	for (i = 0; i < chan_count; i++){
+		if (strcmp(chans[i]->name, name) == 0){
+			*chan = chans[i];
+			id = i + 1;
+			break;
+		}
+	}
+	if (id == -1 && chan_count < CHAN_MAX){
+		*chan = chan_create(name, chan_count + 1);
+		if (*chan){
+			__atomic_store_n(&chans[chan_count], *chan, __ATOMIC_RELEASE);
+			id = ++chan_count;
+		}
+	}
+	else if (id == -1){
+		syslog(LOG_ERR, "channel table full, %s refused", name);
+	}
+	pthread_mutex_unlock(&chans_mutex);
+	return id;
+}
+
+/**********************************************************************************
+ * @name       chan_by_id()
+ **********************************************************************************/
+int chan_by_id(unsigned int id, chan_t **chan)
+{
+	*chan = NULL;
+	if (id == 0) return 0;
+	if (id > CHAN_MAX) return -1;
+	*chan = __atomic_load_n(&chans[id - 1], __ATOMIC_ACQUIRE);
+	return *chan ? 0 : -1;
+}
+
+/**********************************************************************************
+ * @name       chan_id()
+ **********************************************************************************/
+uint16_t chan_id(const chan_t *chan)
+{
+	return chan ? chan->id : 0;
+}
+
+/**********************************************************************************
+ * @name       chan_append()
+ *
+ * @brief      { A failed write may still have reached the file in part, the
+ *               length is taken from the file then. }
+ **********************************************************************************/
+int chan_append(chan_t *chan, const char *buf, size_t len, off_t *end_off)
+{
+	struct iovec iov = { .iov_base = (void *)buf, .iov_len = len };
+	uint64_t t_wait = end_off ? metrics_now() : 0;
+	struct stat st;
+	int ret;
+
+	pthread_mutex_lock(&chan->lock);
+	ret = store_writev(chan->writer_fd, &iov, 1);
+	if (ret == 0){
+		__atomic_store_n(&chan->len, chan->len + (off_t)len, __ATOMIC_RELEASE);
+		chan->dirty = 1;
+	}
+	else if (fstat(chan->reader_fd, &st) == 0){
+		__atomic_store_n(&chan->len, st.st_size, __ATOMIC_RELEASE);
+	}
+
+	if (ret == 0 && (chan_policy == FSYNC_RECORD ||
+	    (chan_policy == FSYNC_INTERVAL && now_ms() - chan->last_sync >= chan_interval_ms))){
+		if (fdatasync(chan->writer_fd) == -1){
+			perror("fdatasync");
+			syslog(LOG_ERR, "fdatasync %s: %s", chan->path, strerror(errno));
+		}
+		chan->dirty = 0;
+		chan->last_sync = now_ms();
+	}
+	if (end_off) *end_off = chan->len;
+	pthread_mutex_unlock(&chan->lock);
+
+	if (t_wait) metrics_commit_wait(metrics_now() - t_wait);
+	return ret;
+}
+
+/**********************************************************************************
+ * @name       chan_committed_len()
+ **********************************************************************************/
+off_t chan_committed_len(const chan_t *chan)
+{
+	return __atomic_load_n(&chan->len, __ATOMIC_ACQUIRE);
+}
+
+/**********************************************************************************
+ * @name       chan_read()
+ **********************************************************************************/
+ssize_t chan_read(const chan_t *chan, void *buf, size_t len, off_t off)
+{
+	return pread(chan->reader_fd, buf, len, off);
+}
+
+/**********************************************************************************
+ * @name       chan_send()
+ **********************************************************************************/
+ssize_t chan_send(const chan_t *chan, int sock_fd, off_t off, size_t count)
+{
+	return sendfile(sock_fd, chan->reader_fd, &off, count);
+}
+
+/**********************************************************************************
+ * @name       chan_seekto()
+ *
+ * @brief      { Counts lines up to the committed length, every newline ends
+ *               one command. A command past the last one lands past the
+ *               end, as with the driver. }
+ **********************************************************************************/
+int chan_seekto(const chan_t *chan, unsigned int write_cmd, unsigned int offset, off_t *pos)
+{
+	char buf[CHAN_SCAN_CHUNK];
+	off_t off = 0, start = 0, end, len = chan_committed_len(chan);
+	unsigned int cmd = 0;
+	char *p, *nl;
+	ssize_t n;
+
+	while (off < len){
+		n = pread(chan->reader_fd, buf, len - off < (off_t)sizeof(buf) ? (size_t)(len - off) : sizeof(buf), off);
+		if (n == -1){
+			if (errno == EINTR) continue;
+			perror("pread");
+			syslog(LOG_ERR, "pread: %s", strerror(errno));
+			return -1;
+		}
+		if (n == 0) break;
+
+		p = buf;
+		while ((nl = memchr(p, '\n', buf + n - p)) != NULL){
+			end = off + (nl - buf) + 1;
+			if (cmd == write_cmd){
+				if (offset >= end - start) return -1;
+				*pos = start + offset;
+				return 0;
+			}
+			cmd++;
+			start = end;
+			p = nl + 1;
+		}
+		off += n;
+	}
+	*pos = start + offset;
+	return 0;
+}
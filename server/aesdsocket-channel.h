@@ -0,0 +1,120 @@
+ /**********************************************************************************
+ * @file    aesdsocket-channel.h
+ * @brief   Named history channels of the aesdsocket server.
+ *
+ * @author        <Li-Huan Lu>
+ * @date          <10/16/2026>
+ ***********************************************************************************/
+#ifndef AESDSOCKET_CHANNEL_H
+#define AESDSOCKET_CHANNEL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "aesdsocket-appender.h"
+
+#define CHAN_MAX      64        // named channels per server
+#define CHAN_NAME_MAX 32        // letters, digits, '_' and '-'
+#define CHAN_DEFAULT  "default" // name of the main history
+
+struct chan_s;
+
+/**********************************************************************************
+ * @name       chan_init()
+ *
+ * @brief      { Sets where channel files go, PREFIX-NAME, and how they are
+ *               synced. Channels are opened on first use. }
+ *
+ * @param[in]  prefix      { Path every channel file starts with }
+ * @param[in]  policy      { When to sync a channel file }
+ * @param[in]  interval_ms { Period for FSYNC_INTERVAL }
+ **********************************************************************************/
+void chan_init(const char *prefix, fsync_policy_t policy, int interval_ms);
+
+/**********************************************************************************
+ * @name       chan_destroy()
+ *
+ * @brief      { Closes every channel and removes its file, like the file store
+ *               does with the main history. Call once no connection is left. }
+ **********************************************************************************/
+void chan_destroy(void);
+
+/**********************************************************************************
+ * @name       chan_open()
+ *
+ * @brief      { Looks a channel up by name, creating it the first time.
+ *               CHAN_DEFAULT is the main history, which is not a channel. }
+ *
+ * @param[in]  name { Channel name, NUL terminated }
+ * @param[out] chan { Channel, NULL for the main history }
+ *
+ * @return     Channel id, 0 for the main history, -1 for a bad name, a full
+ *             table or a failed open
+ **********************************************************************************/
+int chan_open(const char *name, struct chan_s **chan);
+
+/**********************************************************************************
+ * @name       chan_by_id()
+ *
+ * @brief      { Channel a binary request names. Never takes a lock. }
+ *
+ * @param[out] chan { Channel, NULL for id 0 }
+ *
+ * @return     0 on success, -1 for an id chan_open() never handed out
+ **********************************************************************************/
+int chan_by_id(unsigned int id, struct chan_s **chan);
+
+/**********************************************************************************
+ * @name       chan_id()
+ **********************************************************************************/
+uint16_t chan_id(const struct chan_s *chan);
+
+/**********************************************************************************
+ * @name       chan_append()
+ *
+ * @brief      { Writes one record under the channel's own lock, so writers of
+ *               different channels never wait for each other. }
+ *
+ * @param[out] end_off { If not NULL, channel length right after the record }
+ *
+ * @return     0 on success, -1 on failure
+ **********************************************************************************/
+int chan_append(struct chan_s *chan, const char *buf, size_t len, off_t *end_off);
+
+/**********************************************************************************
+ * @name       chan_committed_len()
+ *
+ * @brief      { Channel length covered by completed appends, bytes below it
+ *               never change. }
+ **********************************************************************************/
+off_t chan_committed_len(const struct chan_s *chan);
+
+/**********************************************************************************
+ * @name       chan_read()
+ *
+ * @return     Bytes read, 0 past the end, -1 on failure
+ **********************************************************************************/
+ssize_t chan_read(const struct chan_s *chan, void *buf, size_t len, off_t off);
+
+/**********************************************************************************
+ * @name       chan_send()
+ *
+ * @brief      { Sends up to count channel bytes at off to a socket with
+ *               sendfile(). }
+ *
+ * @return     Bytes sent, 0 past the end, -1 with errno set
+ **********************************************************************************/
+ssize_t chan_send(const struct chan_s *chan, int sock_fd, off_t off, size_t count);
+
+/**********************************************************************************
+ * @name       chan_seekto()
+ *
+ * @brief      { Like store_seekto() on the channel. Channels keep no command
+ *               index, the file is scanned. }
+ *
+ * @return     0 on success, -1 when out of range or on failure
+ **********************************************************************************/
+int chan_seekto(const struct chan_s *chan, unsigned int write_cmd, unsigned int offset, off_t *pos);
+
+#endif /* AESDSOCKET_CHANNEL_H */
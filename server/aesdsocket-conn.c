@@ -0,0 +1,1881 @@
+ /**********************************************************************************
+ * @file    aesdsocket-conn.c
+ * @brief   Per-connection state machine shared by the aesdsocket server modes.
+ *
+ *          Connections are nonblocking. conn_handle() is called whenever the
+ *          socket is ready and reports what it wants to wait for next, so the
+ *          epoll loops and the worker pool only differ in who calls it. Nor
+ *          does a loop wait for the appender: replies to records still being
+ *          written park the connection until the appender's eventfd fires.
+ *
+ * @author        <Li-Huan Lu>
+ * @date          <10/16/2026>
+ * @reference     Linux manual page
+ *                https://man7.org/linux/man-pages/man2/sendfile.2.html
+ ***********************************************************************************/
+#define _GNU_SOURCE     // accept4()
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <endian.h>
+#include <time.h>
+#include <stdint.h>
+#include <sys/resource.h>
+
+// Pthread
+#include <pthread.h>
+
+// Socket
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <arpa/inet.h>
+#include <netinet/tcp.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
+
+#include "aesdsocket-conn.h"
+#include "aesdsocket-appender.h"
+#include "aesdsocket-cache.h"
+#include "aesdsocket-capture.h"
+#include "aesdsocket-channel.h"
+#include "aesdsocket-iobuf.h"
+#include "aesdsocket-log.h"
+#include "aesdsocket-metrics.h"
+#include "aesdsocket-store.h"
+#include "aesdsocket-proto.h"
+#include "aesdsocket-query.h"
+#include "aesdsocket-shm.h"
+#include "aesdsocket-timeindex.h"
+
+#define SENDFILE_CHUNK (1 << 20)    // per call, keeps one big reply from hogging a thread
+#define REPLY_SHM_RING 0xff         // conn_reply_t.op of the answer to a shared ring request
+#define FRAME_CMD_MAX  (QUERY_PATTERN_MAX + 64) // longest command line acted on
+
+// Set once the store refuses sendfile(), e.g. a driver without splice_read
+static volatile int sendfile_unsupported = 0;
+
+// Limits, see conn_init()
+static size_t conn_queue_max = CONN_QUEUE_MAX;
+static size_t conn_budget = (size_t)CONN_BUFFER_MB << 20;
+static slow_policy_t conn_slow_policy = SLOW_THROTTLE;
+static size_t conn_buffered;    // bytes taken from the budget by every connection
+static size_t conn_max = SIZE_MAX;
+static size_t conn_open;        // connections admitted and not yet closed
+static unsigned int conn_idle_ms;
+static unsigned int conn_read_ms;
+static overload_policy_t conn_overload = OVERLOAD_BUSY;
+
+// Descriptor given up to refuse a connection once the process has none left
+static pthread_mutex_t spare_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int spare_fd = -1;
+
+static int frame_records(aesd_conn_t *conn);
+static void frame_incomplete(aesd_conn_t *conn);
+
+/**********************************************************************************
+ * @name       buffer_take()
+ *
+ * @brief      { Takes bytes from the budget for a buffer about to grow. A
+ *               forced take always succeeds and may overshoot it. }
+ *
+ * @return     0 on success, -1 when the budget is spent
+ **********************************************************************************/
+static int buffer_take(aesd_conn_t *conn, size_t bytes, int force)
+{
+	size_t total = __atomic_add_fetch(&conn_buffered, bytes, __ATOMIC_RELAXED);
+
+	if (!force && total > conn_budget){
+		__atomic_sub_fetch(&conn_buffered, bytes, __ATOMIC_RELAXED);
+		return -1;
+	}
+	conn->buffered += bytes;
+	metrics_buffered(bytes);
+	return 0;
+}
+
+/**********************************************************************************
+ * @name       buffer_give()
+ **********************************************************************************/
+static void buffer_give(aesd_conn_t *conn, size_t bytes)
+{
+	__atomic_sub_fetch(&conn_buffered, bytes, __ATOMIC_RELAXED);
+	conn->buffered -= bytes;
+	metrics_buffered(-(ssize_t)bytes);
+}
+
+/**********************************************************************************
+ * @name       slow_consumer()
+ *
+ * @brief      { Applies the policy to a connection that needs more memory
+ *               while the budget is spent. }
+ *
+ * @return     1 to throttle it, -1 to drop it
+ **********************************************************************************/
+static int slow_consumer(aesd_conn_t *conn, const char *why)
+{
+	if (conn_slow_policy == SLOW_DROP){
+		log_post(LOGC_CONN, LOG_ERR, "dropping slow consumer %s, %s", conn->client_ip, why);
+		metrics_slow_dropped();
+		return -1;
+	}
+	metrics_throttled();
+	return 1;
+}
+
+/**********************************************************************************
+ * @name       history_snapshot()
+ *
+ * @brief      { Length a reply may cover right now. For a stable store or a
+ *               channel that is the committed length. The driver and the ring
+ *               keep only their last writes and may evict at any time, so ask
+ *               them. }
+ **********************************************************************************/
+static off_t history_snapshot(struct chan_s *chan)
+{
+	if (chan) return chan_committed_len(chan);
+	if (store_flags() & STORE_STABLE) return appender_committed_len();
+	return store_size();
+}
+
+/**********************************************************************************
+ * @name       history_start()
+ **********************************************************************************/
+static off_t history_start(struct chan_s *chan)
+{
+	return chan ? 0 : store_start();
+}
+
+/**********************************************************************************
+ * @name       history_has_tail()
+ *
+ * @brief      { Whether a tail cursor stays good. The driver and the ring count
+ *               offsets from the oldest command kept, so once one is evicted
+ *               a cursor points past the end for good. }
+ **********************************************************************************/
+static int history_has_tail(struct chan_s *chan)
+{
+	return chan || (store_flags() & STORE_STABLE);
+}
+
+/**********************************************************************************
+ * @name       history_append()
+ *
+ * @brief      { Appends to a channel under its lock, or queues for the
+ *               appender of the main history. }
+ **********************************************************************************/
+static int history_append(struct chan_s *chan, const char *buf, size_t len, off_t *end_off)
+{
+	if (chan) return chan_append(chan, buf, len, end_off);
+	return appender_append(buf, len, end_off);
+}
+
+/**********************************************************************************
+ * @name       history_seekto()
+ **********************************************************************************/
+static int history_seekto(struct chan_s *chan, unsigned int write_cmd, unsigned int offset, off_t *pos)
+{
+	if (chan) return chan_seekto(chan, write_cmd, offset, pos);
+	return store_seekto(write_cmd, offset, pos);
+}
+
+/**********************************************************************************
+ * @name       history_since()
+ *
+ * @brief      { History range written between wall times since and until,
+ *               until 0 meaning up to now, found in the time index. Only the
+ *               main history of a store that gets timestamp lines has one. }
+ *
+ * @param[out] end { -1 for the end of the history }
+ *
+ * @return     0 on success, -1 when there is no time index
+ **********************************************************************************/
+static int history_since(struct chan_s *chan, time_t since, time_t until, off_t *start, off_t *end)
+{
+	if (chan || !(store_flags() & STORE_TIMESTAMPS)) return -1;
+	*start = timeindex_since(since);
+	*end = until ? timeindex_until(until) : -1;
+	return 0;
+}
+
+/**********************************************************************************
+ * @name       reply_open()
+ *
+ * @brief      { Starts a reply of history bytes [off, end). end is a length the
+ *               appender had already committed, so the reply is a consistent
+ *               prefix no matter what gets appended while it drains. }
+ **********************************************************************************/
+static void reply_open(aesd_conn_t *conn, off_t off, off_t end)
+{
+	conn->tx_active = 1;
+	conn->tx_off = off;
+	conn->tx_end = end > off ? end : off;
+	conn->tx_buf = conn->tx_head;
+	conn->tx_len = 0;
+	conn->tx_sent = 0;
+}
+
+/**********************************************************************************
+ * @name       reply_header()
+ *
+ * @brief      { Puts the binary response header in front of the reply, it goes
+ *               out of tx_buf before the history bytes. }
+ **********************************************************************************/
+static void reply_header(aesd_conn_t *conn, const conn_reply_t *req)
+{
+	aesd_bin_hdr_t hdr;
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.len = htobe64(conn->tx_end - conn->tx_off);
+	hdr.id = htobe32(req->id);
+	hdr.op = req->op;
+	hdr.status = req->status;
+	hdr.chan = htobe16(chan_id(req->chan));
+	if (req->op == AESD_BIN_HELLO)
+		hdr.arg0 = htobe64(AESD_BIN_VERSION);
+	else if (req->op == AESD_BIN_CHANNEL)
+		hdr.arg0 = htobe64(chan_id(req->chan));
+	else
+		hdr.arg0 = htobe64(conn->tx_off);
+	hdr.arg1 = htobe64(conn->tx_end);
+
+	memcpy(conn->tx_head, &hdr, sizeof(hdr));
+	conn->tx_len = sizeof(hdr);
+	conn->tx_binary = 1;
+}
+
+/**********************************************************************************
+ * @name       reply_short()
+ *
+ * @brief      { The history ran out before the end of the reply, e.g. the device
+ *               evicted an entry. A text reply just ends there, a binary one
+ *               already announced its length, so the connection goes. }
+ *
+ * @return     CONN_READ, or CONN_CLOSE for a binary reply
+ **********************************************************************************/
+static int reply_short(aesd_conn_t *conn)
+{
+	if (conn->tx_binary){
+		log_post(LOGC_IO, LOG_ERR, "history lost under a binary reply to %s", conn->client_ip);
+		return CONN_CLOSE;
+	}
+	conn->tx_end = conn->tx_off;
+	return CONN_READ;
+}
+
+/**********************************************************************************
+ * @name       reply_shm_ring()
+ *
+ * @brief      { Answers a shared ring request with its size line, the memfd
+ *               and the eventfd riding along with the first bytes. Whatever
+ *               sendmsg() leaves goes out of tx_buf like any reply. }
+ *
+ * @return     CONN_READ once the descriptors are sent, CONN_WRITE while the
+ *             socket is full, CONN_CLOSE on error
+ **********************************************************************************/
+static int reply_shm_ring(aesd_conn_t *conn)
+{
+	union {
+		struct cmsghdr hdr;
+		char buf[CMSG_SPACE(2 * sizeof(int))];
+	} ctrl;
+	struct msghdr msg;
+	struct cmsghdr *cmsg;
+	struct iovec iov;
+	char line[TX_HEAD_MAX];
+	int fds[2];
+	size_t size = 0;
+	ssize_t sent;
+
+	if (conn->shm) size = shm_ring_share(conn->shm, fds);
+	iov.iov_base = line;
+	iov.iov_len = snprintf(line, sizeof(line), AESD_SHM_REQUEST "%zu\n", size);
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	if (size){
+		memset(&ctrl, 0, sizeof(ctrl));
+		msg.msg_control = ctrl.buf;
+		msg.msg_controllen = sizeof(ctrl.buf);
+		cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+		memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+	}
+
+	do {
+		sent = sendmsg(conn->client_fd, &msg, MSG_NOSIGNAL);
+	} while (sent == -1 && errno == EINTR);
+	if (sent == -1){
+		if (errno == EAGAIN || errno == EWOULDBLOCK) return CONN_WRITE;
+		log_post(LOGC_IO, LOG_ERR, "sendmsg: %s", strerror(errno));
+		return CONN_CLOSE;
+	}
+	metrics_bytes_out(sent);
+	capture_data(conn->cap_id, CAP_OUT, line, sent);
+
+	reply_open(conn, 0, 0);
+	conn->tx_chan = NULL;
+	memcpy(conn->tx_head, line, iov.iov_len);
+	conn->tx_len = iov.iov_len;
+	conn->tx_sent = sent;
+	conn->tx_binary = 0;
+	return CONN_READ;
+}
+
+/**********************************************************************************
+ * @name       reply_release()
+ **********************************************************************************/
+static void reply_release(aesd_conn_t *conn)
+{
+	if (conn->tx_seg){
+		cache_put(conn->tx_seg);
+		conn->tx_seg = NULL;
+	}
+}
+
+/**********************************************************************************
+ * @name       reply_copy_buf()
+ *
+ * @brief      { Gets the buffer history is copied through, sized for the rest
+ *               of the reply up to TX_COPY_MAX, so a long reply takes few
+ *               reads and sends. Counted in the budget like a query. }
+ *
+ * @return     0 on success, -1 when out of memory
+ **********************************************************************************/
+static int reply_copy_buf(aesd_conn_t *conn)
+{
+	size_t want = TX_COPY_MAX;
+
+	if (conn->tx_copy) return 0;
+	if ((off_t)want > conn->tx_end - conn->tx_off) want = conn->tx_end - conn->tx_off;
+	conn->tx_copy = (char *) iobuf_get(want, &conn->tx_copy_cap);
+	if (!conn->tx_copy){
+		log_post(LOGC_SERVER, LOG_ERR, "Out of memory, dropping connection");
+		return -1;
+	}
+	buffer_take(conn, conn->tx_copy_cap, 1);
+	return 0;
+}
+
+/**********************************************************************************
+ * @name       reply_copy_put()
+ **********************************************************************************/
+static void reply_copy_put(aesd_conn_t *conn)
+{
+	if (!conn->tx_copy) return;
+	buffer_give(conn, conn->tx_copy_cap);
+	iobuf_put(conn->tx_copy, conn->tx_copy_cap);
+	conn->tx_copy = NULL;
+}
+
+/**********************************************************************************
+ * @name       reply_cached()
+ *
+ * @brief      { Sends straight from the cached segment holding tx_off, shared
+ *               with every other reply covering the same bytes. }
+ *
+ * @return     CONN_READ to keep going, CONN_WRITE while the socket is full,
+ *             CONN_CLOSE on error, 1 on a cache miss
+ **********************************************************************************/
+static int reply_cached(aesd_conn_t *conn)
+{
+	cache_seg_t *seg = conn->tx_seg;
+	ssize_t ret_byte;
+	off_t seg_end;
+	size_t count;
+
+	if (!seg || conn->tx_off < seg->base || conn->tx_off >= seg->base + CACHE_SEG_SIZE){
+		reply_release(conn);
+		seg = cache_get(conn->tx_off);
+		if (!seg) return 1;
+		conn->tx_seg = seg;
+	}
+
+	seg_end = seg->base + CACHE_SEG_SIZE;
+	if (seg_end > conn->tx_end) seg_end = conn->tx_end;
+	count = seg_end - conn->tx_off;
+
+	ret_byte = send(conn->client_fd, seg->data + (conn->tx_off - seg->base), count,
+	                MSG_NOSIGNAL | (seg_end < conn->tx_end ? MSG_MORE : 0));
+	if (ret_byte == -1){
+		if (errno == EAGAIN || errno == EWOULDBLOCK) return CONN_WRITE;
+		if (errno == EINTR) return CONN_READ;
+		log_post(LOGC_IO, LOG_ERR, "send: %s", strerror(errno));
+		return CONN_CLOSE;
+	}
+	capture_data(conn->cap_id, CAP_OUT, seg->data + (conn->tx_off - seg->base), ret_byte);
+	conn->tx_off += ret_byte;
+	metrics_bytes_out(ret_byte);
+	return CONN_READ;
+}
+
+/**********************************************************************************
+ * @name       reply_capture()
+ *
+ * @brief      { Records the len bytes of history from off that sendfile just
+ *               sent, read back through the copy buffer. The socket keeps
+ *               zero-copy, only the capture pays for the read. }
+ *
+ * @return     0 on success, -1 when out of memory
+ **********************************************************************************/
+static int reply_capture(aesd_conn_t *conn, off_t off, size_t len)
+{
+	ssize_t ret_byte;
+	size_t to_read;
+
+	if (reply_copy_buf(conn)) return -1;
+	while (len){
+		to_read = len < conn->tx_copy_cap ? len : conn->tx_copy_cap;
+		if (conn->tx_chan)
+			ret_byte = chan_read(conn->tx_chan, conn->tx_copy, to_read, off);
+		else
+			ret_byte = store_read(conn->tx_copy, to_read, off);
+		if (ret_byte == -1 && errno == EINTR) continue;
+		if (ret_byte <= 0) break;   // retired since, replay sees the reply short
+		capture_data(conn->cap_id, CAP_OUT, conn->tx_copy, ret_byte);
+		off += ret_byte;
+		len -= ret_byte;
+	}
+	return 0;
+}
+
+/**********************************************************************************
+ * @name       reply_sendfile()
+ *
+ * @brief      { Moves reply bytes from the store to the socket in the kernel,
+ *               without copying them through tx_buf. }
+ *
+ * @return     CONN_READ to keep going, CONN_WRITE while the socket is full,
+ *             CONN_CLOSE on error, 1 when the caller must copy instead
+ **********************************************************************************/
+static int reply_sendfile(aesd_conn_t *conn)
+{
+	ssize_t ret_byte;
+	size_t count = SENDFILE_CHUNK;
+
+	if ((off_t)count > conn->tx_end - conn->tx_off) count = conn->tx_end - conn->tx_off;
+
+	if (conn->tx_chan)
+		ret_byte = chan_send(conn->tx_chan, conn->client_fd, conn->tx_off, count);
+	else
+		ret_byte = store_send(conn->client_fd, conn->tx_off, count);
+	if (ret_byte > 0){
+		if (conn->cap_id && reply_capture(conn, conn->tx_off, ret_byte)) return CONN_CLOSE;
+		conn->tx_off += ret_byte;
+		metrics_bytes_out(ret_byte);
+		return CONN_READ;
+	}
+	if (ret_byte == 0) return reply_short(conn); // shorter than the snapshot
+	if (errno == EAGAIN || errno == EWOULDBLOCK) return CONN_WRITE;
+	if (errno == EINTR) return CONN_READ;
+	if (errno == EINVAL || errno == ENOSYS || errno == EOPNOTSUPP){
+		if (conn->tx_chan) return 1;
+		syslog(LOG_INFO, "sendfile not supported on %s, copying replies", store_path());
+		sendfile_unsupported = 1;
+		return 1;
+	}
+	log_post(LOGC_IO, LOG_ERR, "sendfile: %s", strerror(errno));
+	return CONN_CLOSE;
+}
+
+/**********************************************************************************
+ * @name       conn_flush()
+ *
+ * @brief      { Sends as much of the pending reply as the socket accepts: from
+ *               the segment cache when enabled and under its cap (main
+ *               history only), zero-copy when the store allows it, copied
+ *               otherwise. A size-capped store may retire the front of a
+ *               reply while it drains, the reply then goes on from the oldest
+ *               byte still kept. }
+ *
+ * @return     CONN_WRITE while the socket is full, CONN_READ once the reply is
+ *             complete, CONN_CLOSE on error
+ **********************************************************************************/
+static int conn_flush(aesd_conn_t *conn)
+{
+	off_t first;
+	ssize_t ret_byte;
+	size_t to_read;
+
+	while (conn->tx_active){
+		if (conn->tx_sent == conn->tx_len){
+			if (conn->tx_off >= conn->tx_end){
+				reply_release(conn);
+				reply_copy_put(conn);
+				conn->tx_active = 0;
+				// A query counts once, when it ends
+				if (!conn->query) metrics_reply(conn->tx_end - conn->tx_start, conn->tx_t_recv);
+				break;
+			}
+			first = history_start(conn->tx_chan);
+			if (conn->tx_off < first){
+				if (conn->tx_binary) return reply_short(conn);
+				conn->tx_off = first;
+				continue;
+			}
+
+			if (cache_enabled() && !conn->tx_chan){
+				int ret = reply_cached(conn);
+
+				if (ret == CONN_READ) continue;
+				if (ret != 1) return ret;
+			}
+
+			if (conn->tx_chan || !sendfile_unsupported){
+				int ret = reply_sendfile(conn);
+
+				if (ret == CONN_READ) continue;
+				if (ret != 1) return ret;
+			}
+
+			if (reply_copy_buf(conn)) return CONN_CLOSE;
+			to_read = conn->tx_copy_cap;
+			if ((off_t)to_read > conn->tx_end - conn->tx_off) to_read = conn->tx_end - conn->tx_off;
+
+			conn->tx_buf = conn->tx_copy;
+			if (conn->tx_chan)
+				ret_byte = chan_read(conn->tx_chan, conn->tx_buf, to_read, conn->tx_off);
+			else
+				ret_byte = store_read(conn->tx_buf, to_read, conn->tx_off);
+			if (ret_byte == -1){
+				if (errno == EINTR) continue;
+				log_post(LOGC_IO, LOG_ERR, "history read: %s", strerror(errno));
+				return CONN_CLOSE;
+			}
+			if (ret_byte == 0){ // shorter than the snapshot, e.g. device evicted an entry
+				if (reply_short(conn) != CONN_READ) return CONN_CLOSE;
+				continue;
+			}
+			conn->tx_len = ret_byte;
+			conn->tx_sent = 0;
+			conn->tx_off += ret_byte;
+		}
+
+		// More of the reply follows, let the kernel fill whole segments
+		ret_byte = send(conn->client_fd, conn->tx_buf + conn->tx_sent, conn->tx_len - conn->tx_sent,
+		                MSG_NOSIGNAL | (conn->tx_off < conn->tx_end ? MSG_MORE : 0));
+		if (ret_byte == -1){
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return CONN_WRITE;
+			if (errno == EINTR) continue;
+			log_post(LOGC_IO, LOG_ERR, "send: %s", strerror(errno));
+			return CONN_CLOSE;
+		}
+		capture_data(conn->cap_id, CAP_OUT, conn->tx_buf + conn->tx_sent, ret_byte);
+		conn->tx_sent += ret_byte;
+		metrics_bytes_out(ret_byte);
+	}
+
+	return CONN_READ;
+}
+
+/**********************************************************************************
+ * @name       rq_grow()
+ *
+ * @brief      { Doubles the reply queue, within the budget unless forced. }
+ *
+ * @return     0 on success, 1 when the budget is spent, -1 when out of memory
+ **********************************************************************************/
+static int rq_grow(aesd_conn_t *conn, int force)
+{
+	size_t new_cap = conn->rq_cap ? conn->rq_cap * 2 : 16;
+	size_t bytes = (new_cap - conn->rq_cap) * sizeof(conn_reply_t);
+	conn_reply_t *grown;
+
+	if (buffer_take(conn, bytes, force)) return 1;
+	grown = (conn_reply_t *) realloc(conn->rq, new_cap * sizeof(*grown));
+	if (!grown){
+		buffer_give(conn, bytes);
+		log_post(LOGC_SERVER, LOG_ERR, "Out of memory, dropping connection");
+		return -1;
+	}
+	conn->rq = grown;
+	conn->rq_cap = new_cap;
+	return 0;
+}
+
+/**********************************************************************************
+ * @name       reply_queue()
+ *
+ * @brief      { Queues a reply behind the ones already owed. The queue only
+ *               fills while framing and is empty again before the next read,
+ *               so it never wraps. The framer checks for room before each
+ *               request, growing here is only the end of a long append. }
+ *
+ * @return     0 on success, -1 when out of memory
+ **********************************************************************************/
+static int reply_queue(aesd_conn_t *conn, off_t off, off_t end, uint64_t t_recv)
+{
+	if (conn->rq_len == conn->rq_cap && rq_grow(conn, 1)) return -1;
+	conn->rq[conn->rq_len].chan = conn->chan;
+	conn->rq[conn->rq_len].off = off;
+	conn->rq[conn->rq_len].end = end;
+	conn->rq[conn->rq_len].t_recv = t_recv;
+	conn->rq[conn->rq_len].query = NULL;
+	conn->rq[conn->rq_len].query_len = 0;
+	conn->rq[conn->rq_len].id = 0;
+	conn->rq[conn->rq_len].op = 0;
+	conn->rq[conn->rq_len].status = AESD_BIN_OK;
+	conn->rq_len++;
+	return 0;
+}
+
+/**********************************************************************************
+ * @name       query_start()
+ *
+ * @brief      { Starts the scan a queued query asks for, over the history
+ *               committed by now. }
+ *
+ * @return     0 on success, -1 when out of memory
+ **********************************************************************************/
+static int query_start(aesd_conn_t *conn, conn_reply_t *req)
+{
+	conn->query_req = *req;
+	conn->query = query_create(req->chan, req->query, req->query_len,
+	                           history_start(req->chan), history_snapshot(req->chan));
+	free(req->query);
+	req->query = NULL;
+	conn->query_req.query = NULL;
+	conn->query_done = 0;
+	if (!conn->query) return -1;
+	buffer_take(conn, query_footprint(), 1);
+	return 0;
+}
+
+/**********************************************************************************
+ * @name       reply_query()
+ *
+ * @brief      { Puts the next match of the query in flight, like a reply of
+ *               its own. A text query ends with an empty line, which no match
+ *               can be, a binary one with an empty response. Then the query
+ *               is done and counted. }
+ *
+ * @return     CONN_READ to go on, CONN_WRITE to come back after a long scan
+ *             without a match, CONN_CLOSE on error
+ **********************************************************************************/
+static int reply_query(aesd_conn_t *conn)
+{
+	const conn_reply_t *req = &conn->query_req;
+	off_t off, end;
+	int ret;
+
+	ret = query_next(conn->query, &off, &end);
+	if (ret == -1) return CONN_CLOSE;
+	if (ret == QUERY_AGAIN) return CONN_WRITE;  // the socket is writable, so this yields
+	if (ret == QUERY_MATCH){
+		reply_open(conn, off, end);
+		conn->tx_chan = req->chan;
+		conn->tx_binary = 0;
+		if (req->op == AESD_BIN_QUERY) reply_header(conn, req);
+		conn->tx_start = conn->tx_off;
+		return CONN_READ;
+	}
+
+	if (conn->query_done){
+		metrics_reply(query_bytes(conn->query), req->t_recv);
+		query_free(conn->query);
+		conn->query = NULL;
+		buffer_give(conn, query_footprint());
+		return CONN_READ;
+	}
+	end = query_end(conn->query);
+	reply_open(conn, end, end);
+	conn->tx_chan = req->chan;
+	conn->tx_binary = 0;
+	if (req->op == AESD_BIN_QUERY){
+		reply_header(conn, req);
+	}
+	else {
+		conn->tx_head[0] = '\n';
+		conn->tx_len = 1;
+	}
+	conn->tx_start = conn->tx_off;
+	conn->query_done = 1;
+	return CONN_READ;
+}
+
+/**********************************************************************************
+ * @name       commit_done()
+ *
+ * @brief      { Checks the run in flight. Once it is written its replies get
+ *               their history lengths, as frame_commit() does for a run it
+ *               waited on. }
+ *
+ * @return     1 once done, 0 while the appender still has it
+ **********************************************************************************/
+static int commit_done(aesd_conn_t *conn)
+{
+	off_t end_off;
+	size_t i;
+	int status;
+
+	status = appender_poll(conn->commit, &end_off);
+	if (!status) return 0;
+
+	conn->commit = NULL;
+	if (conn->commit_t) metrics_commit_wait(metrics_now() - conn->commit_t);
+	if (status == -1){
+		conn->commit_failed = 1;
+		return 1;
+	}
+	for (i = conn->commit_first; i < conn->commit_last; i++){
+		if (store_flags() & STORE_STABLE)
+			conn->rq[i].end = end_off - conn->rq[i].end;
+		else
+			conn->rq[i].end = -1;
+	}
+	conn->commit_first = conn->commit_last = 0;
+	return 1;
+}
+
+/**********************************************************************************
+ * @name       commit_park()
+ *
+ * @brief      { Parks the connection until its run is written. Checked again
+ *               under the lock, so a wake up that came before is not missed. }
+ *
+ * @return     1 when parked, 0 when the run is done already
+ **********************************************************************************/
+static int commit_park(aesd_conn_t *conn)
+{
+	conn_waiters_t *waiters = conn->waiters;
+	int parked = 0;
+
+	pthread_mutex_lock(&waiters->lock);
+	if (!commit_done(conn)){
+		LIST_INSERT_HEAD(&waiters->conns, conn, wait_entries);
+		conn->parked = parked = 1;
+	}
+	pthread_mutex_unlock(&waiters->lock);
+	return parked;
+}
+
+/**********************************************************************************
+ * @name       conn_drain()
+ *
+ * @brief      { Sends the reply in flight, then the queued ones in order. Each
+ *               text reply, HELLO and TAIL response moves the connection's
+ *               tail cursor to where it ends, one on another channel starts
+ *               over at 0. A binary reply starts no earlier than the history
+ *               kept, so its header holds the exact length. }
+ *
+ * @return     CONN_WRITE while the socket is full, CONN_READ once nothing is
+ *             owed, CONN_COMMIT when parked, CONN_CLOSE on error
+ **********************************************************************************/
+static int conn_drain(aesd_conn_t *conn)
+{
+	conn_reply_t *req;
+	off_t off, end, snapshot;
+	int ret;
+
+	for (;;){
+		if (!conn->tx_active && conn->query){
+			ret = reply_query(conn);
+			if (ret != CONN_READ) return ret;
+			continue;
+		}
+		if (!conn->tx_active && conn->rq_next >= conn->commit_first && conn->rq_next < conn->commit_last){
+			if (conn->commit && commit_park(conn)) return CONN_COMMIT;
+			if (conn->commit_failed){
+				log_post(LOGC_SERVER, LOG_ERR, "append failed");
+				return CONN_CLOSE;
+			}
+		}
+		if (!conn->tx_active){
+			if (conn->rq_next == conn->rq_len){
+				conn->rq_next = conn->rq_len = 0;
+				if (conn->rq_cap > RQ_KEEP){
+					buffer_give(conn, conn->rq_cap * sizeof(conn_reply_t));
+					free(conn->rq);
+					conn->rq = NULL;
+					conn->rq_cap = 0;
+				}
+				// Records held back while the queue was full go on now
+				if (conn->rx_held){
+					conn->rx_held = 0;
+					if (frame_records(conn)) return CONN_CLOSE;
+					frame_incomplete(conn);
+					continue;
+				}
+				return CONN_READ;
+			}
+			req = &conn->rq[conn->rq_next++];
+			if (req->op == REPLY_SHM_RING){
+				ret = reply_shm_ring(conn);
+				if (ret == CONN_WRITE) conn->rq_next--; // descriptors not sent yet
+				if (ret != CONN_READ) return ret;
+				conn->tx_start = conn->tx_off;
+				conn->tx_t_recv = req->t_recv;
+				continue;
+			}
+			if (req->query){
+				if (query_start(conn, req)) return CONN_CLOSE;
+				continue;
+			}
+			off = req->off;
+			if (off < 0)
+				off = req->chan == conn->tail_chan && history_has_tail(req->chan) ? conn->tail_off : 0;
+			end = req->end;
+			if (end < 0 || req->op == AESD_BIN_RANGE){
+				snapshot = history_snapshot(req->chan);
+				if (end < 0 || end > snapshot) end = snapshot;
+			}
+			if (req->op){
+				if (req->op == AESD_BIN_APPEND || req->op == AESD_BIN_HELLO) off = end;
+				if (req->status != AESD_BIN_OK) off = end = 0;
+				if (off < history_start(req->chan)) off = history_start(req->chan);
+			}
+			reply_open(conn, off, end);
+			conn->tx_chan = req->chan;
+			if (!req->op || req->op == AESD_BIN_TAIL || req->op == AESD_BIN_HELLO){
+				conn->tail_chan = req->chan;
+				conn->tail_off = conn->tx_end;
+			}
+			conn->tx_binary = 0;
+			if (req->op) reply_header(conn, req);
+			conn->tx_start = conn->tx_off;
+			conn->tx_t_recv = req->t_recv;
+		}
+		ret = conn_flush(conn);
+		if (ret != CONN_READ) return ret;
+	}
+}
+
+/**********************************************************************************
+ * @name       frame_commit()
+ *
+ * @brief      { Appends the complete records rx_buf[start, stop) to a channel
+ *               in one go and turns the replies queued for them from rx_buf
+ *               positions into history lengths. Every record in the run ends
+ *               at a known place in the batch, so each reply covers the
+ *               history up to its own record. The driver and the ring keep
+ *               only their last writes, so there each reply takes a fresh
+ *               snapshot when it starts instead. A run nobody waits on, like
+ *               the front of a long binary append, is queued without waiting
+ *               for the write. A run for the appender of a connection with a
+ *               parking place is not waited on either, its replies hold how
+ *               far before the end of the run their record ends until
+ *               commit_done(), and the framer stops at the next request. }
+ *
+ * @return     0 on success, -1 on failure
+ **********************************************************************************/
+static int frame_commit(aesd_conn_t *conn, struct chan_s *chan, size_t start, size_t stop,
+                        size_t first_reply)
+{
+	off_t end_off;
+	size_t i;
+
+	if (start == stop) return 0;
+	if (!chan && conn->waiters && first_reply < conn->rq_len){
+		if (appender_append_async(conn->rx_buf + start, stop - start, conn->waiters->fd, &conn->commit)){
+			log_post(LOGC_SERVER, LOG_ERR, "append failed");
+			return -1;
+		}
+		for (i = first_reply; i < conn->rq_len; i++)
+			conn->rq[i].end = (off_t)(stop - conn->rq[i].end);
+		conn->commit_first = first_reply;
+		conn->commit_last = conn->rq_len;
+		conn->commit_t = metrics_now();
+		return 0;
+	}
+	if (history_append(chan, conn->rx_buf + start, stop - start, first_reply < conn->rq_len ? &end_off : NULL)){
+		log_post(LOGC_SERVER, LOG_ERR, "append failed");
+		return -1;
+	}
+	for (i = first_reply; i < conn->rq_len; i++){
+		if (chan || (store_flags() & STORE_STABLE))
+			conn->rq[i].end = end_off - (off_t)(stop - conn->rq[i].end);
+		else
+			conn->rq[i].end = -1;
+	}
+	return 0;
+}
+
+/**********************************************************************************
+ * @name       cmd_seekto()
+ *
+ * @brief      { AESDCHAR_IOCSEEKTO:<write_cmd>,<offset> replies with the history
+ *               from the selected position. A malformed command is dropped. }
+ **********************************************************************************/
+static int cmd_seekto(aesd_conn_t *conn, const char *cmd, uint64_t t_recv)
+{
+	unsigned int write_cmd, offset;
+	off_t pos;
+
+	if (sscanf(cmd, "AESDCHAR_IOCSEEKTO:%u,%u", &write_cmd, &offset) != 2) return 0;
+	if (history_seekto(conn->chan, write_cmd, offset, &pos)){
+		log_post(LOGC_CLIENT, LOG_ERR, "seekto %u,%u failed", write_cmd, offset);
+		return -1;
+	}
+	return reply_queue(conn, pos, -1, t_recv);
+}
+
+/**********************************************************************************
+ * @name       cmd_since()
+ *
+ * @brief      { AESDSOCKET_SINCE:<t0>[,<t1>] replies with the history written
+ *               from wall time t0 on, up to t1 when given, in seconds since the
+ *               Epoch. It starts at a timestamp line, so it may hold up to one
+ *               timestamp period more than asked. A malformed command is
+ *               dropped, one without a time index closes the connection. }
+ **********************************************************************************/
+static int cmd_since(aesd_conn_t *conn, const char *cmd, uint64_t t_recv)
+{
+	long long since, until = 0;
+	off_t start, end;
+
+	if (sscanf(cmd, "AESDSOCKET_SINCE:%lld,%lld", &since, &until) < 1 || since < 0 || until < 0)
+		return 0;
+	if (history_since(conn->chan, since, until, &start, &end)){
+		log_post(LOGC_CLIENT, LOG_ERR, "since %lld refused for %s, no time index", since, conn->client_ip);
+		return -1;
+	}
+	return reply_queue(conn, start, end, t_recv);
+}
+
+/**********************************************************************************
+ * @name       cmd_tail()
+ *
+ * @brief      { AESDSOCKET_TAIL:1 makes each later record reply with only the
+ *               history appended since this connection's previous reply,
+ *               AESDSOCKET_TAIL:0 goes back to the whole history. No reply.
+ *               The main history of the driver or the ring has no tail, its
+ *               replies stay whole. }
+ **********************************************************************************/
+static int cmd_tail(aesd_conn_t *conn, const char *cmd, uint64_t t_recv)
+{
+	unsigned int on;
+
+	(void)t_recv;
+	if (sscanf(cmd, "AESDSOCKET_TAIL:%u", &on) == 1) conn->tail_mode = on != 0;
+	return 0;
+}
+
+/**********************************************************************************
+ * @name       cmd_binary()
+ *
+ * @brief      { AESDSOCKET_BINARY:1 moves the connection to binary framing for
+ *               the rest of its life, answered by a HELLO response once the
+ *               text replies ahead of it are out. }
+ **********************************************************************************/
+static int cmd_binary(aesd_conn_t *conn, const char *cmd, uint64_t t_recv)
+{
+	unsigned int on;
+
+	if (sscanf(cmd, "AESDSOCKET_BINARY:%u", &on) != 1 || on != 1) return 0;
+	if (reply_queue(conn, -1, -1, t_recv)) return -1;
+	conn->rq[conn->rq_len - 1].op = AESD_BIN_HELLO;
+	conn->binary = 1;
+	return 0;
+}
+
+/**********************************************************************************
+ * @name       cmd_channel()
+ *
+ * @brief      { AESDSOCKET_CHANNEL:<name> sends the later records of this
+ *               connection to that channel and answers them from it,
+ *               AESDSOCKET_CHANNEL:default goes back to the main history. No
+ *               reply. A channel that cannot be opened drops the connection,
+ *               rather than let its records land elsewhere. }
+ **********************************************************************************/
+static int cmd_channel(aesd_conn_t *conn, const char *cmd, uint64_t t_recv)
+{
+	char name[CHAN_NAME_MAX + 2];
+	size_t len;
+
+	(void)t_recv;
+	len = strcspn(cmd + strlen("AESDSOCKET_CHANNEL:"), "\n");
+	if (len >= sizeof(name)) len = sizeof(name) - 1; // refused as too long
+	memcpy(name, cmd + strlen("AESDSOCKET_CHANNEL:"), len);
+	name[len] = '\0';
+
+	if (chan_open(name, &conn->chan) == -1){
+		log_post(LOGC_CLIENT, LOG_ERR, "channel %s refused for %s", name, conn->client_ip);
+		return -1;
+	}
+	return 0;
+}
+
+/**********************************************************************************
+ * @name       query_queue()
+ *
+ * @brief      { Queues a query, it starts once the replies ahead of it are
+ *               out. }
+ *
+ * @return     0 on success, -1 when out of memory
+ **********************************************************************************/
+static int query_queue(aesd_conn_t *conn, struct chan_s *chan, uint8_t op, uint32_t id,
+                       const char *pattern, size_t len, uint64_t t_recv)
+{
+	conn_reply_t *req;
+	char *copy;
+
+	copy = (char *) malloc(len + 1);
+	if (!copy || reply_queue(conn, 0, 0, t_recv)){
+		log_post(LOGC_SERVER, LOG_ERR, "Out of memory, dropping connection");
+		free(copy);
+		return -1;
+	}
+	memcpy(copy, pattern, len);
+	req = &conn->rq[conn->rq_len - 1];
+	req->chan = chan;
+	req->op = op;
+	req->id = id;
+	req->query = copy;
+	req->query_len = len;
+	return 0;
+}
+
+/**********************************************************************************
+ * @name       cmd_query()
+ *
+ * @brief      { AESDSOCKET_QUERY:<pattern> replies with the records of the
+ *               connection's channel that hold pattern, then an empty line.
+ *               A pattern too long to take drops the connection. }
+ **********************************************************************************/
+static int cmd_query(aesd_conn_t *conn, const char *cmd, uint64_t t_recv)
+{
+	const char *pattern = cmd + strlen("AESDSOCKET_QUERY:");
+	size_t len = strcspn(pattern, "\n");
+
+	if (pattern[len] != '\n' || len > QUERY_PATTERN_MAX){
+		log_post(LOGC_CLIENT, LOG_ERR, "query pattern too long from %s", conn->client_ip);
+		return -1;
+	}
+	return query_queue(conn, conn->chan, 0, 0, pattern, len, t_recv);
+}
+
+/**********************************************************************************
+ * @name       cmd_shmring()
+ *
+ * @brief      { AESDSOCKET_SHMRING:<bytes> sets up a shared append ring for a
+ *               connection on the UNIX domain listener, see
+ *               aesdsocket-proto.h. Anywhere else, or when rings are off, the
+ *               answer is a size of 0. }
+ **********************************************************************************/
+static int cmd_shmring(aesd_conn_t *conn, const char *cmd, uint64_t t_recv)
+{
+	unsigned long size;
+
+	if (sscanf(cmd, AESD_SHM_REQUEST "%lu", &size) != 1) return 0;
+	if (!conn->shm && conn->local) conn->shm = shm_ring_create(size);
+	if (reply_queue(conn, 0, 0, t_recv)) return -1;
+	conn->rq[conn->rq_len - 1].op = REPLY_SHM_RING;
+	return 0;
+}
+
+// Lines the server acts on instead of appending
+static const struct {
+	const char *prefix;
+	int (*handler)(aesd_conn_t *conn, const char *cmd, uint64_t t_recv);
+} frame_cmds[] = {
+	{ "AESDCHAR_IOCSEEKTO:", cmd_seekto },
+	{ "AESDSOCKET_TAIL:",    cmd_tail },
+	{ "AESDSOCKET_BINARY:",  cmd_binary },
+	{ "AESDSOCKET_CHANNEL:", cmd_channel },
+	{ "AESDSOCKET_QUERY:",   cmd_query },
+	{ "AESDSOCKET_SINCE:",   cmd_since },
+	{ AESD_SHM_REQUEST,      cmd_shmring },
+};
+
+/**********************************************************************************
+ * @name       frame_command()
+ *
+ * @brief      { Looks the line up in frame_cmds. }
+ *
+ * @return     Index into frame_cmds, or -1 for a plain record
+ **********************************************************************************/
+static int frame_command(const char *line, size_t len)
+{
+	size_t i, plen;
+
+	for (i = 0; i < sizeof(frame_cmds) / sizeof(frame_cmds[0]); i++){
+		plen = strlen(frame_cmds[i].prefix);
+		if (len > plen && memcmp(line, frame_cmds[i].prefix, plen) == 0) return i;
+	}
+	return -1;
+}
+
+/**********************************************************************************
+ * @name       frame_consume()
+ *
+ * @brief      { Drops the framed rx_buf[0, used) and keeps the incomplete rest
+ *               at the front. }
+ **********************************************************************************/
+static void frame_consume(aesd_conn_t *conn, size_t used)
+{
+	conn->rx_len -= used;
+	if (conn->rx_len) memmove(conn->rx_buf, conn->rx_buf + used, conn->rx_len);
+	conn->rx_scan = conn->rx_held ? 0 : conn->rx_len;
+	if (used) __atomic_store_n(&conn->rx_since_ms, 0, __ATOMIC_RELAXED);
+
+	// A grown buffer goes back to the pool, the first one is kept for the next record
+	if (!conn->rx_len){
+		conn->rx_max = RX_BUFF_MAX;     // the budget may have room again
+		if (conn->rx_cap > RX_BUFF_START){
+			buffer_give(conn, conn->rx_cap);
+			iobuf_put(conn->rx_buf, conn->rx_cap);
+			conn->rx_buf = NULL;
+			conn->rx_cap = 0;
+		}
+	}
+}
+
+/**********************************************************************************
+ * @name       frame_incomplete()
+ *
+ * @brief      { Starts the read timeout when framing left an incomplete record
+ *               or request behind, stops it when nothing is left. Records held
+ *               back for the queue are the server's to frame, not the
+ *               client's. }
+ **********************************************************************************/
+static void frame_incomplete(aesd_conn_t *conn)
+{
+	if (!conn_read_ms) return;
+
+	if (!((conn->rx_len && !conn->rx_held) || conn->rx_bin_left))
+		__atomic_store_n(&conn->rx_since_ms, 0, __ATOMIC_RELAXED);
+	else if (!conn->rx_since_ms)
+		__atomic_store_n(&conn->rx_since_ms, conn_clock(), __ATOMIC_RELAXED);
+}
+
+/**********************************************************************************
+ * @name       bin_queue()
+ **********************************************************************************/
+static int bin_queue(aesd_conn_t *conn, struct chan_s *chan, uint8_t op, uint32_t id, uint8_t status,
+                     off_t off, off_t end, uint64_t t_recv)
+{
+	conn_reply_t *req;
+
+	if (reply_queue(conn, off, end, t_recv)) return -1;
+	req = &conn->rq[conn->rq_len - 1];
+	req->chan = chan;
+	req->op = op;
+	req->id = id;
+	req->status = status;
+	return 0;
+}
+
+/**********************************************************************************
+ * @name       bin_request()
+ *
+ * @brief      { Queues the response to a request without payload. A seek that
+ *               finds nothing or an unknown channel is answered with a
+ *               status, not by closing. }
+ *
+ * @return     0 on success, -1 on failure
+ **********************************************************************************/
+static int bin_request(aesd_conn_t *conn, const aesd_bin_hdr_t *hdr, uint64_t t_recv)
+{
+	uint32_t id = be32toh(hdr->id);
+	uint64_t arg0 = be64toh(hdr->arg0), arg1 = be64toh(hdr->arg1);
+	struct chan_s *chan;
+	off_t pos, end;
+
+	if (chan_by_id(be16toh(hdr->chan), &chan))
+		return bin_queue(conn, NULL, hdr->op, id, AESD_BIN_ENOENT, 0, 0, t_recv);
+
+	switch (hdr->op){
+		case AESD_BIN_READ:
+			return bin_queue(conn, chan, hdr->op, id, AESD_BIN_OK, 0, -1, t_recv);
+		case AESD_BIN_RANGE:
+			if (arg0 > INT64_MAX) arg0 = INT64_MAX;
+			if (arg1 > INT64_MAX - arg0) arg1 = INT64_MAX - arg0;
+			return bin_queue(conn, chan, hdr->op, id, AESD_BIN_OK, arg0, arg0 + arg1, t_recv);
+		case AESD_BIN_SEEKTO:
+			if (arg0 > UINT32_MAX || arg1 > UINT32_MAX || history_seekto(chan, arg0, arg1, &pos))
+				return bin_queue(conn, chan, hdr->op, id, AESD_BIN_ENOENT, 0, 0, t_recv);
+			return bin_queue(conn, chan, hdr->op, id, AESD_BIN_OK, pos, -1, t_recv);
+		case AESD_BIN_SINCE:
+			if (arg0 > INT64_MAX || arg1 > INT64_MAX || history_since(chan, arg0, arg1, &pos, &end))
+				return bin_queue(conn, chan, hdr->op, id, AESD_BIN_ENOENT, 0, 0, t_recv);
+			return bin_queue(conn, chan, hdr->op, id, AESD_BIN_OK, pos, end, t_recv);
+		case AESD_BIN_TAIL:
+			if (!history_has_tail(chan))
+				return bin_queue(conn, chan, hdr->op, id, AESD_BIN_EOP, 0, 0, t_recv);
+			return bin_queue(conn, chan, hdr->op, id, AESD_BIN_OK, -1, -1, t_recv);
+		default:
+			return bin_queue(conn, chan, hdr->op, id, AESD_BIN_EOP, 0, 0, t_recv);
+	}
+}
+
+/**********************************************************************************
+ * @name       bin_channel()
+ *
+ * @brief      { Answers CHANNEL with the id of the named channel, opening it
+ *               when new. }
+ *
+ * @return     0 on success, -1 on failure
+ **********************************************************************************/
+static int bin_channel(aesd_conn_t *conn, const aesd_bin_hdr_t *hdr, const char *name,
+                       size_t len, uint64_t t_recv)
+{
+	char buf[CHAN_NAME_MAX + 1];
+	struct chan_s *chan;
+
+	memcpy(buf, name, len);
+	buf[len] = '\0';
+	if (chan_open(buf, &chan) == -1)
+		return bin_queue(conn, NULL, hdr->op, be32toh(hdr->id), AESD_BIN_ENOENT, 0, 0, t_recv);
+	return bin_queue(conn, chan, hdr->op, be32toh(hdr->id), AESD_BIN_OK, 0, 0, t_recv);
+}
+
+/**********************************************************************************
+ * @name       bin_query()
+ *
+ * @brief      { Queues a QUERY. A pattern holding a newline can match no
+ *               record, it is answered with ENOENT. }
+ *
+ * @return     0 on success, -1 on failure
+ **********************************************************************************/
+static int bin_query(aesd_conn_t *conn, const aesd_bin_hdr_t *hdr, const char *pattern,
+                     size_t len, uint64_t t_recv)
+{
+	struct chan_s *chan;
+
+	if (chan_by_id(be16toh(hdr->chan), &chan) || memchr(pattern, '\n', len))
+		return bin_queue(conn, chan, hdr->op, be32toh(hdr->id), AESD_BIN_ENOENT, 0, 0, t_recv);
+	return query_queue(conn, chan, hdr->op, be32toh(hdr->id), pattern, len, t_recv);
+}
+
+/**********************************************************************************
+ * @name       frame_hold()
+ *
+ * @brief      { Checks that one more reply fits before framing the next
+ *               request. Without room the rest of rx_buf waits until the queue
+ *               is drained, and no more is read meanwhile, so a client that
+ *               does not read its replies is throttled by TCP flow control. }
+ *
+ * @return     0 to go on, 1 to stop framing, -1 to drop the connection
+ **********************************************************************************/
+static int frame_hold(aesd_conn_t *conn)
+{
+	int ret = 0;
+
+	if (conn->rq_len >= conn_queue_max){
+		metrics_throttled();
+		ret = 1;
+	}
+	else if (conn->rq_len == conn->rq_cap){
+		ret = rq_grow(conn, conn->rq_cap == 0);
+		if (ret == 1) ret = slow_consumer(conn, "buffer budget spent");
+	}
+	if (ret == 1) conn->rx_held = 1;
+	return ret;
+}
+
+/**********************************************************************************
+ * @name       frame_binary()
+ *
+ * @brief      { Splits rx_buf into binary requests. The payloads of a run of
+ *               appends to one channel are moved together over their headers
+ *               and go out as one batch, any other request ends the run so
+ *               it sees the appends sent ahead of it. An append too long to
+ *               buffer is written in pieces as it arrives, like a long text
+ *               record. }
+ *
+ * @return     0 on success, -1 on failure
+ **********************************************************************************/
+static int frame_binary(aesd_conn_t *conn)
+{
+	size_t pos = 0, run = 0, run_reply = conn->rq_len, avail, take;
+	uint64_t now = metrics_now(), len;
+	struct chan_s *run_chan = NULL, *chan;
+	aesd_bin_hdr_t hdr;
+	int ret;
+
+	if (conn->rx_bin_left){
+		take = conn->rx_len < conn->rx_bin_left ? conn->rx_len : conn->rx_bin_left;
+		conn->rx_bin_left -= take;
+		pos = run = take;
+		run_chan = conn->rx_bin_chan;
+		if (!conn->rx_bin_left &&
+		    bin_queue(conn, run_chan, AESD_BIN_APPEND, conn->rx_bin_id, AESD_BIN_OK, 0, run, now))
+			return -1;
+	}
+
+	while (!conn->rx_bin_left && conn->rx_len - pos >= sizeof(hdr)){
+		ret = frame_hold(conn);
+		if (ret == -1) return -1;
+		if (ret) break;
+
+		memcpy(&hdr, conn->rx_buf + pos, sizeof(hdr));
+		len = be64toh(hdr.len);
+		avail = conn->rx_len - pos - sizeof(hdr);
+
+		if (hdr.op == AESD_BIN_APPEND){
+			// Wait for the rest when the whole request fits the buffer
+			if (avail < len && len <= conn->rx_max - sizeof(hdr)) break;
+
+			if (chan_by_id(be16toh(hdr.chan), &chan)){
+				log_post(LOGC_CLIENT, LOG_ERR, "append to unknown channel %u from %s", be16toh(hdr.chan), conn->client_ip);
+				return -1;
+			}
+			if (chan != run_chan){
+				if (frame_commit(conn, run_chan, 0, run, run_reply)) return -1;
+				run = 0;
+				run_reply = conn->rq_len;
+				run_chan = chan;
+				if (conn->commit){
+					conn->rx_held = 1;
+					break;
+				}
+			}
+
+			take = avail < len ? avail : len;
+			memmove(conn->rx_buf + run, conn->rx_buf + pos + sizeof(hdr), take);
+			run += take;
+			pos += sizeof(hdr) + take;
+			if (take < len){
+				conn->rx_bin_left = len - take;
+				conn->rx_bin_id = be32toh(hdr.id);
+				conn->rx_bin_chan = chan;
+				break;
+			}
+			if (bin_queue(conn, chan, AESD_BIN_APPEND, be32toh(hdr.id), AESD_BIN_OK, 0, run, now))
+				return -1;
+			continue;
+		}
+
+		if (hdr.op == AESD_BIN_CHANNEL ? len > CHAN_NAME_MAX :
+		    hdr.op == AESD_BIN_QUERY ? len > QUERY_PATTERN_MAX : len != 0){
+			log_post(LOGC_CLIENT, LOG_ERR, "binary op %u with payload from %s", hdr.op, conn->client_ip);
+			return -1;
+		}
+		if (avail < len) break;
+		if (frame_commit(conn, run_chan, 0, run, run_reply)) return -1;
+		run = 0;
+		run_reply = conn->rq_len;
+		if (conn->commit){
+			conn->rx_held = 1;
+			break;
+		}
+		if (hdr.op == AESD_BIN_CHANNEL){
+			if (bin_channel(conn, &hdr, conn->rx_buf + pos + sizeof(hdr), len, now)) return -1;
+		}
+		else if (hdr.op == AESD_BIN_QUERY){
+			if (bin_query(conn, &hdr, conn->rx_buf + pos + sizeof(hdr), len, now)) return -1;
+		}
+		else if (bin_request(conn, &hdr, now)){
+			return -1;
+		}
+		run_reply = conn->rq_len;
+		pos += sizeof(hdr) + len;
+	}
+	if (frame_commit(conn, run_chan, 0, run, run_reply)) return -1;
+
+	frame_consume(conn, pos);
+	return 0;
+}
+
+/**********************************************************************************
+ * @name       frame_records()
+ *
+ * @brief      { Splits rx_buf into newline terminated records, scanning only
+ *               bytes not looked at before. Runs of plain records go to the
+ *               appender as one batch. A command line ends the run so that it
+ *               acts after everything sent ahead of it. The incomplete tail
+ *               stays buffered for the next read. What follows a switch to
+ *               binary goes to frame_binary(). }
+ *
+ * @return     0 on success, -1 on failure
+ **********************************************************************************/
+static int frame_records(aesd_conn_t *conn)
+{
+	size_t line = 0, run = 0, run_reply = conn->rq_len;
+	uint64_t now = metrics_now();
+	int cmd, ret;
+	char *nl;
+
+	if (conn->binary) return frame_binary(conn);
+
+	// memchr() is the vectorized scan in glibc
+	while ((nl = memchr(conn->rx_buf + conn->rx_scan, '\n', conn->rx_len - conn->rx_scan))){
+		size_t next = nl - conn->rx_buf + 1;
+		size_t len = next - line;
+
+		ret = frame_hold(conn);
+		if (ret == -1) return -1;
+		if (ret) break;
+
+		cmd = frame_command(conn->rx_buf + line, len);
+		if (cmd >= 0){
+			char cmd_buf[FRAME_CMD_MAX];
+			size_t cmd_len = len < sizeof(cmd_buf) ? len : sizeof(cmd_buf) - 1;
+
+			if (frame_commit(conn, conn->chan, run, line, run_reply)) return -1;
+			run = line;
+			run_reply = conn->rq_len;
+			// Acts once the records ahead of it are in
+			if (conn->commit){
+				conn->rx_held = 1;
+				break;
+			}
+
+			memcpy(cmd_buf, conn->rx_buf + line, cmd_len);
+			cmd_buf[cmd_len] = '\0';
+			if (frame_cmds[cmd].handler(conn, cmd_buf, now)) return -1;
+			run = next;
+			run_reply = conn->rq_len;
+			if (conn->binary){
+				line = next;
+				break;
+			}
+		} else if (reply_queue(conn, conn->tail_mode ? -1 : 0, next, now)){ // end is fixed up once committed
+			return -1;
+		}
+		line = conn->rx_scan = next;
+	}
+	if (frame_commit(conn, conn->chan, run, line, run_reply)) return -1;
+
+	frame_consume(conn, line);
+	if (conn->binary && conn->rx_len && !conn->rx_held) return frame_binary(conn);
+	return 0;
+}
+
+/**********************************************************************************
+ * @name       frame_room()
+ *
+ * @brief      { Makes space to read into. The buffer doubles up to RX_BUFF_MAX,
+ *               or as far as the budget allows; a record longer than that is
+ *               appended as it stands and continues with the next read, like
+ *               any partial write. }
+ *
+ * @return     0 on success, -1 on failure
+ **********************************************************************************/
+static int frame_room(aesd_conn_t *conn)
+{
+	size_t new_cap, got;
+	char *grown;
+
+	if (conn->rx_len < conn->rx_cap) return 0;
+
+	new_cap = conn->rx_cap ? conn->rx_cap * 2 : RX_BUFF_START;
+	if (conn->rx_cap < conn->rx_max && buffer_take(conn, new_cap - conn->rx_cap, conn->rx_cap == 0)){
+		if (slow_consumer(conn, "buffer budget spent") == -1) return -1;
+		conn->rx_max = conn->rx_cap;
+		// A binary append waiting to fit is streamed instead
+		if (conn->binary){
+			if (frame_binary(conn)) return -1;
+			if (conn->rx_len < conn->rx_cap) return 0;
+			log_post(LOGC_CLIENT, LOG_ERR, "binary request from %s does not fit", conn->client_ip);
+			return -1;
+		}
+	}
+
+	if (conn->rx_cap >= conn->rx_max){
+		if (history_append(conn->chan, conn->rx_buf, conn->rx_len, NULL)){
+			log_post(LOGC_SERVER, LOG_ERR, "append failed");
+			return -1;
+		}
+		conn->rx_len = conn->rx_scan = 0;
+		__atomic_store_n(&conn->rx_since_ms, 0, __ATOMIC_RELAXED);
+		return 0;
+	}
+
+	// One class up, the smaller buffer goes back for the next connection
+	grown = (char *) iobuf_get(new_cap, &got);
+	if (!grown){
+		buffer_give(conn, new_cap - conn->rx_cap);
+		log_post(LOGC_SERVER, LOG_ERR, "Out of memory, dropping connection");
+		return -1;
+	}
+	if (conn->rx_len) memcpy(grown, conn->rx_buf, conn->rx_len);
+	iobuf_put(conn->rx_buf, conn->rx_cap);
+	conn->rx_buf = grown;
+	conn->rx_cap = new_cap;
+	return 0;
+}
+
+/**********************************************************************************
+ * @name       conn_rx_space()
+ **********************************************************************************/
+int conn_rx_space(aesd_conn_t *conn, char **buf, size_t *len)
+{
+	if (frame_room(conn)) return -1;
+	*buf = conn->rx_buf + conn->rx_len;
+	*len = conn->rx_cap - conn->rx_len;
+	return 0;
+}
+
+/**********************************************************************************
+ * @name       conn_received()
+ **********************************************************************************/
+int conn_received(aesd_conn_t *conn, size_t len)
+{
+	if (len == 0){ // client closed connection, keep what it sent without a newline
+		if (conn->rx_len && !conn->binary && !__atomic_load_n(&conn->expired, __ATOMIC_RELAXED) &&
+		    history_append(conn->chan, conn->rx_buf, conn->rx_len, NULL))
+			log_post(LOGC_SERVER, LOG_ERR, "append failed");
+		conn->rx_len = conn->rx_scan = 0;
+		return CONN_CLOSE;
+	}
+	capture_data(conn->cap_id, CAP_IN, conn->rx_buf + conn->rx_len, len);
+	conn->rx_len += len;
+	metrics_bytes_in(len);
+
+	if (conn_idle_ms) __atomic_store_n(&conn->active_ms, conn_clock(), __ATOMIC_RELAXED);
+
+	if (frame_records(conn)) return CONN_CLOSE;
+	frame_incomplete(conn);
+	return conn_drain(conn);
+}
+
+/**********************************************************************************
+ * @name       conn_readable()
+ *
+ * @brief      { Reads what the client sent into the framer. Every complete
+ *               record is answered with the history up to it (or, in tail
+ *               mode, with what was appended since the previous reply), every
+ *               AESDCHAR_IOCSEEKTO command with the history from where it
+ *               seeks, every binary request with its response, in the order
+ *               they arrived. }
+ *
+ * @return     CONN_READ, CONN_WRITE or CONN_CLOSE
+ **********************************************************************************/
+static int conn_readable(aesd_conn_t *conn)
+{
+	ssize_t ret_byte;
+	size_t len;
+	char *buf;
+
+	if (conn_rx_space(conn, &buf, &len)) return CONN_CLOSE;
+
+	ret_byte = recv(conn->client_fd, buf, len, 0);
+	if (ret_byte == -1){
+		if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) return CONN_READ;
+		log_post(LOGC_IO, LOG_ERR, "recv: %s", strerror(errno));
+		return CONN_CLOSE;
+	}
+	return conn_received(conn, ret_byte);
+}
+
+/**********************************************************************************
+ * @name       conn_handle()
+ **********************************************************************************/
+int conn_handle(aesd_conn_t *conn)
+{
+	if (conn_idle_ms) __atomic_store_n(&conn->active_ms, conn_clock(), __ATOMIC_RELAXED);
+
+	// Replies owed only wait for writable, errors surface from send()
+	if (conn->tx_active || conn->rq_next != conn->rq_len || conn->query) return conn_drain(conn);
+	return conn_readable(conn);
+}
+
+/**********************************************************************************
+ * @name       conn_init()
+ **********************************************************************************/
+void conn_init(const conn_limits_t *limits)
+{
+	struct rlimit rl;
+
+	conn_queue_max = limits->queue_max ? limits->queue_max : 1;
+	conn_budget = limits->buffer_budget;
+	conn_slow_policy = limits->slow_policy;
+	conn_idle_ms = limits->idle_ms;
+	conn_read_ms = limits->read_ms;
+	conn_overload = limits->overload;
+
+	// Leave the store, listeners, channels and rings their descriptors
+	conn_max = limits->max_conns;
+	if (!conn_max){
+		if (getrlimit(RLIMIT_NOFILE, &rl) == -1 || rl.rlim_cur == RLIM_INFINITY)
+			conn_max = SIZE_MAX;
+		else if (rl.rlim_cur > 2 * CONN_FD_RESERVE)
+			conn_max = rl.rlim_cur - CONN_FD_RESERVE;
+		else
+			conn_max = rl.rlim_cur / 2;
+	}
+	if (conn_max != SIZE_MAX) syslog(LOG_INFO, "serving at most %zu connections", conn_max);
+
+	spare_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+	if (spare_fd == -1) syslog(LOG_ERR, "no spare descriptor, connections wait in the backlog when out of them");
+}
+
+/**********************************************************************************
+ * @name       conn_refuse()
+ *
+ * @brief      { Turns a just accepted socket away with the overload policy. }
+ **********************************************************************************/
+static void conn_refuse(int fd, const char *why)
+{
+	struct linger lg = { .l_onoff = 1, .l_linger = 0 };
+
+	if (conn_overload == OVERLOAD_RESET)
+		setsockopt(fd, SOL_SOCKET, SO_LINGER, &lg, sizeof(lg));
+	else if (send(fd, AESD_BUSY, sizeof(AESD_BUSY) - 1, MSG_NOSIGNAL | MSG_DONTWAIT) == -1)
+		log_post(LOGC_CONN, LOG_DEBUG, "busy line not sent: %s", strerror(errno));
+	log_post(LOGC_CONN, LOG_DEBUG, "Refused connection, %s", why);
+	metrics_refused();
+	close(fd);
+}
+
+/**********************************************************************************
+ * @name       conn_shed()
+ *
+ * @brief      { Out of descriptors the pending connection would keep the
+ *               listener readable for good. Gives up the spare descriptor
+ *               for long enough to accept it and turn it away. }
+ *
+ * @return     0 with errno EBUSY when one was refused, -1 with errno set
+ **********************************************************************************/
+static int conn_shed(int listen_fd)
+{
+	int fd, err;
+
+	pthread_mutex_lock(&spare_mutex);
+	if (spare_fd == -1){
+		pthread_mutex_unlock(&spare_mutex);
+		errno = EMFILE;
+		return -1;
+	}
+	close(spare_fd);
+	fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+	err = errno;
+	if (fd != -1) conn_refuse(fd, "out of descriptors");
+	spare_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+	pthread_mutex_unlock(&spare_mutex);
+
+	errno = fd == -1 ? err : EBUSY;
+	return fd == -1 ? -1 : 0;
+}
+
+/**********************************************************************************
+ * @name       conn_accept()
+ **********************************************************************************/
+aesd_conn_t *conn_accept(int listen_fd)
+{
+	struct sockaddr_storage client_addr;
+	socklen_t addr_size = sizeof(client_addr);
+	int new_fd;
+
+	new_fd = accept4(listen_fd, (struct sockaddr *)&client_addr, &addr_size, SOCK_NONBLOCK);
+	if (new_fd == -1){
+		if (errno == EMFILE || errno == ENFILE) conn_shed(listen_fd);
+		return NULL;
+	}
+
+	return conn_new(new_fd, (struct sockaddr *)&client_addr);
+}
+
+/**********************************************************************************
+ * @name       conn_new()
+ **********************************************************************************/
+aesd_conn_t *conn_new(int client_fd, const struct sockaddr *client_addr)
+{
+	aesd_conn_t *conn;
+	size_t open_now;
+	int one = 1;
+
+	// Shed new connections first, the ones already served keep their share
+	open_now = __atomic_add_fetch(&conn_open, 1, __ATOMIC_RELAXED);
+	if (open_now > conn_max || __atomic_load_n(&conn_buffered, __ATOMIC_RELAXED) >= conn_budget){
+		__atomic_sub_fetch(&conn_open, 1, __ATOMIC_RELAXED);
+		conn_refuse(client_fd, open_now > conn_max ? "connection limit" : "buffer budget spent");
+		errno = EBUSY;
+		return NULL;
+	}
+
+	conn = (aesd_conn_t *) calloc(1, sizeof(aesd_conn_t));
+	if (!conn){
+		log_post(LOGC_SERVER, LOG_ERR, "Out of memory, dropping connection");
+		__atomic_sub_fetch(&conn_open, 1, __ATOMIC_RELAXED);
+		close(client_fd);
+		errno = ENOMEM;
+		return NULL;
+	}
+	conn->kind = EV_CONN;
+	conn->client_fd = client_fd;
+	conn->rx_max = RX_BUFF_MAX;
+	conn->active_ms = conn_clock();
+	metrics_conn_open();
+	if (client_addr->sa_family == AF_UNIX){
+		conn->local = 1;
+		strcpy(conn->client_ip, "local");
+	}
+	else {
+		// The tail of a reply must not wait for the ACK of the one before it
+		setsockopt(client_fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+		inet_ntop(AF_INET, &((const struct sockaddr_in *)client_addr)->sin_addr,
+		          conn->client_ip, sizeof(conn->client_ip));
+	}
+
+	conn->cap_id = capture_open(conn->client_ip);
+
+	// Logs message for successful connection
+	log_post(LOGC_CONN, LOG_DEBUG, "Accepted connection from %s", conn->client_ip);
+	return conn;
+}
+
+/**********************************************************************************
+ * @name       conn_waiters_init()
+ **********************************************************************************/
+int conn_waiters_init(conn_waiters_t *waiters)
+{
+	waiters->kind = EV_WAKE;
+	pthread_mutex_init(&waiters->lock, NULL);
+	LIST_INIT(&waiters->conns);
+
+	waiters->fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (waiters->fd == -1){
+		perror("eventfd");
+		syslog(LOG_ERR, "eventfd failed, replies wait for the appender in place: %s", strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+/**********************************************************************************
+ * @name       conn_waiters_destroy()
+ **********************************************************************************/
+void conn_waiters_destroy(conn_waiters_t *waiters)
+{
+	if (waiters->fd != -1) close(waiters->fd);
+	waiters->fd = -1;
+	pthread_mutex_destroy(&waiters->lock);
+}
+
+/**********************************************************************************
+ * @name       conn_waiters_ready()
+ **********************************************************************************/
+aesd_conn_t *conn_waiters_ready(conn_waiters_t *waiters)
+{
+	aesd_conn_t *conn;
+
+	pthread_mutex_lock(&waiters->lock);
+	LIST_FOREACH(conn, &waiters->conns, wait_entries){
+		if (commit_done(conn)){
+			LIST_REMOVE(conn, wait_entries);
+			conn->parked = 0;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&waiters->lock);
+	return conn;
+}
+
+/**********************************************************************************
+ * @name       conn_clock()
+ **********************************************************************************/
+uint64_t conn_clock(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**********************************************************************************
+ * @name       conn_timeouts()
+ **********************************************************************************/
+int conn_timeouts(void)
+{
+	return conn_idle_ms || conn_read_ms;
+}
+
+/**********************************************************************************
+ * @name       conn_expire()
+ *
+ * @brief      { The owner may stamp a field after now was taken, so a stamp
+ *               ahead of now counts as fresh. }
+ **********************************************************************************/
+int conn_expire(aesd_conn_t *conn, uint64_t now)
+{
+	uint64_t active = __atomic_load_n(&conn->active_ms, __ATOMIC_RELAXED);
+	uint64_t since = __atomic_load_n(&conn->rx_since_ms, __ATOMIC_RELAXED);
+	const char *why;
+
+	if (__atomic_load_n(&conn->expired, __ATOMIC_RELAXED)) return 0;
+
+	if (conn_idle_ms && now > active && now - active >= conn_idle_ms)
+		why = "idle";
+	else if (conn_read_ms && since && now > since && now - since >= conn_read_ms)
+		why = "record incomplete";
+	else
+		return 0;
+
+	__atomic_store_n(&conn->expired, 1, __ATOMIC_RELAXED);
+	log_post(LOGC_CONN, LOG_INFO, "Timing out connection from %s, %s", conn->client_ip, why);
+	metrics_timed_out();
+	// Both directions fail from now on, whatever the connection waits for wakes up
+	shutdown(conn->client_fd, SHUT_RDWR);
+	return 1;
+}
+
+/**********************************************************************************
+ * @name       conn_peer_gone()
+ *
+ * @brief      { Whether the client closed or reset the connection before the
+ *               server let it go, only looked at for the capture. A sweep
+ *               shuts both directions itself, that is the server's doing. }
+ **********************************************************************************/
+static int conn_peer_gone(aesd_conn_t *conn)
+{
+	ssize_t ret;
+	char c;
+
+	if (!conn->cap_id || __atomic_load_n(&conn->expired, __ATOMIC_RELAXED)) return 0;
+	ret = recv(conn->client_fd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+	return ret == 0 || (ret == -1 && (errno == ECONNRESET || errno == EPIPE));
+}
+
+/**********************************************************************************
+ * @name       conn_close()
+ **********************************************************************************/
+void conn_close(aesd_conn_t *conn)
+{
+	size_t i;
+
+	log_post(LOGC_CONN, LOG_DEBUG, "Closed connection from %s", conn->client_ip);
+	capture_close(conn->cap_id, conn_peer_gone(conn));
+
+	if (conn->parked){
+		pthread_mutex_lock(&conn->waiters->lock);
+		LIST_REMOVE(conn, wait_entries);
+		pthread_mutex_unlock(&conn->waiters->lock);
+	}
+	if (conn->commit) appender_cancel(conn->commit);
+	if (conn->tx_seg) cache_put(conn->tx_seg);
+	if (conn->shm) shm_ring_detach(conn->shm);
+	if (conn->query) query_free(conn->query);
+	for (i = conn->rq_next; i < conn->rq_len; i++)
+		free(conn->rq[i].query);
+	free(conn->rq);
+	iobuf_put(conn->rx_buf, conn->rx_cap);
+	iobuf_put(conn->tx_copy, conn->tx_copy_cap);
+	buffer_give(conn, conn->buffered);
+	__atomic_sub_fetch(&conn_open, 1, __ATOMIC_RELAXED);
+	metrics_conn_close();
+	if (close(conn->client_fd)){
+		log_post(LOGC_IO, LOG_ERR, "close failed: %s", strerror(errno));
+	}
+	free(conn);
+}
+
+/**********************************************************************************
+ * @name       timestamp_timer_create()
+ **********************************************************************************/
+int timestamp_timer_create(void)
+{
+	struct itimerspec its = {
+		.it_interval = { .tv_sec = TIMESTAMP_INTERVAL },
+		.it_value    = { .tv_sec = TIMESTAMP_INTERVAL },
+	};
+	int fd;
+
+	fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (fd == -1 || timerfd_settime(fd, 0, &its, NULL) == -1){
+		perror("timerfd");
+		syslog(LOG_ERR, "timerfd failed: %s", strerror(errno));
+		if (fd != -1) close(fd);
+		return -1;
+	}
+	return fd;
+}
@@ -0,0 +1,310 @@
+ /**********************************************************************************
+ * @file    aesdsocket-conn.h
+ * @brief   Per-connection state machine shared by the aesdsocket server modes.
+ *
+ * @author        <Li-Huan Lu>
+ * @date          <10/16/2026>
+ ***********************************************************************************/
+#ifndef AESDSOCKET_CONN_H
+#define AESDSOCKET_CONN_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/queue.h>
+#include <arpa/inet.h>
+
+// Pthread
+#include <pthread.h>
+
+#include "aesdsocket.h"
+
+// What epoll_data.ptr points at
+typedef enum {
+	EV_LISTEN,
+	EV_LISTEN_LOCAL,            // UNIX domain listener
+	EV_TIMER,
+	EV_CONN,
+	EV_WAKE,                    // conn_waiters_t, the appender committed records
+} ev_kind_t;
+
+// A reply owed to the client, history bytes [off, end) of a channel
+typedef struct conn_reply_s {
+	struct chan_s *chan;        // NULL for the main history
+	off_t off;                  // -1 to start at the connection's tail cursor
+	off_t end;                  // -1 for whatever is there when the reply starts
+	uint64_t t_recv;            // metrics_now() when the request arrived
+	char *query;                // pattern of a query, owned by the queue
+	size_t query_len;
+	// Binary replies only, op 0 is a plain text reply
+	uint32_t id;
+	uint8_t op;
+	uint8_t status;
+} conn_reply_t;
+
+// conn_handle() results
+#define CONN_CLOSE  -1  // drop the connection
+#define CONN_READ    0  // wait until readable
+#define CONN_WRITE   1  // reply pending, wait until writable
+#define CONN_COMMIT  2  // parked until its records are committed, see conn_waiters_ready()
+
+#define RX_BUFF_START (4 << 10)     // first rx buffer, the smallest pool class
+#define RX_BUFF_MAX  (1 << 20)  // longest record buffered whole, longer ones are appended in pieces
+#define RQ_KEEP      64         // an emptied reply queue larger than this is given back
+#define TX_COPY_MAX  (256 << 10)    // largest buffer history is copied through
+#define TX_HEAD_MAX  64         // response header or answer line
+
+#define CONN_QUEUE_MAX 1024     // default replies owed per connection
+#define CONN_BUFFER_MB 64       // default budget of all connection buffers
+#define CONN_FD_RESERVE 64      // descriptors kept out of the default connection limit
+#define CONN_SWEEP_MS  1000     // how often the models look for timed out connections
+
+// What happens to a connection that needs more memory once the budget is spent
+typedef enum {
+	SLOW_THROTTLE = 0,          // it makes do with what it has, reading waits for its replies
+	SLOW_DROP,                  // close it
+} slow_policy_t;
+
+// How a connection turned away at accept learns about it
+typedef enum {
+	OVERLOAD_BUSY = 0,          // AESD_BUSY line, then close
+	OVERLOAD_RESET,             // close with a TCP reset, nothing sent
+} overload_policy_t;
+
+typedef struct conn_limits_s {
+	size_t queue_max;           // replies owed per connection
+	size_t buffer_budget;       // bytes of rx buffers, reply queues and queries
+	slow_policy_t slow_policy;
+	size_t max_conns;           // open at once, 0 for what RLIMIT_NOFILE allows
+	unsigned int idle_ms;       // close after this long without traffic, 0 never
+	unsigned int read_ms;       // close when a record stays incomplete this long, 0 never
+	overload_policy_t overload;
+} conn_limits_t;
+
+typedef struct aesd_conn_s {
+	ev_kind_t kind;             // must be first, epoll_data.ptr points here
+	int client_fd;
+	char client_ip[INET_ADDRSTRLEN];
+	int local;                  // came in on the UNIX domain listener
+	uint32_t cap_id;            // capture connection number, 0 when not capturing
+	uint32_t events;            // currently registered epoll interest
+	int owner;                  // loop or worker the connection prefers
+
+	// Channel plain records go to, NULL for the main history
+	struct chan_s *chan;
+
+	// Reply in flight, history bytes [tx_off, tx_end) of tx_chan
+	int tx_active;
+	struct chan_s *tx_chan;
+	int tx_binary;              // its length went out up front in a header
+	off_t tx_start;
+	uint64_t tx_t_recv;
+	off_t tx_off;
+	off_t tx_end;
+	struct cache_seg_s *tx_seg; // cached segment being sent from, if any
+	char *tx_buf;               // tx_head, or tx_copy
+	size_t tx_len;              // bytes valid in tx_buf
+	size_t tx_sent;             // bytes of tx_buf already sent
+	char *tx_copy;              // pooled buffer history is read into, while a reply needs one
+	size_t tx_copy_cap;
+	char tx_head[TX_HEAD_MAX];
+
+	// Query being answered, each match goes out as a reply of its own
+	struct query_s *query;
+	conn_reply_t query_req;
+	int query_done;             // end of results in flight
+
+	// Replies owed to complete records, sent in order after the one in flight
+	struct conn_reply_s *rq;
+	size_t rq_next;             // next to send
+	size_t rq_len;              // queued
+	size_t rq_cap;
+
+	// Records handed to the appender without waiting, one run at a time
+	struct conn_waiters_s *waiters; // set by the model, NULL to wait for the appender in place
+	struct append_rec_s *commit; // ticket of the run in flight, NULL when none
+	size_t commit_first;        // replies [commit_first, commit_last) wait for it
+	size_t commit_last;
+	uint64_t commit_t;          // metrics_now() when it was queued
+	int commit_failed;
+	int parked;                 // in waiters, under its lock
+	LIST_ENTRY(aesd_conn_s) wait_entries;
+
+	// Tail mode replies only carry history past the previous reply
+	int tail_mode;
+	struct chan_s *tail_chan;   // channel of the previous reply
+	off_t tail_off;             // where it ended
+
+	// Line framer, rx_buf holds at most one incomplete record between reads
+	char *rx_buf;               // pooled, given back when it empties grown
+	size_t rx_len;              // bytes valid in rx_buf
+	size_t rx_cap;
+	size_t rx_scan;             // rx_buf[0, rx_scan) holds no newline
+
+	// Binary framer, see aesdsocket-proto.h
+	int binary;
+	uint64_t rx_bin_left;       // payload bytes of an append still to come
+	uint32_t rx_bin_id;         // and the request they belong to
+	struct chan_s *rx_bin_chan; // and its channel
+
+	struct shm_ring_s *shm;     // shared append ring, local connections only
+
+	// Memory the budget counts for this connection
+	size_t buffered;
+	size_t rx_max;              // rx_buf may grow to this, less once the budget refused
+	int rx_held;                // rx_buf holds records not framed while the queue was full
+
+	// Timeouts, read by whichever thread sweeps, see conn_expire()
+	uint64_t active_ms;         // conn_clock() of the last traffic
+	uint64_t rx_since_ms;       // when rx_buf last started an incomplete record, 0 for none
+	int expired;                // shut down by a sweep, its partial record is dropped
+
+	LIST_ENTRY(aesd_conn_s) entries;
+} aesd_conn_t;
+
+LIST_HEAD(aesd_conn_list, aesd_conn_s);
+
+// Connections of one loop parked until the appender commits their records
+typedef struct conn_waiters_s {
+	ev_kind_t kind;             // must be first, epoll_data.ptr points here
+	int fd;                     // eventfd the appender signals, -1 when there is none
+	pthread_mutex_t lock;       // the pool parks from its workers
+	struct aesd_conn_list conns;
+} conn_waiters_t;
+
+/**********************************************************************************
+ * @name       conn_init()
+ *
+ * @brief      { Sets the limits every connection runs under. Each connection
+ *               may always take its first rx buffer and reply queue, so it
+ *               makes progress, the budget caps what grows beyond that. Call
+ *               before the first connection. }
+ **********************************************************************************/
+void conn_init(const conn_limits_t *limits);
+
+/**********************************************************************************
+ * @name       conn_accept()
+ *
+ * @brief      { Accepts one pending connection as a nonblocking socket, from
+ *               the TCP or the UNIX domain listener. Out of descriptors, the
+ *               pending connection is refused instead of left in the queue. }
+ *
+ * @return     New connection, or NULL with errno set (EAGAIN when none pending,
+ *             EBUSY when one was refused)
+ **********************************************************************************/
+aesd_conn_t *conn_accept(int listen_fd);
+
+/**********************************************************************************
+ * @name       conn_new()
+ *
+ * @brief      { Wraps a nonblocking socket accepted by someone else. Refuses it
+ *               with the overload policy at the connection limit or once the
+ *               buffer budget is spent, and closes it when out of memory. }
+ *
+ * @return     New connection, or NULL with errno set (EBUSY when refused)
+ **********************************************************************************/
+aesd_conn_t *conn_new(int client_fd, const struct sockaddr *client_addr);
+
+/**********************************************************************************
+ * @name       conn_handle()
+ *
+ * @brief      { Makes progress on a ready connection: drains the pending replies
+ *               if there are any, otherwise handles one recv() worth of data.
+ *               On CONN_COMMIT the connection is parked, and belongs to
+ *               conn_waiters_ready() until it comes back from there. }
+ *
+ * @return     CONN_READ, CONN_WRITE, CONN_COMMIT or CONN_CLOSE
+ **********************************************************************************/
+int conn_handle(aesd_conn_t *conn);
+
+/**********************************************************************************
+ * @name       conn_rx_space()
+ *
+ * @brief      { For callers that read the socket themselves: where the next
+ *               bytes go and how many fit. Hand them over with conn_received(). }
+ *
+ * @return     0 on success, -1 when the connection has to be dropped
+ **********************************************************************************/
+int conn_rx_space(aesd_conn_t *conn, char **buf, size_t *len);
+
+/**********************************************************************************
+ * @name       conn_received()
+ *
+ * @brief      { Frames len bytes just read into the conn_rx_space() buffer, 0
+ *               meaning the client closed, and starts the replies they ask for. }
+ *
+ * @return     CONN_READ, CONN_WRITE, CONN_COMMIT or CONN_CLOSE
+ **********************************************************************************/
+int conn_received(aesd_conn_t *conn, size_t len);
+
+/**********************************************************************************
+ * @name       conn_waiters_init()
+ *
+ * @brief      { Sets up the parking place of one loop. Without an eventfd its
+ *               connections wait for the appender in place instead. }
+ *
+ * @return     0 on success, -1 on failure
+ **********************************************************************************/
+int conn_waiters_init(conn_waiters_t *waiters);
+
+/**********************************************************************************
+ * @name       conn_waiters_destroy()
+ *
+ * @brief      { Call once every connection of the loop is closed. }
+ **********************************************************************************/
+void conn_waiters_destroy(conn_waiters_t *waiters);
+
+/**********************************************************************************
+ * @name       conn_waiters_ready()
+ *
+ * @brief      { Unparks one connection whose records are committed, to be
+ *               served with conn_handle() again. Read the eventfd first, then
+ *               call until it returns NULL. }
+ *
+ * @return     Connection, or NULL when none is ready
+ **********************************************************************************/
+aesd_conn_t *conn_waiters_ready(conn_waiters_t *waiters);
+
+/**********************************************************************************
+ * @name       conn_clock()
+ *
+ * @brief      { Coarse monotonic time in ms the timeouts are measured in. }
+ **********************************************************************************/
+uint64_t conn_clock(void);
+
+/**********************************************************************************
+ * @name       conn_timeouts()
+ *
+ * @brief      { Whether any timeout is set, so the models skip the sweep. }
+ **********************************************************************************/
+int conn_timeouts(void);
+
+/**********************************************************************************
+ * @name       conn_expire()
+ *
+ * @brief      { Shuts down a connection past its idle or read timeout at now.
+ *               It stays open and the model closes it through its usual path
+ *               on the next event, so this may run on any thread that keeps
+ *               the connection from being freed meanwhile. }
+ *
+ * @return     1 when it was shut down, 0 otherwise
+ **********************************************************************************/
+int conn_expire(aesd_conn_t *conn, uint64_t now);
+
+/**********************************************************************************
+ * @name       conn_close()
+ *
+ * @brief      { Logs, closes and frees a connection. The caller unlinks it from
+ *               any list first. }
+ **********************************************************************************/
+void conn_close(aesd_conn_t *conn);
+
+/**********************************************************************************
+ * @name       timestamp_timer_create()
+ *
+ * @brief      { Creates a nonblocking timerfd firing every TIMESTAMP_INTERVAL. }
+ *
+ * @return     timerfd, or -1 on failure
+ **********************************************************************************/
+int timestamp_timer_create(void);
+
+#endif /* AESDSOCKET_CONN_H */
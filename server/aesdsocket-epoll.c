@@ -0,0 +1,360 @@
+ /**********************************************************************************
+ * @file    aesdsocket-epoll.c
+ * @brief   Event loop connection model for aesdsocket.
+ *
+ *          A small fixed number of threads each run an epoll loop over
+ *          nonblocking sockets. The listening socket is registered in every
+ *          loop with EPOLLEXCLUSIVE, so an accepted connection is owned by
+ *          the loop that accepted it for its whole lifetime. With reuseport
+ *          each loop instead accepts from its own SO_REUSEPORT listener and
+ *          the kernel spreads connections over them, so accepts never
+ *          contend on one queue. The UNIX domain listener, when there is
+ *          one, is always shared with EPOLLEXCLUSIVE. Loop 0 also owns the
+ *          timerfd that appends the timestamp line in file mode. Every loop
+ *          has an eventfd the appender signals once the records its parked
+ *          connections wait on are written.
+ *
+ * @author        <Li-Huan Lu>
+ * @date          <10/16/2026>
+ * @reference     https://man7.org/linux/man-pages/man7/epoll.7.html
+ *                https://man7.org/linux/man-pages/man2/timerfd_create.2.html
+ ***********************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+// Socket
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+
+// Pthread
+#include <pthread.h>
+#include <sys/queue.h>
+
+#include "aesdsocket.h"
+#include "aesdsocket-conn.h"
+#include "aesdsocket-log.h"
+#include "aesdsocket-store.h"
+
+#define EPOLL_MAX_EVENTS 64
+#define EPOLL_WAIT_MS    1000   // upper bound on how long terminate goes unnoticed
+
+typedef struct ev_loop_s {
+	pthread_t thread_id;
+	int index;
+	int epfd;
+	int listen_fd;
+	int own_listener;           // listen_fd is this loop's SO_REUSEPORT socket
+	int local_fd;               // UNIX domain listener, shared by all loops, or -1
+	int timer_fd;
+	conn_waiters_t waiters;
+	struct aesd_conn_list conns;
+} ev_loop_t;
+
+static ev_kind_t listen_tag = EV_LISTEN;
+static ev_kind_t local_tag = EV_LISTEN_LOCAL;
+static ev_kind_t timer_tag = EV_TIMER;
+
+/**********************************************************************************
+ * @name       loop_set_events()
+ *
+ * @brief      { Switches the epoll interest of a connection, skips the syscall
+ *               when nothing changes. }
+ **********************************************************************************/
+static int loop_set_events(ev_loop_t *loop, aesd_conn_t *conn, uint32_t events)
+{
+	struct epoll_event ev;
+
+	if (conn->events == events) return 0;
+
+	ev.events = events;
+	ev.data.ptr = conn;
+	if (epoll_ctl(loop->epfd, EPOLL_CTL_MOD, conn->client_fd, &ev) == -1){
+		log_post(LOGC_IO, LOG_ERR, "epoll_ctl MOD failed: %s", strerror(errno));
+		return -1;
+	}
+	conn->events = events;
+	return 0;
+}
+
+/**********************************************************************************
+ * @name       loop_accept()
+ *
+ * @brief      { Accepts every pending connection and registers it with this
+ *               loop. Running out of descriptors or memory drops the new
+ *               connection instead of the server. }
+ **********************************************************************************/
+static void loop_accept(ev_loop_t *loop, int listen_fd)
+{
+	struct epoll_event ev;
+	aesd_conn_t *conn;
+
+	while (!terminate){
+		conn = conn_accept(listen_fd);
+		if (!conn){
+			if (errno == EAGAIN || errno == EWOULDBLOCK) return;
+			if (errno == EINTR || errno == ECONNABORTED || errno == ENOMEM || errno == EBUSY) continue;
+			log_post(LOGC_IO, LOG_ERR, "accept failed: %s", strerror(errno));
+			return;
+		}
+		conn->owner = loop->index;
+		conn->events = EPOLLIN;
+		if (loop->waiters.fd != -1) conn->waiters = &loop->waiters;
+
+		ev.events = conn->events;
+		ev.data.ptr = conn;
+		if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, conn->client_fd, &ev) == -1){
+			log_post(LOGC_IO, LOG_ERR, "epoll_ctl ADD failed: %s", strerror(errno));
+			conn_close(conn);
+			continue;
+		}
+		LIST_INSERT_HEAD(&loop->conns, conn, entries);
+	}
+}
+
+/**********************************************************************************
+ * @name       loop_serve()
+ *
+ * @brief      { Serves a ready connection. A parked one hears nothing from its
+ *               socket until it comes back from the appender, one shot lets
+ *               an error or hang up through once without spinning. }
+ **********************************************************************************/
+static void loop_serve(ev_loop_t *loop, aesd_conn_t *conn)
+{
+	uint32_t events;
+	int ret;
+
+	ret = conn_handle(conn);
+	if (ret == CONN_CLOSE){
+		LIST_REMOVE(conn, entries);
+		conn_close(conn);
+		return;
+	}
+	events = ret == CONN_COMMIT ? EPOLLONESHOT : ret == CONN_WRITE ? EPOLLOUT : EPOLLIN;
+	if (loop_set_events(loop, conn, events)){
+		LIST_REMOVE(conn, entries);
+		conn_close(conn);
+	}
+}
+
+/**********************************************************************************
+ * @name       loop_thread()
+ **********************************************************************************/
+static void *loop_thread(void *arg)
+{
+	ev_loop_t *loop = (ev_loop_t *)arg;
+	struct epoll_event events[EPOLL_MAX_EVENTS];
+	aesd_conn_t *conn;
+	uint64_t expirations, now, next_sweep = 0;
+	int nfds, i, woken = 0;
+
+	while (!terminate){
+		nfds = epoll_wait(loop->epfd, events, EPOLL_MAX_EVENTS, EPOLL_WAIT_MS);
+		if (nfds == -1){
+			if (errno == EINTR) continue;
+			perror("epoll_wait");
+			syslog(LOG_ERR, "epoll_wait failed: %s", strerror(errno));
+			break;
+		}
+
+		for (i = 0; i < nfds; i++){
+			ev_kind_t *kind = (ev_kind_t *)events[i].data.ptr;
+
+			if (*kind == EV_LISTEN){
+				loop_accept(loop, loop->listen_fd);
+			}
+			else if (*kind == EV_LISTEN_LOCAL){
+				loop_accept(loop, loop->local_fd);
+			}
+			else if (*kind == EV_TIMER){
+				if (read(loop->timer_fd, &expirations, sizeof(expirations)) > 0 && write_timestamp())
+					syslog(LOG_ERR, "timestamp failed.");
+			}
+			else if (*kind == EV_WAKE){
+				woken = read(loop->waiters.fd, &expirations, sizeof(expirations)) > 0;
+			}
+			else {
+				conn = (aesd_conn_t *)kind;
+				if (!conn->parked) loop_serve(loop, conn);
+			}
+		}
+
+		// After the batch, a connection closed here may still have an event in it
+		if (woken){
+			while ((conn = conn_waiters_ready(&loop->waiters)) != NULL)
+				loop_serve(loop, conn);
+			woken = 0;
+		}
+
+		// Expired connections wake up shut down and close on the next round
+		if (conn_timeouts() && (now = conn_clock()) >= next_sweep){
+			next_sweep = now + CONN_SWEEP_MS;
+			LIST_FOREACH(conn, &loop->conns, entries)
+				conn_expire(conn, now);
+		}
+	}
+
+	// Close connections still owned by this loop
+	while ((conn = LIST_FIRST(&loop->conns)) != NULL){
+		LIST_REMOVE(conn, entries);
+		conn_close(conn);
+	}
+
+	return NULL;
+}
+
+/**********************************************************************************
+ * @name       loop_init()
+ **********************************************************************************/
+static int loop_init(ev_loop_t *loop, int index, int listen_fd, const server_opts_t *opts)
+{
+	struct epoll_event ev;
+	int reuseport = opts->reuseport;
+	int flags;
+
+	loop->index = index;
+	loop->listen_fd = listen_fd;
+	loop->local_fd = opts->local_fd;
+	loop->timer_fd = -1;
+	LIST_INIT(&loop->conns);
+
+	// Loop 0 keeps the socket main() bound, it is part of the same group
+	if (reuseport && index > 0){
+		loop->listen_fd = listener_reuseport(opts->backlog);
+		if (loop->listen_fd == -1) return -1;
+		loop->own_listener = 1;
+
+		flags = fcntl(loop->listen_fd, F_GETFL, 0);
+		if (flags == -1 || fcntl(loop->listen_fd, F_SETFL, flags | O_NONBLOCK) == -1){
+			perror("fcntl");
+			syslog(LOG_ERR, "fcntl O_NONBLOCK failed.");
+			return -1;
+		}
+	}
+
+	loop->epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (loop->epfd == -1){
+		perror("epoll_create1");
+		syslog(LOG_ERR, "epoll_create1 failed: %s", strerror(errno));
+		return -1;
+	}
+
+	// Only one of the loops is woken per incoming connection
+	ev.events = EPOLLIN | (reuseport ? 0 : EPOLLEXCLUSIVE);
+	ev.data.ptr = &listen_tag;
+	if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, loop->listen_fd, &ev) == -1){
+		perror("epoll_ctl");
+		syslog(LOG_ERR, "epoll_ctl listen failed: %s", strerror(errno));
+		return -1;
+	}
+	if (loop->local_fd != -1){
+		ev.events = EPOLLIN | EPOLLEXCLUSIVE;
+		ev.data.ptr = &local_tag;
+		if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, loop->local_fd, &ev) == -1){
+			perror("epoll_ctl");
+			syslog(LOG_ERR, "epoll_ctl listen failed: %s", strerror(errno));
+			return -1;
+		}
+	}
+
+	if (loop->waiters.fd != -1){
+		ev.events = EPOLLIN;
+		ev.data.ptr = &loop->waiters;
+		if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, loop->waiters.fd, &ev) == -1){
+			perror("epoll_ctl");
+			syslog(LOG_ERR, "epoll_ctl eventfd failed: %s", strerror(errno));
+			return -1;
+		}
+	}
+
+	if (index == 0 && (store_flags() & STORE_TIMESTAMPS)){
+		loop->timer_fd = timestamp_timer_create();
+		if (loop->timer_fd == -1) return -1;
+
+		ev.events = EPOLLIN;
+		ev.data.ptr = &timer_tag;
+		if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, loop->timer_fd, &ev) == -1){
+			perror("epoll_ctl");
+			syslog(LOG_ERR, "epoll_ctl timer failed: %s", strerror(errno));
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/**********************************************************************************
+ * @name       run_epoll_server()
+ **********************************************************************************/
+int run_epoll_server(int listen_fd, const server_opts_t *opts)
+{
+	int nloops = opts->nthreads;
+	ev_loop_t *loops;
+	int flags, i, started = 0, ret = 0;
+
+	flags = fcntl(listen_fd, F_GETFL, 0);
+	if (flags == -1 || fcntl(listen_fd, F_SETFL, flags | O_NONBLOCK) == -1){
+		perror("fcntl");
+		syslog(LOG_ERR, "fcntl O_NONBLOCK failed.");
+		return -1;
+	}
+	if (opts->local_fd != -1){
+		flags = fcntl(opts->local_fd, F_GETFL, 0);
+		if (flags == -1 || fcntl(opts->local_fd, F_SETFL, flags | O_NONBLOCK) == -1){
+			perror("fcntl");
+			syslog(LOG_ERR, "fcntl O_NONBLOCK failed.");
+			return -1;
+		}
+	}
+
+	loops = (ev_loop_t *) calloc(nloops, sizeof(ev_loop_t));
+	if (!loops){
+		syslog(LOG_ERR, "Out of memory");
+		return -1;
+	}
+	for (i = 0; i < nloops; i++){
+		loops[i].epfd = -1;
+		loops[i].timer_fd = -1;
+		conn_waiters_init(&loops[i].waiters);
+	}
+
+	for (i = 0; i < nloops; i++){
+		if (loop_init(&loops[i], i, listen_fd, opts)){
+			ret = -1;
+			break;
+		}
+		if (pthread_create(&loops[i].thread_id, NULL, loop_thread, &loops[i])){
+			perror("pthread_create");
+			syslog(LOG_ERR, "pthread_create failed for event loop %d", i);
+			ret = -1;
+			break;
+		}
+		if (opts->affinity) thread_pin(loops[i].thread_id, i);
+		started++;
+	}
+	// A listener nobody accepts from would still take its share of connections
+	if (i < nloops && loops[i].own_listener){
+		close(loops[i].listen_fd);
+		loops[i].own_listener = 0;
+	}
+
+	// A partial start still serves with fewer loops
+	if (started == 0) terminate = 1;
+
+	for (i = 0; i < started; i++)
+		pthread_join(loops[i].thread_id, NULL);
+
+	for (i = 0; i < nloops; i++){
+		if (loops[i].timer_fd != -1) close(loops[i].timer_fd);
+		if (loops[i].epfd != -1) close(loops[i].epfd);
+		if (loops[i].own_listener) close(loops[i].listen_fd);
+		conn_waiters_destroy(&loops[i].waiters);
+	}
+	free(loops);
+
+	return started ? 0 : ret;
+}
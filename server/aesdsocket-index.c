@@ -0,0 +1,317 @@
+ /**********************************************************************************
+ * @file    aesdsocket-index.c
+ * @brief   Persistent command offset index of the aesdsocket history file.
+ *
+ *          Every newline in the history ends one command. The index keeps
+ *          the end offset of each command in an array, so the start and end
+ *          of the Nth command are two loads instead of a scan of the file.
+ *          The appender stages the commands of a batch before writing it and
+ *          publishes them once the write succeeded. The new entries are then
+ *          appended to the index file next to the data file as raw 64-bit
+ *          offsets.
+ *
+ *          The index file is never synced, it can always be rebuilt from the
+ *          data. At startup the longest prefix that is ascending and ends on
+ *          a newline of the data file is kept, and only the data past it is
+ *          scanned again.
+ *
+ * @author        <Li-Huan Lu>
+ * @date          <10/16/2026>
+ ***********************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <syslog.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+// Pthread
+#include <pthread.h>
+
+#include "aesdsocket-index.h"
+
+#define INDEX_SCAN_CHUNK (64 * 1024)
+#define INDEX_MIN_CAP    4096       // entries
+
+// ends[i] is the history length right after command i
+static pthread_mutex_t index_mutex = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t *ends;
+static size_t ends_cap;
+static size_t ends_count;       // published, under index_mutex
+static int index_ok;            // cleared for good when the index cannot grow
+
+// Appender thread only
+static size_t staged_count;     // ends[ends_count, staged_count) not yet visible
+static off_t staged_scanned;    // data bytes scanned, including staged ones
+static off_t scanned;           // data bytes scanned up to the published commands
+static int index_fd = -1;
+static char *index_path;
+
+/**********************************************************************************
+ * @name       index_push()
+ *
+ * @brief      { Stages one command end. Growing moves the array, so that part
+ *               holds the lock lookups take. }
+ **********************************************************************************/
+static int index_push(uint64_t end)
+{
+	if (staged_count == ends_cap){
+		size_t new_cap = ends_cap ? ends_cap * 2 : INDEX_MIN_CAP;
+		uint64_t *grown;
+
+		pthread_mutex_lock(&index_mutex);
+		grown = (uint64_t *) realloc(ends, new_cap * sizeof(*ends));
+		if (!grown){
+			index_ok = 0;
+			pthread_mutex_unlock(&index_mutex);
+			syslog(LOG_ERR, "Out of memory, command index disabled");
+			return -1;
+		}
+		ends = grown;
+		ends_cap = new_cap;
+		pthread_mutex_unlock(&index_mutex);
+	}
+	ends[staged_count++] = end;
+	return 0;
+}
+
+/**********************************************************************************
+ * @name       index_scan()
+ **********************************************************************************/
+void index_scan(const char *buf, size_t len)
+{
+	const char *p = buf, *nl;
+
+	if (!index_ok) return;
+
+	while ((nl = memchr(p, '\n', buf + len - p)) != NULL){
+		if (index_push(staged_scanned + (nl - buf) + 1)) return;
+		p = nl + 1;
+	}
+	staged_scanned += len;
+}
+
+/**********************************************************************************
+ * @name       index_commit()
+ **********************************************************************************/
+void index_commit(void)
+{
+	size_t first, len, done = 0;
+	ssize_t ret_byte;
+
+	if (!index_ok) return;
+
+	pthread_mutex_lock(&index_mutex);
+	first = ends_count;
+	ends_count = staged_count;
+	pthread_mutex_unlock(&index_mutex);
+	scanned = staged_scanned;
+
+	if (index_fd == -1 || first == staged_count) return;
+
+	// Same thread grows the array, no lock needed to read it here
+	len = (staged_count - first) * sizeof(*ends);
+	while (done < len){
+		ret_byte = write(index_fd, (const char *)(ends + first) + done, len - done);
+		if (ret_byte == -1){
+			if (errno == EINTR) continue;
+			// Rebuilt from the data next time
+			perror("write");
+			syslog(LOG_ERR, "index %s: %s, no longer persisted", index_path, strerror(errno));
+			close(index_fd);
+			index_fd = -1;
+			return;
+		}
+		done += ret_byte;
+	}
+}
+
+/**********************************************************************************
+ * @name       index_catch_up()
+ *
+ * @brief      { Scans the data file from the last published command to its end
+ *               and publishes what it found. }
+ **********************************************************************************/
+static int index_catch_up(int data_fd)
+{
+	char *buf;
+	off_t off = scanned;
+	ssize_t n;
+
+	buf = (char *) malloc(INDEX_SCAN_CHUNK);
+	if (!buf){
+		syslog(LOG_ERR, "Out of memory");
+		return -1;
+	}
+	for (;;){
+		n = pread(data_fd, buf, INDEX_SCAN_CHUNK, off);
+		if (n == -1){
+			if (errno == EINTR) continue;
+			perror("pread");
+			syslog(LOG_ERR, "index scan: %s", strerror(errno));
+			free(buf);
+			return -1;
+		}
+		if (n == 0) break;
+		index_scan(buf, n);
+		off += n;
+	}
+	free(buf);
+	index_commit();
+	return index_ok ? 0 : -1;
+}
+
+/**********************************************************************************
+ * @name       index_resync()
+ **********************************************************************************/
+void index_resync(int data_fd)
+{
+	off_t before = scanned;
+
+	if (!index_ok) return;
+
+	staged_count = ends_count;
+	staged_scanned = scanned;
+	if (index_catch_up(data_fd))
+		syslog(LOG_ERR, "index resync failed");
+	else if (scanned != before)
+		syslog(LOG_WARNING, "index %s: %lld bytes of a failed write stayed in the data file",
+		       index_path ? index_path : "", (long long)(scanned - before));
+}
+
+/**********************************************************************************
+ * @name       index_load()
+ *
+ * @brief      { Reads the index file and keeps the entries that still describe
+ *               the data file. }
+ *
+ * @return     Number of entries kept
+ **********************************************************************************/
+static size_t index_load(int data_fd)
+{
+	struct stat st, data_st;
+	size_t n, kept, done = 0;
+	ssize_t ret_byte;
+	char last;
+
+	if (fstat(index_fd, &st) == -1 || fstat(data_fd, &data_st) == -1) return 0;
+	n = st.st_size / sizeof(*ends);
+	if (n == 0) return 0;
+
+	ends_cap = n > INDEX_MIN_CAP ? n : INDEX_MIN_CAP;
+	ends = (uint64_t *) malloc(ends_cap * sizeof(*ends));
+	if (!ends){
+		ends_cap = 0;
+		return 0;
+	}
+	while (done < n * sizeof(*ends)){
+		ret_byte = pread(index_fd, (char *)ends + done, n * sizeof(*ends) - done, done);
+		if (ret_byte <= 0){
+			if (ret_byte == -1 && errno == EINTR) continue;
+			break;
+		}
+		done += ret_byte;
+	}
+	n = done / sizeof(*ends);
+
+	// A crash may leave the index ahead of the data, or torn
+	for (kept = 0; kept < n; kept++){
+		if (ends[kept] > (uint64_t)data_st.st_size) break;
+		if (kept && ends[kept] <= ends[kept - 1]) break;
+	}
+	if (kept && (pread(data_fd, &last, 1, ends[kept - 1] - 1) != 1 || last != '\n'))
+		kept = 0;
+	return kept;
+}
+
+/**********************************************************************************
+ * @name       index_open()
+ **********************************************************************************/
+int index_open(const char *path, int data_fd)
+{
+	size_t kept;
+
+	index_path = strdup(path);
+	if (!index_path){
+		syslog(LOG_ERR, "Out of memory");
+		return -1;
+	}
+	index_fd = open(path, O_RDWR | O_CREAT | O_APPEND, 0664);
+	if (index_fd == -1){
+		perror("open");
+		syslog(LOG_ERR, "open %s: %s", path, strerror(errno));
+		free(index_path);
+		index_path = NULL;
+		return -1;
+	}
+
+	kept = index_load(data_fd);
+	if (ftruncate(index_fd, kept * sizeof(*ends)) == -1){
+		perror("ftruncate");
+		syslog(LOG_ERR, "ftruncate %s: %s", path, strerror(errno));
+		index_close(0);
+		return -1;
+	}
+	ends_count = staged_count = kept;
+	scanned = staged_scanned = kept ? (off_t)ends[kept - 1] : 0;
+	index_ok = 1;
+
+	if (index_catch_up(data_fd)){
+		index_close(0);
+		return -1;
+	}
+	syslog(LOG_INFO, "index %s: %zu commands, %zu reused", path, ends_count, kept);
+	return 0;
+}
+
+/**********************************************************************************
+ * @name       index_close()
+ **********************************************************************************/
+void index_close(int unlink_file)
+{
+	pthread_mutex_lock(&index_mutex);
+	index_ok = 0;
+	free(ends);
+	ends = NULL;
+	ends_cap = ends_count = 0;
+	pthread_mutex_unlock(&index_mutex);
+	staged_count = 0;
+	scanned = staged_scanned = 0;
+
+	if (index_fd != -1){
+		close(index_fd);
+		index_fd = -1;
+	}
+	if (index_path){
+		if (unlink_file && unlink(index_path)){
+			perror("unlink");
+			syslog(LOG_ERR, "remove index failed.");
+		}
+		free(index_path);
+		index_path = NULL;
+	}
+}
+
+/**********************************************************************************
+ * @name       index_lookup()
+ **********************************************************************************/
+int index_lookup(unsigned int write_cmd, off_t *start, off_t *end)
+{
+	int ret = -1;
+
+	pthread_mutex_lock(&index_mutex);
+	if (!index_ok)
+		ret = 1;
+	else if (write_cmd < ends_count){
+		*start = write_cmd ? (off_t)ends[write_cmd - 1] : 0;
+		*end = ends[write_cmd];
+		ret = 0;
+	}
+	else
+		*start = *end = ends_count ? (off_t)ends[ends_count - 1] : 0;
+	pthread_mutex_unlock(&index_mutex);
+	return ret;
+}
@@ -0,0 +1,74 @@
+ /**********************************************************************************
+ * @file    aesdsocket-index.h
+ * @brief   Persistent command offset index of the aesdsocket history file.
+ *
+ * @author        <Li-Huan Lu>
+ * @date          <10/16/2026>
+ ***********************************************************************************/
+#ifndef AESDSOCKET_INDEX_H
+#define AESDSOCKET_INDEX_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/**********************************************************************************
+ * @name       index_open()
+ *
+ * @brief      { Loads the index at path, keeps the longest prefix that still
+ *               matches the data file and scans only the data past it. A
+ *               missing or foreign index is rebuilt from the data. }
+ *
+ * @param[in]  path    { Index file }
+ * @param[in]  data_fd { Readable fd on the data file }
+ *
+ * @return     0 on success, -1 on failure
+ **********************************************************************************/
+int index_open(const char *path, int data_fd);
+
+/**********************************************************************************
+ * @name       index_close()
+ *
+ * @brief      { Frees the index, and removes its file when unlink_file is set. }
+ **********************************************************************************/
+void index_close(int unlink_file);
+
+/**********************************************************************************
+ * @name       index_scan()
+ *
+ * @brief      { Stages the commands ending in bytes about to be appended.
+ *               Appender thread only, lookups do not see them until
+ *               index_commit(). }
+ **********************************************************************************/
+void index_scan(const char *buf, size_t len);
+
+/**********************************************************************************
+ * @name       index_commit()
+ *
+ * @brief      { Publishes the staged commands and appends them to the index
+ *               file, once the data write succeeded. }
+ **********************************************************************************/
+void index_commit(void);
+
+/**********************************************************************************
+ * @name       index_resync()
+ *
+ * @brief      { Drops the staged commands after a failed data write. The write
+ *               truncates the data file back to where it ended, so normally
+ *               nothing is left to scan; bytes it could not take back are
+ *               scanned like any data, the appender ends their command. }
+ **********************************************************************************/
+void index_resync(int data_fd);
+
+/**********************************************************************************
+ * @name       index_lookup()
+ *
+ * @brief      { History range [start, end) of the write_cmd-th command, zero
+ *               based, in O(1). Past the last command both are where the
+ *               next one will start. }
+ *
+ * @return     0 on success, -1 when there is no such command, 1 when there
+ *             is no index to ask
+ **********************************************************************************/
+int index_lookup(unsigned int write_cmd, off_t *start, off_t *end);
+
+#endif /* AESDSOCKET_INDEX_H */
@@ -0,0 +1,277 @@
+ /**********************************************************************************
+ * @file    aesdsocket-iobuf.c
+ * @brief   Pool of reusable I/O buffers shared by the aesdsocket connections.
+ *
+ *          Buffers come in power of two classes from IOBUF_MIN to IOBUF_MAX,
+ *          so a connection that needs more room steps up one class and the
+ *          one it leaves is reused by the next connection. Each thread keeps
+ *          a short free list per class of its own, so getting and putting a
+ *          buffer takes no lock in the common case. A thread whose list
+ *          runs dry takes a batch from the shared list of the class, one
+ *          whose list overflows hands half of it over, and an exiting
+ *          thread hands over everything. The shared lists are capped, a
+ *          buffer that does not fit is freed.
+ *
+ * @author        <Li-Huan Lu>
+ * @date          <10/16/2026>
+ * @reference     Bonwick, "The Slab Allocator: An Object-Caching Kernel Memory
+ *                Allocator"
+ ***********************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+
+// Pthread
+#include <pthread.h>
+
+#include "aesdsocket-iobuf.h"
+#include "aesdsocket-metrics.h"
+
+#define IOBUF_CLASSES     (IOBUF_MAX_SHIFT - IOBUF_MIN_SHIFT + 1)
+#define IOBUF_CACHE_BYTES (256 << 10)   // per thread and class, at least one buffer
+
+typedef struct iobuf_free_s {
+	struct iobuf_free_s *next;
+} iobuf_free_t;
+
+typedef struct iobuf_list_s {
+	iobuf_free_t *head;
+	size_t count;
+} iobuf_list_t;
+
+// Calling thread's free lists
+typedef struct iobuf_cache_s {
+	int registered;             // the exit destructor is set
+	iobuf_list_t lists[IOBUF_CLASSES];
+} iobuf_cache_t;
+
+static __thread iobuf_cache_t my_cache;
+
+static pthread_once_t key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t cache_key;
+
+static pthread_mutex_t shared_mutex = PTHREAD_MUTEX_INITIALIZER;
+static iobuf_list_t shared[IOBUF_CLASSES];
+static size_t shared_held;      // bytes on the shared lists
+static size_t shared_max = (size_t)IOBUF_POOL_MB << 20;
+
+/**********************************************************************************
+ * @name       class_of()
+ *
+ * @brief      { Smallest class holding len bytes, len at most IOBUF_MAX. }
+ **********************************************************************************/
+static int class_of(size_t len)
+{
+	int cls = 0;
+
+	while (((size_t)IOBUF_MIN << cls) < len) cls++;
+	return cls;
+}
+
+/**********************************************************************************
+ * @name       cache_limit()
+ *
+ * @brief      { Buffers of class cls a thread keeps for itself. }
+ **********************************************************************************/
+static size_t cache_limit(int cls)
+{
+	size_t n = IOBUF_CACHE_BYTES >> (IOBUF_MIN_SHIFT + cls);
+
+	return n ? n : 1;
+}
+
+/**********************************************************************************
+ * @name       list_move()
+ *
+ * @brief      { Moves up to n buffers from the front of one list to another. }
+ **********************************************************************************/
+static void list_move(iobuf_list_t *from, iobuf_list_t *to, size_t n)
+{
+	iobuf_free_t *b;
+
+	while (n-- && (b = from->head) != NULL){
+		from->head = b->next;
+		from->count--;
+		b->next = to->head;
+		to->head = b;
+		to->count++;
+	}
+}
+
+/**********************************************************************************
+ * @name       cache_flush()
+ *
+ * @brief      { Hands n buffers of a class over to the shared list, freeing
+ *               what goes over its cap. }
+ **********************************************************************************/
+static void cache_flush(iobuf_cache_t *cache, int cls, size_t n)
+{
+	iobuf_list_t *list = &cache->lists[cls];
+	size_t size = (size_t)IOBUF_MIN << cls;
+	iobuf_free_t *b;
+
+	pthread_mutex_lock(&shared_mutex);
+	while (n && list->head && shared_held + size <= shared_max){
+		list_move(list, &shared[cls], 1);
+		shared_held += size;
+		n--;
+	}
+	pthread_mutex_unlock(&shared_mutex);
+
+	while (n-- && (b = list->head) != NULL){
+		list->head = b->next;
+		list->count--;
+		metrics_iobuf_held(-(ssize_t)size);
+		free(b);
+	}
+}
+
+/**********************************************************************************
+ * @name       cache_exit()
+ *
+ * @brief      { Thread exit destructor, nothing a thread kept is lost. }
+ **********************************************************************************/
+static void cache_exit(void *arg)
+{
+	iobuf_cache_t *cache = (iobuf_cache_t *)arg;
+	int cls;
+
+	for (cls = 0; cls < IOBUF_CLASSES; cls++)
+		cache_flush(cache, cls, cache->lists[cls].count);
+	cache->registered = 0;
+}
+
+static void key_create(void)
+{
+	if (pthread_key_create(&cache_key, cache_exit))
+		syslog(LOG_ERR, "pthread_key_create failed, exiting threads leak their buffers");
+}
+
+/**********************************************************************************
+ * @name       cache()
+ *
+ * @brief      { The calling thread's lists, registered for the exit destructor
+ *               on first use. }
+ **********************************************************************************/
+static iobuf_cache_t *cache(void)
+{
+	iobuf_cache_t *c = &my_cache;
+
+	if (!c->registered){
+		pthread_once(&key_once, key_create);
+		pthread_setspecific(cache_key, c);
+		c->registered = 1;
+	}
+	return c;
+}
+
+/**********************************************************************************
+ * @name       iobuf_init()
+ **********************************************************************************/
+void iobuf_init(size_t max_held)
+{
+	shared_max = max_held;
+}
+
+/**********************************************************************************
+ * @name       iobuf_destroy()
+ **********************************************************************************/
+void iobuf_destroy(void)
+{
+	iobuf_free_t *b;
+	int cls;
+
+	// The calling thread outlives the others and has no destructor run yet
+	if (my_cache.registered) cache_exit(&my_cache);
+
+	pthread_mutex_lock(&shared_mutex);
+	for (cls = 0; cls < IOBUF_CLASSES; cls++){
+		while ((b = shared[cls].head) != NULL){
+			shared[cls].head = b->next;
+			metrics_iobuf_held(-(ssize_t)((size_t)IOBUF_MIN << cls));
+			free(b);
+		}
+		shared[cls].count = 0;
+	}
+	shared_held = 0;
+	pthread_mutex_unlock(&shared_mutex);
+}
+
+/**********************************************************************************
+ * @name       iobuf_get()
+ **********************************************************************************/
+void *iobuf_get(size_t len, size_t *cap)
+{
+	iobuf_cache_t *c;
+	iobuf_list_t *list;
+	iobuf_free_t *b;
+	size_t size, before;
+	int cls;
+
+	if (len > IOBUF_MAX){
+		b = (iobuf_free_t *) malloc(len);
+		if (!b) return NULL;
+		metrics_iobuf_get(0, len);
+		*cap = len;
+		return b;
+	}
+
+	cls = class_of(len);
+	size = (size_t)IOBUF_MIN << cls;
+	c = cache();
+	list = &c->lists[cls];
+
+	// Run dry, take half a thread's worth from the shared list
+	if (!list->head && __atomic_load_n(&shared[cls].head, __ATOMIC_RELAXED)){
+		pthread_mutex_lock(&shared_mutex);
+		before = list->count;
+		list_move(&shared[cls], list, (cache_limit(cls) + 1) / 2);
+		shared_held -= (list->count - before) * size;
+		pthread_mutex_unlock(&shared_mutex);
+	}
+
+	b = list->head;
+	if (b){
+		list->head = b->next;
+		list->count--;
+		metrics_iobuf_get(1, size);
+	}
+	else {
+		b = (iobuf_free_t *) malloc(size);
+		if (!b) return NULL;
+		metrics_iobuf_get(0, size);
+	}
+	*cap = size;
+	return b;
+}
+
+/**********************************************************************************
+ * @name       iobuf_put()
+ **********************************************************************************/
+void iobuf_put(void *buf, size_t cap)
+{
+	iobuf_cache_t *c;
+	iobuf_list_t *list;
+	iobuf_free_t *b = (iobuf_free_t *)buf;
+	int cls;
+
+	if (!buf) return;
+	if (cap > IOBUF_MAX){
+		metrics_iobuf_put(cap, 0);
+		free(buf);
+		return;
+	}
+
+	cls = class_of(cap);
+	c = cache();
+	list = &c->lists[cls];
+	b->next = list->head;
+	list->head = b;
+	list->count++;
+	metrics_iobuf_put(cap, 1);
+
+	// Keep half, the rest goes where other threads find it
+	if (list->count > cache_limit(cls))
+		cache_flush(c, cls, list->count - (cache_limit(cls) + 1) / 2);
+}
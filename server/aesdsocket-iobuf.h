@@ -0,0 +1,56 @@
+ /**********************************************************************************
+ * @file    aesdsocket-iobuf.h
+ * @brief   Pool of reusable I/O buffers shared by the aesdsocket connections.
+ *
+ * @author        <Li-Huan Lu>
+ * @date          <10/16/2026>
+ ***********************************************************************************/
+#ifndef AESDSOCKET_IOBUF_H
+#define AESDSOCKET_IOBUF_H
+
+#include <stddef.h>
+
+#define IOBUF_MIN_SHIFT 12          // smallest buffer, 4 KB
+#define IOBUF_MAX_SHIFT 20          // largest pooled buffer, 1 MB
+#define IOBUF_MIN       ((size_t)1 << IOBUF_MIN_SHIFT)
+#define IOBUF_MAX       ((size_t)1 << IOBUF_MAX_SHIFT)
+#define IOBUF_POOL_MB   16          // default cap of idle buffers shared between threads
+
+/**********************************************************************************
+ * @name       iobuf_init()
+ *
+ * @brief      { Caps the idle buffers the shared lists keep, on top of the few
+ *               each thread keeps for itself. Without a call the cap is
+ *               IOBUF_POOL_MB. }
+ **********************************************************************************/
+void iobuf_init(size_t max_held);
+
+/**********************************************************************************
+ * @name       iobuf_destroy()
+ *
+ * @brief      { Frees every idle buffer. Call once the threads that used the
+ *               pool are gone. }
+ **********************************************************************************/
+void iobuf_destroy(void);
+
+/**********************************************************************************
+ * @name       iobuf_get()
+ *
+ * @brief      { Hands out a buffer of at least len bytes, a power of two from
+ *               IOBUF_MIN. One larger than IOBUF_MAX is allocated on its own
+ *               and not pooled. }
+ *
+ * @param[out] cap { Usable size, pass it back to iobuf_put() }
+ *
+ * @return     Buffer, or NULL when out of memory
+ **********************************************************************************/
+void *iobuf_get(size_t len, size_t *cap);
+
+/**********************************************************************************
+ * @name       iobuf_put()
+ *
+ * @brief      { Returns a buffer from iobuf_get() for reuse, from any thread. }
+ **********************************************************************************/
+void iobuf_put(void *buf, size_t cap);
+
+#endif /* AESDSOCKET_IOBUF_H */
@@ -0,0 +1,309 @@
+ /**********************************************************************************
+ * @file    aesdsocket-log.c
+ * @brief   Asynchronous, rate limited logging for the aesdsocket request path.
+ *
+ *          A thread that logs formats the message into a ring of its own,
+ *          single producer and single consumer, and goes on; it never waits
+ *          on the syslog socket or on another thread. One drainer thread
+ *          empties the rings every LOG_DRAIN_MS into syslog. Each message
+ *          class may log LOG_RATE messages a second, the rest, and whatever
+ *          finds its ring full, is dropped, counted and reported once a
+ *          second. Messages of different threads may reach syslog out of
+ *          order, those of one thread keep theirs.
+ *
+ * @author        <Li-Huan Lu>
+ * @date          <10/16/2026>
+ * @reference     https://man7.org/linux/man-pages/man3/syslog.3.html
+ ***********************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <syslog.h>
+#include <time.h>
+
+// Pthread
+#include <pthread.h>
+
+#include "aesdsocket-log.h"
+#include "aesdsocket-metrics.h"
+
+#define LOG_RING_SLOTS 128      // messages a thread may have queued, a power of two
+#define LOG_MSG_MAX    240      // longer messages are cut
+#define LOG_DRAIN_MS   50
+#define LOG_WINDOW_MS  1000     // rate limit window, drops are reported per window
+
+typedef struct log_slot_s {
+	int priority;
+	int cls;
+	char msg[LOG_MSG_MAX];
+} log_slot_t;
+
+typedef struct log_ring_s {
+	unsigned head;              // next slot the owner fills
+	unsigned tail;              // next slot the drainer empties
+	int dead;                   // owner exited, freed once drained
+	struct log_ring_s *next;
+	log_slot_t slots[LOG_RING_SLOTS];
+} log_ring_t;
+
+typedef struct log_count_s {
+	unsigned posted;            // this window
+	uint64_t dropped;           // since the last report
+} __attribute__((aligned(64))) log_count_t;
+
+static const char *class_names[LOGC_CLASSES] = { "conn", "client", "io", "server" };
+
+static volatile int log_async = 0;
+static volatile int log_stopping;
+static unsigned log_rate;
+static log_count_t counts[LOGC_CLASSES];
+
+static __thread log_ring_t *my_ring;
+static pthread_mutex_t rings_mutex = PTHREAD_MUTEX_INITIALIZER;
+static log_ring_t *rings;
+
+static pthread_once_t key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t ring_key;
+static pthread_t drain_thread_id;
+
+/**********************************************************************************
+ * @name       ring_exit()
+ *
+ * @brief      { Thread exit destructor, the drainer frees the ring once it has
+ *               written out what is left in it. }
+ **********************************************************************************/
+static void ring_exit(void *arg)
+{
+	log_ring_t *ring = (log_ring_t *)arg;
+
+	__atomic_store_n(&ring->dead, 1, __ATOMIC_RELEASE);
+}
+
+static void key_create(void)
+{
+	if (pthread_key_create(&ring_key, ring_exit))
+		syslog(LOG_ERR, "pthread_key_create failed, exiting threads leak their log rings");
+}
+
+/**********************************************************************************
+ * @name       ring()
+ *
+ * @brief      { The calling thread's ring, allocated and linked on first use. }
+ **********************************************************************************/
+static log_ring_t *ring(void)
+{
+	log_ring_t *r = my_ring;
+
+	if (r) return r;
+	r = (log_ring_t *) calloc(1, sizeof(log_ring_t));
+	if (!r) return NULL;
+
+	pthread_once(&key_once, key_create);
+	pthread_setspecific(ring_key, r);
+
+	pthread_mutex_lock(&rings_mutex);
+	r->next = rings;
+	rings = r;
+	pthread_mutex_unlock(&rings_mutex);
+
+	my_ring = r;
+	return r;
+}
+
+/**********************************************************************************
+ * @name       log_drop()
+ **********************************************************************************/
+static void log_drop(log_class_t cls)
+{
+	__atomic_fetch_add(&counts[cls].dropped, 1, __ATOMIC_RELAXED);
+	metrics_log_dropped(cls);
+}
+
+/**********************************************************************************
+ * @name       ring_drain()
+ *
+ * @brief      { Writes out every message queued in a ring. }
+ *
+ * @return     1 when the ring is dead and empty, 0 otherwise
+ **********************************************************************************/
+static int ring_drain(log_ring_t *r)
+{
+	unsigned tail = r->tail;
+	int dead = __atomic_load_n(&r->dead, __ATOMIC_ACQUIRE);
+	unsigned head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+	log_slot_t *slot;
+
+	while (tail != head){
+		slot = &r->slots[tail & (LOG_RING_SLOTS - 1)];
+		syslog(slot->priority, "%s", slot->msg);
+		if (slot->cls == LOGC_CONN) printf("%s\n", slot->msg);
+		__atomic_store_n(&r->tail, ++tail, __ATOMIC_RELEASE);
+	}
+	return dead;
+}
+
+/**********************************************************************************
+ * @name       drain_all()
+ *
+ * @brief      { Drains every ring and frees those of exited threads. New rings
+ *               are only ever linked at the front, so the list is walked
+ *               without the lock. }
+ **********************************************************************************/
+static void drain_all(void)
+{
+	log_ring_t *r, *next, **pp;
+
+	pthread_mutex_lock(&rings_mutex);
+	r = rings;
+	pthread_mutex_unlock(&rings_mutex);
+
+	for (; r; r = next){
+		next = r->next;
+		if (!ring_drain(r)) continue;
+
+		pthread_mutex_lock(&rings_mutex);
+		for (pp = &rings; *pp != r; pp = &(*pp)->next);
+		*pp = r->next;
+		pthread_mutex_unlock(&rings_mutex);
+		free(r);
+	}
+}
+
+/**********************************************************************************
+ * @name       window_roll()
+ *
+ * @brief      { Opens a new rate limit window and reports what the last one
+ *               dropped. }
+ **********************************************************************************/
+static void window_roll(void)
+{
+	uint64_t dropped;
+	int cls;
+
+	for (cls = 0; cls < LOGC_CLASSES; cls++){
+		__atomic_store_n(&counts[cls].posted, 0, __ATOMIC_RELAXED);
+		dropped = __atomic_exchange_n(&counts[cls].dropped, 0, __ATOMIC_RELAXED);
+		if (dropped)
+			syslog(LOG_WARNING, "%llu %s log messages dropped", (unsigned long long)dropped, class_names[cls]);
+	}
+}
+
+/**********************************************************************************
+ * @name       drain_thread()
+ **********************************************************************************/
+static void *drain_thread(void *arg)
+{
+	struct timespec nap = { 0, LOG_DRAIN_MS * 1000000L };
+	int ticks = 0;
+
+	(void)arg;
+	while (!log_stopping){
+		nanosleep(&nap, NULL);
+		drain_all();
+		if (++ticks * LOG_DRAIN_MS >= LOG_WINDOW_MS){
+			window_roll();
+			ticks = 0;
+		}
+	}
+	drain_all();
+	window_roll();
+	fflush(stdout);
+	return NULL;
+}
+
+/**********************************************************************************
+ * @name       log_start()
+ **********************************************************************************/
+int log_start(unsigned rate)
+{
+	log_rate = rate;
+	log_stopping = 0;
+	if (pthread_create(&drain_thread_id, NULL, drain_thread, NULL)){
+		perror("pthread_create");
+		syslog(LOG_ERR, "pthread_create failed for log drainer");
+		return -1;
+	}
+	__atomic_store_n(&log_async, 1, __ATOMIC_RELEASE);
+	return 0;
+}
+
+/**********************************************************************************
+ * @name       log_stop()
+ **********************************************************************************/
+void log_stop(void)
+{
+	log_ring_t *r;
+
+	if (!log_async) return;
+
+	// Late messages go straight to syslog while the drainer finishes
+	__atomic_store_n(&log_async, 0, __ATOMIC_RELEASE);
+	log_stopping = 1;
+	pthread_join(drain_thread_id, NULL);
+
+	pthread_mutex_lock(&rings_mutex);
+	while ((r = rings) != NULL){
+		rings = r->next;
+		free(r);
+	}
+	pthread_mutex_unlock(&rings_mutex);
+	my_ring = NULL;
+}
+
+/**********************************************************************************
+ * @name       log_post()
+ **********************************************************************************/
+void log_post(log_class_t cls, int priority, const char *fmt, ...)
+{
+	va_list ap;
+	log_ring_t *r;
+	log_slot_t *slot;
+	unsigned head;
+
+	if (!__atomic_load_n(&log_async, __ATOMIC_ACQUIRE)){
+		va_start(ap, fmt);
+		vsyslog(priority, fmt, ap);
+		va_end(ap);
+		if (cls == LOGC_CONN){
+			va_start(ap, fmt);
+			vprintf(fmt, ap);
+			va_end(ap);
+			putchar('\n');
+		}
+		return;
+	}
+
+	if (log_rate && __atomic_add_fetch(&counts[cls].posted, 1, __ATOMIC_RELAXED) > log_rate){
+		log_drop(cls);
+		return;
+	}
+
+	r = ring();
+	if (!r){
+		log_drop(cls);
+		return;
+	}
+	head = r->head;
+	if (head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) == LOG_RING_SLOTS){
+		log_drop(cls);
+		return;
+	}
+
+	slot = &r->slots[head & (LOG_RING_SLOTS - 1)];
+	slot->priority = priority;
+	slot->cls = cls;
+	va_start(ap, fmt);
+	vsnprintf(slot->msg, sizeof(slot->msg), fmt, ap);
+	va_end(ap);
+	__atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+}
+
+/**********************************************************************************
+ * @name       log_class_name()
+ **********************************************************************************/
+const char *log_class_name(log_class_t cls)
+{
+	return class_names[cls];
+}
@@ -0,0 +1,61 @@
+ /**********************************************************************************
+ * @file    aesdsocket-log.h
+ * @brief   Asynchronous, rate limited logging for the aesdsocket request path.
+ *
+ * @author        <Li-Huan Lu>
+ * @date          <10/16/2026>
+ ***********************************************************************************/
+#ifndef AESDSOCKET_LOG_H
+#define AESDSOCKET_LOG_H
+
+#define LOG_RATE 100                // default messages per second and class
+
+// Each class has its own rate limit and drop counter
+typedef enum {
+	LOGC_CONN = 0,              // accepted, closed, refused, timed out; also on stdout
+	LOGC_CLIENT,                // requests a client got wrong
+	LOGC_IO,                    // socket and history read/write errors
+	LOGC_SERVER,                // out of memory, appends failing
+	LOGC_CLASSES,
+} log_class_t;
+
+/**********************************************************************************
+ * @name       log_start()
+ *
+ * @brief      { Starts the drainer thread, from then on log_post() only queues.
+ *               Before it and after log_stop() messages go to syslog at once. }
+ *
+ * @param[in]  rate { Messages per second each class may log, 0 for no limit }
+ *
+ * @return     0 on success, -1 on failure
+ **********************************************************************************/
+int log_start(unsigned rate);
+
+/**********************************************************************************
+ * @name       log_stop()
+ *
+ * @brief      { Writes out everything queued and stops the drainer. Call once
+ *               the threads that log are gone. }
+ **********************************************************************************/
+void log_stop(void);
+
+/**********************************************************************************
+ * @name       log_post()
+ *
+ * @brief      { Formats a message into the calling thread's ring for the
+ *               drainer to hand to syslog. Takes no lock and makes no system
+ *               call; over the class's rate or with the ring full the message
+ *               is dropped and counted. }
+ *
+ * @param[in]  cls      { Message class }
+ * @param[in]  priority { syslog priority }
+ **********************************************************************************/
+void log_post(log_class_t cls, int priority, const char *fmt, ...)
+	__attribute__((format(printf, 3, 4)));
+
+/**********************************************************************************
+ * @name       log_class_name()
+ **********************************************************************************/
+const char *log_class_name(log_class_t cls);
+
+#endif /* AESDSOCKET_LOG_H */
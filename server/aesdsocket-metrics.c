@@ -0,0 +1,519 @@
+ /**********************************************************************************
+ * @file    aesdsocket-metrics.c
+ * @brief   Counters and latency histograms of the aesdsocket server.
+ *
+ *          Every thread that hits a hook gets its own cache line aligned
+ *          shard on first use, so counting never shares a line with another
+ *          thread. A connection may move between threads, which is why
+ *          gauges such as open connections are kept as opened/closed counts
+ *          and only combined when read. The metrics thread sums all shards
+ *          for each client of the UNIX socket.
+ *
+ *          Latency is bucketed log-linear, 8 buckets per power of two of
+ *          microseconds, so quantiles are within 12.5%.
+ *
+ * @author        <Li-Huan Lu>
+ * @date          <10/16/2026>
+ * @reference     https://prometheus.io/docs/instrumenting/exposition_formats/
+ ***********************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+
+// Socket
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+// Pthread
+#include <pthread.h>
+
+#include "aesdsocket.h"
+#include "aesdsocket-log.h"
+#include "aesdsocket-metrics.h"
+
+#define METRICS_WAIT_MS   1000  // upper bound on how long terminate goes unnoticed
+#define LAT_LINEAR        16    // microseconds counted exactly
+#define LAT_SUB_BITS      3     // 8 buckets per power of two above that
+#define LAT_BUCKETS       (LAT_LINEAR + (40 - 4 + 1) * (1 << LAT_SUB_BITS))
+#define SIZE_BUCKETS      16    // replies up to 64 B, 256 B, ... 64 GB, +Inf
+
+typedef struct metrics_shard_s {
+	uint64_t conns_opened;
+	uint64_t conns_closed;
+	uint64_t bytes_in;
+	uint64_t bytes_out;
+	uint64_t commits;
+	uint64_t commit_wait_ns;
+	int64_t buffered;           // a connection may grow here and shrink elsewhere
+	uint64_t throttled;
+	uint64_t slow_dropped;
+	uint64_t refused;
+	uint64_t timed_out;
+	uint64_t iobuf_hits;
+	uint64_t iobuf_misses;
+	int64_t iobuf_used;         // bytes handed out, gauge
+	int64_t iobuf_held;         // bytes idle in the pool, gauge
+	uint64_t log_dropped[LOGC_CLASSES];
+	uint64_t replies;
+	uint64_t reply_bytes;
+	uint64_t reply_size[SIZE_BUCKETS];
+	uint64_t latency_ns;
+	uint64_t latency[LAT_BUCKETS];
+	struct metrics_shard_s *next;
+} __attribute__((aligned(64))) metrics_shard_t;
+
+static volatile int metrics_on = 0;
+static __thread metrics_shard_t *my_shard;
+
+static pthread_mutex_t shards_mutex = PTHREAD_MUTEX_INITIALIZER;
+static metrics_shard_t *shards;
+
+static int metrics_fd = -1;
+static char metrics_path[108];
+static pthread_t metrics_thread_id;
+
+/**********************************************************************************
+ * @name       shard()
+ *
+ * @brief      { The calling thread's shard, allocated and linked on first use.
+ *               Shards outlive their threads so nothing counted is lost. }
+ **********************************************************************************/
+static metrics_shard_t *shard(void)
+{
+	metrics_shard_t *s = my_shard;
+
+	if (s) return s;
+	if (posix_memalign((void **)&s, 64, sizeof(*s))) return NULL;
+	memset(s, 0, sizeof(*s));
+
+	pthread_mutex_lock(&shards_mutex);
+	s->next = shards;
+	shards = s;
+	pthread_mutex_unlock(&shards_mutex);
+
+	my_shard = s;
+	return s;
+}
+
+// Only the owner writes a shard, the metrics thread reads it at any time
+#define COUNT(field, v) __atomic_fetch_add(&(field), (v), __ATOMIC_RELAXED)
+#define READ(field)     __atomic_load_n(&(field), __ATOMIC_RELAXED)
+
+/**********************************************************************************
+ * @name       latency_bucket()
+ **********************************************************************************/
+static int latency_bucket(uint64_t us)
+{
+	int e;
+
+	if (us < LAT_LINEAR) return (int)us;
+	e = 63 - __builtin_clzll(us);
+	if (e > 40) return LAT_BUCKETS - 1;
+	return LAT_LINEAR + (e - 4) * (1 << LAT_SUB_BITS) +
+	       (int)((us >> (e - LAT_SUB_BITS)) & ((1 << LAT_SUB_BITS) - 1));
+}
+
+/**********************************************************************************
+ * @name       latency_upper()
+ *
+ * @brief      { Largest microsecond value falling into bucket idx. }
+ **********************************************************************************/
+static uint64_t latency_upper(int idx)
+{
+	int e, sub;
+
+	if (idx < LAT_LINEAR) return idx;
+	e = (idx - LAT_LINEAR) / (1 << LAT_SUB_BITS) + 4;
+	sub = (idx - LAT_LINEAR) % (1 << LAT_SUB_BITS);
+	return ((uint64_t)((1 << LAT_SUB_BITS) + sub + 1) << (e - LAT_SUB_BITS)) - 1;
+}
+
+/**********************************************************************************
+ * @name       size_bucket()
+ **********************************************************************************/
+static int size_bucket(size_t len)
+{
+	int idx = 0;
+
+	// 64 << 2 * idx
+	while (idx < SIZE_BUCKETS - 1 && len > ((size_t)64 << (2 * idx))) idx++;
+	return idx;
+}
+
+/**********************************************************************************
+ * Hooks
+ **********************************************************************************/
+uint64_t metrics_now(void)
+{
+	struct timespec ts;
+
+	if (!metrics_on) return 0;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+void metrics_conn_open(void)
+{
+	metrics_shard_t *s;
+
+	if (metrics_on && (s = shard())) COUNT(s->conns_opened, 1);
+}
+
+void metrics_conn_close(void)
+{
+	metrics_shard_t *s;
+
+	if (metrics_on && (s = shard())) COUNT(s->conns_closed, 1);
+}
+
+void metrics_bytes_in(size_t len)
+{
+	metrics_shard_t *s;
+
+	if (metrics_on && (s = shard())) COUNT(s->bytes_in, len);
+}
+
+void metrics_bytes_out(size_t len)
+{
+	metrics_shard_t *s;
+
+	if (metrics_on && (s = shard())) COUNT(s->bytes_out, len);
+}
+
+void metrics_commit_wait(uint64_t ns)
+{
+	metrics_shard_t *s;
+
+	if (!metrics_on || !(s = shard())) return;
+	COUNT(s->commits, 1);
+	COUNT(s->commit_wait_ns, ns);
+}
+
+void metrics_buffered(ssize_t delta)
+{
+	metrics_shard_t *s;
+
+	if (metrics_on && (s = shard())) COUNT(s->buffered, delta);
+}
+
+void metrics_throttled(void)
+{
+	metrics_shard_t *s;
+
+	if (metrics_on && (s = shard())) COUNT(s->throttled, 1);
+}
+
+void metrics_slow_dropped(void)
+{
+	metrics_shard_t *s;
+
+	if (metrics_on && (s = shard())) COUNT(s->slow_dropped, 1);
+}
+
+void metrics_refused(void)
+{
+	metrics_shard_t *s;
+
+	if (metrics_on && (s = shard())) COUNT(s->refused, 1);
+}
+
+void metrics_timed_out(void)
+{
+	metrics_shard_t *s;
+
+	if (metrics_on && (s = shard())) COUNT(s->timed_out, 1);
+}
+
+void metrics_iobuf_get(int hit, size_t size)
+{
+	metrics_shard_t *s;
+
+	if (!metrics_on || !(s = shard())) return;
+	if (hit){
+		COUNT(s->iobuf_hits, 1);
+		COUNT(s->iobuf_held, -(int64_t)size);
+	}
+	else {
+		COUNT(s->iobuf_misses, 1);
+	}
+	COUNT(s->iobuf_used, size);
+}
+
+void metrics_iobuf_put(size_t size, int kept)
+{
+	metrics_shard_t *s;
+
+	if (!metrics_on || !(s = shard())) return;
+	COUNT(s->iobuf_used, -(int64_t)size);
+	if (kept) COUNT(s->iobuf_held, size);
+}
+
+void metrics_iobuf_held(ssize_t delta)
+{
+	metrics_shard_t *s;
+
+	if (metrics_on && (s = shard())) COUNT(s->iobuf_held, delta);
+}
+
+void metrics_log_dropped(int cls)
+{
+	metrics_shard_t *s;
+
+	if (metrics_on && (s = shard())) COUNT(s->log_dropped[cls], 1);
+}
+
+void metrics_reply(size_t len, uint64_t t_recv)
+{
+	metrics_shard_t *s;
+	uint64_t ns;
+
+	if (!metrics_on || !(s = shard())) return;
+	COUNT(s->replies, 1);
+	COUNT(s->reply_bytes, len);
+	COUNT(s->reply_size[size_bucket(len)], 1);
+
+	if (!t_recv) return; // started before collection was on
+	ns = metrics_now() - t_recv;
+	COUNT(s->latency_ns, ns);
+	COUNT(s->latency[latency_bucket(ns / 1000)], 1);
+}
+
+/**********************************************************************************
+ * @name       metrics_write()
+ *
+ * @brief      { Sums every shard and prints the result. }
+ **********************************************************************************/
+static void metrics_write(FILE *out)
+{
+	static const double quantiles[] = { 0.5, 0.99, 0.999 };
+	metrics_shard_t total, *s;
+	uint64_t cum, rank;
+	size_t i, q;
+
+	memset(&total, 0, sizeof(total));
+	pthread_mutex_lock(&shards_mutex);
+	for (s = shards; s; s = s->next){
+		total.conns_opened   += READ(s->conns_opened);
+		total.conns_closed   += READ(s->conns_closed);
+		total.bytes_in       += READ(s->bytes_in);
+		total.bytes_out      += READ(s->bytes_out);
+		total.commits        += READ(s->commits);
+		total.commit_wait_ns += READ(s->commit_wait_ns);
+		total.buffered       += READ(s->buffered);
+		total.throttled      += READ(s->throttled);
+		total.slow_dropped   += READ(s->slow_dropped);
+		total.refused        += READ(s->refused);
+		total.timed_out      += READ(s->timed_out);
+		total.iobuf_hits     += READ(s->iobuf_hits);
+		total.iobuf_misses   += READ(s->iobuf_misses);
+		total.iobuf_used     += READ(s->iobuf_used);
+		total.iobuf_held     += READ(s->iobuf_held);
+		total.replies        += READ(s->replies);
+		total.reply_bytes    += READ(s->reply_bytes);
+		total.latency_ns     += READ(s->latency_ns);
+		for (i = 0; i < LOGC_CLASSES; i++) total.log_dropped[i] += READ(s->log_dropped[i]);
+		for (i = 0; i < SIZE_BUCKETS; i++) total.reply_size[i] += READ(s->reply_size[i]);
+		for (i = 0; i < LAT_BUCKETS; i++) total.latency[i] += READ(s->latency[i]);
+	}
+	pthread_mutex_unlock(&shards_mutex);
+
+	fprintf(out, "# HELP aesdsocket_connections_active Open client connections.\n"
+	             "# TYPE aesdsocket_connections_active gauge\n"
+	             "aesdsocket_connections_active %lld\n",
+	        (long long)(total.conns_opened - total.conns_closed));
+	fprintf(out, "# TYPE aesdsocket_connections_total counter\n"
+	             "aesdsocket_connections_total %llu\n", (unsigned long long)total.conns_opened);
+	fprintf(out, "# TYPE aesdsocket_received_bytes_total counter\n"
+	             "aesdsocket_received_bytes_total %llu\n", (unsigned long long)total.bytes_in);
+	fprintf(out, "# TYPE aesdsocket_sent_bytes_total counter\n"
+	             "aesdsocket_sent_bytes_total %llu\n", (unsigned long long)total.bytes_out);
+
+	fprintf(out, "# HELP aesdsocket_buffered_bytes Memory held by connection buffers and queues.\n"
+	             "# TYPE aesdsocket_buffered_bytes gauge\n"
+	             "aesdsocket_buffered_bytes %lld\n", (long long)total.buffered);
+	fprintf(out, "# HELP aesdsocket_throttled_total Times a connection stopped being read until its replies were out.\n"
+	             "# TYPE aesdsocket_throttled_total counter\n"
+	             "aesdsocket_throttled_total %llu\n", (unsigned long long)total.throttled);
+	fprintf(out, "# HELP aesdsocket_slow_dropped_total Connections closed for falling behind.\n"
+	             "# TYPE aesdsocket_slow_dropped_total counter\n"
+	             "aesdsocket_slow_dropped_total %llu\n", (unsigned long long)total.slow_dropped);
+	fprintf(out, "# HELP aesdsocket_refused_total Connections turned away at the connection limit or out of memory.\n"
+	             "# TYPE aesdsocket_refused_total counter\n"
+	             "aesdsocket_refused_total %llu\n", (unsigned long long)total.refused);
+	fprintf(out, "# HELP aesdsocket_timed_out_total Connections closed for being idle or sending too slowly.\n"
+	             "# TYPE aesdsocket_timed_out_total counter\n"
+	             "aesdsocket_timed_out_total %llu\n", (unsigned long long)total.timed_out);
+	fprintf(out, "# HELP aesdsocket_iobuf_hits_total I/O buffers reused from the pool.\n"
+	             "# TYPE aesdsocket_iobuf_hits_total counter\n"
+	             "aesdsocket_iobuf_hits_total %llu\n", (unsigned long long)total.iobuf_hits);
+	fprintf(out, "# HELP aesdsocket_iobuf_misses_total I/O buffers the pool had to allocate.\n"
+	             "# TYPE aesdsocket_iobuf_misses_total counter\n"
+	             "aesdsocket_iobuf_misses_total %llu\n", (unsigned long long)total.iobuf_misses);
+	fprintf(out, "# HELP aesdsocket_iobuf_used_bytes Memory of the I/O buffers in use.\n"
+	             "# TYPE aesdsocket_iobuf_used_bytes gauge\n"
+	             "aesdsocket_iobuf_used_bytes %lld\n", (long long)total.iobuf_used);
+	fprintf(out, "# HELP aesdsocket_iobuf_held_bytes Memory of the idle I/O buffers the pool keeps.\n"
+	             "# TYPE aesdsocket_iobuf_held_bytes gauge\n"
+	             "aesdsocket_iobuf_held_bytes %lld\n", (long long)total.iobuf_held);
+	fprintf(out, "# HELP aesdsocket_log_dropped_total Log messages dropped over the rate limit or with the ring full.\n"
+	             "# TYPE aesdsocket_log_dropped_total counter\n");
+	for (i = 0; i < LOGC_CLASSES; i++)
+		fprintf(out, "aesdsocket_log_dropped_total{class=\"%s\"} %llu\n",
+		        log_class_name(i), (unsigned long long)total.log_dropped[i]);
+
+	fprintf(out, "# HELP aesdsocket_commit_wait_seconds Time writers waited for their records to be committed.\n"
+	             "# TYPE aesdsocket_commit_wait_seconds summary\n"
+	             "aesdsocket_commit_wait_seconds_sum %.9f\n"
+	             "aesdsocket_commit_wait_seconds_count %llu\n",
+	        total.commit_wait_ns / 1e9, (unsigned long long)total.commits);
+
+	fprintf(out, "# HELP aesdsocket_reply_bytes Size of completed replies.\n"
+	             "# TYPE aesdsocket_reply_bytes histogram\n");
+	for (i = 0, cum = 0; i < SIZE_BUCKETS; i++){
+		cum += total.reply_size[i];
+		if (i < SIZE_BUCKETS - 1)
+			fprintf(out, "aesdsocket_reply_bytes_bucket{le=\"%llu\"} %llu\n",
+			        (unsigned long long)64 << (2 * i), (unsigned long long)cum);
+		else
+			fprintf(out, "aesdsocket_reply_bytes_bucket{le=\"+Inf\"} %llu\n", (unsigned long long)cum);
+	}
+	fprintf(out, "aesdsocket_reply_bytes_sum %llu\n"
+	             "aesdsocket_reply_bytes_count %llu\n",
+	        (unsigned long long)total.reply_bytes, (unsigned long long)total.replies);
+
+	// Replies started before collection have no latency
+	for (i = 0, cum = 0; i < LAT_BUCKETS; i++) cum += total.latency[i];
+
+	fprintf(out, "# HELP aesdsocket_reply_latency_seconds From the newline received to the reply sent.\n"
+	             "# TYPE aesdsocket_reply_latency_seconds summary\n");
+	for (q = 0; q < sizeof(quantiles) / sizeof(quantiles[0]); q++){
+		uint64_t seen = 0;
+
+		rank = (uint64_t)(quantiles[q] * cum + 0.5);
+		if (rank == 0) rank = 1;
+		for (i = 0; i < LAT_BUCKETS - 1; i++){
+			seen += total.latency[i];
+			if (seen >= rank) break;
+		}
+		fprintf(out, "aesdsocket_reply_latency_seconds{quantile=\"%g\"} %.6f\n",
+		        quantiles[q], cum ? latency_upper(i) / 1e6 : 0.0);
+	}
+	fprintf(out, "aesdsocket_reply_latency_seconds_sum %.9f\n"
+	             "aesdsocket_reply_latency_seconds_count %llu\n",
+	        total.latency_ns / 1e9, (unsigned long long)cum);
+}
+
+/**********************************************************************************
+ * @name       metrics_thread()
+ *
+ * @brief      { One client at a time: write the text, close. }
+ **********************************************************************************/
+static void *metrics_thread(void *arg)
+{
+	struct pollfd pfd = { .fd = metrics_fd, .events = POLLIN };
+	struct timeval tv = { .tv_sec = 1 };
+	char *text;
+	size_t len, sent;
+	ssize_t ret;
+	FILE *out;
+	int fd;
+
+	(void)arg;
+	while (!terminate){
+		if (poll(&pfd, 1, METRICS_WAIT_MS) <= 0) continue;
+
+		fd = accept(metrics_fd, NULL, NULL);
+		if (fd == -1) continue;
+		// A client that stops reading cannot hold the thread for long
+		setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+		text = NULL;
+		len = 0;
+		out = open_memstream(&text, &len);
+		if (out){
+			metrics_write(out);
+			fclose(out);
+			for (sent = 0; sent < len; sent += ret){
+				ret = send(fd, text + sent, len - sent, MSG_NOSIGNAL);
+				if (ret <= 0) break;
+			}
+		}
+		free(text);
+		close(fd);
+	}
+	return NULL;
+}
+
+/**********************************************************************************
+ * @name       metrics_start()
+ **********************************************************************************/
+int metrics_start(const char *path)
+{
+	struct sockaddr_un addr;
+
+	if (strlen(path) >= sizeof(addr.sun_path)){
+		syslog(LOG_ERR, "metrics socket path too long: %s", path);
+		return -1;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+
+	metrics_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (metrics_fd == -1){
+		perror("socket");
+		syslog(LOG_ERR, "metrics socket: %s", strerror(errno));
+		return -1;
+	}
+	unlink(path); // left over from a previous run
+	if (bind(metrics_fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 ||
+	    listen(metrics_fd, LISTEN_BACKLOG) == -1){
+		perror("bind");
+		syslog(LOG_ERR, "metrics socket %s: %s", path, strerror(errno));
+		close(metrics_fd);
+		metrics_fd = -1;
+		return -1;
+	}
+	strcpy(metrics_path, path);
+
+	metrics_on = 1;
+	if (pthread_create(&metrics_thread_id, NULL, metrics_thread, NULL)){
+		perror("pthread_create");
+		syslog(LOG_ERR, "pthread_create failed for metrics");
+		metrics_on = 0;
+		close(metrics_fd);
+		metrics_fd = -1;
+		unlink(metrics_path);
+		return -1;
+	}
+	return 0;
+}
+
+/**********************************************************************************
+ * @name       metrics_stop()
+ **********************************************************************************/
+void metrics_stop(void)
+{
+	metrics_shard_t *s;
+
+	if (metrics_fd == -1) return;
+
+	pthread_join(metrics_thread_id, NULL);
+	close(metrics_fd);
+	metrics_fd = -1;
+	unlink(metrics_path);
+
+	metrics_on = 0;
+	pthread_mutex_lock(&shards_mutex);
+	while ((s = shards) != NULL){
+		shards = s->next;
+		free(s);
+	}
+	pthread_mutex_unlock(&shards_mutex);
+}
@@ -0,0 +1,66 @@
+ /**********************************************************************************
+ * @file    aesdsocket-metrics.h
+ * @brief   Counters and latency histograms of the aesdsocket server.
+ *
+ * @author        <Li-Huan Lu>
+ * @date          <10/16/2026>
+ ***********************************************************************************/
+#ifndef AESDSOCKET_METRICS_H
+#define AESDSOCKET_METRICS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/**********************************************************************************
+ * @name       metrics_start()
+ *
+ * @brief      { Turns collection on and serves the current values in the
+ *               Prometheus text format to every client of the UNIX socket at
+ *               path. Collection stays off, and every hook returns at once,
+ *               unless this is called. }
+ *
+ * @return     0 on success, -1 on failure
+ **********************************************************************************/
+int metrics_start(const char *path);
+
+/**********************************************************************************
+ * @name       metrics_stop()
+ *
+ * @brief      { Stops the metrics thread and removes the socket. Call once the
+ *               server threads are gone. }
+ **********************************************************************************/
+void metrics_stop(void);
+
+/**********************************************************************************
+ * @name       metrics_now()
+ *
+ * @brief      { Monotonic time in ns for the latency hooks, 0 when off. }
+ **********************************************************************************/
+uint64_t metrics_now(void);
+
+// Hot path hooks, each only touches the calling thread's counters
+void metrics_conn_open(void);
+void metrics_conn_close(void);
+void metrics_bytes_in(size_t len);
+void metrics_bytes_out(size_t len);
+void metrics_commit_wait(uint64_t ns);
+void metrics_buffered(ssize_t delta);
+void metrics_throttled(void);
+void metrics_slow_dropped(void);
+void metrics_refused(void);
+void metrics_timed_out(void);
+void metrics_iobuf_get(int hit, size_t size);
+void metrics_iobuf_put(size_t size, int kept);
+void metrics_iobuf_held(ssize_t delta);
+void metrics_log_dropped(int cls);
+
+/**********************************************************************************
+ * @name       metrics_reply()
+ *
+ * @brief      { Records a completed reply of len bytes whose request was
+ *               received at t_recv (metrics_now()). }
+ **********************************************************************************/
+void metrics_reply(size_t len, uint64_t t_recv);
+
+#endif /* AESDSOCKET_METRICS_H */
@@ -0,0 +1,515 @@
+ /**********************************************************************************
+ * @file    aesdsocket-pool.c
+ * @brief   Dispatcher plus work-stealing worker pool connection model.
+ *
+ *          The dispatcher thread owns one epoll set holding the listening
+ *          socket, the timestamp timerfd and every connection registered with
+ *          EPOLLONESHOT. A ready connection is disarmed by the kernel and
+ *          pushed onto its owner worker's deque, so at most one worker touches
+ *          a connection at a time. Workers serve their own deque oldest first,
+ *          so no ready connection waits behind later ones, and steal from the
+ *          others when they run dry, then re-arm the connection once
+ *          conn_handle() says what it waits for next. The deques are short
+ *          mutex protected rings; a thief only tries the lock and moves on. A
+ *          connection parked for the appender stays disarmed, the dispatcher
+ *          queues it again when the appender's eventfd fires.
+ *
+ * @author        <Li-Huan Lu>
+ * @date          <10/16/2026>
+ * @reference     https://man7.org/linux/man-pages/man7/epoll.7.html
+ ***********************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sched.h>
+#include <errno.h>
+
+// Socket
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+
+// Pthread
+#include <pthread.h>
+#include <sys/queue.h>
+
+#include "aesdsocket.h"
+#include "aesdsocket-conn.h"
+#include "aesdsocket-log.h"
+#include "aesdsocket-store.h"
+
+#define POOL_MAX_EVENTS   64
+#define POOL_WAIT_MS      1000  // upper bound on how long terminate goes unnoticed
+#define DEQUE_INIT_CAP    64
+
+typedef struct pool_deque_s {
+	pthread_mutex_t lock;
+	aesd_conn_t **items;        // ring buffer, capacity is a power of two
+	size_t cap;
+	size_t top;                 // oldest, both the owner and thieves take from here
+	size_t bottom;              // newest, the dispatcher pushes here
+} pool_deque_t;
+
+struct pool_s;
+
+typedef struct pool_worker_s {
+	pthread_t thread_id;
+	int index;
+	struct pool_s *pool;
+	pool_deque_t deque;
+} pool_worker_t;
+
+typedef struct pool_s {
+	int epfd;
+	int listen_fd;
+	int local_fd;               // UNIX domain listener, or -1
+	int timer_fd;
+	conn_waiters_t waiters;
+	int nworkers;               // workers actually running
+	int next_owner;             // round-robin for new connections
+	pool_worker_t *workers;
+
+	// Work available across all deques, workers sleep on ready_cond
+	pthread_mutex_t ready_mutex;
+	pthread_cond_t ready_cond;
+	size_t ready;
+
+	// Every open connection, for shutdown
+	pthread_mutex_t conns_mutex;
+	struct aesd_conn_list conns;
+} pool_t;
+
+static ev_kind_t listen_tag = EV_LISTEN;
+static ev_kind_t local_tag = EV_LISTEN_LOCAL;
+static ev_kind_t timer_tag = EV_TIMER;
+
+/**********************************************************************************
+ * @name       deque_push()
+ *
+ * @brief      { Pushes a connection on the newest end, grows the ring when
+ *               full. }
+ **********************************************************************************/
+static int deque_push(pool_deque_t *dq, aesd_conn_t *conn)
+{
+	pthread_mutex_lock(&dq->lock);
+	if (dq->bottom - dq->top == dq->cap){
+		size_t new_cap = dq->cap ? dq->cap * 2 : DEQUE_INIT_CAP;
+		aesd_conn_t **items = (aesd_conn_t **) malloc(new_cap * sizeof(*items));
+		size_t i;
+
+		if (!items){
+			pthread_mutex_unlock(&dq->lock);
+			return -1;
+		}
+		for (i = dq->top; i != dq->bottom; i++)
+			items[i & (new_cap - 1)] = dq->items[i & (dq->cap - 1)];
+		free(dq->items);
+		dq->items = items;
+		dq->cap = new_cap;
+	}
+	dq->items[dq->bottom & (dq->cap - 1)] = conn;
+	dq->bottom++;
+	pthread_mutex_unlock(&dq->lock);
+	return 0;
+}
+
+/**********************************************************************************
+ * @name       deque_pop()
+ *
+ * @brief      { Owner side, oldest first. Newest first kept the socket buffers
+ *               warm but let a busy worker leave an early connection waiting
+ *               behind every later one, which showed in the tail latency. }
+ **********************************************************************************/
+static aesd_conn_t *deque_pop(pool_deque_t *dq)
+{
+	aesd_conn_t *conn = NULL;
+
+	pthread_mutex_lock(&dq->lock);
+	if (dq->bottom != dq->top){
+		conn = dq->items[dq->top & (dq->cap - 1)];
+		dq->top++;
+	}
+	pthread_mutex_unlock(&dq->lock);
+	return conn;
+}
+
+/**********************************************************************************
+ * @name       deque_steal()
+ *
+ * @brief      { Thief side, oldest first like the owner. Skips a deque whose
+ *               owner is busy with it rather than queueing behind the owner. }
+ **********************************************************************************/
+static aesd_conn_t *deque_steal(pool_deque_t *dq)
+{
+	aesd_conn_t *conn = NULL;
+
+	if (pthread_mutex_trylock(&dq->lock)) return NULL;
+	if (dq->bottom != dq->top){
+		conn = dq->items[dq->top & (dq->cap - 1)];
+		dq->top++;
+	}
+	pthread_mutex_unlock(&dq->lock);
+	return conn;
+}
+
+/**********************************************************************************
+ * @name       pool_rearm()
+ **********************************************************************************/
+static int pool_rearm(pool_t *pool, aesd_conn_t *conn, uint32_t events)
+{
+	struct epoll_event ev;
+
+	conn->events = events;
+	ev.events = events | EPOLLONESHOT;
+	ev.data.ptr = conn;
+	if (epoll_ctl(pool->epfd, EPOLL_CTL_MOD, conn->client_fd, &ev) == -1){
+		log_post(LOGC_IO, LOG_ERR, "epoll_ctl MOD failed: %s", strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+/**********************************************************************************
+ * @name       pool_drop()
+ **********************************************************************************/
+static void pool_drop(pool_t *pool, aesd_conn_t *conn)
+{
+	pthread_mutex_lock(&pool->conns_mutex);
+	LIST_REMOVE(conn, entries);
+	pthread_mutex_unlock(&pool->conns_mutex);
+	conn_close(conn);
+}
+
+/**********************************************************************************
+ * @name       pool_run_conn()
+ *
+ * @brief      { Serves one ready connection and hands it back to epoll. }
+ **********************************************************************************/
+static void pool_run_conn(pool_t *pool, aesd_conn_t *conn)
+{
+	int ret = conn_handle(conn);
+
+	if (ret == CONN_COMMIT) return;     // the dispatcher has it now
+	if (ret == CONN_CLOSE || pool_rearm(pool, conn, ret == CONN_WRITE ? EPOLLOUT : EPOLLIN))
+		pool_drop(pool, conn);
+}
+
+/**********************************************************************************
+ * @name       worker_take()
+ *
+ * @brief      { Claims one unit of ready work, sleeping while there is none.
+ *               A claim guarantees a connection sits in some deque, so the
+ *               search below only loops while racing other thieves. }
+ *
+ * @return     Connection to serve, or NULL once terminate is set
+ **********************************************************************************/
+static aesd_conn_t *worker_take(pool_worker_t *self)
+{
+	pool_t *pool = self->pool;
+	aesd_conn_t *conn;
+	struct timespec ts;
+	int i;
+
+	pthread_mutex_lock(&pool->ready_mutex);
+	while (pool->ready == 0 && !terminate){
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_sec += POOL_WAIT_MS / 1000;
+		pthread_cond_timedwait(&pool->ready_cond, &pool->ready_mutex, &ts);
+	}
+	if (terminate){
+		pthread_mutex_unlock(&pool->ready_mutex);
+		return NULL;
+	}
+	pool->ready--;
+	pthread_mutex_unlock(&pool->ready_mutex);
+
+	for (;;){
+		if ((conn = deque_pop(&self->deque)) != NULL) return conn;
+
+		for (i = 1; i < pool->nworkers; i++){
+			pool_worker_t *victim = &pool->workers[(self->index + i) % pool->nworkers];
+
+			if ((conn = deque_steal(&victim->deque)) != NULL) return conn;
+		}
+		sched_yield();
+	}
+}
+
+/**********************************************************************************
+ * @name       worker_thread()
+ **********************************************************************************/
+static void *worker_thread(void *arg)
+{
+	pool_worker_t *self = (pool_worker_t *)arg;
+	aesd_conn_t *conn;
+
+	while ((conn = worker_take(self)) != NULL)
+		pool_run_conn(self->pool, conn);
+
+	return NULL;
+}
+
+/**********************************************************************************
+ * @name       pool_dispatch()
+ *
+ * @brief      { Queues a ready connection on its owner's deque. Without any
+ *               worker, or when the deque cannot grow, the dispatcher serves
+ *               the connection itself so nothing is lost. }
+ **********************************************************************************/
+static void pool_dispatch(pool_t *pool, aesd_conn_t *conn)
+{
+	if (pool->nworkers == 0 || deque_push(&pool->workers[conn->owner].deque, conn)){
+		pool_run_conn(pool, conn);
+		return;
+	}
+
+	pthread_mutex_lock(&pool->ready_mutex);
+	pool->ready++;
+	pthread_cond_signal(&pool->ready_cond);
+	pthread_mutex_unlock(&pool->ready_mutex);
+}
+
+/**********************************************************************************
+ * @name       pool_accept()
+ **********************************************************************************/
+static void pool_accept(pool_t *pool, int listen_fd)
+{
+	struct epoll_event ev;
+	aesd_conn_t *conn;
+
+	while (!terminate){
+		conn = conn_accept(listen_fd);
+		if (!conn){
+			if (errno == EAGAIN || errno == EWOULDBLOCK) return;
+			if (errno == EINTR || errno == ECONNABORTED || errno == ENOMEM || errno == EBUSY) continue;
+			log_post(LOGC_IO, LOG_ERR, "accept failed: %s", strerror(errno));
+			return;
+		}
+		if (pool->nworkers){
+			conn->owner = pool->next_owner;
+			pool->next_owner = (pool->next_owner + 1) % pool->nworkers;
+		}
+		conn->events = EPOLLIN;
+		if (pool->waiters.fd != -1) conn->waiters = &pool->waiters;
+
+		pthread_mutex_lock(&pool->conns_mutex);
+		LIST_INSERT_HEAD(&pool->conns, conn, entries);
+		pthread_mutex_unlock(&pool->conns_mutex);
+
+		ev.events = EPOLLIN | EPOLLONESHOT;
+		ev.data.ptr = conn;
+		if (epoll_ctl(pool->epfd, EPOLL_CTL_ADD, conn->client_fd, &ev) == -1){
+			log_post(LOGC_IO, LOG_ERR, "epoll_ctl ADD failed: %s", strerror(errno));
+			pool_drop(pool, conn);
+		}
+	}
+}
+
+/**********************************************************************************
+ * @name       pool_init()
+ **********************************************************************************/
+static int pool_init(pool_t *pool, int listen_fd, int local_fd)
+{
+	struct epoll_event ev;
+	int flags;
+
+	memset(pool, 0, sizeof(*pool));
+	pool->epfd = -1;
+	pool->listen_fd = listen_fd;
+	pool->local_fd = local_fd;
+	pool->timer_fd = -1;
+	pthread_mutex_init(&pool->ready_mutex, NULL);
+	pthread_cond_init(&pool->ready_cond, NULL);
+	pthread_mutex_init(&pool->conns_mutex, NULL);
+	LIST_INIT(&pool->conns);
+	conn_waiters_init(&pool->waiters);
+
+	flags = fcntl(listen_fd, F_GETFL, 0);
+	if (flags == -1 || fcntl(listen_fd, F_SETFL, flags | O_NONBLOCK) == -1){
+		perror("fcntl");
+		syslog(LOG_ERR, "fcntl O_NONBLOCK failed.");
+		return -1;
+	}
+	if (local_fd != -1){
+		flags = fcntl(local_fd, F_GETFL, 0);
+		if (flags == -1 || fcntl(local_fd, F_SETFL, flags | O_NONBLOCK) == -1){
+			perror("fcntl");
+			syslog(LOG_ERR, "fcntl O_NONBLOCK failed.");
+			return -1;
+		}
+	}
+
+	pool->epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (pool->epfd == -1){
+		perror("epoll_create1");
+		syslog(LOG_ERR, "epoll_create1 failed: %s", strerror(errno));
+		return -1;
+	}
+
+	ev.events = EPOLLIN;
+	ev.data.ptr = &listen_tag;
+	if (epoll_ctl(pool->epfd, EPOLL_CTL_ADD, listen_fd, &ev) == -1){
+		perror("epoll_ctl");
+		syslog(LOG_ERR, "epoll_ctl listen failed: %s", strerror(errno));
+		return -1;
+	}
+	if (local_fd != -1){
+		ev.events = EPOLLIN;
+		ev.data.ptr = &local_tag;
+		if (epoll_ctl(pool->epfd, EPOLL_CTL_ADD, local_fd, &ev) == -1){
+			perror("epoll_ctl");
+			syslog(LOG_ERR, "epoll_ctl listen failed: %s", strerror(errno));
+			return -1;
+		}
+	}
+
+	if (pool->waiters.fd != -1){
+		ev.events = EPOLLIN;
+		ev.data.ptr = &pool->waiters;
+		if (epoll_ctl(pool->epfd, EPOLL_CTL_ADD, pool->waiters.fd, &ev) == -1){
+			perror("epoll_ctl");
+			syslog(LOG_ERR, "epoll_ctl eventfd failed: %s", strerror(errno));
+			return -1;
+		}
+	}
+
+	if (store_flags() & STORE_TIMESTAMPS){
+		pool->timer_fd = timestamp_timer_create();
+		if (pool->timer_fd == -1) return -1;
+
+		ev.events = EPOLLIN;
+		ev.data.ptr = &timer_tag;
+		if (epoll_ctl(pool->epfd, EPOLL_CTL_ADD, pool->timer_fd, &ev) == -1){
+			perror("epoll_ctl");
+			syslog(LOG_ERR, "epoll_ctl timer failed: %s", strerror(errno));
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/**********************************************************************************
+ * @name       pool_start_workers()
+ *
+ * @brief      { Starts up to nworkers threads. A failed pthread_create() leaves
+ *               the pool smaller instead of taking the process down. }
+ **********************************************************************************/
+static void pool_start_workers(pool_t *pool, int nworkers, int affinity)
+{
+	int i;
+
+	pool->workers = (pool_worker_t *) calloc(nworkers, sizeof(pool_worker_t));
+	if (!pool->workers){
+		syslog(LOG_ERR, "Out of memory, dispatcher serves connections itself");
+		return;
+	}
+
+	for (i = 0; i < nworkers; i++){
+		pool_worker_t *worker = &pool->workers[pool->nworkers];
+
+		worker->index = pool->nworkers;
+		worker->pool = pool;
+		pthread_mutex_init(&worker->deque.lock, NULL);
+
+		if (pthread_create(&worker->thread_id, NULL, worker_thread, worker)){
+			perror("pthread_create");
+			syslog(LOG_ERR, "pthread_create failed, pool runs with %d workers", pool->nworkers);
+			pthread_mutex_destroy(&worker->deque.lock);
+			break;
+		}
+		if (affinity) thread_pin(worker->thread_id, worker->index);
+		pool->nworkers++;
+	}
+}
+
+/**********************************************************************************
+ * @name       run_pool_server()
+ **********************************************************************************/
+int run_pool_server(int listen_fd, const server_opts_t *opts)
+{
+	pool_t pool;
+	struct epoll_event events[POOL_MAX_EVENTS];
+	aesd_conn_t *conn;
+	uint64_t expirations, now, next_sweep = 0;
+	int nfds, i, ret = 0;
+
+	if (pool_init(&pool, listen_fd, opts->local_fd)){
+		if (pool.timer_fd != -1) close(pool.timer_fd);
+		if (pool.epfd != -1) close(pool.epfd);
+		conn_waiters_destroy(&pool.waiters);
+		return -1;
+	}
+	pool_start_workers(&pool, opts->nthreads, opts->affinity);
+
+	while (!terminate){
+		nfds = epoll_wait(pool.epfd, events, POOL_MAX_EVENTS, POOL_WAIT_MS);
+		if (nfds == -1){
+			if (errno == EINTR) continue;
+			perror("epoll_wait");
+			syslog(LOG_ERR, "epoll_wait failed: %s", strerror(errno));
+			ret = -1;
+			break;
+		}
+
+		for (i = 0; i < nfds; i++){
+			ev_kind_t *kind = (ev_kind_t *)events[i].data.ptr;
+
+			if (*kind == EV_LISTEN)
+				pool_accept(&pool, pool.listen_fd);
+			else if (*kind == EV_LISTEN_LOCAL)
+				pool_accept(&pool, pool.local_fd);
+			else if (*kind == EV_TIMER){
+				if (read(pool.timer_fd, &expirations, sizeof(expirations)) > 0 && write_timestamp())
+					syslog(LOG_ERR, "timestamp failed.");
+			}
+			else if (*kind == EV_WAKE){
+				if (read(pool.waiters.fd, &expirations, sizeof(expirations)) > 0){
+					while ((conn = conn_waiters_ready(&pool.waiters)) != NULL)
+						pool_dispatch(&pool, conn);
+				}
+			}
+			else
+				pool_dispatch(&pool, (aesd_conn_t *)kind);
+		}
+
+		// A worker may be serving one of them, the shutdown makes it close it
+		if (conn_timeouts() && (now = conn_clock()) >= next_sweep){
+			next_sweep = now + CONN_SWEEP_MS;
+			pthread_mutex_lock(&pool.conns_mutex);
+			LIST_FOREACH(conn, &pool.conns, entries)
+				conn_expire(conn, now);
+			pthread_mutex_unlock(&pool.conns_mutex);
+		}
+	}
+
+	// Wake and join the workers, then close whatever is still open
+	terminate = 1;
+	pthread_mutex_lock(&pool.ready_mutex);
+	pthread_cond_broadcast(&pool.ready_cond);
+	pthread_mutex_unlock(&pool.ready_mutex);
+
+	for (i = 0; i < pool.nworkers; i++){
+		pthread_join(pool.workers[i].thread_id, NULL);
+		pthread_mutex_destroy(&pool.workers[i].deque.lock);
+		free(pool.workers[i].deque.items);
+	}
+	free(pool.workers);
+
+	while ((conn = LIST_FIRST(&pool.conns)) != NULL){
+		LIST_REMOVE(conn, entries);
+		conn_close(conn);
+	}
+
+	if (pool.timer_fd != -1) close(pool.timer_fd);
+	close(pool.epfd);
+	conn_waiters_destroy(&pool.waiters);
+	pthread_mutex_destroy(&pool.conns_mutex);
+	pthread_cond_destroy(&pool.ready_cond);
+	pthread_mutex_destroy(&pool.ready_mutex);
+
+	return ret;
+}
@@ -0,0 +1,131 @@
+ /**********************************************************************************
+ * @file    aesdsocket-proto.h
+ * @brief   Binary wire format of the aesdsocket server.
+ *
+ *          A connection starts in the newline text protocol. The text line
+ *          AESD_BIN_SWITCH moves it to binary framing for good: the server
+ *          answers with an AESD_BIN_HELLO response and every later byte in
+ *          both directions is a header followed by len payload bytes. All
+ *          header fields are big-endian.
+ *
+ *          Requests carry an id the client picks, echoed in the response.
+ *          Responses come back in request order, so a client may send any
+ *          number of requests without waiting and match them up by id.
+ *          A response describes the history range [arg0, arg1) and its
+ *          payload is exactly those bytes.
+ *
+ *          op              request args            response
+ *          APPEND          payload = bytes         [end, end), end = history
+ *                                                  length after the payload
+ *          READ            -                       whole history kept
+ *          RANGE           arg0 = off, arg1 = len  [off, off + len), clipped
+ *          SEEKTO          arg0 = cmd, arg1 = off  from that byte of the
+ *                                                  cmd-th command to the end
+ *          TAIL            -                       history since the previous
+ *                                                  TAIL or the HELLO response
+ *                                                  on this connection
+ *          CHANNEL         payload = name          arg0 = id of the channel,
+ *                                                  created on first use
+ *          SINCE           arg0 = t0, arg1 = t1    from the timestamp line at
+ *                                                  or before t0 to the first
+ *                                                  one after t1, or the end
+ *                                                  when t1 is 0, in seconds
+ *                                                  since the Epoch
+ *          QUERY           payload = pattern       one response per record
+ *                                                  holding the pattern as it
+ *                                                  is found, then an empty
+ *                                                  one, [end, end) of the scan
+ *
+ *          Every request names the channel it acts on in chan, 0 being the
+ *          main history and any other id one CHANNEL returned. A TAIL on
+ *          another channel than the previous one starts over at 0. The main
+ *          history of the driver and the ring stores numbers its bytes from
+ *          the oldest command kept, a TAIL on it answers EOP.
+ *
+ *          Only APPEND, CHANNEL and QUERY carry a payload. A request that
+ *          breaks the framing, or an APPEND to a channel id never handed
+ *          out, closes the connection.
+ *
+ * @author        <Li-Huan Lu>
+ * @date          <10/16/2026>
+ ***********************************************************************************/
+#ifndef AESDSOCKET_PROTO_H
+#define AESDSOCKET_PROTO_H
+
+#include <stdint.h>
+
+#define AESD_BIN_SWITCH  "AESDSOCKET_BINARY:1\n"
+#define AESD_BIN_VERSION 1
+
+// Operations
+#define AESD_BIN_APPEND  1
+#define AESD_BIN_READ    2
+#define AESD_BIN_RANGE   3
+#define AESD_BIN_SEEKTO  4
+#define AESD_BIN_TAIL    5
+#define AESD_BIN_CHANNEL 6
+#define AESD_BIN_QUERY   7
+#define AESD_BIN_SINCE   8
+#define AESD_BIN_HELLO   0x80   // response only, id 0, arg0 = version, arg1 = history length
+
+// Response status, payload is empty unless OK
+#define AESD_BIN_OK      0
+#define AESD_BIN_ENOENT  1      // no such command, offset or channel
+#define AESD_BIN_EOP     2      // unknown operation, or one the store cannot serve
+
+typedef struct aesd_bin_hdr_s {
+	uint64_t len;               // payload bytes after the header
+	uint32_t id;
+	uint8_t op;
+	uint8_t status;             // responses only
+	uint16_t chan;              // channel, 0 for the main history
+	uint64_t arg0;
+	uint64_t arg1;
+} aesd_bin_hdr_t;
+
+_Static_assert(sizeof(aesd_bin_hdr_t) == 32, "aesd_bin_hdr_t must have no padding");
+
+/**********************************************************************************
+ * Overload
+ *
+ * A server at its connection limit, or with its connection memory spent,
+ * may answer a new connection with the text line AESD_BUSY and close it
+ * without reading anything. The line comes in place of any reply, binary
+ * framing included, and the client should back off before trying again.
+ **********************************************************************************/
+#define AESD_BUSY "AESDSOCKET_BUSY\n"
+
+/**********************************************************************************
+ * Shared append ring, UNIX socket connections only
+ *
+ * The text line "AESDSOCKET_SHMRING:<bytes>" asks for a ring of about that
+ * size. It is answered in order with "AESDSOCKET_SHMRING:<size>" and two
+ * descriptors passed with SCM_RIGHTS: a memfd and an eventfd. A size of 0
+ * means refused, and then no descriptors come with the answer.
+ *
+ * The memfd holds an aesd_shm_hdr_t, then size data bytes at AESD_SHM_DATA.
+ * The producer copies a record to data[head % size], wrapping around, and
+ * then stores the new head with release order. It keeps head - tail at or
+ * below size, and waits for tail to move when the ring is full. After
+ * moving head, a producer that finds wake set clears it and writes 1 to the
+ * eventfd. The server appends complete lines to the history, and a partial
+ * one only when it fills the ring or the connection goes. The ring lives as
+ * long as the connection that asked for it, and whatever is left in it is
+ * appended when that connection closes.
+ **********************************************************************************/
+#define AESD_SHM_REQUEST "AESDSOCKET_SHMRING:"
+#define AESD_SHM_MAGIC   0x41455344u    // "AESD"
+#define AESD_SHM_DATA    4096
+#define AESD_SHM_MIN     (64 << 10)
+#define AESD_SHM_MAX     (64 << 20)
+
+typedef struct aesd_shm_hdr_s {
+	uint32_t magic;
+	uint32_t version;           // AESD_BIN_VERSION
+	uint64_t size;              // data bytes, a power of two
+	uint64_t head __attribute__((aligned(64)));     // bytes ever written, producer only
+	uint32_t wake __attribute__((aligned(64)));     // server sleeps until the eventfd fires
+	uint64_t tail __attribute__((aligned(64)));     // bytes ever appended, server only
+} aesd_shm_hdr_t;
+
+#endif /* AESDSOCKET_PROTO_H */
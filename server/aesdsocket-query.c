@@ -0,0 +1,238 @@
+ /**********************************************************************************
+ * @file    aesdsocket-query.c
+ * @brief   Server-side substring queries over the aesdsocket history.
+ *
+ *          A query reads the history in chunks and only hands back the
+ *          records that hold the pattern, so a client looking for a few
+ *          lines no longer downloads the whole history to grep it. Reads
+ *          go through pread() like any reply, no lock is taken.
+ *
+ *          The search compares the first and the last pattern byte against
+ *          sixteen positions at once and only runs memcmp() where both
+ *          agree. It is written with GCC vector extensions, which become
+ *          SSE2 on x86-64 and NEON on ARM.
+ *
+ * @author        <Li-Huan Lu>
+ * @date          <10/16/2026>
+ * @reference     http://0x80.pl/articles/simd-strfind.html
+ ***********************************************************************************/
+#define _GNU_SOURCE     // memrchr()
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <errno.h>
+
+#include "aesdsocket-query.h"
+#include "aesdsocket-channel.h"
+#include "aesdsocket-iobuf.h"
+#include "aesdsocket-store.h"
+
+#define QUERY_CHUNK (64 << 10)  // bytes read at a time, a pool class
+#define QUERY_TURN  (8 << 20)   // bytes scanned per query_next() call at most
+
+typedef unsigned char query_vec_t __attribute__((vector_size(16)));
+
+typedef struct query_s {
+	struct chan_s *chan;
+	off_t line;                 // start of the record being scanned
+	off_t pos;                  // next byte to read, no newline in [line, pos)
+	off_t end;
+	int matched;                // the record at line matched, its end is still to come
+	uint64_t bytes;
+	size_t pattern_len;
+	char pattern[QUERY_PATTERN_MAX];
+	char *buf;                  // QUERY_CHUNK bytes from the I/O buffer pool
+	size_t buf_cap;
+} query_t;
+
+/**********************************************************************************
+ * @name       query_find()
+ **********************************************************************************/
+const char *query_find(const char *buf, size_t len, const char *pattern, size_t plen)
+{
+	query_vec_t first, last, a, b, hit;
+	uint64_t any[2];
+	size_t i, j;
+
+	if (plen == 0 || len < plen) return NULL;
+	if (plen == 1) return (const char *) memchr(buf, pattern[0], len);
+
+	first = (query_vec_t){ 0 } + (unsigned char)pattern[0];
+	last = (query_vec_t){ 0 } + (unsigned char)pattern[plen - 1];
+
+	for (i = 0; i + plen - 1 + sizeof(query_vec_t) <= len; i += sizeof(query_vec_t)){
+		memcpy(&a, buf + i, sizeof(a));
+		memcpy(&b, buf + i + plen - 1, sizeof(b));
+		hit = (query_vec_t)((a == first) & (b == last));
+		memcpy(any, &hit, sizeof(any));
+		if (!(any[0] | any[1])) continue;
+
+		for (j = 0; j < sizeof(query_vec_t); j++){
+			if (hit[j] && memcmp(buf + i + j + 1, pattern + 1, plen - 2) == 0)
+				return buf + i + j;
+		}
+	}
+
+	// Fewer than sixteen positions left
+	for (; i + plen <= len; i++){
+		if (buf[i] == pattern[0] && memcmp(buf + i, pattern, plen) == 0) return buf + i;
+	}
+	return NULL;
+}
+
+/**********************************************************************************
+ * @name       query_read()
+ *
+ * @brief      { Fills buf from the channel or the main history. A driver may
+ *               return one entry per read, so keep reading. }
+ *
+ * @return     Bytes read, fewer only when the history ended early, -1 on error
+ **********************************************************************************/
+static ssize_t query_read(query_t *query, size_t len, off_t off)
+{
+	size_t got = 0;
+	ssize_t n;
+
+	while (got < len){
+		if (query->chan)
+			n = chan_read(query->chan, query->buf + got, len - got, off + got);
+		else
+			n = store_read(query->buf + got, len - got, off + got);
+		if (n == -1){
+			if (errno == EINTR) continue;
+			perror("read");
+			syslog(LOG_ERR, "query read: %s", strerror(errno));
+			return -1;
+		}
+		if (n == 0) break;
+		got += n;
+	}
+	return got;
+}
+
+/**********************************************************************************
+ * @name       query_create()
+ **********************************************************************************/
+query_t *query_create(struct chan_s *chan, const char *pattern, size_t len, off_t start, off_t end)
+{
+	query_t *query;
+
+	if (len > QUERY_PATTERN_MAX) return NULL;
+	query = (query_t *) malloc(sizeof(query_t));
+	if (query) query->buf = (char *) iobuf_get(QUERY_CHUNK, &query->buf_cap);
+	if (!query || !query->buf){
+		syslog(LOG_ERR, "Out of memory");
+		free(query);
+		return NULL;
+	}
+	query->chan = chan;
+	query->line = query->pos = start;
+	query->end = end > start ? end : start;
+	query->matched = 0;
+	query->bytes = 0;
+	query->pattern_len = len;
+	memcpy(query->pattern, pattern, len);
+	return query;
+}
+
+/**********************************************************************************
+ * @name       query_footprint()
+ **********************************************************************************/
+size_t query_footprint(void)
+{
+	return sizeof(query_t) + QUERY_CHUNK;
+}
+
+/**********************************************************************************
+ * @name       query_free()
+ **********************************************************************************/
+void query_free(query_t *query)
+{
+	iobuf_put(query->buf, query->buf_cap);
+	free(query);
+}
+
+/**********************************************************************************
+ * @name       query_next()
+ *
+ * @brief      { Without a match the last pattern_len - 1 bytes of the chunk
+ *               are read again with the next one, so a match across two reads
+ *               is still found. }
+ **********************************************************************************/
+int query_next(query_t *query, off_t *off, off_t *end)
+{
+	size_t plen = query->pattern_len, want, scanned = 0;
+	const char *hit, *nl, *buf = query->buf;
+	off_t base, next;
+	ssize_t n;
+
+	if (plen == 0) return QUERY_DONE;
+
+	while (query->pos < query->end){
+		if (scanned >= QUERY_TURN) return QUERY_AGAIN;
+
+		base = query->pos;
+		want = query->end - base < QUERY_CHUNK ? (size_t)(query->end - base) : QUERY_CHUNK;
+		n = query_read(query, want, base);
+		if (n == -1) return -1;
+		if ((size_t)n < want) query->end = base + n;    // history shrank under the scan
+		if (n == 0) break;
+		scanned += n;
+
+		if (query->matched){
+			nl = (const char *) memchr(buf, '\n', n);
+			if (!nl){
+				query->pos = base + n;
+				continue;
+			}
+			*off = query->line;
+			*end = base + (nl - buf) + 1;
+			query->line = query->pos = *end;
+			query->matched = 0;
+			query->bytes += *end - *off;
+			return QUERY_MATCH;
+		}
+
+		hit = query_find(buf, n, query->pattern, plen);
+		if (hit){
+			nl = (const char *) memrchr(buf, '\n', hit - buf);
+			if (nl) query->line = base + (nl - buf) + 1;
+			nl = (const char *) memchr(hit + plen, '\n', buf + n - (hit + plen));
+			if (!nl){
+				query->matched = 1;
+				query->pos = base + n;
+				continue;
+			}
+			*off = query->line;
+			*end = base + (nl - buf) + 1;
+			query->line = query->pos = *end;
+			query->bytes += *end - *off;
+			return QUERY_MATCH;
+		}
+
+		nl = (const char *) memrchr(buf, '\n', n);
+		if (nl) query->line = base + (nl - buf) + 1;
+		if (base + n >= query->end) break;
+		next = base + n - (off_t)(plen - 1);
+		query->pos = next > query->line ? next : query->line;
+	}
+	query->pos = query->end;
+	return QUERY_DONE;
+}
+
+/**********************************************************************************
+ * @name       query_end()
+ **********************************************************************************/
+off_t query_end(const query_t *query)
+{
+	return query->end;
+}
+
+/**********************************************************************************
+ * @name       query_bytes()
+ **********************************************************************************/
+uint64_t query_bytes(const query_t *query)
+{
+	return query->bytes;
+}
@@ -0,0 +1,88 @@
+ /**********************************************************************************
+ * @file    aesdsocket-query.h
+ * @brief   Server-side substring queries over the aesdsocket history.
+ *
+ * @author        <Li-Huan Lu>
+ * @date          <10/16/2026>
+ ***********************************************************************************/
+#ifndef AESDSOCKET_QUERY_H
+#define AESDSOCKET_QUERY_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#define QUERY_PATTERN_MAX 256   // longest pattern a client may send
+
+// query_next() results
+#define QUERY_DONE  0   // scan reached the end
+#define QUERY_MATCH 1   // a matching record, more may follow
+#define QUERY_AGAIN 2   // scanned a turn worth without a match, call again later
+
+struct chan_s;
+struct query_s;
+
+/**********************************************************************************
+ * @name       query_create()
+ *
+ * @brief      { Starts a scan of history bytes [start, end) of a channel for
+ *               the newline terminated records holding pattern. The pattern
+ *               is copied, it must not contain a newline. }
+ *
+ * @param[in]  chan    { Channel, NULL for the main history }
+ *
+ * @return     Query, or NULL when out of memory
+ **********************************************************************************/
+struct query_s *query_create(struct chan_s *chan, const char *pattern, size_t len,
+                             off_t start, off_t end);
+
+/**********************************************************************************
+ * @name       query_footprint()
+ *
+ * @brief      { Bytes a query holds while it runs. }
+ **********************************************************************************/
+size_t query_footprint(void);
+
+/**********************************************************************************
+ * @name       query_free()
+ **********************************************************************************/
+void query_free(struct query_s *query);
+
+/**********************************************************************************
+ * @name       query_next()
+ *
+ * @brief      { Scans on to the next matching record. A record cut off by the
+ *               end of the scan is not a match. Reads at most a few MB per
+ *               call, so one long scan does not hold up a thread. }
+ *
+ * @param[out] off { Start of the matching record }
+ * @param[out] end { Its end, right after the newline }
+ *
+ * @return     QUERY_MATCH, QUERY_AGAIN, QUERY_DONE, or -1 on a read error
+ **********************************************************************************/
+int query_next(struct query_s *query, off_t *off, off_t *end);
+
+/**********************************************************************************
+ * @name       query_end()
+ *
+ * @brief      { Where the scan stops. }
+ **********************************************************************************/
+off_t query_end(const struct query_s *query);
+
+/**********************************************************************************
+ * @name       query_bytes()
+ *
+ * @brief      { Bytes of the records matched so far. }
+ **********************************************************************************/
+uint64_t query_bytes(const struct query_s *query);
+
+/**********************************************************************************
+ * @name       query_find()
+ *
+ * @brief      { Finds pattern in buf, sixteen positions per step. }
+ *
+ * @return     First occurrence, or NULL
+ **********************************************************************************/
+const char *query_find(const char *buf, size_t len, const char *pattern, size_t plen);
+
+#endif /* AESDSOCKET_QUERY_H */
@@ -0,0 +1,760 @@
+ /**********************************************************************************
+ * @file    aesdsocket-replay.c
+ * @brief   Plays a traffic capture of aesdsocket back against a server.
+ *
+ *          Reads a capture written with aesdsocket -W and opens, feeds and
+ *          closes every connection in it the way the server saw them, in
+ *          the recorded order, at the recorded pace (-s 1), N times faster
+ *          (-s N) or as fast as possible (-s 0). An event never goes out
+ *          before the server has sent every connection what it had sent
+ *          them by then in the capture, so a client that waited for a reply
+ *          waits for it again, and a request sent after another connection
+ *          was answered reaches the history after it again. Requests of
+ *          different connections in flight together, on different loops or
+ *          while the appender had the first, are sent in the recorded order
+ *          but may be appended the other way round, and the replies of both
+ *          then differ from the first record taken out of turn. A
+ *          connection whose replies do not come within the wait time is
+ *          given up on, reported stalled, and no longer waited for.
+ *
+ *          Everything a connection receives is compared with the recorded
+ *          replies, and each chunk sent is timed until the replies recorded
+ *          after it are in. Replies hold history, so they only match when
+ *          the server starts from the history the capture started from,
+ *          usually an empty one, without timestamp lines. Bytes past the
+ *          recorded end are counted apart from mismatches: where the client
+ *          closed first in the capture it did not wait for the rest of its
+ *          replies, anywhere else the server sent more than it did.
+ *
+ * @author        <Li-Huan Lu>
+ * @date          <10/16/2026>
+ * @reference     https://tcpreplay.appneta.com/wiki/tcpreplay.html
+ ***********************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <getopt.h>
+#include <fcntl.h>
+#include <time.h>
+
+// Socket
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "aesdsocket-capture.h"
+
+#define REPLAY_MAX_EVENTS 64
+#define REPLAY_RECV_SIZE  (256 << 10)
+#define REPLAY_POLL_MS    10    // longest sleep while waiting on replies
+#define LAT_LINEAR        16    // microseconds counted exactly
+#define LAT_SUB_BITS      3     // 8 buckets per power of two above that
+#define LAT_BUCKETS       (LAT_LINEAR + (40 - 4 + 1) * (1 << LAT_SUB_BITS))
+
+typedef enum {
+	RC_WAITING = 0,             // not opened yet
+	RC_OPEN,
+	RC_HALF,                    // our side shut down, reading to the end
+	RC_DONE,
+} replay_state_t;
+
+typedef struct replay_event_s {
+	uint64_t t_us;
+	int conn;                   // index into conns
+	int type;                   // CAP_OPEN, CAP_IN or CAP_CLOSE
+	const char *data;
+	size_t len;
+	size_t out_before;          // bytes the connection had been sent before it
+	size_t outs_before;         // replies recorded before it, all connections
+	size_t reply_end;           // CAP_IN: bytes sent up to the connection's next event
+} replay_event_t;
+
+typedef struct replay_out_s {
+	int conn;
+	size_t end;                 // bytes the connection had been sent with this reply,
+	                            // SIZE_MAX for a close: served once the server hangs up
+} replay_out_t;
+
+typedef struct replay_req_s {
+	uint64_t t0;                // ns, first byte sent
+	size_t reply_end;
+} replay_req_t;
+
+typedef struct replay_conn_s {
+	int fd;
+	replay_state_t state;
+	char client[64];
+	int failed;                 // connect or socket error
+	int stalled;                // waits given up
+	int given_up;               // its replies are no longer waited for
+	int want_out;
+
+	char *expect;               // every byte the capture recorded sent to it
+	size_t expect_len, expect_cap;
+	size_t got;
+	long long mismatch;         // first byte that differs, -1 for none
+	size_t surplus;             // bytes received past expect_len
+	int by_client;              // the client closed first in the capture
+
+	const char *pend;           // rest of a chunk the socket did not take yet
+	size_t pend_len;
+
+	replay_req_t *reqs;         // one per chunk sent, in order
+	uint64_t *lat_us;           // latency of each completed one
+	size_t nreqs, reqs_cap, reqs_done;
+	int last_in;                // event index of its latest CAP_IN, -1 for none
+} replay_conn_t;
+
+typedef struct replay_opts_s {
+	const char *host;
+	int port;
+	const char *unix_path;
+	double speed;               // 0 as fast as possible
+	double wait;                // seconds before a wait for replies is given up
+	int quiet;
+} replay_opts_t;
+
+static replay_opts_t opts = {
+	.host = "127.0.0.1",
+	.port = 9000,
+	.speed = 1,
+	.wait = 5,
+};
+static replay_event_t *events;
+static size_t nevents;
+static replay_out_t *outs;      // every CAP_OUT, in capture order
+static size_t nouts;
+static replay_conn_t *conns;
+static size_t nconns;
+static int epfd;
+static uint64_t latency[LAT_BUCKETS];
+static uint64_t lat_count, lat_max;
+
+/**********************************************************************************
+ * @name       now_ns()
+ **********************************************************************************/
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/**********************************************************************************
+ * @name       latency_bucket() / latency_upper()
+ *
+ * @brief      { Same log-linear buckets as the server metrics. }
+ **********************************************************************************/
+static int latency_bucket(uint64_t us)
+{
+	int e;
+
+	if (us < LAT_LINEAR) return (int)us;
+	e = 63 - __builtin_clzll(us);
+	if (e > 40) return LAT_BUCKETS - 1;
+	return LAT_LINEAR + (e - 4) * (1 << LAT_SUB_BITS) +
+	       (int)((us >> (e - LAT_SUB_BITS)) & ((1 << LAT_SUB_BITS) - 1));
+}
+
+static uint64_t latency_upper(int idx)
+{
+	int e, sub;
+
+	if (idx < LAT_LINEAR) return idx;
+	e = (idx - LAT_LINEAR) / (1 << LAT_SUB_BITS) + 4;
+	sub = (idx - LAT_LINEAR) % (1 << LAT_SUB_BITS);
+	return ((uint64_t)((1 << LAT_SUB_BITS) + sub + 1) << (e - LAT_SUB_BITS)) - 1;
+}
+
+/**********************************************************************************
+ * @name       grow()
+ *
+ * @brief      { Makes room for n more elements of size each in *buf. }
+ *
+ * @return     0 on success, -1 when out of memory
+ **********************************************************************************/
+static int grow(void **buf, size_t *cap, size_t len, size_t n, size_t size)
+{
+	size_t new_cap = *cap ? *cap : 16;
+	void *grown;
+
+	if (len + n <= *cap) return 0;
+	while (new_cap < len + n) new_cap *= 2;
+	grown = realloc(*buf, new_cap * size);
+	if (!grown) return -1;
+	*buf = grown;
+	*cap = new_cap;
+	return 0;
+}
+
+/**********************************************************************************
+ * @name       capture_load()
+ *
+ * @brief      { Maps the capture and turns it into the event list plus, per
+ *               connection, the bytes it is expected to receive. A record cut
+ *               short at the end, from a server that died, ends the capture. }
+ *
+ * @return     0 on success, -1 on failure
+ **********************************************************************************/
+static int capture_load(const char *path)
+{
+	const aesd_cap_file_t *hdr;
+	aesd_cap_rec_t rec;
+	replay_conn_t *c;
+	replay_event_t *ev;
+	size_t ev_cap = 0, conn_cap = 0, out_cap = 0, off, i;
+	const char *base;
+	struct stat st;
+	int fd;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd == -1 || fstat(fd, &st) == -1){
+		perror(path);
+		return -1;
+	}
+	if ((size_t)st.st_size < sizeof(*hdr)){
+		fprintf(stderr, "%s: not a capture\n", path);
+		return -1;
+	}
+	base = (const char *) mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED){
+		perror("mmap");
+		return -1;
+	}
+	hdr = (const aesd_cap_file_t *)base;
+	if (memcmp(hdr->magic, AESD_CAP_MAGIC, sizeof(hdr->magic))){
+		fprintf(stderr, "%s: not a capture\n", path);
+		return -1;
+	}
+
+	for (off = sizeof(*hdr); off + sizeof(rec) <= (size_t)st.st_size; off += sizeof(rec) + rec.len){
+		memcpy(&rec, base + off, sizeof(rec));
+		if (rec.len > st.st_size - off - sizeof(rec)){
+			fprintf(stderr, "%s: last record cut short, ignored\n", path);
+			break;
+		}
+		if (rec.conn == 0 || rec.type < CAP_OPEN || rec.type > CAP_CLOSE){
+			fprintf(stderr, "%s: bad record at byte %zu\n", path, off);
+			return -1;
+		}
+
+		// Connections are numbered from 1 in the order they opened
+		if (rec.conn > nconns){
+			if (grow((void **)&conns, &conn_cap, nconns, rec.conn - nconns, sizeof(*conns))) return -1;
+			memset(conns + nconns, 0, (rec.conn - nconns) * sizeof(*conns));
+			for (i = nconns; i < rec.conn; i++){
+				conns[i].fd = -1;
+				conns[i].mismatch = -1;
+				conns[i].last_in = -1;
+			}
+			nconns = rec.conn;
+		}
+		c = &conns[rec.conn - 1];
+
+		if (rec.type == CAP_OUT){
+			if (grow((void **)&c->expect, &c->expect_cap, c->expect_len, rec.len, 1)) return -1;
+			memcpy(c->expect + c->expect_len, base + off + sizeof(rec), rec.len);
+			c->expect_len += rec.len;
+			if (grow((void **)&outs, &out_cap, nouts, 1, sizeof(*outs))) return -1;
+			outs[nouts].conn = rec.conn - 1;
+			outs[nouts].end = c->expect_len;
+			nouts++;
+			continue;
+		}
+		if (rec.type == CAP_OPEN)
+			snprintf(c->client, sizeof(c->client), "%.*s", (int)rec.len, base + off + sizeof(rec));
+
+		// A chunk's replies are what the connection was sent until its next event
+		if (c->last_in >= 0) events[c->last_in].reply_end = c->expect_len;
+
+		if (grow((void **)&events, &ev_cap, nevents, 1, sizeof(*events))) return -1;
+		ev = &events[nevents];
+		ev->t_us = rec.t_us;
+		ev->conn = rec.conn - 1;
+		ev->type = rec.type;
+		ev->data = base + off + sizeof(rec);
+		ev->len = rec.len;
+		ev->out_before = c->expect_len;
+		ev->outs_before = nouts;
+		ev->reply_end = c->expect_len;
+		c->last_in = rec.type == CAP_IN ? (int)nevents : -1;
+		nevents++;
+
+		// A close appends what is left of the record, later events wait for it
+		if (rec.type == CAP_CLOSE){
+			c->by_client = rec.len >= 1 && (uint8_t)ev->data[0] == CAP_BY_CLIENT;
+			if (grow((void **)&outs, &out_cap, nouts, 1, sizeof(*outs))) return -1;
+			outs[nouts].conn = rec.conn - 1;
+			outs[nouts].end = SIZE_MAX;
+			nouts++;
+		}
+	}
+
+	for (i = 0; i < nconns; i++)
+		if (conns[i].last_in >= 0) events[conns[i].last_in].reply_end = conns[i].expect_len;
+	return 0;
+}
+
+/**********************************************************************************
+ * @name       conn_interest()
+ **********************************************************************************/
+static void conn_interest(replay_conn_t *c, int want_out)
+{
+	struct epoll_event ev;
+
+	if (c->want_out == want_out) return;
+	ev.events = EPOLLIN | (want_out ? EPOLLOUT : 0);
+	ev.data.ptr = c;
+	epoll_ctl(epfd, EPOLL_CTL_MOD, c->fd, &ev);
+	c->want_out = want_out;
+}
+
+/**********************************************************************************
+ * @name       conn_done()
+ **********************************************************************************/
+static void conn_done(replay_conn_t *c, int failed)
+{
+	if (failed) c->failed = 1;
+	if (c->fd != -1){
+		epoll_ctl(epfd, EPOLL_CTL_DEL, c->fd, NULL);
+		close(c->fd);
+		c->fd = -1;
+	}
+	c->state = RC_DONE;
+	c->pend_len = 0;
+}
+
+/**********************************************************************************
+ * @name       conn_open()
+ *
+ * @brief      { Connects (blocking, then switches to nonblocking). }
+ **********************************************************************************/
+static void conn_open(replay_conn_t *c)
+{
+	struct sockaddr_in in_addr;
+	struct sockaddr_un un_addr;
+	struct epoll_event ev;
+	int ret, one = 1;
+
+	c->state = RC_OPEN;
+	c->fd = socket(opts.unix_path ? AF_UNIX : AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (c->fd == -1){
+		perror("socket");
+		conn_done(c, 1);
+		return;
+	}
+	if (opts.unix_path){
+		memset(&un_addr, 0, sizeof(un_addr));
+		un_addr.sun_family = AF_UNIX;
+		strncpy(un_addr.sun_path, opts.unix_path, sizeof(un_addr.sun_path) - 1);
+		ret = connect(c->fd, (struct sockaddr *)&un_addr, sizeof(un_addr));
+	}
+	else {
+		memset(&in_addr, 0, sizeof(in_addr));
+		in_addr.sin_family = AF_INET;
+		in_addr.sin_port = htons(opts.port);
+		inet_pton(AF_INET, opts.host, &in_addr.sin_addr);
+		ret = connect(c->fd, (struct sockaddr *)&in_addr, sizeof(in_addr));
+		if (ret == 0) setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	}
+	if (ret == -1){
+		perror("connect");
+		conn_done(c, 1);
+		return;
+	}
+	fcntl(c->fd, F_SETFL, fcntl(c->fd, F_GETFL, 0) | O_NONBLOCK);
+
+	ev.events = EPOLLIN;
+	ev.data.ptr = c;
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, c->fd, &ev) == -1){
+		perror("epoll_ctl");
+		conn_done(c, 1);
+	}
+}
+
+/**********************************************************************************
+ * @name       conn_flush()
+ *
+ * @brief      { Sends what is left of the current chunk. }
+ **********************************************************************************/
+static void conn_flush(replay_conn_t *c)
+{
+	ssize_t ret;
+
+	while (c->pend_len){
+		ret = send(c->fd, c->pend, c->pend_len, MSG_NOSIGNAL);
+		if (ret == -1){
+			if (errno == EAGAIN || errno == EWOULDBLOCK){
+				conn_interest(c, 1);
+				return;
+			}
+			if (errno == EINTR) continue;
+			perror("send");
+			conn_done(c, 1);
+			return;
+		}
+		c->pend += ret;
+		c->pend_len -= ret;
+	}
+	conn_interest(c, 0);
+}
+
+/**********************************************************************************
+ * @name       conn_readable()
+ *
+ * @brief      { Reads what the server sent, checks it against the capture and
+ *               completes the chunks whose replies are all in. }
+ **********************************************************************************/
+static void conn_readable(replay_conn_t *c, uint64_t now)
+{
+	static char buf[REPLAY_RECV_SIZE];
+	uint64_t us;
+	size_t cmp, i;
+	ssize_t ret;
+
+	for (;;){
+		ret = recv(c->fd, buf, sizeof(buf), 0);
+		if (ret == -1){
+			if (errno == EAGAIN || errno == EWOULDBLOCK) return;
+			if (errno == EINTR) continue;
+			perror("recv");
+			conn_done(c, 1);
+			return;
+		}
+		if (ret == 0){
+			conn_done(c, 0);
+			return;
+		}
+
+		cmp = c->got < c->expect_len ? c->expect_len - c->got : 0;
+		if (cmp > (size_t)ret) cmp = ret;
+		if (c->mismatch < 0){
+			for (i = 0; i < cmp && buf[i] == c->expect[c->got + i]; i++);
+			if (i < cmp) c->mismatch = c->got + i;
+		}
+		c->surplus += ret - cmp;
+		c->got += ret;
+
+		while (c->reqs_done < c->nreqs && c->got >= c->reqs[c->reqs_done].reply_end){
+			us = (now - c->reqs[c->reqs_done].t0) / 1000;
+			c->lat_us[c->reqs_done++] = us;
+			latency[latency_bucket(us)]++;
+			lat_count++;
+			if (us > lat_max) lat_max = us;
+		}
+	}
+}
+
+/**********************************************************************************
+ * @name       event_run()
+ *
+ * @brief      { Performs one event. A chunk the socket does not take at once
+ *               is finished by conn_flush(). }
+ **********************************************************************************/
+static void event_run(const replay_event_t *ev, uint64_t now)
+{
+	replay_conn_t *c = &conns[ev->conn];
+
+	if (ev->type == CAP_OPEN){
+		if (c->state == RC_WAITING) conn_open(c);
+		return;
+	}
+	if (c->state != RC_OPEN) return;
+
+	if (ev->type == CAP_CLOSE){
+		shutdown(c->fd, SHUT_WR);
+		c->state = RC_HALF;
+		return;
+	}
+
+	if (ev->reply_end > ev->out_before){
+		if (grow((void **)&c->reqs, &c->reqs_cap, c->nreqs, 1, sizeof(*c->reqs)) ||
+		    !(c->lat_us = (uint64_t *) realloc(c->lat_us, c->reqs_cap * sizeof(*c->lat_us)))){
+			perror("realloc");
+			exit(1);
+		}
+		c->reqs[c->nreqs].t0 = now;
+		c->reqs[c->nreqs].reply_end = ev->reply_end;
+		c->nreqs++;
+	}
+	c->pend = ev->data;
+	c->pend_len = ev->len;
+	conn_flush(c);
+}
+
+/**********************************************************************************
+ * @name       poll_once()
+ *
+ * @brief      { Waits up to timeout_ms for the sockets and serves them. }
+ **********************************************************************************/
+static void poll_once(int timeout_ms)
+{
+	struct epoll_event evs[REPLAY_MAX_EVENTS];
+	replay_conn_t *c;
+	uint64_t now;
+	int n, i;
+
+	n = epoll_wait(epfd, evs, REPLAY_MAX_EVENTS, timeout_ms);
+	now = now_ns();
+	for (i = 0; i < n; i++){
+		c = (replay_conn_t *)evs[i].data.ptr;
+		if (c->state == RC_DONE) continue;
+		if (evs[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) conn_readable(c, now);
+		if (c->state != RC_DONE && (evs[i].events & EPOLLOUT)) conn_flush(c);
+	}
+}
+
+/**********************************************************************************
+ * @name       outs_served()
+ *
+ * @brief      { Moves past the recorded replies that are in, or will not come
+ *               because their connection is gone or given up on. }
+ *
+ * @return     Number of recorded replies served, in capture order
+ **********************************************************************************/
+static size_t outs_served(void)
+{
+	static size_t done;
+	const replay_conn_t *c;
+
+	while (done < nouts){
+		c = &conns[outs[done].conn];
+		if (c->got < outs[done].end && !c->given_up && c->state != RC_DONE) break;
+		done++;
+	}
+	return done;
+}
+
+/**********************************************************************************
+ * @name       replay()
+ *
+ * @brief      { Runs the events in order, each once its time has come and the
+ *               replies recorded before it are in, then waits for the last
+ *               replies. }
+ **********************************************************************************/
+static void replay(uint64_t start)
+{
+	uint64_t wait_ns = (uint64_t)(opts.wait * 1e9);
+	uint64_t now, due, waiting = 0, last_progress;
+	const replay_event_t *ev;
+	replay_conn_t *c, *blocker;
+	size_t next = 0, i, open, got, got_before = 0, served;
+	int timeout_ms;
+
+	while (next < nevents){
+		ev = &events[next];
+		c = &conns[ev->conn];
+		now = now_ns();
+		due = opts.speed > 0 ? start + (uint64_t)(ev->t_us * 1000 / opts.speed) : now;
+
+		// The chunk before has to be out, then time, then the replies before it
+		if (c->pend_len){
+			poll_once(REPLAY_POLL_MS);
+			continue;
+		}
+		if (now < due){
+			timeout_ms = (int)((due - now + 999999) / 1000000);
+			poll_once(timeout_ms < REPLAY_POLL_MS ? timeout_ms : REPLAY_POLL_MS);
+			continue;
+		}
+		if ((served = outs_served()) < ev->outs_before){
+			if (!waiting) waiting = now;
+			if (now - waiting < wait_ns){
+				poll_once(REPLAY_POLL_MS);
+				continue;
+			}
+			blocker = &conns[outs[served].conn];
+			blocker->stalled++;
+			blocker->given_up = 1;
+			waiting = 0;
+			continue;
+		}
+		waiting = 0;
+		event_run(ev, now);
+		next++;
+		poll_once(0);
+	}
+
+	// Connections still open when the capture ended are shut down once served
+	last_progress = now_ns();
+	for (;;){
+		open = 0;
+		for (i = 0; i < nconns; i++){
+			c = &conns[i];
+			if (c->state == RC_OPEN && !c->pend_len && c->got >= c->expect_len){
+				shutdown(c->fd, SHUT_WR);
+				c->state = RC_HALF;
+			}
+			if (c->state == RC_OPEN || c->state == RC_HALF) open++;
+		}
+		if (!open) break;
+
+		poll_once(REPLAY_POLL_MS);
+		now = now_ns();
+		for (i = 0, got = 0; i < nconns; i++) got += conns[i].got;
+		if (got != got_before){
+			got_before = got;
+			last_progress = now;
+		}
+		else if (now - last_progress >= wait_ns){
+			for (i = 0; i < nconns; i++){
+				c = &conns[i];
+				if (c->state != RC_OPEN && c->state != RC_HALF) continue;
+				c->stalled++;
+				conn_done(c, 0);
+			}
+		}
+	}
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/**********************************************************************************
+ * @name       report()
+ *
+ * @brief      { One line per connection, then the totals.}
+ *
+ * @return     Number of connections that did not replay as captured
+ **********************************************************************************/
+static int report(double secs)
+{
+	static const double quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+	uint64_t seen, rank, bound;
+	replay_conn_t *c;
+	size_t i, q, reqs = 0;
+	int bad = 0, b;
+	char result[64];
+
+	if (!opts.quiet)
+		printf("%6s %-16s %8s %12s %12s %10s %10s  %s\n",
+		       "conn", "client", "requests", "received", "expected", "p50 us", "max us", "result");
+	for (i = 0; i < nconns; i++){
+		c = &conns[i];
+		reqs += c->reqs_done;
+
+		if (c->failed) snprintf(result, sizeof(result), "failed");
+		else if (c->mismatch >= 0) snprintf(result, sizeof(result), "mismatch at byte %lld", c->mismatch);
+		else if (c->got < c->expect_len) snprintf(result, sizeof(result), "short by %zu bytes", c->expect_len - c->got);
+		else if (c->surplus && !c->by_client) snprintf(result, sizeof(result), "%zu bytes past the end", c->surplus);
+		else if (c->stalled) snprintf(result, sizeof(result), "stalled %d times", c->stalled);
+		else if (c->surplus) snprintf(result, sizeof(result), "ok, %zu bytes after client close", c->surplus);
+		else snprintf(result, sizeof(result), "ok");
+		b = strncmp(result, "ok", 2) != 0;
+		bad += b;
+		if (opts.quiet && !b) continue;
+
+		qsort(c->lat_us, c->reqs_done, sizeof(*c->lat_us), cmp_u64);
+		printf("%6zu %-16s %8zu %12zu %12zu %10llu %10llu  %s\n", i + 1, c->client, c->reqs_done,
+		       c->got, c->expect_len,
+		       (unsigned long long)(c->reqs_done ? c->lat_us[(c->reqs_done - 1) / 2] : 0),
+		       (unsigned long long)(c->reqs_done ? c->lat_us[c->reqs_done - 1] : 0), result);
+	}
+
+	printf("duration    %.3f s", secs);
+	if (opts.speed > 0) printf(" at %gx\n", opts.speed);
+	else printf(" as fast as possible\n");
+	printf("connections %zu, %d not as captured\n", nconns, bad);
+	printf("requests    %zu (%.1f/s)\n", reqs, secs > 0 ? reqs / secs : 0);
+	if (!lat_count) return bad;
+
+	printf("latency us");
+	for (q = 0; q < sizeof(quantiles) / sizeof(quantiles[0]); q++){
+		rank = (uint64_t)(quantiles[q] * lat_count + 0.5);
+		if (rank == 0) rank = 1;
+		for (b = 0, seen = 0; b < LAT_BUCKETS - 1; b++){
+			seen += latency[b];
+			if (seen >= rank) break;
+		}
+		bound = latency_upper(b);
+		printf("  p%g %llu", quantiles[q] * 100, (unsigned long long)(bound < lat_max ? bound : lat_max));
+	}
+	printf("  max %llu\n", (unsigned long long)lat_max);
+	return bad;
+}
+
+/**********************************************************************************
+ * @name       usage()
+ **********************************************************************************/
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [options] capture_file\n"
+	                "  -H, --host ADDR       server address (default: 127.0.0.1)\n"
+	                "  -p, --port N          server port (default: 9000)\n"
+	                "  -U, --unix PATH       connect to the server's UNIX domain socket instead\n"
+	                "  -s, --speed N         1 replays at the captured pace (default), N times\n"
+	                "                        faster, 0 as fast as possible\n"
+	                "  -w, --wait S          seconds to wait for a reply before going on\n"
+	                "                        without it (default: 5)\n"
+	                "  -q, --quiet           only list connections that did not replay as captured\n",
+	                prog);
+}
+
+/**********************************************************************************
+ * Main functions
+ **********************************************************************************/
+int main(int argc, char **argv)
+{
+	static const struct option long_options[] = {
+		{"host",  required_argument, NULL, 'H'},
+		{"port",  required_argument, NULL, 'p'},
+		{"unix",  required_argument, NULL, 'U'},
+		{"speed", required_argument, NULL, 's'},
+		{"wait",  required_argument, NULL, 'w'},
+		{"quiet", no_argument,       NULL, 'q'},
+		{NULL, 0, NULL, 0}
+	};
+	struct in_addr addr;
+	uint64_t start;
+	int opt, bad;
+
+	while ((opt = getopt_long(argc, argv, "H:p:U:s:w:q", long_options, NULL)) != -1){
+		switch (opt){
+			case 'H': opts.host = optarg; break;
+			case 'p': opts.port = atoi(optarg); break;
+			case 'U': opts.unix_path = optarg; break;
+			case 's': opts.speed = atof(optarg); break;
+			case 'w': opts.wait = atof(optarg); break;
+			case 'q': opts.quiet = 1; break;
+			default:
+				usage(argv[0]);
+				exit(1);
+		}
+	}
+	if (optind != argc - 1 || opts.speed < 0 || opts.wait < 0){
+		usage(argv[0]);
+		exit(1);
+	}
+	if (!opts.unix_path && inet_pton(AF_INET, opts.host, &addr) != 1){
+		fprintf(stderr, "bad address %s\n", opts.host);
+		exit(1);
+	}
+
+	if (capture_load(argv[optind])) exit(1);
+	epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (epfd == -1){
+		perror("epoll_create1");
+		exit(1);
+	}
+
+	start = now_ns();
+	replay(start);
+	bad = report((now_ns() - start) / 1e9);
+	close(epfd);
+	return bad ? 1 : 0;
+}
@@ -0,0 +1,423 @@
+ /**********************************************************************************
+ * @file    aesdsocket-shm.c
+ * @brief   Shared memory append rings for producers on the same host.
+ *
+ *          A producer connected over the UNIX socket may ask for a ring in a
+ *          memfd and then write records into it directly, skipping the
+ *          socket stack. One thread consumes every ring: it waits on the
+ *          eventfd doorbells with epoll, hands complete lines to the
+ *          appender like any other record and moves the ring's tail once
+ *          they are committed. Each ring has one run with the appender at a
+ *          time, so a producer that outruns the store waits on its full
+ *          ring instead of piling up copies in the appender queue.
+ *
+ *          The data area is mapped twice back to back, so a record that
+ *          wraps around the end is still one contiguous run and goes to the
+ *          appender in one piece. The producer only rings the doorbell after
+ *          the consumer said it is going to sleep, so a busy ring costs no
+ *          syscalls on either side. The memfd is sealed at its size before
+ *          it is handed out, so a producer cannot truncate it under the
+ *          consumer.
+ *
+ * @author        <Li-Huan Lu>
+ * @date          <10/16/2026>
+ * @reference     https://man7.org/linux/man-pages/man2/memfd_create.2.html
+ *                https://man7.org/linux/man-pages/man2/eventfd.2.html
+ ***********************************************************************************/
+#define _GNU_SOURCE     // memfd_create(), memrchr()
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/queue.h>
+
+// Pthread
+#include <pthread.h>
+
+#include "aesdsocket-shm.h"
+#include "aesdsocket-proto.h"
+#include "aesdsocket-appender.h"
+#include "aesdsocket-metrics.h"
+
+#define SHM_MAX_EVENTS 64
+#define SHM_WAIT_MS    1000
+#define SHM_TURN_BYTES (1 << 20)    // per run unless one line is longer
+
+typedef struct shm_ring_s {
+	aesd_shm_hdr_t *hdr;
+	const char *data;           // size bytes, mapped twice in a row
+	size_t size;
+	uint64_t tail;              // ring thread only
+	struct append_rec_s *commit; // ticket of the run with the appender, ring thread only
+	size_t commit_len;          // and its length, the tail moves past it once committed
+	int memfd;
+	int evfd;
+	int detached;               // under shm_mutex
+	int broken;                 // producer broke the protocol, ring thread only
+	LIST_ENTRY(shm_ring_s) entries;
+} shm_ring_t;
+
+static LIST_HEAD(, shm_ring_s) rings = LIST_HEAD_INITIALIZER(rings);
+static pthread_mutex_t shm_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t shm_thread_id;
+static int shm_epfd = -1;
+static int shm_commit_fd = -1;  // eventfd the appender signals, epoll_data.ptr NULL
+static volatile int shm_stopping;
+
+/**********************************************************************************
+ * @name       ring_free()
+ **********************************************************************************/
+static void ring_free(shm_ring_t *ring)
+{
+	if (ring->data) munmap((void *)ring->data, 2 * ring->size);
+	if (ring->hdr) munmap(ring->hdr, AESD_SHM_DATA);
+	if (ring->evfd != -1) close(ring->evfd);
+	if (ring->memfd != -1) close(ring->memfd);
+	free(ring);
+}
+
+/**********************************************************************************
+ * @name       ring_sleep()
+ *
+ * @brief      { Tells the producer to ring the doorbell, then looks once more so
+ *               a head stored in between is not missed. }
+ *
+ * @return     1 when the ring may sleep, 0 when there is more to do
+ **********************************************************************************/
+static int ring_sleep(shm_ring_t *ring, uint64_t head)
+{
+	__atomic_store_n(&ring->hdr->wake, 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&ring->hdr->head, __ATOMIC_SEQ_CST) == head) return 1;
+	__atomic_store_n(&ring->hdr->wake, 0, __ATOMIC_RELAXED);
+	return 0;
+}
+
+/**********************************************************************************
+ * @name       ring_commit()
+ *
+ * @brief      { Moves the tail past the run the appender had, once it is
+ *               written. On final the run is given up, it still gets written
+ *               and the rest goes behind it. }
+ *
+ * @return     1 when the ring may go on, 0 while the run is pending
+ **********************************************************************************/
+static int ring_commit(shm_ring_t *ring, int final)
+{
+	off_t end_off;
+	int status = 1;
+
+	if (!ring->commit) return 1;
+	if (final)
+		appender_cancel(ring->commit);
+	else if (!(status = appender_poll(ring->commit, &end_off)))
+		return 0;
+	if (status == -1)
+		syslog(LOG_ERR, "append failed, %zu bytes of shared ring lost", ring->commit_len);
+
+	ring->commit = NULL;
+	ring->tail += ring->commit_len;
+	__atomic_store_n(&ring->hdr->tail, ring->tail, __ATOMIC_RELEASE);
+	return 1;
+}
+
+/**********************************************************************************
+ * @name       ring_drain()
+ *
+ * @brief      { Hands the complete lines waiting in the ring to the appender,
+ *               at most SHM_TURN_BYTES unless one line is longer, and comes
+ *               back when the appender signals they are in. On final it
+ *               appends everything left without waiting. }
+ **********************************************************************************/
+static void ring_drain(shm_ring_t *ring, int final)
+{
+	uint64_t head, avail;
+	size_t n, scan;
+	const char *p, *nl;
+
+	if (!ring_commit(ring, final)) return;
+
+	while (!ring->broken){
+		head = __atomic_load_n(&ring->hdr->head, __ATOMIC_ACQUIRE);
+		avail = head - ring->tail;
+		if (avail > ring->size){
+			syslog(LOG_ERR, "shared ring head %llu out of range, ring ignored", (unsigned long long)head);
+			ring->broken = 1;
+			break;
+		}
+
+		p = ring->data + (ring->tail & (ring->size - 1));
+		scan = avail > SHM_TURN_BYTES ? SHM_TURN_BYTES : avail;
+		nl = scan ? (const char *) memrchr(p, '\n', scan) : NULL;
+		if (!nl && scan < avail) nl = (const char *) memchr(p + scan, '\n', avail - scan);
+		n = nl ? (size_t)(nl - p + 1) : (avail == ring->size || final ? avail : 0);
+		if (n == 0){
+			if (final || ring_sleep(ring, head)) break;
+			continue;
+		}
+		metrics_bytes_in(n);
+
+		// One record per run, so nobody else's record lands inside a line
+		if (!final){
+			if (appender_append_async(p, n, shm_commit_fd, &ring->commit) == 0){
+				ring->commit_len = n;
+				break;
+			}
+			syslog(LOG_ERR, "append failed, %zu bytes of shared ring lost", n);
+		}
+		else if (appender_append(p, n, NULL)){
+			syslog(LOG_ERR, "append failed, %zu bytes of shared ring lost", n);
+		}
+		ring->tail += n;
+		__atomic_store_n(&ring->hdr->tail, ring->tail, __ATOMIC_RELEASE);
+	}
+}
+
+/**********************************************************************************
+ * @name       ring_reap()
+ *
+ * @brief      { Frees a ring its connection gave up, after appending the rest. }
+ *
+ * @return     1 when freed
+ **********************************************************************************/
+static int ring_reap(shm_ring_t *ring)
+{
+	int detached;
+
+	pthread_mutex_lock(&shm_mutex);
+	detached = ring->detached;
+	if (detached) LIST_REMOVE(ring, entries);
+	pthread_mutex_unlock(&shm_mutex);
+	if (!detached) return 0;
+
+	ring_drain(ring, 1);
+	epoll_ctl(shm_epfd, EPOLL_CTL_DEL, ring->evfd, NULL);
+	ring_free(ring);
+	return 1;
+}
+
+/**********************************************************************************
+ * @name       shm_thread()
+ **********************************************************************************/
+static void *shm_thread(void *arg)
+{
+	struct epoll_event events[SHM_MAX_EVENTS];
+	shm_ring_t *ring;
+	uint64_t count;
+	int nfds, i, woken = 0;
+
+	(void)arg;
+	while (!shm_stopping){
+		nfds = epoll_wait(shm_epfd, events, SHM_MAX_EVENTS, SHM_WAIT_MS);
+		if (nfds == -1){
+			if (errno == EINTR) continue;
+			perror("epoll_wait");
+			syslog(LOG_ERR, "shared ring epoll_wait: %s", strerror(errno));
+			break;
+		}
+		for (i = 0; i < nfds; i++){
+			ring = (shm_ring_t *)events[i].data.ptr;
+			if (!ring){
+				woken = read(shm_commit_fd, &count, sizeof(count)) > 0;
+				continue;
+			}
+			if (read(ring->evfd, &count, sizeof(count)) == -1 && errno != EAGAIN)
+				syslog(LOG_ERR, "shared ring doorbell: %s", strerror(errno));
+			__atomic_store_n(&ring->hdr->wake, 0, __ATOMIC_RELAXED);
+			if (!ring_reap(ring)) ring_drain(ring, 0);
+		}
+
+		// Rings whose run the appender wrote go on, the reaped ones are gone by now
+		if (woken){
+			pthread_mutex_lock(&shm_mutex);
+			LIST_FOREACH(ring, &rings, entries){
+				if (ring->commit) ring_drain(ring, 0);
+			}
+			pthread_mutex_unlock(&shm_mutex);
+			woken = 0;
+		}
+	}
+	return NULL;
+}
+
+/**********************************************************************************
+ * @name       shm_start()
+ **********************************************************************************/
+int shm_start(void)
+{
+	struct epoll_event ev;
+
+	shm_epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (shm_epfd == -1){
+		perror("epoll_create1");
+		syslog(LOG_ERR, "shared ring epoll_create1: %s", strerror(errno));
+		return -1;
+	}
+	shm_commit_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	ev.events = EPOLLIN;
+	ev.data.ptr = NULL;
+	if (shm_commit_fd == -1 || epoll_ctl(shm_epfd, EPOLL_CTL_ADD, shm_commit_fd, &ev) == -1){
+		perror("eventfd");
+		syslog(LOG_ERR, "shared ring commit eventfd: %s", strerror(errno));
+		goto fail;
+	}
+	shm_stopping = 0;
+	if (pthread_create(&shm_thread_id, NULL, shm_thread, NULL)){
+		perror("pthread_create");
+		syslog(LOG_ERR, "pthread_create failed for shared rings");
+		goto fail;
+	}
+	return 0;
+
+fail:
+	if (shm_commit_fd != -1) close(shm_commit_fd);
+	close(shm_epfd);
+	shm_commit_fd = shm_epfd = -1;
+	return -1;
+}
+
+/**********************************************************************************
+ * @name       shm_stop()
+ **********************************************************************************/
+void shm_stop(void)
+{
+	shm_ring_t *ring;
+
+	if (shm_epfd == -1) return;
+
+	shm_stopping = 1;
+	pthread_join(shm_thread_id, NULL);
+
+	// Connections are closed, every ring left is detached
+	while ((ring = LIST_FIRST(&rings)) != NULL){
+		LIST_REMOVE(ring, entries);
+		ring_drain(ring, 1);
+		ring_free(ring);
+	}
+	close(shm_commit_fd);
+	close(shm_epfd);
+	shm_commit_fd = shm_epfd = -1;
+}
+
+/**********************************************************************************
+ * @name       shm_ring_create()
+ **********************************************************************************/
+shm_ring_t *shm_ring_create(size_t size)
+{
+	struct epoll_event ev;
+	shm_ring_t *ring;
+	size_t ring_size = AESD_SHM_MIN;
+	char *area;
+
+	if (shm_epfd == -1) return NULL;
+	while (ring_size < size && ring_size < AESD_SHM_MAX) ring_size <<= 1;
+
+	ring = (shm_ring_t *) calloc(1, sizeof(shm_ring_t));
+	if (!ring){
+		syslog(LOG_ERR, "Out of memory");
+		return NULL;
+	}
+	ring->size = ring_size;
+	ring->evfd = -1;
+
+	ring->memfd = memfd_create("aesdsocket-ring", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (ring->memfd == -1 || ftruncate(ring->memfd, AESD_SHM_DATA + ring_size) == -1){
+		perror("memfd_create");
+		syslog(LOG_ERR, "shared ring memfd: %s", strerror(errno));
+		goto fail;
+	}
+	// A producer that shrinks the memfd would fault the consumer's mappings
+	if (fcntl(ring->memfd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) == -1){
+		perror("fcntl");
+		syslog(LOG_ERR, "shared ring seal: %s", strerror(errno));
+		goto fail;
+	}
+	ring->hdr = (aesd_shm_hdr_t *) mmap(NULL, AESD_SHM_DATA, PROT_READ | PROT_WRITE, MAP_SHARED, ring->memfd, 0);
+	if (ring->hdr == MAP_FAILED){
+		ring->hdr = NULL;
+		perror("mmap");
+		syslog(LOG_ERR, "shared ring mmap: %s", strerror(errno));
+		goto fail;
+	}
+
+	// Reserve twice the size, then map the data into both halves
+	area = (char *) mmap(NULL, 2 * ring_size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (area == MAP_FAILED){
+		perror("mmap");
+		syslog(LOG_ERR, "shared ring mmap: %s", strerror(errno));
+		goto fail;
+	}
+	ring->data = area;
+	if (mmap(area, ring_size, PROT_READ, MAP_SHARED | MAP_FIXED, ring->memfd, AESD_SHM_DATA) == MAP_FAILED ||
+	    mmap(area + ring_size, ring_size, PROT_READ, MAP_SHARED | MAP_FIXED, ring->memfd, AESD_SHM_DATA) == MAP_FAILED){
+		perror("mmap");
+		syslog(LOG_ERR, "shared ring mmap: %s", strerror(errno));
+		goto fail;
+	}
+
+	ring->hdr->magic = AESD_SHM_MAGIC;
+	ring->hdr->version = AESD_BIN_VERSION;
+	ring->hdr->size = ring_size;
+	ring->hdr->wake = 1;
+
+	ring->evfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (ring->evfd == -1){
+		perror("eventfd");
+		syslog(LOG_ERR, "shared ring eventfd: %s", strerror(errno));
+		goto fail;
+	}
+
+	pthread_mutex_lock(&shm_mutex);
+	LIST_INSERT_HEAD(&rings, ring, entries);
+	pthread_mutex_unlock(&shm_mutex);
+
+	ev.events = EPOLLIN;
+	ev.data.ptr = ring;
+	if (epoll_ctl(shm_epfd, EPOLL_CTL_ADD, ring->evfd, &ev) == -1){
+		perror("epoll_ctl");
+		syslog(LOG_ERR, "shared ring epoll_ctl: %s", strerror(errno));
+		pthread_mutex_lock(&shm_mutex);
+		LIST_REMOVE(ring, entries);
+		pthread_mutex_unlock(&shm_mutex);
+		goto fail;
+	}
+
+	return ring;
+
+fail:
+	ring_free(ring);
+	return NULL;
+}
+
+/**********************************************************************************
+ * @name       shm_ring_share()
+ **********************************************************************************/
+size_t shm_ring_share(const shm_ring_t *ring, int fds[2])
+{
+	fds[0] = ring->memfd;
+	fds[1] = ring->evfd;
+	return ring->size;
+}
+
+/**********************************************************************************
+ * @name       shm_ring_detach()
+ *
+ * @brief      { The doorbell is rung under the lock the ring thread checks
+ *               before freeing, so it never hits a closed eventfd. }
+ **********************************************************************************/
+void shm_ring_detach(shm_ring_t *ring)
+{
+	uint64_t one = 1;
+
+	pthread_mutex_lock(&shm_mutex);
+	ring->detached = 1;
+	if (write(ring->evfd, &one, sizeof(one)) == -1 && errno != EAGAIN)
+		syslog(LOG_ERR, "shared ring doorbell: %s", strerror(errno));
+	pthread_mutex_unlock(&shm_mutex);
+}
@@ -0,0 +1,62 @@
+ /**********************************************************************************
+ * @file    aesdsocket-shm.h
+ * @brief   Shared memory append rings for producers on the same host.
+ *
+ * @author        <Li-Huan Lu>
+ * @date          <10/16/2026>
+ ***********************************************************************************/
+#ifndef AESDSOCKET_SHM_H
+#define AESDSOCKET_SHM_H
+
+#include <stddef.h>
+
+struct shm_ring_s;
+
+/**********************************************************************************
+ * @name       shm_start()
+ *
+ * @brief      { Starts the thread that moves ring contents to the appender.
+ *               Rings cannot be created unless this is called. }
+ *
+ * @return     0 on success, -1 on failure
+ **********************************************************************************/
+int shm_start(void);
+
+/**********************************************************************************
+ * @name       shm_stop()
+ *
+ * @brief      { Appends what is left in every ring and stops the thread. Call
+ *               once the connections are gone and before appender_stop(). }
+ **********************************************************************************/
+void shm_stop(void);
+
+/**********************************************************************************
+ * @name       shm_ring_create()
+ *
+ * @brief      { Creates a ring for one producer, see aesdsocket-proto.h. The
+ *               size is rounded up to a power of two within AESD_SHM_MIN and
+ *               AESD_SHM_MAX. }
+ *
+ * @return     Ring, or NULL on failure or when shm_start() was not called
+ **********************************************************************************/
+struct shm_ring_s *shm_ring_create(size_t size);
+
+/**********************************************************************************
+ * @name       shm_ring_share()
+ *
+ * @brief      { What to pass to the producer: fds[0] the memfd, fds[1] the
+ *               eventfd. Both stay owned by the ring, send them as they are. }
+ *
+ * @return     Data size of the ring
+ **********************************************************************************/
+size_t shm_ring_share(const struct shm_ring_s *ring, int fds[2]);
+
+/**********************************************************************************
+ * @name       shm_ring_detach()
+ *
+ * @brief      { Gives the ring up when its connection closes. The rest of it is
+ *               appended and it is freed by the ring thread. }
+ **********************************************************************************/
+void shm_ring_detach(struct shm_ring_s *ring);
+
+#endif /* AESDSOCKET_SHM_H */
@@ -0,0 +1,184 @@
+ /**********************************************************************************
+ * @file    aesdsocket-store-chardev.c
+ * @brief   aesdchar driver storage backend of the aesdsocket history.
+ *
+ *          The driver keeps only its last AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED
+ *          commands and may evict one at any time, so offsets are only good
+ *          until the next append and every reply asks for the size when it
+ *          starts. A write becomes a command once it ends in a newline.
+ *
+ * @author        <Li-Huan Lu>
+ * @date          <10/16/2026>
+ * @reference     ../aesd-char-driver/main.c
+ ***********************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+
+// aesd ioctl
+#include "../aesd-char-driver/aesd_ioctl.h"
+
+#include "aesdsocket-store.h"
+
+#define CHARDEV_IOV_MAX 64      // commands per writev()
+
+static int writer_fd = -1;
+static int reader_fd = -1;      // shared by every reply, explicit offsets only
+static const char *chardev_path;
+
+/**********************************************************************************
+ * @name       chardev_open()
+ **********************************************************************************/
+static int chardev_open(const char *path, const store_opts_t *opts)
+{
+	(void)opts;
+	writer_fd = open(path, O_WRONLY);
+	if (writer_fd == -1){
+		perror("open");
+		syslog(LOG_ERR, "open %s: %s", path, strerror(errno));
+		return -1;
+	}
+	reader_fd = open(path, O_RDONLY);
+	if (reader_fd == -1){
+		perror("open");
+		syslog(LOG_ERR, "open %s: %s", path, strerror(errno));
+		close(writer_fd);
+		writer_fd = -1;
+		return -1;
+	}
+	chardev_path = path;
+	return 0;
+}
+
+/**********************************************************************************
+ * @name       chardev_close()
+ **********************************************************************************/
+static void chardev_close(void)
+{
+	if (writer_fd == -1) return;
+
+	close(reader_fd);
+	reader_fd = -1;
+	close(writer_fd);
+	writer_fd = -1;
+}
+
+/**********************************************************************************
+ * @name       chardev_append()
+ *
+ * @brief      { The driver stores each write() ending in a newline as a single
+ *               command, and a writev() reaches it as one write() per segment.
+ *               Records arrive batched, so cut the segments at every newline to
+ *               keep one command per line. }
+ **********************************************************************************/
+static int chardev_append(struct iovec *iov, int iovcnt)
+{
+	struct iovec split[CHARDEV_IOV_MAX];
+	char *p, *end, *nl;
+	size_t len;
+	int n = 0, i;
+
+	for (i = 0; i < iovcnt; i++){
+		p = iov[i].iov_base;
+		end = p + iov[i].iov_len;
+		while (p < end){
+			nl = memchr(p, '\n', end - p);
+			len = nl ? (size_t)(nl + 1 - p) : (size_t)(end - p);
+
+			if (n == CHARDEV_IOV_MAX){
+				if (store_writev(writer_fd, split, n)) return -1;
+				n = 0;
+			}
+			split[n].iov_base = p;
+			split[n].iov_len = len;
+			n++;
+			p += len;
+		}
+	}
+	return n ? store_writev(writer_fd, split, n) : 0;
+}
+
+/**********************************************************************************
+ * @name       chardev_read()
+ **********************************************************************************/
+static ssize_t chardev_read(void *buf, size_t len, off_t off)
+{
+	return pread(reader_fd, buf, len, off);
+}
+
+/**********************************************************************************
+ * @name       chardev_size()
+ *
+ * @brief      { The driver sums its entries on SEEK_END. Moving the shared
+ *               position is harmless, reads pass their own offset. }
+ **********************************************************************************/
+static off_t chardev_size(void)
+{
+	off_t end = lseek(reader_fd, 0, SEEK_END);
+
+	if (end == -1){
+		perror("lseek");
+		syslog(LOG_ERR, "lseek");
+		return 0;
+	}
+	return end;
+}
+
+/**********************************************************************************
+ * @name       chardev_seekto()
+ *
+ * @brief      { The ioctl only moves the position of a private fd, the reply
+ *               itself is read from the shared fd like any other. }
+ **********************************************************************************/
+static int chardev_seekto(unsigned int write_cmd, unsigned int offset, off_t *pos)
+{
+	struct aesd_seekto seekto;
+	int fd;
+
+	seekto.write_cmd = write_cmd;
+	seekto.write_cmd_offset = offset;
+
+	fd = open(chardev_path, O_RDWR);
+	if (fd == -1){
+		perror("open");
+		syslog(LOG_ERR, "open");
+		return -1;
+	}
+	if (ioctl(fd, AESDCHAR_IOCSEEKTO, &seekto) == -1 || (*pos = lseek(fd, 0, SEEK_CUR)) == -1){
+		perror("ioctl");
+		syslog(LOG_ERR, "ioctl");
+		close(fd);
+		return -1;
+	}
+	close(fd);
+	return 0;
+}
+
+/**********************************************************************************
+ * @name       chardev_send()
+ *
+ * @brief      { Needs splice_read in the driver, the caller copies otherwise. }
+ **********************************************************************************/
+static ssize_t chardev_send(int sock_fd, off_t off, size_t count)
+{
+	return sendfile(sock_fd, reader_fd, &off, count);
+}
+
+const store_ops_t store_chardev_ops = {
+	.name         = "chardev",
+	.default_path = "/dev/aesdchar",
+	.flags        = 0,
+	.open         = chardev_open,
+	.close        = chardev_close,
+	.append       = chardev_append,
+	.read         = chardev_read,
+	.size         = chardev_size,
+	.seekto       = chardev_seekto,
+	.send         = chardev_send,
+};
@@ -0,0 +1,235 @@
+ /**********************************************************************************
+ * @file    aesdsocket-store-file.c
+ * @brief   Flat file storage backend of the aesdsocket history.
+ *
+ *          The history is one append-only file. Bytes never move once
+ *          written, so replies may use exact offsets, sendfile() and the
+ *          mmap segment cache. A command offset index kept next to the file
+ *          answers seek-to-command without reading the history. Both files
+ *          are removed when the server exits.
+ *
+ * @author        <Li-Huan Lu>
+ * @date          <10/16/2026>
+ ***********************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+
+#include "aesdsocket-store.h"
+#include "aesdsocket-index.h"
+
+#define FILE_SCAN_CHUNK (16 * 1024)
+
+static int writer_fd = -1;
+static int reader_fd = -1;      // shared by every reply, pread/sendfile only
+static const char *file_path;
+static int file_indexed;        // seekto goes through the index
+
+/**********************************************************************************
+ * @name       file_open()
+ **********************************************************************************/
+static int file_open(const char *path, const store_opts_t *opts)
+{
+	char idx_path[PATH_MAX];
+
+	(void)opts;
+
+	writer_fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0664);
+	if (writer_fd == -1){
+		perror("open");
+		syslog(LOG_ERR, "open %s: %s", path, strerror(errno));
+		return -1;
+	}
+	reader_fd = open(path, O_RDONLY);
+	if (reader_fd == -1){
+		perror("open");
+		syslog(LOG_ERR, "open %s: %s", path, strerror(errno));
+		close(writer_fd);
+		writer_fd = -1;
+		return -1;
+	}
+	file_path = path;
+
+	// Without an index seekto still works, by scanning
+	if (snprintf(idx_path, sizeof(idx_path), "%s.idx", path) < (int)sizeof(idx_path) &&
+	    index_open(idx_path, reader_fd) == 0)
+		file_indexed = 1;
+	else
+		syslog(LOG_ERR, "no command index for %s, seekto scans the file", path);
+	return 0;
+}
+
+/**********************************************************************************
+ * @name       file_close()
+ **********************************************************************************/
+static void file_close(void)
+{
+	if (writer_fd == -1) return;
+
+	if (file_indexed) index_close(1);
+	file_indexed = 0;
+	close(reader_fd);
+	reader_fd = -1;
+	close(writer_fd);
+	writer_fd = -1;
+
+	if (remove(file_path)){
+		perror("remove");
+		syslog(LOG_ERR, "remove file failed.");
+	}
+}
+
+/**********************************************************************************
+ * @name       file_append()
+ **********************************************************************************/
+static int file_append(struct iovec *iov, int iovcnt)
+{
+	int i;
+
+	if (!file_indexed) return store_writev(writer_fd, iov, iovcnt);
+
+	// Scan first, the write may consume iov
+	for (i = 0; i < iovcnt; i++)
+		index_scan(iov[i].iov_base, iov[i].iov_len);
+	if (store_writev(writer_fd, iov, iovcnt)){
+		index_resync(reader_fd);
+		return -1;
+	}
+	index_commit();
+	return 0;
+}
+
+/**********************************************************************************
+ * @name       file_sync()
+ **********************************************************************************/
+static int file_sync(void)
+{
+	return fdatasync(writer_fd);
+}
+
+/**********************************************************************************
+ * @name       file_read()
+ **********************************************************************************/
+static ssize_t file_read(void *buf, size_t len, off_t off)
+{
+	return pread(reader_fd, buf, len, off);
+}
+
+/**********************************************************************************
+ * @name       file_size()
+ **********************************************************************************/
+static off_t file_size(void)
+{
+	struct stat st;
+
+	if (fstat(reader_fd, &st) == -1){
+		perror("fstat");
+		syslog(LOG_ERR, "fstat: %s", strerror(errno));
+		return 0;
+	}
+	return st.st_size;
+}
+
+/**********************************************************************************
+ * @name       file_scan_seekto()
+ *
+ * @brief      { Counts lines from the start of the file, every newline ends one
+ *               command. Only used when there is no index. }
+ **********************************************************************************/
+static int file_scan_seekto(unsigned int write_cmd, unsigned int offset, off_t *pos)
+{
+	char buf[FILE_SCAN_CHUNK];
+	off_t off = 0, start = 0, end;
+	unsigned int cmd = 0;
+	char *p, *nl;
+	ssize_t n;
+
+	for (;;){
+		n = pread(reader_fd, buf, sizeof(buf), off);
+		if (n == -1){
+			if (errno == EINTR) continue;
+			perror("pread");
+			syslog(LOG_ERR, "pread: %s", strerror(errno));
+			return -1;
+		}
+		if (n == 0) break;
+
+		p = buf;
+		while ((nl = memchr(p, '\n', buf + n - p)) != NULL){
+			end = off + (nl - buf) + 1;
+			if (cmd == write_cmd){
+				if (offset >= end - start) return -1;
+				*pos = start + offset;
+				return 0;
+			}
+			cmd++;
+			start = end;
+			p = nl + 1;
+		}
+		off += n;
+	}
+	*pos = start + offset;
+	return 0;
+}
+
+/**********************************************************************************
+ * @name       file_seekto()
+ *
+ * @brief      { The offset has to fall inside the command. A command past the
+ *               last one lands past the end, as with the driver. }
+ **********************************************************************************/
+static int file_seekto(unsigned int write_cmd, unsigned int offset, off_t *pos)
+{
+	off_t start, end;
+	int ret;
+
+	ret = index_lookup(write_cmd, &start, &end);
+	if (ret == 1) return file_scan_seekto(write_cmd, offset, pos);
+	if (ret == 0 && offset >= end - start) return -1;
+	*pos = start + offset;
+	return 0;
+}
+
+/**********************************************************************************
+ * @name       file_send()
+ *
+ * @brief      { The explicit offset leaves the shared fd position alone, so
+ *               every reply can use the same fd without a lock. }
+ **********************************************************************************/
+static ssize_t file_send(int sock_fd, off_t off, size_t count)
+{
+	return sendfile(sock_fd, reader_fd, &off, count);
+}
+
+/**********************************************************************************
+ * @name       file_map()
+ **********************************************************************************/
+static void *file_map(off_t off, size_t len)
+{
+	void *map = mmap(NULL, len, PROT_READ, MAP_SHARED, reader_fd, off);
+
+	return map == MAP_FAILED ? NULL : map;
+}
+
+const store_ops_t store_file_ops = {
+	.name         = "file",
+	.default_path = "/var/tmp/aesdsocketdata",
+	.flags        = STORE_STABLE | STORE_TIMESTAMPS,
+	.open         = file_open,
+	.close        = file_close,
+	.append       = file_append,
+	.sync         = file_sync,
+	.read         = file_read,
+	.size         = file_size,
+	.seekto       = file_seekto,
+	.send         = file_send,
+	.map          = file_map,
+};
@@ -0,0 +1,214 @@
+ /**********************************************************************************
+ * @file    aesdsocket-store-ring.c
+ * @brief   In-process ring storage backend of the aesdsocket history.
+ *
+ *          Keeps the history the way the aesdchar driver does, with the
+ *          driver's own circular buffer code: the last
+ *          AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED commands, a command ending
+ *          at each newline, offsets counted from the oldest command kept. It
+ *          needs no kernel module, so the server can be run and measured
+ *          with driver semantics anywhere.
+ *
+ * @author        <Li-Huan Lu>
+ * @date          <10/16/2026>
+ * @reference     ../aesd-char-driver/main.c
+ ***********************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <errno.h>
+
+// Pthread
+#include <pthread.h>
+
+#include "../aesd-char-driver/aesd-circular-buffer.h"
+
+#include "aesdsocket-store.h"
+
+static struct aesd_circular_buffer ring;
+static pthread_mutex_t ring_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Command still waiting for its newline, appender thread only
+static char *pending;
+static size_t pending_len;
+
+/**********************************************************************************
+ * @name       ring_open()
+ **********************************************************************************/
+static int ring_open(const char *path, const store_opts_t *opts)
+{
+	(void)path;
+	(void)opts;
+	aesd_circular_buffer_init(&ring);
+	return 0;
+}
+
+/**********************************************************************************
+ * @name       ring_close()
+ **********************************************************************************/
+static void ring_close(void)
+{
+	struct aesd_buffer_entry *entry;
+	uint8_t index;
+
+	pthread_mutex_lock(&ring_mutex);
+	AESD_CIRCULAR_BUFFER_FOREACH(entry, &ring, index){
+		free((char *)entry->buffptr);
+	}
+	aesd_circular_buffer_init(&ring);
+	pthread_mutex_unlock(&ring_mutex);
+
+	free(pending);
+	pending = NULL;
+	pending_len = 0;
+}
+
+/**********************************************************************************
+ * @name       ring_write()
+ *
+ * @brief      { Same as the driver's write(): bytes collect in the pending
+ *               command until one ends in a newline, which adds the command
+ *               and evicts the oldest when the ring is full. }
+ **********************************************************************************/
+static int ring_write(const char *buf, size_t len)
+{
+	struct aesd_buffer_entry entry;
+	const char *evicted;
+	char *grown;
+
+	grown = (char *) realloc(pending, pending_len + len);
+	if (!grown){
+		syslog(LOG_ERR, "Out of memory, dropping %zu bytes", len);
+		return -1;
+	}
+	memcpy(grown + pending_len, buf, len);
+	pending = grown;
+	pending_len += len;
+
+	if (pending[pending_len - 1] != '\n') return 0;
+
+	entry.buffptr = pending;
+	entry.size = pending_len;
+	pthread_mutex_lock(&ring_mutex);
+	evicted = aesd_circular_buffer_add_entry(&ring, &entry);
+	pthread_mutex_unlock(&ring_mutex);
+	free((char *)evicted);
+
+	pending = NULL;
+	pending_len = 0;
+	return 0;
+}
+
+/**********************************************************************************
+ * @name       ring_append()
+ *
+ * @brief      { Records arrive batched, cut them at every newline so each line
+ *               is one command. }
+ **********************************************************************************/
+static int ring_append(struct iovec *iov, int iovcnt)
+{
+	char *p, *end, *nl;
+	size_t len;
+	int i;
+
+	for (i = 0; i < iovcnt; i++){
+		p = iov[i].iov_base;
+		end = p + iov[i].iov_len;
+		while (p < end){
+			nl = memchr(p, '\n', end - p);
+			len = nl ? (size_t)(nl + 1 - p) : (size_t)(end - p);
+			if (ring_write(p, len)) return -1;
+			p += len;
+		}
+	}
+	return 0;
+}
+
+/**********************************************************************************
+ * @name       ring_read()
+ *
+ * @brief      { Copies across commands, unlike the driver's read() which stops
+ *               at the end of one. }
+ **********************************************************************************/
+static ssize_t ring_read(void *buf, size_t len, off_t off)
+{
+	struct aesd_buffer_entry *entry;
+	size_t entry_off, n, done = 0;
+
+	pthread_mutex_lock(&ring_mutex);
+	while (done < len){
+		entry = aesd_circular_buffer_find_entry_offset_for_fpos(&ring, off + done, &entry_off);
+		if (!entry) break;
+
+		n = entry->size - entry_off;
+		if (n > len - done) n = len - done;
+		memcpy((char *)buf + done, entry->buffptr + entry_off, n);
+		done += n;
+	}
+	pthread_mutex_unlock(&ring_mutex);
+	return done;
+}
+
+/**********************************************************************************
+ * @name       ring_size()
+ **********************************************************************************/
+static off_t ring_size(void)
+{
+	struct aesd_buffer_entry *entry;
+	uint8_t index;
+	off_t total = 0;
+
+	pthread_mutex_lock(&ring_mutex);
+	AESD_CIRCULAR_BUFFER_FOREACH(entry, &ring, index){
+		total += entry->size;
+	}
+	pthread_mutex_unlock(&ring_mutex);
+	return total;
+}
+
+/**********************************************************************************
+ * @name       ring_seekto()
+ *
+ * @brief      { Same rules as the driver's AESDCHAR_IOCSEEKTO, including a
+ *               command past the last one landing past the end. }
+ **********************************************************************************/
+static int ring_seekto(unsigned int write_cmd, unsigned int offset, off_t *pos)
+{
+	struct aesd_buffer_entry *entry;
+	uint8_t index;
+	off_t start = 0;
+	int i, ret = 0;
+
+	if (write_cmd >= AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED) return -1;
+
+	pthread_mutex_lock(&ring_mutex);
+	index = ring.out_offs;
+	for (i = 0; i < AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED; i++){
+		entry = &ring.entry[index];
+		if (entry->buffptr == NULL) break; // unused
+
+		if ((unsigned int)i == write_cmd){
+			if (offset >= entry->size) ret = -1;
+			break;
+		}
+		start += entry->size;
+		index = (index + 1) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+	}
+	pthread_mutex_unlock(&ring_mutex);
+
+	*pos = start + offset;
+	return ret;
+}
+
+const store_ops_t store_ring_ops = {
+	.name         = "ring",
+	.default_path = NULL,
+	.flags        = 0,
+	.open         = ring_open,
+	.close        = ring_close,
+	.append       = ring_append,
+	.read         = ring_read,
+	.size         = ring_size,
+	.seekto       = ring_seekto,
+};
@@ -0,0 +1,773 @@
+ /**********************************************************************************
+ * @file    aesdsocket-store-seg.c
+ * @brief   Segmented, size-capped storage backend of the aesdsocket history.
+ *
+ *          The history is split over segment files PATH.000000, PATH.000001,
+ *          ... of a fixed size, segment k holding history bytes
+ *          [k * size, (k + 1) * size). Offsets never move. Once more than
+ *          the configured number of segments exist the oldest one is retired
+ *          as a whole, the way the driver evicts its oldest entry, and the
+ *          history then starts at the first command that is still complete.
+ *
+ *          Every segment keeps the end offsets of the commands ending in it,
+ *          so seek-to-command walks the few segments and indexes the array.
+ *          The arrays go away with their segment and are rebuilt from the
+ *          files at startup.
+ *
+ *          The appender never waits on the file system for a rotation: a
+ *          keeper thread creates the next segment file ahead of time, and
+ *          unlinks and closes retired ones once no reader is still inside a
+ *          read, sendfile() or mmap() call on them.
+ *
+ * @author        <Li-Huan Lu>
+ * @date          <10/16/2026>
+ ***********************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <syslog.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include <libgen.h>
+#include <dirent.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+
+// Pthread
+#include <pthread.h>
+
+#include "aesdsocket-store.h"
+
+#define SEG_IOV_MAX     128         // pieces per writev(), a whole appender batch
+#define SEG_SCAN_CHUNK  (64 * 1024)
+#define SEG_KEEPER_MS   100         // retry period for segments readers still use
+
+typedef struct seg_s {
+	unsigned long long id;      // holds history [id * seg_bytes, (id + 1) * seg_bytes)
+	int fd;
+	int refs;                   // readers inside a call on fd, under seg_mutex
+	int unlinked;               // retired and its file removed, keeper only
+	struct seg_s *next;         // retired list
+
+	// History offsets right after each command ending in this segment
+	uint64_t *ends;
+	size_t nends;               // published, under seg_mutex
+	size_t staged;              // appender only
+	size_t cap;
+} seg_t;
+
+static pthread_mutex_t seg_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t keeper_cond = PTHREAD_COND_INITIALIZER;
+
+// Under seg_mutex
+static seg_t **slots;           // retained segments by id % nslots
+static size_t nslots;
+static unsigned long long first_id, last_id;
+static seg_t *spare;            // next segment, created ahead by the keeper
+static seg_t *retired;
+static int keeper_stop;
+static int start_pending;       // history start waits for the next command end
+
+static off_t hist_start;        // first complete command still kept, atomic
+static off_t write_off;         // history length written, atomic, appender writes
+static size_t seg_bytes;
+static size_t seg_keep;
+static char seg_prefix[PATH_MAX];
+static pthread_t keeper_id;
+static int keeper_running;
+
+// Appender only
+static seg_t *cur;
+static unsigned long long unsynced_id;  // oldest segment written since the last sync
+
+/**********************************************************************************
+ * @name       seg_name()
+ **********************************************************************************/
+static void seg_name(char *buf, size_t len, unsigned long long id)
+{
+	snprintf(buf, len, "%s.%06llu", seg_prefix, id);
+}
+
+/**********************************************************************************
+ * @name       seg_base()
+ **********************************************************************************/
+static off_t seg_base(const seg_t *seg)
+{
+	return (off_t)(seg->id * seg_bytes);
+}
+
+/**********************************************************************************
+ * @name       seg_new()
+ *
+ * @brief      { Opens the file of segment id, truncated unless keep is set. }
+ **********************************************************************************/
+static seg_t *seg_new(unsigned long long id, int keep)
+{
+	char path[PATH_MAX + 32];
+	seg_t *seg;
+
+	seg = (seg_t *) calloc(1, sizeof(seg_t));
+	if (!seg){
+		syslog(LOG_ERR, "Out of memory");
+		return NULL;
+	}
+	seg->id = id;
+
+	seg_name(path, sizeof(path), id);
+	seg->fd = open(path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC | (keep ? 0 : O_TRUNC), 0664);
+	if (seg->fd == -1){
+		perror("open");
+		syslog(LOG_ERR, "open %s: %s", path, strerror(errno));
+		free(seg);
+		return NULL;
+	}
+	return seg;
+}
+
+/**********************************************************************************
+ * @name       seg_free()
+ **********************************************************************************/
+static void seg_free(seg_t *seg, int unlink_file)
+{
+	char path[PATH_MAX + 32];
+
+	if (unlink_file && !seg->unlinked){
+		seg_name(path, sizeof(path), seg->id);
+		unlink(path);
+	}
+	close(seg->fd);
+	free(seg->ends);
+	free(seg);
+}
+
+/**********************************************************************************
+ * @name       seg_get()
+ *
+ * @brief      { Segment holding history offset off, with a reference that keeps
+ *               its fd open until seg_put(). NULL when off is not kept. }
+ **********************************************************************************/
+static seg_t *seg_get(off_t off)
+{
+	unsigned long long id = off / seg_bytes;
+	seg_t *seg = NULL;
+
+	pthread_mutex_lock(&seg_mutex);
+	if (off >= 0 && slots && id >= first_id && id <= last_id){
+		seg = slots[id % nslots];
+		seg->refs++;
+	}
+	pthread_mutex_unlock(&seg_mutex);
+	return seg;
+}
+
+/**********************************************************************************
+ * @name       seg_put()
+ **********************************************************************************/
+static void seg_put(seg_t *seg)
+{
+	pthread_mutex_lock(&seg_mutex);
+	seg->refs--;
+	pthread_mutex_unlock(&seg_mutex);
+}
+
+/**********************************************************************************
+ * @name       seg_scan()
+ *
+ * @brief      { Stages the command ends in bytes landing at history offset pos.
+ *               Growing moves the array, so that part holds the lock. }
+ **********************************************************************************/
+static int seg_scan(seg_t *seg, const char *buf, size_t len, off_t pos)
+{
+	const char *p = buf, *nl;
+
+	while ((nl = memchr(p, '\n', buf + len - p)) != NULL){
+		if (seg->staged == seg->cap){
+			size_t new_cap = seg->cap ? seg->cap * 2 : 1024;
+			uint64_t *grown;
+
+			pthread_mutex_lock(&seg_mutex);
+			grown = (uint64_t *) realloc(seg->ends, new_cap * sizeof(*grown));
+			if (grown){
+				seg->ends = grown;
+				seg->cap = new_cap;
+			}
+			pthread_mutex_unlock(&seg_mutex);
+			if (!grown){
+				syslog(LOG_ERR, "Out of memory, command offsets lost");
+				return -1;
+			}
+		}
+		seg->ends[seg->staged++] = pos + (nl - buf) + 1;
+		p = nl + 1;
+	}
+	return 0;
+}
+
+/**********************************************************************************
+ * @name       seg_publish()
+ **********************************************************************************/
+static void seg_publish(seg_t *seg)
+{
+	pthread_mutex_lock(&seg_mutex);
+	seg->nends = seg->staged;
+	if (start_pending && seg->nends){
+		__atomic_store_n(&hist_start, (off_t)seg->ends[0], __ATOMIC_RELEASE);
+		start_pending = 0;
+	}
+	pthread_mutex_unlock(&seg_mutex);
+}
+
+/**********************************************************************************
+ * @name       seg_scan_file()
+ *
+ * @brief      { Stages and publishes the command ends in the file bytes
+ *               [from, to) of the segment, relative to the segment start. }
+ **********************************************************************************/
+static int seg_scan_file(seg_t *seg, off_t from, off_t to)
+{
+	char *buf;
+	ssize_t n;
+	int ret = 0;
+
+	buf = (char *) malloc(SEG_SCAN_CHUNK);
+	if (!buf){
+		syslog(LOG_ERR, "Out of memory");
+		return -1;
+	}
+	while (from < to){
+		n = pread(seg->fd, buf, to - from < SEG_SCAN_CHUNK ? to - from : SEG_SCAN_CHUNK, from);
+		if (n == -1 && errno == EINTR) continue;
+		if (n <= 0){
+			if (n == -1){
+				perror("pread");
+				syslog(LOG_ERR, "segment scan: %s", strerror(errno));
+			}
+			ret = -1;
+			break;
+		}
+		if (seg_scan(seg, buf, n, seg_base(seg) + from)){
+			ret = -1;
+			break;
+		}
+		from += n;
+	}
+	free(buf);
+	seg_publish(seg);
+	return ret;
+}
+
+/**********************************************************************************
+ * @name       seg_update_start()
+ *
+ * @brief      { Moves the history start to the first command that begins in a
+ *               retained segment. prev_end is the last command end of the
+ *               segment just retired, 0 when unknown. Holds seg_mutex. }
+ **********************************************************************************/
+static void seg_update_start(uint64_t prev_end)
+{
+	seg_t *oldest = slots[first_id % nslots];
+	off_t start = seg_base(oldest);
+	unsigned long long id;
+
+	// Unless a command ended right at the boundary, skip the one cut in two
+	start_pending = 0;
+	if (start && prev_end != (uint64_t)start){
+		for (id = first_id; id <= last_id; id++){
+			seg_t *seg = slots[id % nslots];
+
+			if (seg->nends){
+				start = seg->ends[0];
+				break;
+			}
+		}
+		// Still inside that command, it ends in a later write
+		if (id > last_id){
+			start = __atomic_load_n(&write_off, __ATOMIC_ACQUIRE);
+			start_pending = 1;
+		}
+	}
+	__atomic_store_n(&hist_start, start, __ATOMIC_RELEASE);
+}
+
+/**********************************************************************************
+ * @name       seg_keeper()
+ *
+ * @brief      { Creates the next segment ahead of the appender, and removes
+ *               retired segments once no reader is inside a call on them. }
+ **********************************************************************************/
+static void *seg_keeper(void *arg)
+{
+	char path[PATH_MAX + 32];
+	struct timespec ts;
+	seg_t **link, *seg;
+	unsigned long long id;
+
+	(void)arg;
+	pthread_mutex_lock(&seg_mutex);
+	while (!keeper_stop){
+		for (link = &retired; (seg = *link) != NULL;){
+			if (!seg->unlinked){
+				seg_name(path, sizeof(path), seg->id);
+				pthread_mutex_unlock(&seg_mutex);
+				if (unlink(path) && errno != ENOENT){
+					perror("unlink");
+					syslog(LOG_ERR, "unlink %s: %s", path, strerror(errno));
+				}
+				pthread_mutex_lock(&seg_mutex);
+				seg->unlinked = 1;
+			}
+			if (seg->refs){
+				link = &seg->next;
+				continue;
+			}
+			*link = seg->next;
+			pthread_mutex_unlock(&seg_mutex);
+			seg_free(seg, 0);
+			pthread_mutex_lock(&seg_mutex);
+		}
+
+		if (!spare){
+			id = last_id + 1;
+			pthread_mutex_unlock(&seg_mutex);
+			seg = seg_new(id, 0);
+			pthread_mutex_lock(&seg_mutex);
+			if (seg && !spare && id == last_id + 1)
+				spare = seg;
+			else if (seg){
+				pthread_mutex_unlock(&seg_mutex);
+				seg_free(seg, 0);
+				pthread_mutex_lock(&seg_mutex);
+			}
+		}
+
+		if (keeper_stop) break;
+		if (retired){
+			clock_gettime(CLOCK_REALTIME, &ts);
+			ts.tv_nsec += SEG_KEEPER_MS * 1000000L;
+			if (ts.tv_nsec >= 1000000000L){
+				ts.tv_sec++;
+				ts.tv_nsec -= 1000000000L;
+			}
+			pthread_cond_timedwait(&keeper_cond, &seg_mutex, &ts);
+		}
+		else if (spare)
+			pthread_cond_wait(&keeper_cond, &seg_mutex);
+		else {
+			// Could not create the file, try again later
+			clock_gettime(CLOCK_REALTIME, &ts);
+			ts.tv_sec++;
+			pthread_cond_timedwait(&keeper_cond, &seg_mutex, &ts);
+		}
+	}
+	pthread_mutex_unlock(&seg_mutex);
+	return NULL;
+}
+
+/**********************************************************************************
+ * @name       seg_roll()
+ *
+ * @brief      { Makes the next segment current. Takes the file the keeper made
+ *               ahead, only opens one itself when the keeper fell behind. }
+ **********************************************************************************/
+static int seg_roll(void)
+{
+	unsigned long long id = cur->id + 1;
+	seg_t *seg, *old;
+
+	pthread_mutex_lock(&seg_mutex);
+	seg = spare;
+	spare = NULL;
+	pthread_mutex_unlock(&seg_mutex);
+
+	if (seg && seg->id != id){
+		seg_free(seg, 1);
+		seg = NULL;
+	}
+	if (!seg) seg = seg_new(id, 0);
+	if (!seg) return -1;
+
+	pthread_mutex_lock(&seg_mutex);
+	slots[id % nslots] = seg;
+	last_id = id;
+	cur = seg;
+	if (last_id - first_id + 1 > seg_keep){
+		old = slots[first_id % nslots];
+		slots[first_id % nslots] = NULL;
+		first_id++;
+		seg_update_start(old->nends ? old->ends[old->nends - 1] : 0);
+		old->next = retired;
+		retired = old;
+	}
+	pthread_cond_signal(&keeper_cond);
+	pthread_mutex_unlock(&seg_mutex);
+	return 0;
+}
+
+/**********************************************************************************
+ * @name       seg_flush()
+ *
+ * @brief      { Writes the staged pieces to the current segment, then publishes
+ *               their command ends. A failed write truncates the segment back,
+ *               so its staged ends are dropped; only bytes it could not take
+ *               back are scanned and count as written. Pieces flushed before
+ *               a roll stay, the appender keeps the records they complete and
+ *               ends the one cut short. }
+ **********************************************************************************/
+static int seg_flush(struct iovec *out, int n, off_t pos)
+{
+	off_t written = write_off - seg_base(cur);
+	struct stat st;
+
+	if (n == 0) return 0;
+	if (store_writev(cur->fd, out, n) == 0){
+		seg_publish(cur);
+		__atomic_store_n(&write_off, pos, __ATOMIC_RELEASE);
+		return 0;
+	}
+
+	cur->staged = cur->nends;
+	if (fstat(cur->fd, &st) == 0 && st.st_size > written){
+		syslog(LOG_WARNING, "segment %06llu: %lld bytes of a failed write stayed", cur->id,
+		       (long long)(st.st_size - written));
+		seg_scan_file(cur, written, st.st_size);
+		__atomic_store_n(&write_off, seg_base(cur) + st.st_size, __ATOMIC_RELEASE);
+	}
+	return -1;
+}
+
+/**********************************************************************************
+ * @name       seg_append()
+ *
+ * @brief      { Cuts the batch at segment boundaries, rolling over to the next
+ *               segment at each one. }
+ **********************************************************************************/
+static int seg_append(struct iovec *iov, int iovcnt)
+{
+	struct iovec out[SEG_IOV_MAX];
+	off_t pos = write_off, seg_end = seg_base(cur) + seg_bytes;
+	size_t len, chunk;
+	char *p;
+	int n = 0, i;
+
+	for (i = 0; i < iovcnt; i++){
+		p = iov[i].iov_base;
+		len = iov[i].iov_len;
+		while (len){
+			if (pos == seg_end){
+				if (seg_flush(out, n, pos) || seg_roll()) return -1;
+				n = 0;
+				seg_end += seg_bytes;
+			}
+			if (n == SEG_IOV_MAX){
+				if (seg_flush(out, n, pos)) return -1;
+				n = 0;
+			}
+			chunk = len < (size_t)(seg_end - pos) ? len : (size_t)(seg_end - pos);
+			if (seg_scan(cur, p, chunk, pos)){
+				cur->staged = cur->nends;
+				return -1;
+			}
+			out[n].iov_base = p;
+			out[n].iov_len = chunk;
+			n++;
+			pos += chunk;
+			p += chunk;
+			len -= chunk;
+		}
+	}
+	return seg_flush(out, n, pos);
+}
+
+/**********************************************************************************
+ * @name       seg_sync()
+ *
+ * @brief      { Syncs every segment written since the last call, a batch may
+ *               have rolled over. }
+ **********************************************************************************/
+static int seg_sync(void)
+{
+	unsigned long long id;
+	int ret = 0;
+	seg_t *seg;
+
+	for (id = unsynced_id; id <= cur->id; id++){
+		seg = seg_get((off_t)(id * seg_bytes));
+		if (!seg) continue;
+		if (fdatasync(seg->fd) == -1) ret = -1;
+		seg_put(seg);
+	}
+	unsynced_id = cur->id;
+	return ret;
+}
+
+/**********************************************************************************
+ * @name       seg_discover()
+ *
+ * @brief      { Finds the ids of segment files left by an earlier run, and
+ *               removes the ones below prune_below. }
+ *
+ * @return     Number of files found, their lowest and highest id
+ **********************************************************************************/
+static int seg_discover(unsigned long long prune_below, unsigned long long *lo,
+                        unsigned long long *hi)
+{
+	char dir_buf[PATH_MAX], base_buf[PATH_MAX];
+	const char *dir, *base;
+	struct dirent *de;
+	unsigned long long id;
+	size_t base_len;
+	char *end;
+	DIR *d;
+	int found = 0;
+
+	snprintf(dir_buf, sizeof(dir_buf), "%s", seg_prefix);
+	snprintf(base_buf, sizeof(base_buf), "%s", seg_prefix);
+	dir = dirname(dir_buf);
+	base = basename(base_buf);
+	base_len = strlen(base);
+
+	d = opendir(dir);
+	if (!d) return 0;
+	while ((de = readdir(d)) != NULL){
+		if (strncmp(de->d_name, base, base_len) || de->d_name[base_len] != '.') continue;
+		if (strlen(de->d_name + base_len + 1) < 6) continue;
+		errno = 0;
+		id = strtoull(de->d_name + base_len + 1, &end, 10);
+		if (errno || *end) continue;
+		if (id < prune_below){
+			if (unlinkat(dirfd(d), de->d_name, 0)) syslog(LOG_ERR, "unlink %s: %s", de->d_name, strerror(errno));
+			continue;
+		}
+		if (!found || id < *lo) *lo = id;
+		if (!found || id > *hi) *hi = id;
+		found++;
+	}
+	closedir(d);
+	return found;
+}
+
+/**********************************************************************************
+ * @name       seg_open()
+ **********************************************************************************/
+static int seg_open(const char *path, const store_opts_t *opts)
+{
+	unsigned long long lo = 0, hi = 0, id;
+	char name[PATH_MAX + 32];
+	struct stat st;
+	seg_t *seg;
+
+	seg_bytes = opts && opts->segment_bytes ? opts->segment_bytes : (size_t)64 << 20;
+	seg_keep = opts && opts->segments >= 2 ? (size_t)opts->segments : 8;
+	if (snprintf(seg_prefix, sizeof(seg_prefix), "%s", path) >= (int)sizeof(seg_prefix)){
+		syslog(LOG_ERR, "segment path too long");
+		return -1;
+	}
+
+	nslots = seg_keep + 1;
+	slots = (seg_t **) calloc(nslots, sizeof(*slots));
+	if (!slots){
+		syslog(LOG_ERR, "Out of memory");
+		return -1;
+	}
+
+	// Pick up what an earlier run left, past the retention limit it goes
+	if (seg_discover(0, &lo, &hi)){
+		// The keeper makes the next file ahead, it holds nothing yet
+		seg_name(name, sizeof(name), hi);
+		if (hi > lo && stat(name, &st) == 0 && st.st_size == 0 && unlink(name) == 0) hi--;
+		if (hi - lo + 1 > seg_keep){
+			lo = hi - seg_keep + 1;
+			seg_discover(lo, &lo, &hi);
+		}
+	}
+	for (id = lo; id <= hi; id++){
+		seg = seg_new(id, 1);
+		if (!seg || fstat(seg->fd, &st) == -1 || seg_scan_file(seg, 0, st.st_size)){
+			if (seg) seg_free(seg, 0);
+			while (id-- > lo) seg_free(slots[id % nslots], 0);
+			free(slots);
+			slots = NULL;
+			return -1;
+		}
+		slots[id % nslots] = seg;
+	}
+	first_id = lo;
+	last_id = hi;
+	cur = slots[hi % nslots];
+	unsynced_id = hi;
+	write_off = seg_base(cur) + st.st_size;
+	seg_update_start(0);
+
+	keeper_stop = 0;
+	if (pthread_create(&keeper_id, NULL, seg_keeper, NULL)){
+		perror("pthread_create");
+		syslog(LOG_ERR, "pthread_create failed for segment keeper, rolling inline");
+	}
+	else
+		keeper_running = 1;
+
+	syslog(LOG_INFO, "segments %s: %llu..%llu of %zu MB, keeping %zu", path,
+	       first_id, last_id, seg_bytes >> 20, seg_keep);
+	return 0;
+}
+
+/**********************************************************************************
+ * @name       seg_close()
+ *
+ * @brief      { Stops the keeper and removes every segment file, like the file
+ *               backend removes its data file. }
+ **********************************************************************************/
+static void seg_close(void)
+{
+	unsigned long long id;
+	seg_t *seg;
+
+	if (!slots) return;
+
+	if (keeper_running){
+		pthread_mutex_lock(&seg_mutex);
+		keeper_stop = 1;
+		pthread_cond_signal(&keeper_cond);
+		pthread_mutex_unlock(&seg_mutex);
+		pthread_join(keeper_id, NULL);
+		keeper_running = 0;
+	}
+
+	for (id = first_id; id <= last_id; id++) seg_free(slots[id % nslots], 1);
+	if (spare) seg_free(spare, 1);
+	while ((seg = retired) != NULL){
+		retired = seg->next;
+		seg_free(seg, 1);
+	}
+	spare = NULL;
+	free(slots);
+	slots = NULL;
+	cur = NULL;
+}
+
+/**********************************************************************************
+ * @name       seg_read()
+ *
+ * @brief      { Stops at the end of a segment, the caller reads on from there. }
+ **********************************************************************************/
+static ssize_t seg_read(void *buf, size_t len, off_t off)
+{
+	seg_t *seg = seg_get(off);
+	off_t rel;
+	ssize_t ret;
+
+	if (!seg) return 0;
+	rel = off - seg_base(seg);
+	if (len > seg_bytes - rel) len = seg_bytes - rel;
+	ret = pread(seg->fd, buf, len, rel);
+	seg_put(seg);
+	return ret;
+}
+
+/**********************************************************************************
+ * @name       seg_send()
+ **********************************************************************************/
+static ssize_t seg_send(int sock_fd, off_t off, size_t count)
+{
+	seg_t *seg = seg_get(off);
+	off_t rel;
+	ssize_t ret;
+
+	if (!seg) return 0;
+	rel = off - seg_base(seg);
+	if (count > seg_bytes - rel) count = seg_bytes - rel;
+	ret = sendfile(sock_fd, seg->fd, &rel, count);
+	seg_put(seg);
+	return ret;
+}
+
+/**********************************************************************************
+ * @name       seg_map()
+ *
+ * @brief      { The segment size is a multiple of the window, so a window
+ *               never spans two files. The mapping outlives the segment. }
+ **********************************************************************************/
+static void *seg_map(off_t off, size_t len)
+{
+	seg_t *seg = seg_get(off);
+	void *map;
+
+	if (!seg) return NULL;
+	map = mmap(NULL, len, PROT_READ, MAP_SHARED, seg->fd, off - seg_base(seg));
+	seg_put(seg);
+	return map == MAP_FAILED ? NULL : map;
+}
+
+/**********************************************************************************
+ * @name       seg_size()
+ **********************************************************************************/
+static off_t seg_size(void)
+{
+	return __atomic_load_n(&write_off, __ATOMIC_ACQUIRE);
+}
+
+/**********************************************************************************
+ * @name       seg_start()
+ **********************************************************************************/
+static off_t seg_start(void)
+{
+	return __atomic_load_n(&hist_start, __ATOMIC_ACQUIRE);
+}
+
+/**********************************************************************************
+ * @name       seg_seekto()
+ *
+ * @brief      { Command 0 is the oldest one kept. Each segment adds the ends
+ *               past the history start, so only the segment holding the
+ *               command is indexed. A command past the last one lands past
+ *               the end, as with the driver. }
+ **********************************************************************************/
+static int seg_seekto(unsigned int write_cmd, unsigned int offset, off_t *pos)
+{
+	off_t start = seg_start(), prev = start;
+	unsigned long long id;
+	size_t skip, count;
+	int ret = 0;
+	seg_t *seg;
+
+	pthread_mutex_lock(&seg_mutex);
+	for (id = first_id; id <= last_id; id++){
+		seg = slots[id % nslots];
+
+		// Only the first segments can hold ends at or before the start
+		for (skip = 0; skip < seg->nends && seg->ends[skip] <= (uint64_t)start; skip++);
+		count = seg->nends - skip;
+		if (write_cmd < count){
+			if (write_cmd + skip) prev = seg->ends[skip + write_cmd - 1];
+			if (prev < start) prev = start;
+			if (offset >= seg->ends[skip + write_cmd] - prev) ret = -1;
+			break;
+		}
+		write_cmd -= count;
+		if (count) prev = seg->ends[seg->nends - 1];
+	}
+	pthread_mutex_unlock(&seg_mutex);
+	*pos = prev + offset;
+	return ret;
+}
+
+const store_ops_t store_seg_ops = {
+	.name         = "seg",
+	.default_path = "/var/tmp/aesdsocketdata",
+	.flags        = STORE_STABLE | STORE_TIMESTAMPS,
+	.open         = seg_open,
+	.close        = seg_close,
+	.append       = seg_append,
+	.sync         = seg_sync,
+	.read         = seg_read,
+	.size         = seg_size,
+	.seekto       = seg_seekto,
+	.start        = seg_start,
+	.send         = seg_send,
+	.map          = seg_map,
+};
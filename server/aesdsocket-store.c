@@ -0,0 +1,204 @@
+ /**********************************************************************************
+ * @file    aesdsocket-store.c
+ * @brief   Storage backend selection for the aesdsocket history.
+ *
+ *          The history is kept by one of several backends behind the same
+ *          append, read-range, seek-to-command and size operations: the
+ *          aesdchar driver, a flat file, size-capped segment files, or a
+ *          ring in this process that behaves like the driver. The backend
+ *          is picked at run time, the rest of the server only goes through
+ *          the store_*() calls.
+ *
+ * @author        <Li-Huan Lu>
+ * @date          <10/16/2026>
+ ***********************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+#include "aesdsocket.h"
+#include "aesdsocket-store.h"
+
+static const store_ops_t *const stores[] = {
+	&store_chardev_ops,
+	&store_file_ops,
+	&store_seg_ops,
+	&store_ring_ops,
+};
+
+static const store_ops_t *store = USE_AESD_CHAR_DEVICE ? &store_chardev_ops : &store_file_ops;
+static const char *store_path_sel;  // NULL for the backend default
+
+/**********************************************************************************
+ * @name       store_select()
+ **********************************************************************************/
+int store_select(const char *spec)
+{
+	const char *colon = strchr(spec, ':');
+	size_t name_len = colon ? (size_t)(colon - spec) : strlen(spec);
+	size_t i;
+
+	for (i = 0; i < sizeof(stores) / sizeof(stores[0]); i++){
+		if (strlen(stores[i]->name) == name_len && strncmp(stores[i]->name, spec, name_len) == 0){
+			store = stores[i];
+			store_path_sel = colon && colon[1] ? colon + 1 : NULL;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+/**********************************************************************************
+ * @name       store_open()
+ **********************************************************************************/
+int store_open(const store_opts_t *opts)
+{
+	if (store->open(store_path(), opts)) return -1;
+	syslog(LOG_INFO, "history store %s %s", store->name, store_path());
+	return 0;
+}
+
+/**********************************************************************************
+ * @name       store_close()
+ **********************************************************************************/
+void store_close(void)
+{
+	store->close();
+}
+
+/**********************************************************************************
+ * @name       store_name()
+ **********************************************************************************/
+const char *store_name(void)
+{
+	return store->name;
+}
+
+/**********************************************************************************
+ * @name       store_path()
+ **********************************************************************************/
+const char *store_path(void)
+{
+	if (store_path_sel) return store_path_sel;
+	return store->default_path ? store->default_path : store->name;
+}
+
+/**********************************************************************************
+ * @name       store_flags()
+ **********************************************************************************/
+int store_flags(void)
+{
+	return store->flags;
+}
+
+/**********************************************************************************
+ * @name       store_append()
+ **********************************************************************************/
+int store_append(struct iovec *iov, int iovcnt)
+{
+	return store->append(iov, iovcnt);
+}
+
+/**********************************************************************************
+ * @name       store_sync()
+ **********************************************************************************/
+int store_sync(void)
+{
+	return store->sync ? store->sync() : 0;
+}
+
+/**********************************************************************************
+ * @name       store_read()
+ **********************************************************************************/
+ssize_t store_read(void *buf, size_t len, off_t off)
+{
+	return store->read(buf, len, off);
+}
+
+/**********************************************************************************
+ * @name       store_size()
+ **********************************************************************************/
+off_t store_size(void)
+{
+	return store->size();
+}
+
+/**********************************************************************************
+ * @name       store_seekto()
+ **********************************************************************************/
+int store_seekto(unsigned int write_cmd, unsigned int offset, off_t *pos)
+{
+	return store->seekto(write_cmd, offset, pos);
+}
+
+/**********************************************************************************
+ * @name       store_start()
+ **********************************************************************************/
+off_t store_start(void)
+{
+	return store->start ? store->start() : 0;
+}
+
+/**********************************************************************************
+ * @name       store_send()
+ **********************************************************************************/
+ssize_t store_send(int sock_fd, off_t off, size_t count)
+{
+	if (!store->send){
+		errno = EOPNOTSUPP;
+		return -1;
+	}
+	return store->send(sock_fd, off, count);
+}
+
+/**********************************************************************************
+ * @name       store_map()
+ **********************************************************************************/
+void *store_map(off_t off, size_t len)
+{
+	return store->map ? store->map(off, len) : NULL;
+}
+
+/**********************************************************************************
+ * @name       store_writev()
+ **********************************************************************************/
+int store_writev(int fd, struct iovec *iov, int iovcnt)
+{
+	ssize_t ret_byte;
+	size_t done = 0;
+	struct stat st;
+	int err;
+
+	while (iovcnt > 0){
+		ret_byte = writev(fd, iov, iovcnt);
+		if (ret_byte == -1){
+			if (errno == EINTR) continue;
+			err = errno;
+			perror("writev");
+			syslog(LOG_ERR, "writev: %s", strerror(err));
+
+			// Take back what went out, a regular file ends where it did before
+			if (done && fstat(fd, &st) == 0 && S_ISREG(st.st_mode) &&
+			    ftruncate(fd, st.st_size - (off_t)done) == -1)
+				syslog(LOG_ERR, "ftruncate: %s, %zu bytes of a failed write kept", strerror(errno), done);
+			errno = err;
+			return -1;
+		}
+		done += ret_byte;
+		// Partial write, skip what went out
+		while (iovcnt > 0 && (size_t)ret_byte >= iov->iov_len){
+			ret_byte -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+		if (iovcnt > 0){
+			iov->iov_base = (char *)iov->iov_base + ret_byte;
+			iov->iov_len -= ret_byte;
+		}
+	}
+	return 0;
+}
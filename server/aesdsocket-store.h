@@ -0,0 +1,180 @@
+ /**********************************************************************************
+ * @file    aesdsocket-store.h
+ * @brief   Storage backends of the aesdsocket history.
+ *
+ * @author        <Li-Huan Lu>
+ * @date          <10/16/2026>
+ ***********************************************************************************/
+#ifndef AESDSOCKET_STORE_H
+#define AESDSOCKET_STORE_H
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+// Backend properties
+#define STORE_STABLE     0x1    // bytes never move once written, append end offsets are exact, map() works
+#define STORE_TIMESTAMPS 0x2    // the periodic timestamp line is appended
+
+typedef struct store_opts_s {
+	size_t segment_bytes;       // seg: history per segment file, a multiple of 1 MB
+	int segments;               // seg: segment files kept, older ones are retired
+} store_opts_t;
+
+typedef struct store_ops_s {
+	const char *name;
+	const char *default_path;   // NULL when the backend has no path
+	int flags;
+
+	int (*open)(const char *path, const store_opts_t *opts);
+	void (*close)(void);
+	// Appender thread only, may consume iov
+	int (*append)(struct iovec *iov, int iovcnt);
+	int (*sync)(void);          // optional
+	// Any thread
+	ssize_t (*read)(void *buf, size_t len, off_t off);
+	off_t (*size)(void);
+	int (*seekto)(unsigned int write_cmd, unsigned int offset, off_t *pos);
+	off_t (*start)(void);       // optional, first history byte still kept, 0 without
+	ssize_t (*send)(int sock_fd, off_t off, size_t count);  // optional, in-kernel copy
+	void *(*map)(off_t off, size_t len);                     // STORE_STABLE only
+} store_ops_t;
+
+extern const store_ops_t store_file_ops;
+extern const store_ops_t store_seg_ops;
+extern const store_ops_t store_chardev_ops;
+extern const store_ops_t store_ring_ops;
+
+/**********************************************************************************
+ * @name       store_select()
+ *
+ * @brief      { Picks the backend before store_open(), spec is NAME[:PATH] with
+ *               NAME one of file, seg, chardev or ring. Without a call the default
+ *               is the char device, or the file when built with
+ *               USE_AESD_CHAR_DEVICE=0. }
+ *
+ * @return     0 on success, -1 for an unknown backend
+ **********************************************************************************/
+int store_select(const char *spec);
+
+/**********************************************************************************
+ * @name       store_open()
+ *
+ * @brief      { Opens the selected backend once for the whole process. }
+ *
+ * @param[in]  opts { Limits for the backends that use them }
+ *
+ * @return     0 on success, -1 on failure
+ **********************************************************************************/
+int store_open(const store_opts_t *opts);
+
+/**********************************************************************************
+ * @name       store_close()
+ *
+ * @brief      { Closes the backend. The file and seg backends remove their
+ *               files. Call once the appender has stopped. }
+ **********************************************************************************/
+void store_close(void);
+
+const char *store_name(void);
+const char *store_path(void);
+int store_flags(void);
+
+/**********************************************************************************
+ * @name       store_append()
+ *
+ * @brief      { Writes a batch of records in order, retrying short writes. Only
+ *               the appender thread calls it. After a failure store_size()
+ *               tells how much of the batch stayed in the history, the fd
+ *               backends take back what they can. }
+ *
+ * @return     0 on success, -1 on failure
+ **********************************************************************************/
+int store_append(struct iovec *iov, int iovcnt);
+
+/**********************************************************************************
+ * @name       store_sync()
+ *
+ * @brief      { Flushes appended data to stable storage where that means
+ *               anything. }
+ *
+ * @return     0 on success, -1 on failure
+ **********************************************************************************/
+int store_sync(void);
+
+/**********************************************************************************
+ * @name       store_read()
+ *
+ * @brief      { Reads history bytes at off without a shared position, so any
+ *               thread may call it. }
+ *
+ * @return     Bytes read, 0 past the end, -1 on failure
+ **********************************************************************************/
+ssize_t store_read(void *buf, size_t len, off_t off);
+
+/**********************************************************************************
+ * @name       store_size()
+ *
+ * @brief      { Current history length as the backend sees it. }
+ **********************************************************************************/
+off_t store_size(void);
+
+/**********************************************************************************
+ * @name       store_seekto()
+ *
+ * @brief      { History position of byte offset of the write_cmd-th command,
+ *               both zero based, like AESDCHAR_IOCSEEKTO. Every backend
+ *               follows the driver: a command that does not exist yet is
+ *               taken to start where the last one ends, so the position
+ *               lands past the end. }
+ *
+ * @return     0 on success, -1 when offset is past the end of an existing
+ *             command, write_cmd is more than the driver or the ring keep,
+ *             or on failure
+ **********************************************************************************/
+int store_seekto(unsigned int write_cmd, unsigned int offset, off_t *pos);
+
+/**********************************************************************************
+ * @name       store_start()
+ *
+ * @brief      { Offset of the oldest history byte a size-capped backend still
+ *               keeps. Offsets never move, older ones just stop being readable. }
+ **********************************************************************************/
+off_t store_start(void);
+
+/**********************************************************************************
+ * @name       store_send()
+ *
+ * @brief      { Sends up to count history bytes at off straight to a socket
+ *               with sendfile(), possibly fewer at a file boundary. }
+ *
+ * @return     Bytes sent, 0 past the end, -1 with errno set, EOPNOTSUPP when
+ *             the backend cannot
+ **********************************************************************************/
+ssize_t store_send(int sock_fd, off_t off, size_t count);
+
+/**********************************************************************************
+ * @name       store_map()
+ *
+ * @brief      { Read-only shared mapping of len history bytes at off, for a
+ *               STORE_STABLE backend. off and len are multiples of 1 MB. Pages
+ *               past the committed length must not be touched. Release it with
+ *               munmap(). }
+ *
+ * @return     Mapping, or NULL on failure
+ **********************************************************************************/
+void *store_map(off_t off, size_t len);
+
+/**********************************************************************************
+ * @name       store_writev()
+ *
+ * @brief      { Helper for fd backends, writes all of iov with as few writev()
+ *               calls as the kernel allows. When a call fails after part of
+ *               iov went out to a regular file, the file is truncated back to
+ *               where it ended before. }
+ *
+ * @return     0 on success, -1 on failure
+ **********************************************************************************/
+int store_writev(int fd, struct iovec *iov, int iovcnt);
+
+#endif /* AESDSOCKET_STORE_H */
@@ -0,0 +1,127 @@
+ /**********************************************************************************
+ * @file    aesdsocket-timeindex.c
+ * @brief   Wall-clock index of the timestamp lines in the aesdsocket history.
+ *
+ *          The appender notes the offset of every timestamp line it writes
+ *          next to the time in it. The entries are sorted by both, so a
+ *          request for the history since or until a time is a binary search
+ *          instead of reading and parsing the whole file. A time is known to
+ *          the resolution of the timestamp period, the range returned always
+ *          covers the one asked for.
+ *
+ *          The index lives in memory for the run, like the history file
+ *          itself. A wall clock stepping back is recorded as the latest time
+ *          seen, so the entries stay sorted.
+ *
+ * @author        <Li-Huan Lu>
+ * @date          <10/16/2026>
+ ***********************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <syslog.h>
+
+// Pthread
+#include <pthread.h>
+
+#include "aesdsocket-timeindex.h"
+
+#define TIMEINDEX_MIN_CAP 256   // entries, over 40 minutes at the 10 s period
+
+typedef struct stamp_s {
+	time_t t;
+	off_t off;
+} stamp_t;
+
+static pthread_mutex_t timeindex_mutex = PTHREAD_MUTEX_INITIALIZER;
+static stamp_t *stamps;
+static size_t stamps_cap;
+static size_t stamps_count;     // under timeindex_mutex
+
+/**********************************************************************************
+ * @name       timeindex_add()
+ **********************************************************************************/
+void timeindex_add(time_t t, off_t off)
+{
+	size_t new_cap;
+	stamp_t *grown;
+
+	pthread_mutex_lock(&timeindex_mutex);
+	if (stamps_count == stamps_cap){
+		new_cap = stamps_cap ? stamps_cap * 2 : TIMEINDEX_MIN_CAP;
+		grown = (stamp_t *) realloc(stamps, new_cap * sizeof(*stamps));
+		if (!grown){
+			pthread_mutex_unlock(&timeindex_mutex);
+			syslog(LOG_ERR, "Out of memory, timestamp at %lld not indexed", (long long)off);
+			return;
+		}
+		stamps = grown;
+		stamps_cap = new_cap;
+	}
+	if (stamps_count && t < stamps[stamps_count - 1].t) t = stamps[stamps_count - 1].t;
+	stamps[stamps_count].t = t;
+	stamps[stamps_count].off = off;
+	stamps_count++;
+	pthread_mutex_unlock(&timeindex_mutex);
+}
+
+/**********************************************************************************
+ * @name       stamps_upto()
+ *
+ * @brief      { Number of entries stamped no later than t, under the lock. }
+ **********************************************************************************/
+static size_t stamps_upto(time_t t)
+{
+	size_t lo = 0, hi = stamps_count, mid;
+
+	while (lo < hi){
+		mid = lo + (hi - lo) / 2;
+		if (stamps[mid].t <= t)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/**********************************************************************************
+ * @name       timeindex_since()
+ **********************************************************************************/
+off_t timeindex_since(time_t t)
+{
+	off_t off = 0;
+	size_t i;
+
+	// The first of the lines stamped with that second
+	pthread_mutex_lock(&timeindex_mutex);
+	i = stamps_upto(t);
+	if (i) off = stamps[stamps_upto(stamps[i - 1].t - 1)].off;
+	pthread_mutex_unlock(&timeindex_mutex);
+	return off;
+}
+
+/**********************************************************************************
+ * @name       timeindex_until()
+ **********************************************************************************/
+off_t timeindex_until(time_t t)
+{
+	off_t off = -1;
+	size_t i;
+
+	pthread_mutex_lock(&timeindex_mutex);
+	i = stamps_upto(t);
+	if (i < stamps_count) off = stamps[i].off;
+	pthread_mutex_unlock(&timeindex_mutex);
+	return off;
+}
+
+/**********************************************************************************
+ * @name       timeindex_clear()
+ **********************************************************************************/
+void timeindex_clear(void)
+{
+	pthread_mutex_lock(&timeindex_mutex);
+	free(stamps);
+	stamps = NULL;
+	stamps_cap = stamps_count = 0;
+	pthread_mutex_unlock(&timeindex_mutex);
+}
@@ -0,0 +1,49 @@
+ /**********************************************************************************
+ * @file    aesdsocket-timeindex.h
+ * @brief   Wall-clock index of the timestamp lines in the aesdsocket history.
+ *
+ * @author        <Li-Huan Lu>
+ * @date          <10/16/2026>
+ ***********************************************************************************/
+#ifndef AESDSOCKET_TIMEINDEX_H
+#define AESDSOCKET_TIMEINDEX_H
+
+#include <time.h>
+#include <sys/types.h>
+
+/**********************************************************************************
+ * @name       timeindex_add()
+ *
+ * @brief      { Records that the timestamp line for wall time t starts at
+ *               history offset off. Appender thread only, in history order. }
+ **********************************************************************************/
+void timeindex_add(time_t t, off_t off);
+
+/**********************************************************************************
+ * @name       timeindex_since()
+ *
+ * @brief      { Where the history written at or after t starts: the first
+ *               of the latest timestamp lines stamped no later than t. }
+ *
+ * @return     History offset, 0 when no line is that old
+ **********************************************************************************/
+off_t timeindex_since(time_t t);
+
+/**********************************************************************************
+ * @name       timeindex_until()
+ *
+ * @brief      { Where the history written at or before t ends: the first
+ *               timestamp line stamped after t. }
+ *
+ * @return     History offset, -1 when no line is that recent
+ **********************************************************************************/
+off_t timeindex_until(time_t t);
+
+/**********************************************************************************
+ * @name       timeindex_clear()
+ *
+ * @brief      { Frees the index. Call once the appender has stopped. }
+ **********************************************************************************/
+void timeindex_clear(void);
+
+#endif /* AESDSOCKET_TIMEINDEX_H */
@@ -0,0 +1,719 @@
+ /**********************************************************************************
+ * @file    aesdsocket-uring.c
+ * @brief   io_uring connection model for aesdsocket.
+ *
+ *          Like the epoll model, a fixed number of threads each own their
+ *          connections, but every loop drives them through its own io_uring:
+ *          accept, recv and the waits for a full socket or the timestamp
+ *          tick are queued as submissions and reaped as completions, so one
+ *          io_uring_enter() call submits the next operations of every
+ *          connection served in a round. Bytes are received straight into
+ *          the framer buffer. Replies go out with the same nonblocking
+ *          cache/sendfile/pread path as the other models. The listening
+ *          socket and the timerfd are registered as fixed files. With
+ *          reuseport every loop accepts from its own SO_REUSEPORT listener.
+ *          A connection parked for the appender has nothing queued, a poll
+ *          on the loop's eventfd brings it back once its records are in.
+ *
+ *          There is no liburing dependency, the rings are set up with the
+ *          raw system calls.
+ *
+ * @author        <Li-Huan Lu>
+ * @date          <10/16/2026>
+ * @reference     https://man7.org/linux/man-pages/man7/io_uring.7.html
+ *                https://man7.org/linux/man-pages/man2/io_uring_enter.2.html
+ ***********************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+// Socket
+#include <sys/types.h>
+#include <sys/socket.h>
+
+// Pthread
+#include <pthread.h>
+#include <sys/queue.h>
+#include <sys/un.h>
+
+#include "aesdsocket.h"
+#include "aesdsocket-conn.h"
+#include "aesdsocket-log.h"
+#include "aesdsocket-store.h"
+
+#define URING_SQ_ENTRIES 256
+#define URING_CQ_ENTRIES 4096   // one operation per connection is in flight at most
+#define URING_TICK_SEC   1      // upper bound on how long terminate goes unnoticed
+
+// Fixed file slots
+#define URING_FIXED_LISTEN 0
+#define URING_FIXED_TIMER  1
+
+// What a completion is for, kept in the low bits of user_data; loops and
+// connections come from calloc() and are 16 byte aligned
+enum {
+	UOP_ACCEPT = 0,             // loop, accept on the listening socket
+	UOP_TIMER,                  // loop, timerfd readable
+	UOP_TICK,                   // loop, periodic wake up
+	UOP_CANCEL,                 // loop, result of a cancel request
+	UOP_RECV,                   // connection, bytes received
+	UOP_RECV_POLL,              // connection, readable again after EAGAIN
+	UOP_SEND_POLL,              // connection, writable again
+	UOP_ACCEPT_LOCAL,           // loop, accept on the UNIX domain listener
+	UOP_WAKE,                   // loop, appender committed records of parked connections
+	UOP_MASK = 15,
+};
+
+typedef struct uring_loop_s {
+	pthread_t thread_id;
+	int index;
+	int listen_fd;
+	int own_listener;           // listen_fd is this loop's SO_REUSEPORT socket
+	int local_fd;               // UNIX domain listener, shared by all loops, or -1
+	int timer_fd;
+	int fixed;                  // listen_fd and timer_fd are registered
+
+	// Ring
+	int ring_fd;
+	void *sq_map, *cq_map;
+	size_t sq_map_len, cq_map_len;
+	struct io_uring_sqe *sqes;
+	size_t sqes_len;
+	unsigned *sq_head, *sq_tail, *sq_mask, *sq_array, sq_entries;
+	unsigned *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_cqe *cqes;
+	unsigned sq_local_tail;     // next free slot, published on submit
+	unsigned inflight;          // submissions without a completion yet
+
+	// Buffers the kernel fills in for queued operations
+	struct sockaddr_in accept_addr;
+	socklen_t accept_len;
+	struct sockaddr_un local_addr;
+	socklen_t local_len;
+	struct __kernel_timespec tick;
+
+	int stopping;
+	unsigned accept_paused;     // 1 << UOP_ACCEPT*, resumed on the next tick
+	conn_waiters_t waiters;
+	struct aesd_conn_list conns;
+} __attribute__((aligned(16))) uring_loop_t;
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *p)
+{
+	return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+	return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int sys_io_uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args)
+{
+	return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+/**********************************************************************************
+ * @name       uring_supported()
+ **********************************************************************************/
+int uring_supported(void)
+{
+	static const unsigned char needed[] = {
+		IORING_OP_ACCEPT, IORING_OP_RECV, IORING_OP_POLL_ADD,
+		IORING_OP_TIMEOUT, IORING_OP_ASYNC_CANCEL,
+	};
+	struct io_uring_params params;
+	struct io_uring_probe *probe;
+	size_t probe_len = sizeof(*probe) + IORING_OP_LAST * sizeof(struct io_uring_probe_op);
+	int fd, ok = 0;
+	size_t i;
+
+	memset(&params, 0, sizeof(params));
+	fd = sys_io_uring_setup(4, &params);
+	if (fd == -1){
+		syslog(LOG_INFO, "io_uring_setup: %s", strerror(errno));
+		return 0;
+	}
+
+	probe = (struct io_uring_probe *) calloc(1, probe_len);
+	if (probe && (params.features & IORING_FEAT_NODROP) &&
+	    sys_io_uring_register(fd, IORING_REGISTER_PROBE, probe, IORING_OP_LAST) == 0){
+		ok = 1;
+		for (i = 0; i < sizeof(needed); i++){
+			if (needed[i] > probe->last_op || !(probe->ops[needed[i]].flags & IO_URING_OP_SUPPORTED))
+				ok = 0;
+		}
+	}
+	if (!ok) syslog(LOG_INFO, "io_uring lacks operations aesdsocket needs");
+
+	free(probe);
+	close(fd);
+	return ok;
+}
+
+/**********************************************************************************
+ * @name       uring_setup()
+ *
+ * @brief      { Creates the ring and maps its queues. }
+ *
+ * @return     0 on success, -1 on failure
+ **********************************************************************************/
+static int uring_setup(uring_loop_t *loop)
+{
+	struct io_uring_params params;
+
+	memset(&params, 0, sizeof(params));
+	params.flags = IORING_SETUP_CQSIZE;
+	params.cq_entries = URING_CQ_ENTRIES;
+
+	loop->ring_fd = sys_io_uring_setup(URING_SQ_ENTRIES, &params);
+	if (loop->ring_fd == -1){
+		perror("io_uring_setup");
+		syslog(LOG_ERR, "io_uring_setup failed: %s", strerror(errno));
+		return -1;
+	}
+
+	loop->sq_map_len = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	loop->cq_map_len = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	if (params.features & IORING_FEAT_SINGLE_MMAP){
+		if (loop->cq_map_len > loop->sq_map_len) loop->sq_map_len = loop->cq_map_len;
+		loop->cq_map_len = 0;
+	}
+
+	loop->sq_map = mmap(NULL, loop->sq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+	                    loop->ring_fd, IORING_OFF_SQ_RING);
+	if (loop->sq_map == MAP_FAILED){
+		loop->sq_map = NULL;
+		goto fail;
+	}
+	if (loop->cq_map_len){
+		loop->cq_map = mmap(NULL, loop->cq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+		                    loop->ring_fd, IORING_OFF_CQ_RING);
+		if (loop->cq_map == MAP_FAILED){
+			loop->cq_map = NULL;
+			goto fail;
+		}
+	}
+	else {
+		loop->cq_map = loop->sq_map;
+	}
+
+	loop->sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+	loop->sqes = (struct io_uring_sqe *) mmap(NULL, loop->sqes_len, PROT_READ | PROT_WRITE,
+	                                          MAP_SHARED | MAP_POPULATE, loop->ring_fd, IORING_OFF_SQES);
+	if (loop->sqes == MAP_FAILED){
+		loop->sqes = NULL;
+		goto fail;
+	}
+
+	loop->sq_head    = (unsigned *)((char *)loop->sq_map + params.sq_off.head);
+	loop->sq_tail    = (unsigned *)((char *)loop->sq_map + params.sq_off.tail);
+	loop->sq_mask    = (unsigned *)((char *)loop->sq_map + params.sq_off.ring_mask);
+	loop->sq_array   = (unsigned *)((char *)loop->sq_map + params.sq_off.array);
+	loop->sq_entries = params.sq_entries;
+	loop->cq_head    = (unsigned *)((char *)loop->cq_map + params.cq_off.head);
+	loop->cq_tail    = (unsigned *)((char *)loop->cq_map + params.cq_off.tail);
+	loop->cq_mask    = (unsigned *)((char *)loop->cq_map + params.cq_off.ring_mask);
+	loop->cqes       = (struct io_uring_cqe *)((char *)loop->cq_map + params.cq_off.cqes);
+	loop->sq_local_tail = *loop->sq_tail;
+	return 0;
+
+fail:
+	perror("mmap");
+	syslog(LOG_ERR, "io_uring mmap failed: %s", strerror(errno));
+	return -1;
+}
+
+/**********************************************************************************
+ * @name       uring_teardown()
+ **********************************************************************************/
+static void uring_teardown(uring_loop_t *loop)
+{
+	if (loop->sqes) munmap(loop->sqes, loop->sqes_len);
+	if (loop->cq_map && loop->cq_map != loop->sq_map) munmap(loop->cq_map, loop->cq_map_len);
+	if (loop->sq_map) munmap(loop->sq_map, loop->sq_map_len);
+	if (loop->ring_fd != -1) close(loop->ring_fd);
+	loop->sqes = NULL;
+	loop->sq_map = loop->cq_map = NULL;
+	loop->ring_fd = -1;
+}
+
+/**********************************************************************************
+ * @name       uring_submit()
+ *
+ * @brief      { Publishes the queued submissions and hands them to the kernel,
+ *               optionally waiting for at least one completion. }
+ *
+ * @return     0 on success, -1 on failure
+ **********************************************************************************/
+static int uring_submit(uring_loop_t *loop, int wait)
+{
+	unsigned pending;
+
+	__atomic_store_n(loop->sq_tail, loop->sq_local_tail, __ATOMIC_RELEASE);
+	pending = loop->sq_local_tail - __atomic_load_n(loop->sq_head, __ATOMIC_ACQUIRE);
+	if (!pending && !wait) return 0;
+
+	if (sys_io_uring_enter(loop->ring_fd, pending, wait ? 1 : 0, wait ? IORING_ENTER_GETEVENTS : 0) == -1){
+		if (errno == EINTR || errno == EAGAIN || errno == EBUSY) return 0;
+		perror("io_uring_enter");
+		syslog(LOG_ERR, "io_uring_enter failed: %s", strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+/**********************************************************************************
+ * @name       uring_sqe()
+ *
+ * @brief      { Returns a cleared submission slot tagged with user_data, first
+ *               flushing the queue to the kernel when it is full. }
+ *
+ * @return     Slot, or NULL when the queue stays full
+ **********************************************************************************/
+static struct io_uring_sqe *uring_sqe(uring_loop_t *loop, void *ptr, unsigned op)
+{
+	struct io_uring_sqe *sqe;
+	unsigned idx;
+
+	if (loop->sq_local_tail - __atomic_load_n(loop->sq_head, __ATOMIC_ACQUIRE) == loop->sq_entries){
+		if (uring_submit(loop, 0) ||
+		    loop->sq_local_tail - __atomic_load_n(loop->sq_head, __ATOMIC_ACQUIRE) == loop->sq_entries){
+			log_post(LOGC_IO, LOG_ERR, "io_uring submission queue full");
+			return NULL;
+		}
+	}
+
+	idx = loop->sq_local_tail & *loop->sq_mask;
+	sqe = &loop->sqes[idx];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->user_data = (uint64_t)(uintptr_t)ptr | op;
+	loop->sq_array[idx] = idx;
+	loop->sq_local_tail++;
+	loop->inflight++;
+	return sqe;
+}
+
+/**********************************************************************************
+ * @name       uring_fd()
+ *
+ * @brief      { Points a submission at a registered file when there is one. }
+ **********************************************************************************/
+static void uring_fd(uring_loop_t *loop, struct io_uring_sqe *sqe, int fd, int slot)
+{
+	if (loop->fixed){
+		sqe->fd = slot;
+		sqe->flags |= IOSQE_FIXED_FILE;
+	}
+	else {
+		sqe->fd = fd;
+	}
+}
+
+/**********************************************************************************
+ * @name       uring_poll()
+ **********************************************************************************/
+static int uring_poll(uring_loop_t *loop, void *ptr, unsigned op, int fd, short events)
+{
+	struct io_uring_sqe *sqe = uring_sqe(loop, ptr, op);
+
+	if (!sqe) return -1;
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = fd;
+	sqe->poll_events = events;
+	return 0;
+}
+
+/**********************************************************************************
+ * @name       uring_accept()
+ **********************************************************************************/
+static int uring_accept(uring_loop_t *loop)
+{
+	struct io_uring_sqe *sqe = uring_sqe(loop, loop, UOP_ACCEPT);
+
+	if (!sqe) return -1;
+	loop->accept_len = sizeof(loop->accept_addr);
+	sqe->opcode = IORING_OP_ACCEPT;
+	uring_fd(loop, sqe, loop->listen_fd, URING_FIXED_LISTEN);
+	sqe->addr = (uint64_t)(uintptr_t)&loop->accept_addr;
+	sqe->addr2 = (uint64_t)(uintptr_t)&loop->accept_len;
+	sqe->accept_flags = SOCK_NONBLOCK;
+	return 0;
+}
+
+/**********************************************************************************
+ * @name       uring_accept_local()
+ **********************************************************************************/
+static int uring_accept_local(uring_loop_t *loop)
+{
+	struct io_uring_sqe *sqe = uring_sqe(loop, loop, UOP_ACCEPT_LOCAL);
+
+	if (!sqe) return -1;
+	loop->local_len = sizeof(loop->local_addr);
+	sqe->opcode = IORING_OP_ACCEPT;
+	sqe->fd = loop->local_fd;
+	sqe->addr = (uint64_t)(uintptr_t)&loop->local_addr;
+	sqe->addr2 = (uint64_t)(uintptr_t)&loop->local_len;
+	sqe->accept_flags = SOCK_NONBLOCK;
+	return 0;
+}
+
+/**********************************************************************************
+ * @name       uring_timer()
+ **********************************************************************************/
+static int uring_timer(uring_loop_t *loop)
+{
+	struct io_uring_sqe *sqe = uring_sqe(loop, loop, UOP_TIMER);
+
+	if (!sqe) return -1;
+	sqe->opcode = IORING_OP_POLL_ADD;
+	uring_fd(loop, sqe, loop->timer_fd, URING_FIXED_TIMER);
+	sqe->poll_events = POLLIN;
+	return 0;
+}
+
+/**********************************************************************************
+ * @name       uring_tick()
+ **********************************************************************************/
+static int uring_tick(uring_loop_t *loop)
+{
+	struct io_uring_sqe *sqe = uring_sqe(loop, loop, UOP_TICK);
+
+	if (!sqe) return -1;
+	loop->tick.tv_sec = URING_TICK_SEC;
+	loop->tick.tv_nsec = 0;
+	sqe->opcode = IORING_OP_TIMEOUT;
+	sqe->fd = -1;
+	sqe->addr = (uint64_t)(uintptr_t)&loop->tick;
+	sqe->len = 1;
+	return 0;
+}
+
+/**********************************************************************************
+ * @name       uring_wake()
+ **********************************************************************************/
+static int uring_wake(uring_loop_t *loop)
+{
+	return uring_poll(loop, loop, UOP_WAKE, loop->waiters.fd, POLLIN);
+}
+
+/**********************************************************************************
+ * @name       uring_cancel()
+ *
+ * @brief      { Asks the kernel to cancel the operation tagged with user_data. }
+ **********************************************************************************/
+static void uring_cancel(uring_loop_t *loop, void *ptr, unsigned op)
+{
+	struct io_uring_sqe *sqe = uring_sqe(loop, loop, UOP_CANCEL);
+
+	if (!sqe) return;
+	sqe->opcode = IORING_OP_ASYNC_CANCEL;
+	sqe->fd = -1;
+	sqe->addr = (uint64_t)(uintptr_t)ptr | op;
+}
+
+/**********************************************************************************
+ * @name       uring_conn_next()
+ *
+ * @brief      { Queues what the connection waits for after conn_handle() or
+ *               conn_received() returned ret: a recv straight into the framer
+ *               buffer or a poll for writable, nothing while it is parked.
+ *               Drops it on CONN_CLOSE. }
+ **********************************************************************************/
+static void uring_conn_next(uring_loop_t *loop, aesd_conn_t *conn, int ret)
+{
+	struct io_uring_sqe *sqe;
+	size_t len;
+	char *buf;
+
+	if (ret == CONN_COMMIT) return;
+	if (ret == CONN_WRITE){
+		if (uring_poll(loop, conn, UOP_SEND_POLL, conn->client_fd, POLLOUT) == 0) return;
+	}
+	else if (ret == CONN_READ && conn_rx_space(conn, &buf, &len) == 0){
+		sqe = uring_sqe(loop, conn, UOP_RECV);
+		if (sqe){
+			sqe->opcode = IORING_OP_RECV;
+			sqe->fd = conn->client_fd;
+			sqe->addr = (uint64_t)(uintptr_t)buf;
+			sqe->len = len > 0x7fffffff ? 0x7fffffff : (unsigned)len;
+			return;
+		}
+	}
+
+	LIST_REMOVE(conn, entries);
+	conn_close(conn);
+}
+
+/**********************************************************************************
+ * @name       uring_complete()
+ *
+ * @brief      { Handles one completion and queues the follow-up operation. }
+ **********************************************************************************/
+static void uring_complete(uring_loop_t *loop, uint64_t user_data, int res)
+{
+	void *ptr = (void *)(uintptr_t)(user_data & ~(uint64_t)UOP_MASK);
+	unsigned op = user_data & UOP_MASK;
+	aesd_conn_t *conn = (aesd_conn_t *)ptr;
+	uint64_t expirations, now;
+
+	loop->inflight--;
+
+	switch (op){
+		case UOP_ACCEPT:
+		case UOP_ACCEPT_LOCAL:
+			if (res >= 0){
+				if (loop->stopping){
+					close(res);
+					break;
+				}
+				conn = conn_new(res, op == UOP_ACCEPT ? (struct sockaddr *)&loop->accept_addr
+				                                      : (struct sockaddr *)&loop->local_addr);
+				if (conn){
+					conn->owner = loop->index;
+					if (loop->waiters.fd != -1) conn->waiters = &loop->waiters;
+					LIST_INSERT_HEAD(&loop->conns, conn, entries);
+					uring_conn_next(loop, conn, CONN_READ);
+				}
+			}
+			else if (res == -EMFILE || res == -ENFILE){
+				// Retrying at once would fail the same way, the backlog holds them meanwhile
+				if (!loop->accept_paused) log_post(LOGC_IO, LOG_ERR, "accept: %s, loop %d pauses accepting", strerror(-res), loop->index);
+				loop->accept_paused |= 1u << op;
+				break;
+			}
+			else if (res != -EAGAIN && res != -EINTR && res != -ECONNABORTED && res != -ECANCELED){
+				log_post(LOGC_IO, LOG_ERR, "accept failed: %s", strerror(-res));
+			}
+			if (!loop->stopping && (op == UOP_ACCEPT ? uring_accept(loop) : uring_accept_local(loop)))
+				syslog(LOG_ERR, "accept not queued, loop %d stops accepting", loop->index);
+			break;
+
+		case UOP_TIMER:
+			if (loop->stopping) break;
+			if (read(loop->timer_fd, &expirations, sizeof(expirations)) > 0 && write_timestamp())
+				syslog(LOG_ERR, "timestamp failed.");
+			uring_timer(loop);
+			break;
+
+		case UOP_TICK:
+			if (loop->stopping) break;
+			uring_tick(loop);
+			if (conn_timeouts()){
+				now = conn_clock();
+				LIST_FOREACH(conn, &loop->conns, entries)
+					conn_expire(conn, now);
+			}
+			if ((loop->accept_paused & (1u << UOP_ACCEPT)) && uring_accept(loop) == 0)
+				loop->accept_paused &= ~(1u << UOP_ACCEPT);
+			if ((loop->accept_paused & (1u << UOP_ACCEPT_LOCAL)) && uring_accept_local(loop) == 0)
+				loop->accept_paused &= ~(1u << UOP_ACCEPT_LOCAL);
+			break;
+
+		case UOP_CANCEL:
+			break;
+
+		case UOP_WAKE:
+			if (loop->stopping) break;
+			if (read(loop->waiters.fd, &expirations, sizeof(expirations)) > 0){
+				while ((conn = conn_waiters_ready(&loop->waiters)) != NULL)
+					uring_conn_next(loop, conn, conn_handle(conn));
+			}
+			if (uring_wake(loop)) syslog(LOG_ERR, "eventfd poll not queued, loop %d stalls parked connections", loop->index);
+			break;
+
+		case UOP_RECV:
+			if (loop->stopping || (res < 0 && res != -EAGAIN && res != -EINTR)){
+				if (!loop->stopping) log_post(LOGC_IO, LOG_ERR, "recv: %s", strerror(-res));
+				LIST_REMOVE(conn, entries);
+				conn_close(conn);
+			}
+			else if (res == -EAGAIN){
+				if (uring_poll(loop, conn, UOP_RECV_POLL, conn->client_fd, POLLIN)){
+					LIST_REMOVE(conn, entries);
+					conn_close(conn);
+				}
+			}
+			else {
+				uring_conn_next(loop, conn, res == -EINTR ? CONN_READ : conn_received(conn, res));
+			}
+			break;
+
+		case UOP_RECV_POLL:
+		case UOP_SEND_POLL:
+			if (loop->stopping || res < 0){
+				LIST_REMOVE(conn, entries);
+				conn_close(conn);
+			}
+			else {
+				uring_conn_next(loop, conn, op == UOP_RECV_POLL ? CONN_READ : conn_handle(conn));
+			}
+			break;
+	}
+}
+
+/**********************************************************************************
+ * @name       uring_stop()
+ *
+ * @brief      { Cancels the accept, tick and timer waits and shuts the client
+ *               sockets down, so that every operation in flight completes and
+ *               no buffer is freed under the kernel. }
+ **********************************************************************************/
+static void uring_stop(uring_loop_t *loop)
+{
+	aesd_conn_t *conn;
+
+	loop->stopping = 1;
+	uring_cancel(loop, loop, UOP_ACCEPT);
+	if (loop->local_fd != -1) uring_cancel(loop, loop, UOP_ACCEPT_LOCAL);
+	uring_cancel(loop, loop, UOP_TICK);
+	if (loop->timer_fd != -1) uring_cancel(loop, loop, UOP_TIMER);
+	if (loop->waiters.fd != -1) uring_cancel(loop, loop, UOP_WAKE);
+	LIST_FOREACH(conn, &loop->conns, entries)
+		shutdown(conn->client_fd, SHUT_RDWR);
+}
+
+/**********************************************************************************
+ * @name       uring_thread()
+ **********************************************************************************/
+static void *uring_thread(void *arg)
+{
+	uring_loop_t *loop = (uring_loop_t *)arg;
+	struct io_uring_cqe *cqe;
+	unsigned head, tail;
+	aesd_conn_t *conn;
+
+	while (loop->inflight){
+		if (terminate && !loop->stopping) uring_stop(loop);
+
+		if (uring_submit(loop, 1)) break;
+
+		// Reap everything that completed, the next submit carries all follow-ups
+		head = *loop->cq_head;
+		tail = __atomic_load_n(loop->cq_tail, __ATOMIC_ACQUIRE);
+		while (head != tail){
+			cqe = &loop->cqes[head & *loop->cq_mask];
+			head++;
+			uring_complete(loop, cqe->user_data, cqe->res);
+			__atomic_store_n(loop->cq_head, head, __ATOMIC_RELEASE);
+		}
+	}
+
+	// Parked connections, or all of them after a ring failure, nothing can complete any more
+	while ((conn = LIST_FIRST(&loop->conns)) != NULL){
+		LIST_REMOVE(conn, entries);
+		conn_close(conn);
+	}
+	uring_teardown(loop);
+
+	return NULL;
+}
+
+/**********************************************************************************
+ * @name       uring_loop_init()
+ **********************************************************************************/
+static int uring_loop_init(uring_loop_t *loop, int index, int listen_fd, const server_opts_t *opts)
+{
+	int reuseport = opts->reuseport;
+	int files[2];
+
+	loop->index = index;
+	loop->listen_fd = listen_fd;
+	loop->local_fd = opts->local_fd;
+	loop->timer_fd = -1;
+	LIST_INIT(&loop->conns);
+
+	// Loop 0 keeps the socket main() bound, it is part of the same group
+	if (reuseport && index > 0){
+		loop->listen_fd = listener_reuseport(opts->backlog);
+		if (loop->listen_fd == -1) return -1;
+		loop->own_listener = 1;
+	}
+
+	if (uring_setup(loop)) return -1;
+
+	if (index == 0 && (store_flags() & STORE_TIMESTAMPS)){
+		loop->timer_fd = timestamp_timer_create();
+		if (loop->timer_fd == -1) return -1;
+	}
+
+	// Saves the kernel a file table lookup per accept and tick, optional
+	files[URING_FIXED_LISTEN] = loop->listen_fd;
+	files[URING_FIXED_TIMER] = loop->timer_fd;
+	if (sys_io_uring_register(loop->ring_fd, IORING_REGISTER_FILES, files,
+	                          loop->timer_fd != -1 ? 2 : 1) == 0)
+		loop->fixed = 1;
+	else
+		syslog(LOG_INFO, "io_uring fixed files: %s", strerror(errno));
+
+	if (uring_accept(loop) || uring_tick(loop)) return -1;
+	if (loop->local_fd != -1 && uring_accept_local(loop)) return -1;
+	if (loop->timer_fd != -1 && uring_timer(loop)) return -1;
+	if (loop->waiters.fd != -1 && uring_wake(loop)) return -1;
+	return 0;
+}
+
+/**********************************************************************************
+ * @name       run_uring_server()
+ **********************************************************************************/
+int run_uring_server(int listen_fd, const server_opts_t *opts)
+{
+	int nloops = opts->nthreads;
+	uring_loop_t *loops;
+	int i, started = 0, ret = 0;
+
+	loops = (uring_loop_t *) calloc(nloops, sizeof(uring_loop_t));
+	if (!loops){
+		syslog(LOG_ERR, "Out of memory");
+		return -1;
+	}
+	for (i = 0; i < nloops; i++){
+		loops[i].ring_fd = -1;
+		loops[i].timer_fd = -1;
+		conn_waiters_init(&loops[i].waiters);
+	}
+
+	for (i = 0; i < nloops; i++){
+		if (uring_loop_init(&loops[i], i, listen_fd, opts)){
+			uring_teardown(&loops[i]);
+			ret = -1;
+			break;
+		}
+		if (pthread_create(&loops[i].thread_id, NULL, uring_thread, &loops[i])){
+			perror("pthread_create");
+			syslog(LOG_ERR, "pthread_create failed for io_uring loop %d", i);
+			uring_teardown(&loops[i]);
+			ret = -1;
+			break;
+		}
+		if (opts->affinity) thread_pin(loops[i].thread_id, i);
+		started++;
+	}
+	// A listener nobody accepts from would still take its share of connections
+	if (i < nloops && loops[i].own_listener){
+		close(loops[i].listen_fd);
+		loops[i].own_listener = 0;
+	}
+
+	// A partial start still serves with fewer loops
+	if (started == 0) terminate = 1;
+
+	for (i = 0; i < started; i++)
+		pthread_join(loops[i].thread_id, NULL);
+
+	for (i = 0; i < nloops; i++){
+		if (loops[i].timer_fd != -1) close(loops[i].timer_fd);
+		if (loops[i].own_listener) close(loops[i].listen_fd);
+		conn_waiters_destroy(&loops[i].waiters);
+	}
+	free(loops);
+
+	return started ? 0 : ret;
+}
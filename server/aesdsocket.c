@@ -9,7 +9,9 @@
  *                https://beej.us/guide/bgnet/html/
  *                https://nxmnpg.lemoda.net/3/SLIST_FOREACH_SAFE
  *                https://github.com/stockrt/queue.h/blob/master/sample.c
+ *                https://man7.org/linux/man-pages/man7/epoll.7.html
  ***********************************************************************************/
+#define _GNU_SOURCE     // CPU affinity
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
@@ -18,54 +20,40 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <signal.h>
+#include <sched.h>
 #include <time.h>
 #include <errno.h>
+#include <limits.h>
 
 // Socket
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netdb.h>
+#include <sys/un.h>
 #include <arpa/inet.h>
 
 // Pthread
 #include <pthread.h>
-#include <sys/queue.h>
 
-// aesd ioctl
-#include "../aesd-char-driver/aesd_ioctl.h"
+// Options
+#include <getopt.h>
 
-#ifndef USE_AESD_CHAR_DEVICE
-#define USE_AESD_CHAR_DEVICE 1  // default
-#endif
+#include "aesdsocket.h"
+#include "aesdsocket-appender.h"
+#include "aesdsocket-cache.h"
+#include "aesdsocket-capture.h"
+#include "aesdsocket-channel.h"
+#include "aesdsocket-conn.h"
+#include "aesdsocket-iobuf.h"
+#include "aesdsocket-log.h"
+#include "aesdsocket-metrics.h"
+#include "aesdsocket-shm.h"
+#include "aesdsocket-store.h"
+#include "aesdsocket-timeindex.h"
 
-#define LISTEN_BACKLOG 50   // From linux manual page
-#define BUFF_SIZE      1024
-
-#if USE_AESD_CHAR_DEVICE
-    const char filename[] = "/dev/aesdchar";
-#else
-    const char filename[] = "/var/tmp/aesdsocketdata";
-#endif
-typedef struct slist_thread_s{
-	pthread_t thread_id;
-	int client_fd;
-	char client_ip[INET_ADDRSTRLEN];
-	bool thread_complete;
-	
-	SLIST_ENTRY(slist_thread_s) entries;
-} slist_thread_t;
-
-SLIST_HEAD(slisthead, slist_thread_s) head;
-
-pthread_mutex_t file_mutex = PTHREAD_MUTEX_INITIALIZER;
-
-int sockfd, new_sockfd;
-int wrfd;
+int sockfd;
 volatile int terminate = 0;
 
-#if !USE_AESD_CHAR_DEVICE	
-pthread_t timestamp_id;
-#endif
 /**********************************************************************************
  * @name       signal_handler()
  *
@@ -94,227 +82,207 @@ void set_signal(void)
     sa.sa_flags = 0;
 	sigaction(SIGTERM, &sa, NULL);
 	sigaction(SIGINT, &sa, NULL);	
+
+	// sendfile() has no MSG_NOSIGNAL, a client leaving mid reply gets EPIPE
+	sa.sa_handler = SIG_IGN;
+	sigaction(SIGPIPE, &sa, NULL);
 }
 
 /**********************************************************************************
- * @name       append_timestamp()       
+ * @name       write_timestamp()       
  **********************************************************************************/
-void* append_timestamp(void* arg)
+int write_timestamp(void)
 {
-	int ret;
-	ssize_t ret_byte;
 	time_t rawtime;
     struct tm * timeinfo;
     char buffer [80];
-    int fd;
-	
-	while (!terminate){
-		sleep(10);
-		if (terminate) break;
-		
-	    // Get wall time	
-        time (&rawtime);
-        timeinfo = localtime (&rawtime);
-        strftime(buffer, sizeof(buffer), "timestamp:%a %b %d %H:%M:%S %Y\n", timeinfo);
-	
-	    // Lock file
-        ret = pthread_mutex_lock(&file_mutex);		
-        if (ret){
-		    perror("pthread_mutex_lock");
-		    exit(1);
-        }
+	size_t len;
 	
-		fd = open(filename, O_WRONLY | O_APPEND | O_CREAT, 0664);
-		if (fd == -1){
-			perror("open");
-			syslog(LOG_ERR, "open");
-			exit(1);
-		}
+	// Get wall time	
+	time (&rawtime);
+	timeinfo = localtime (&rawtime);
+	len = strftime(buffer, sizeof(buffer), "timestamp:%a %b %d %H:%M:%S %Y\n", timeinfo);
+
+	// Append and index, nobody waits for the commit
+	return appender_append_stamp(buffer, len, rawtime);
+}
+
+/**********************************************************************************
+ * @name       listener_open()
+ *
+ * @brief      { Opens a stream socket bound to port 9000, not listening yet. }
+ **********************************************************************************/
+int listener_open(int reuseport)
+{
+	struct addrinfo hints, *servinfo;
+	int fd, ret, yes = 1;
+
+	fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd == -1){
+	    perror("socket");
+		syslog(LOG_ERR, "socket create failed.");
+		return -1;
+	}
 	
-		// Append	
-		ret_byte = write(fd, buffer, strlen(buffer));
-		if (ret_byte != strlen(buffer)){
-			perror("write");
-			syslog(LOG_ERR, "write");
-			pthread_mutex_unlock(&file_mutex);
-			exit(1);
-		}
-			
-		ret = pthread_mutex_unlock(&file_mutex);
-		if (ret){
-			perror("pthread_mutex_lock");
-			exit(1);
-		}
-		// Unlock file
-		
-		close(fd);
+	// Enable SO_REUSEADDR to allow reuse of the address/port
+	ret = setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+	// Every listener of the group must set SO_REUSEPORT before bind()
+	if (ret == 0 && reuseport)
+		ret = setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof(yes));
+    if (ret == -1) {
+        perror("setsockopt");
+        syslog(LOG_ERR, "setsockopt failed.");
+        close(fd);
+        return -1;
     }
+
+	memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC; 
+    hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE;
 	
-	return NULL;
+	ret = getaddrinfo(NULL, "9000", &hints, &servinfo);
+    if (ret != 0) {
+        fprintf(stderr, "getaddrinfo: %s\n", gai_strerror(ret));
+		syslog(LOG_ERR, "getaddrinfo failed with errcode %d.", ret);
+        close(fd);
+        return -1;
+    }
+
+	// bind()
+	ret = bind(fd, servinfo->ai_addr, sizeof(struct sockaddr));
+	// Free memory
+	freeaddrinfo(servinfo); // all done with this structure
+	if (ret == -1){
+	    perror("bind");
+		syslog(LOG_ERR, "bind failed.");
+		close(fd);
+		return -1;
+	}
+	return fd;
 }
 
+/**********************************************************************************
+ * @name       listener_reuseport()
+ **********************************************************************************/
+int listener_reuseport(int backlog)
+{
+	int fd = listener_open(1);
+
+	if (fd != -1 && listen(fd, backlog) == -1){
+	    perror("listen");
+		syslog(LOG_ERR, "listen failed.");
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
 
 /**********************************************************************************
- * @name       socketThread()
- *
- * @brief      { Socket thread for send and receive. }
- *
- * @param[in]  threadp { Pointer to thread parameter }
- * 
- * @return     None 
+ * @name       listener_local()
  **********************************************************************************/
-void *socketThread(void *arg)
-{	
-	// Return code
-	int ret;
-	ssize_t ret_byte, bytes_to_wr, bytes_to_send;
-	// Buffer
-	char recv_buf[BUFF_SIZE];
-	char send_buf[BUFF_SIZE];
-	// Flags
-    int send_enable = 0;
-	// FD
-	int rdfd;
-	
-	slist_thread_t *thread_data = (slist_thread_t *)arg;
-	
-    // Receives data over the connection, until client closes connection, return 0
-    while ((ret_byte = recv(thread_data->client_fd, recv_buf, sizeof(recv_buf), 0)) > 0){
-		if (ret_byte == -1){
-			perror("recv");
-			syslog(LOG_ERR, "recv");
-			return NULL;
-		}
-		// Appends to file 1 byte at a time
-		bytes_to_wr = ret_byte;
-		if (recv_buf[bytes_to_wr-1] == '\n') send_enable = 1;
-		
-		// Lock file
-        ret = pthread_mutex_lock(&file_mutex);		
-		if (ret){
-		    perror("pthread_mutex_lock");
-			return NULL;
-		}
-		
-		// Handle ioctl
-		if (strncmp(recv_buf, "AESDCHAR_IOCSEEKTO:", 19) == 0) {
-		    unsigned int write_cmd, offset;
-			
-			if (sscanf(recv_buf, "AESDCHAR_IOCSEEKTO:%u,%u", &write_cmd, &offset) == 2) {
-			    struct aesd_seekto seekto;
-                seekto.write_cmd = write_cmd;
-                seekto.write_cmd_offset = offset;
-				
-				int iofd = open(filename, O_RDWR);
-		        if (iofd == -1){
-			        perror("open");
-			        syslog(LOG_ERR, "open");
-					pthread_mutex_unlock(&file_mutex);
-			        return NULL;
-		        }
-				
-                int result_ret = ioctl(iofd,AESDCHAR_IOCSEEKTO,&seekto);
-			    if (result_ret == -1){
-			        perror("ioctl");
-			        syslog(LOG_ERR, "ioctl");
-					close(iofd);
-					pthread_mutex_unlock(&file_mutex);
-			        return NULL;
-		        }
-				
-				while ((ret_byte = read(iofd, send_buf, sizeof(send_buf))) > 0){
-					if (ret_byte == -1){
-						perror("read");
-						syslog(LOG_ERR, "read");
-						pthread_mutex_unlock(&file_mutex);
-						return NULL;
-					}
-						
-					bytes_to_send = ret_byte;
-					ret_byte = send(thread_data->client_fd, send_buf, bytes_to_send, 0);
-					if (ret_byte == -1){
-						perror("send");
-						syslog(LOG_ERR, "send");
-						close(iofd);
-						pthread_mutex_unlock(&file_mutex);
-						return NULL;
-					}
-			    }
-				
-				close(iofd);
-			}
-			
-			pthread_mutex_unlock(&file_mutex);
-            continue;		
-		}
-		
-		wrfd = open(filename, O_WRONLY | O_CREAT | O_APPEND, 0664);
-		if (wrfd == -1){
-			perror("open");
-			syslog(LOG_ERR, "open");
-			pthread_mutex_unlock(&file_mutex);
-			return NULL;
-		}
-	
-		ret_byte = write(wrfd, recv_buf, bytes_to_wr);
-		if (ret_byte == -1){
-			perror("write");
-			syslog(LOG_ERR, "write");
-			pthread_mutex_unlock(&file_mutex);
-			return NULL;
-		}
-	    close(wrfd);
-		
-		if (!send_enable) continue; // keep receiving
-		else {                      // send whole file		
-			rdfd = open(filename, O_RDONLY);
-			if (rdfd == -1){
-				perror("open");
-				syslog(LOG_ERR, "open");
-				pthread_mutex_unlock(&file_mutex);
-				return NULL;
-			}
+int listener_local(const char *path, int backlog)
+{
+	struct sockaddr_un addr;
+	int fd;
 
-			while ((ret_byte = read(rdfd, send_buf, sizeof(send_buf))) > 0){
-				if (ret_byte == -1){
-					perror("read");
-					syslog(LOG_ERR, "read");
-					pthread_mutex_unlock(&file_mutex);
-					return NULL;
-				}
-					
-				bytes_to_send = ret_byte;
-				ret_byte = send(thread_data->client_fd, send_buf, bytes_to_send, 0);
-				if (ret_byte == -1){
-					perror("send");
-					syslog(LOG_ERR, "send");
-					pthread_mutex_unlock(&file_mutex);
-					return NULL;
-				}
-			}
-			close(rdfd);
-			send_enable = 0;
-			
-			ret = pthread_mutex_unlock(&file_mutex);
-		    if (ret){
-		        perror("pthread_mutex_lock");
-		        pthread_exit(NULL);
-		    }		
-            // Unlock file
-		}
+	if (strlen(path) >= sizeof(addr.sun_path)){
+		syslog(LOG_ERR, "UNIX socket path too long: %s", path);
+		return -1;
 	}
-		
-	// Logs message to the syslog “Closed connection from XXX”
-	printf("Closed connection from %s\n", thread_data->client_ip);
-	syslog(LOG_DEBUG, "Closed connection from %s\n", thread_data->client_ip);
-	if (close(thread_data->client_fd)){
-		perror("close");
-		syslog(LOG_ERR, "close failed.");
-		return NULL;
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd == -1){
+	    perror("socket");
+		syslog(LOG_ERR, "UNIX socket create failed.");
+		return -1;
 	}
-	
-	thread_data->thread_complete = true;
-	return NULL;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+	unlink(path);   // stale socket of an earlier run
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 ||
+	    listen(fd, backlog) == -1){
+	    perror("bind");
+		syslog(LOG_ERR, "UNIX socket %s: %s", path, strerror(errno));
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/**********************************************************************************
+ * @name       thread_pin()
+ **********************************************************************************/
+void thread_pin(pthread_t thread, int index)
+{
+	cpu_set_t allowed, one;
+	int cpu, nth = -1;
+
+	if (sched_getaffinity(0, sizeof(allowed), &allowed) == -1 || CPU_COUNT(&allowed) == 0) return;
+	index %= CPU_COUNT(&allowed);
+
+	// index-th CPU the process may run on, so a restricted cpuset still works
+	for (cpu = 0; cpu < CPU_SETSIZE; cpu++){
+		if (CPU_ISSET(cpu, &allowed) && ++nth == index) break;
+	}
+	CPU_ZERO(&one);
+	CPU_SET(cpu, &one);
+	if (pthread_setaffinity_np(thread, sizeof(one), &one))
+		syslog(LOG_ERR, "pthread_setaffinity_np failed for cpu %d", cpu);
+}
+
+/**********************************************************************************
+ * @name       usage()       
+ **********************************************************************************/
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [-d] [-m pool|epoll|uring] [-w workers] [-R] [-a] [-f none|interval|record]\n"
+	                "          [-i ms] [-c cache_mb] [-M metrics_socket] [-s store[:path]] [-g mb] [-k n]\n"
+	                "          [-U unix_socket [-S]] [-C channel_prefix] [-q n] [-b mb] [-P throttle|drop]\n"
+	                "          [-B backlog] [-n max_conns] [-I sec] [-T sec] [-O busy|reset]\n"
+	                "          [-o mb] [-L rate] [-W capture_file]\n"
+	                "  -d, --daemon          run as a daemon\n"
+	                "  -m, --mode MODE       connection model, pool (default), epoll or uring\n"
+	                "                        (uring falls back to epoll without io_uring)\n"
+	                "  -w, --workers N       worker or event loop threads (default: cores)\n"
+	                "  -R, --reuseport       one SO_REUSEPORT listener per event loop (epoll, uring)\n"
+	                "  -a, --affinity        pin worker or event loop i to CPU i\n"
+	                "  -f, --fsync POLICY    none (default), interval or record\n"
+	                "  -i, --fsync-interval MS  period for -f interval (default: 1000)\n"
+	                "  -c, --cache-mb N      cache up to N MB of history in memory (default: 0, off)\n"
+	                "  -M, --metrics PATH    serve metrics as text on a UNIX socket at PATH\n"
+	                "  -s, --store NAME[:PATH]  history backend: chardev (/dev/aesdchar), file\n"
+	                "                        (/var/tmp/aesdsocketdata), seg (PATH.NNNNNN segment\n"
+	                "                        files) or ring (in memory, like the driver), default: %s\n"
+	                "  -g, --segment-mb N    seg: history per segment file (default: 64)\n"
+	                "  -k, --segments N      seg: segment files kept, at least 2 (default: 8)\n"
+	                "  -U, --unix PATH       also serve the protocol on a UNIX socket at PATH\n"
+	                "  -S, --shm-ring        let -U clients append through shared memory rings\n"
+	                "  -C, --channel-prefix PREFIX  named channels live in PREFIX-NAME files\n"
+	                "                        (default: the file or seg path, else %s)\n"
+	                "  -q, --queue N         replies one connection may owe (default: %d)\n"
+	                "  -b, --buffer-mb N     memory for all connection buffers (default: %d)\n"
+	                "  -P, --slow POLICY     throttle (default) or drop a connection that needs\n"
+	                "                        more buffer memory once -b is spent\n"
+	                "  -B, --backlog N       pending connections per listener, the kernel caps it\n"
+	                "                        at net.core.somaxconn (default: %d)\n"
+	                "  -n, --max-conns N     connections served at once, more are refused\n"
+	                "                        (default: the descriptor limit less %d)\n"
+	                "  -I, --idle-timeout SEC  close a connection without traffic for SEC\n"
+	                "                        (default: 0, never)\n"
+	                "  -T, --read-timeout SEC  close a connection whose record stays incomplete\n"
+	                "                        for SEC (default: 0, never)\n"
+	                "  -O, --overload POLICY answer a refused connection with a busy line (busy,\n"
+	                "                        default) or a TCP reset (reset)\n"
+	                "  -o, --iobuf-mb N      idle I/O buffers kept for reuse (default: %d)\n"
+	                "  -L, --log-rate N      log messages per second of each class, more are\n"
+	                "                        dropped and counted (default: %d, 0 for no limit)\n"
+	                "  -W, --capture FILE    record the traffic of every connection into FILE\n"
+	                "                        for aesdsocket-replay\n",
+	                prog, USE_AESD_CHAR_DEVICE ? "chardev" : "file", store_file_ops.default_path,
+	                CONN_QUEUE_MAX, CONN_BUFFER_MB, LISTEN_BACKLOG, CONN_FD_RESERVE, IOBUF_POOL_MB,
+	                LOG_RATE);
 }
 
 /**********************************************************************************
@@ -322,18 +290,63 @@ void *socketThread(void *arg)
  **********************************************************************************/
 int main(int argc, char **argv)
 {
-	// Server
-	struct addrinfo hints, *servinfo;
-	// Client
-	struct sockaddr client_addr;
-	socklen_t addr_size;
-	char client_ip[INET_ADDRSTRLEN];
 	// Return code
 	int ret;
 	// Flags
 	int daemon_mode = 0;
+	server_mode_t server_mode = SERVER_MODE_POOL;
+	long workers = sysconf(_SC_NPROCESSORS_ONLN);
+	server_opts_t server_opts = { .local_fd = -1, .backlog = LISTEN_BACKLOG };
+	fsync_policy_t fsync_policy = FSYNC_NONE;
+	long fsync_interval_ms = 1000;
+	long cache_mb = 0;
+	long iobuf_mb = IOBUF_POOL_MB;
+	long log_rate = LOG_RATE;
+	const char *metrics_path = NULL;
+	const char *capture_path = NULL;
+	const char *local_path = NULL;
+	const char *channel_prefix = NULL;
+	int shm_rings = 0;
+	store_opts_t store_opts = { .segment_bytes = (size_t)64 << 20, .segments = 8 };
+	conn_limits_t conn_limits = {
+		.queue_max = CONN_QUEUE_MAX,
+		.buffer_budget = (size_t)CONN_BUFFER_MB << 20,
+		.slow_policy = SLOW_THROTTLE,
+		.overload = OVERLOAD_BUSY,
+	};
+	long segment_mb, limit;
+	int opt;
 	
-	SLIST_INIT(&head);
+	static const struct option long_options[] = {
+		{"daemon",  no_argument,       NULL, 'd'},
+		{"mode",    required_argument, NULL, 'm'},
+		{"workers", required_argument, NULL, 'w'},
+		{"reuseport", no_argument,     NULL, 'R'},
+		{"affinity", no_argument,      NULL, 'a'},
+		{"fsync",   required_argument, NULL, 'f'},
+		{"fsync-interval", required_argument, NULL, 'i'},
+		{"cache-mb", required_argument, NULL, 'c'},
+		{"metrics", required_argument, NULL, 'M'},
+		{"store",   required_argument, NULL, 's'},
+		{"segment-mb", required_argument, NULL, 'g'},
+		{"segments", required_argument, NULL, 'k'},
+		{"unix",    required_argument, NULL, 'U'},
+		{"shm-ring", no_argument,      NULL, 'S'},
+		{"channel-prefix", required_argument, NULL, 'C'},
+		{"queue",   required_argument, NULL, 'q'},
+		{"buffer-mb", required_argument, NULL, 'b'},
+		{"slow",    required_argument, NULL, 'P'},
+		{"backlog", required_argument, NULL, 'B'},
+		{"max-conns", required_argument, NULL, 'n'},
+		{"idle-timeout", required_argument, NULL, 'I'},
+		{"read-timeout", required_argument, NULL, 'T'},
+		{"overload", required_argument, NULL, 'O'},
+		{"iobuf-mb", required_argument, NULL, 'o'},
+		{"log-rate", required_argument, NULL, 'L'},
+		{"capture", required_argument, NULL, 'W'},
+		{NULL, 0, NULL, 0}
+	};
+
 	
 	// Set up signal
 	set_signal();
@@ -341,47 +354,188 @@ int main(int argc, char **argv)
 	// Logging with LOG_USER facility.
     openlog(NULL, 0, LOG_USER);
 	
-	if (argc == 2 && strcmp(argv[1], "-d") == 0) daemon_mode = 1;
-	
-	
-	// Opens a stream socket bound to port 9000
-	sockfd = socket(AF_INET, SOCK_STREAM, 0);
-	if (sockfd == -1){
-	    perror("socket");
-		syslog(LOG_ERR, "socket create failed.");
+	while ((opt = getopt_long(argc, argv, "dm:w:Raf:i:c:M:s:g:k:U:SC:q:b:P:B:n:I:T:O:o:L:W:", long_options, NULL)) != -1){
+		switch (opt){
+			case 'd':
+				daemon_mode = 1;
+				break;
+			case 'm':
+				if (strcmp(optarg, "pool") == 0)       server_mode = SERVER_MODE_POOL;
+				else if (strcmp(optarg, "epoll") == 0) server_mode = SERVER_MODE_EPOLL;
+				else if (strcmp(optarg, "uring") == 0) server_mode = SERVER_MODE_URING;
+				else {
+					usage(argv[0]);
+					exit(1);
+				}
+				break;
+			case 'w':
+				workers = strtol(optarg, NULL, 10);
+				if (workers <= 0){
+					usage(argv[0]);
+					exit(1);
+				}
+				break;
+			case 'R':
+				server_opts.reuseport = 1;
+				break;
+			case 'a':
+				server_opts.affinity = 1;
+				break;
+			case 'f':
+				if (strcmp(optarg, "none") == 0)          fsync_policy = FSYNC_NONE;
+				else if (strcmp(optarg, "interval") == 0) fsync_policy = FSYNC_INTERVAL;
+				else if (strcmp(optarg, "record") == 0)   fsync_policy = FSYNC_RECORD;
+				else {
+					usage(argv[0]);
+					exit(1);
+				}
+				break;
+			case 'i':
+				fsync_interval_ms = strtol(optarg, NULL, 10);
+				if (fsync_interval_ms <= 0){
+					usage(argv[0]);
+					exit(1);
+				}
+				break;
+			case 'c':
+				cache_mb = strtol(optarg, NULL, 10);
+				if (cache_mb < 0){
+					usage(argv[0]);
+					exit(1);
+				}
+				break;
+			case 'M':
+				metrics_path = optarg;
+				break;
+			case 's':
+				if (store_select(optarg)){
+					usage(argv[0]);
+					exit(1);
+				}
+				break;
+			case 'g':
+				segment_mb = strtol(optarg, NULL, 10);
+				if (segment_mb <= 0){
+					usage(argv[0]);
+					exit(1);
+				}
+				store_opts.segment_bytes = (size_t)segment_mb << 20;
+				break;
+			case 'k':
+				store_opts.segments = (int)strtol(optarg, NULL, 10);
+				if (store_opts.segments < 2){
+					usage(argv[0]);
+					exit(1);
+				}
+				break;
+			case 'U':
+				local_path = optarg;
+				break;
+			case 'S':
+				shm_rings = 1;
+				break;
+			case 'C':
+				channel_prefix = optarg;
+				break;
+			case 'q':
+				limit = strtol(optarg, NULL, 10);
+				if (limit <= 0){
+					usage(argv[0]);
+					exit(1);
+				}
+				conn_limits.queue_max = (size_t)limit;
+				break;
+			case 'b':
+				limit = strtol(optarg, NULL, 10);
+				if (limit <= 0){
+					usage(argv[0]);
+					exit(1);
+				}
+				conn_limits.buffer_budget = (size_t)limit << 20;
+				break;
+			case 'o':
+				iobuf_mb = strtol(optarg, NULL, 10);
+				if (iobuf_mb < 0){
+					usage(argv[0]);
+					exit(1);
+				}
+				break;
+			case 'W':
+				capture_path = optarg;
+				break;
+			case 'L':
+				log_rate = strtol(optarg, NULL, 10);
+				if (log_rate < 0 || log_rate > UINT_MAX){
+					usage(argv[0]);
+					exit(1);
+				}
+				break;
+			case 'P':
+				if (strcmp(optarg, "throttle") == 0)  conn_limits.slow_policy = SLOW_THROTTLE;
+				else if (strcmp(optarg, "drop") == 0) conn_limits.slow_policy = SLOW_DROP;
+				else {
+					usage(argv[0]);
+					exit(1);
+				}
+				break;
+			case 'B':
+				limit = strtol(optarg, NULL, 10);
+				if (limit <= 0 || limit > INT_MAX){
+					usage(argv[0]);
+					exit(1);
+				}
+				server_opts.backlog = (int)limit;
+				break;
+			case 'n':
+				limit = strtol(optarg, NULL, 10);
+				if (limit <= 0){
+					usage(argv[0]);
+					exit(1);
+				}
+				conn_limits.max_conns = (size_t)limit;
+				break;
+			case 'I':
+			case 'T':
+				limit = strtol(optarg, NULL, 10);
+				if (limit < 0 || limit > UINT_MAX / 1000){
+					usage(argv[0]);
+					exit(1);
+				}
+				if (opt == 'I') conn_limits.idle_ms = (unsigned int)limit * 1000;
+				else            conn_limits.read_ms = (unsigned int)limit * 1000;
+				break;
+			case 'O':
+				if (strcmp(optarg, "busy") == 0)       conn_limits.overload = OVERLOAD_BUSY;
+				else if (strcmp(optarg, "reset") == 0) conn_limits.overload = OVERLOAD_RESET;
+				else {
+					usage(argv[0]);
+					exit(1);
+				}
+				break;
+			default:
+				usage(argv[0]);
+				exit(1);
+		}
+	}
+	if (workers <= 0) workers = 1;
+	server_opts.nthreads = (int)workers;
+	if (server_opts.reuseport && server_mode == SERVER_MODE_POOL){
+		syslog(LOG_INFO, "reuseport needs an event loop mode, pool keeps one listener");
+		server_opts.reuseport = 0;
+	}
+	if (shm_rings && !local_path){
+		usage(argv[0]);
 		exit(1);
 	}
 	
-	// Enable SO_REUSEADDR to allow reuse of the address/port
-    int yes = 1;
-	ret = setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
-    if (ret == -1) {
-        perror("setsockopt");
-        syslog(LOG_ERR, "setsockopt failed.");
-        exit(1);
-    }
-
-	memset(&hints, 0, sizeof(hints));
-    hints.ai_family = AF_UNSPEC; 
-    hints.ai_socktype = SOCK_STREAM;
-	hints.ai_flags = AI_PASSIVE;
 	
-	ret = getaddrinfo(NULL, "9000", &hints, &servinfo);
-    if (ret != 0) {
-        fprintf(stderr, "getaddrinfo: %s\n", gai_strerror(ret));
-		syslog(LOG_ERR, "getaddrinfo failed with errcode %d.", ret);
-        exit(1);
-    }
-
-	// bind()
-	ret = bind(sockfd, servinfo->ai_addr, sizeof(struct sockaddr));
-	if (ret == -1){
-	    perror("bind");
-		syslog(LOG_ERR, "bind failed.");
-		exit(1);
+	// Opens a stream socket bound to port 9000
+	sockfd = listener_open(server_opts.reuseport);
+	if (sockfd == -1) exit(1);
+	if (local_path){
+		server_opts.local_fd = listener_local(local_path, server_opts.backlog);
+		if (server_opts.local_fd == -1) exit(1);
 	}
-	// Free memory
-	freeaddrinfo(servinfo); // all done with this structure
 	
 	// support a -d argument to run as a daemon
 	// should fork after ensuring it can bind to port 9000
@@ -422,107 +576,88 @@ int main(int argc, char **argv)
     dup2(fd, STDERR_FILENO);
 
 	// Listens for and accepts a connection
-	ret = listen(sockfd, LISTEN_BACKLOG);
+	ret = listen(sockfd, server_opts.backlog);
 	if (ret == -1){
 	    perror("listen");
 		syslog(LOG_ERR, "listen failed.");
 		exit(1);
 	}
-#if !USE_AESD_CHAR_DEVICE	
-	// Start timestamp thread
-	ret = pthread_create(&timestamp_id, NULL, append_timestamp, NULL);
+	// Threads started from here on log through the drainer
+	if (log_start((unsigned)log_rate)){
+		syslog(LOG_ERR, "log start failed.");
+		exit(1);
+	}
+	// History backend, then its single writer
+	if (store_open(&store_opts)){
+		syslog(LOG_ERR, "store open failed.");
+		exit(1);
+	}
+	ret = appender_start(fsync_policy, (int)fsync_interval_ms);
 	if (ret){
-		perror("pthread_create");
+		syslog(LOG_ERR, "appender start failed.");
 		exit(1);
 	}
-#endif	
-	while (!terminate){
-		addr_size = sizeof(client_addr);
-		new_sockfd = accept(sockfd, (struct sockaddr *)&client_addr, &addr_size); // return new file descriptor
-		if (new_sockfd == -1){
-			if (errno == EINTR && terminate) break; // Signal caught
-			perror("accept");
-			syslog(LOG_ERR, "accept failed.");
-			exit(1);
-		}
-
-		// Logs message for successful connection
-		inet_ntop(AF_INET, &client_addr.sa_data, client_ip, sizeof(client_ip));
-		printf("Accepted connection from %s\n", client_ip);
-		syslog(LOG_DEBUG, "Accepted connection from %s\n", client_ip);
-        
-		slist_thread_t *thread_node = (slist_thread_t *) malloc(sizeof(slist_thread_t));
-		
-		thread_node->client_fd = new_sockfd;
-		thread_node->thread_complete = false;
-		strcpy(thread_node->client_ip, client_ip);
-		
-		// Create thread
-		ret = pthread_create(&thread_node->thread_id, NULL, socketThread, thread_node);
-	    if (ret){
-		    perror("pthread_create");
-		    free(thread_node);
-			close(new_sockfd);
-		    //return false;
-			exit(1);
-	    }
-		
-	    // Insert node to linked list
-		SLIST_INSERT_HEAD(&head, thread_node, entries);
-		
-	    // Check thread_complete and join the thread
-		// Remove node
-		slist_thread_t *var = SLIST_FIRST(&head);
-        slist_thread_t *temp_var;
-
-        while (var != NULL) {
-			temp_var = SLIST_NEXT(var, entries);
-
-			if (var->thread_complete) {
-				pthread_join(var->thread_id, NULL);
-				SLIST_REMOVE(&head, var, slist_thread_s, entries);
-				free(var);
-			}
+	cache_init((size_t)cache_mb << 20);
+	iobuf_init((size_t)iobuf_mb << 20);
+	conn_init(&conn_limits);
+	// Channel files sit next to the history unless that is a device or memory
+	if (!channel_prefix && (store_flags() & STORE_STABLE)) channel_prefix = store_path();
+	chan_init(channel_prefix, fsync_policy, (int)fsync_interval_ms);
+	if (metrics_path && metrics_start(metrics_path)){
+		syslog(LOG_ERR, "metrics start failed.");
+		exit(1);
+	}
+	if (shm_rings && shm_start()){
+		syslog(LOG_ERR, "shared rings start failed.");
+		exit(1);
+	}
+	if (capture_path && capture_start(capture_path)){
+		syslog(LOG_ERR, "capture start failed.");
+		exit(1);
+	}
+	
+	if (server_mode == SERVER_MODE_URING && !uring_supported()){
+		syslog(LOG_INFO, "io_uring not available, using epoll");
+		server_mode = SERVER_MODE_EPOLL;
+	}
 
-			var = temp_var;
-        }
+	if (server_mode == SERVER_MODE_URING){
+		// Event loops queue accept, recv and waits on their own io_uring
+		ret = run_uring_server(sockfd, &server_opts);
+	}
+	else if (server_mode == SERVER_MODE_EPOLL){
+		// Event loops handle accept, recv, send and the timestamp tick
+		ret = run_epoll_server(sockfd, &server_opts);
+	}
+	else {
+		// One dispatcher feeds ready connections to a fixed worker pool
+		ret = run_pool_server(sockfd, &server_opts);
+	}
+	if (ret){
+		syslog(LOG_ERR, "server failed.");
 	}
 	
 	printf("Caught signal, exiting\n");
 	syslog(LOG_DEBUG, "Caught signal, exiting\n");
 	
-	// Final clean up
-    slist_thread_t *var2 = SLIST_FIRST(&head);
-    slist_thread_t *temp_var2;
-	var2 = SLIST_FIRST(&head);
-	
-    while (var2 != NULL) {
-        temp_var2 = SLIST_NEXT(var2, entries);
-
-        if (pthread_join(var2->thread_id, NULL) != 0) {
-            perror("pthread_join");
-            syslog(LOG_ERR, "pthread_join failed.");
-        }
-
-        SLIST_REMOVE(&head, var2, slist_thread_s, entries);
-        free(var2);
-
-        var2 = temp_var2;
-    }
+	// Rings append through the appender and count in the metrics
+	shm_stop();
+	capture_stop();
+	metrics_stop();
+	cache_destroy();
+	chan_destroy();
+	appender_stop();
+	store_close();
+	timeindex_clear();
+	iobuf_destroy();
+	log_stop();
 	
 	if (sockfd != -1) close(sockfd);
-	if (new_sockfd != -1) close(new_sockfd);
-	if (wrfd != -1) close(wrfd);
-		
-	if (remove(filename)){
-		perror("remove");
-		syslog(LOG_ERR, "remove file failed.");
+	if (server_opts.local_fd != -1){
+		close(server_opts.local_fd);
+		unlink(local_path);
 	}
 	
     closelog();	
-#if !USE_AESD_CHAR_DEVICE		
-	// join timestamp thread
-	pthread_join(timestamp_id, NULL);
-#endif		
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,135 @@
+ /**********************************************************************************
+ * @file    aesdsocket.h
+ * @brief   Shared definitions for the aesdsocket server.
+ *
+ * @author        <Li-Huan Lu>
+ * @date          <10/16/2026>
+ ***********************************************************************************/
+#ifndef AESDSOCKET_H
+#define AESDSOCKET_H
+
+#include <pthread.h>
+
+#ifndef USE_AESD_CHAR_DEVICE
+#define USE_AESD_CHAR_DEVICE 1  // default store, -s picks another at run time
+#endif
+
+#define LISTEN_BACKLOG     50   // default, from linux manual page
+#define TIMESTAMP_INTERVAL 10   // seconds
+
+typedef enum {
+	SERVER_MODE_POOL = 0,       // dispatcher plus work-stealing worker pool
+	SERVER_MODE_EPOLL,          // nonblocking event loops
+	SERVER_MODE_URING,          // event loops driven by io_uring completions
+} server_mode_t;
+
+typedef struct server_opts_s {
+	int nthreads;               // workers or event loops
+	int reuseport;              // every event loop accepts on its own SO_REUSEPORT listener
+	int affinity;               // pin worker or event loop i to the i-th usable CPU
+	int local_fd;               // UNIX domain listener served next to TCP, -1 for none
+	int backlog;                // listen() backlog of every listener
+} server_opts_t;
+
+extern volatile int terminate;
+
+/**********************************************************************************
+ * @name       write_timestamp()
+ *
+ * @brief      { Queues one "timestamp:" line for the history. }
+ *
+ * @return     0 on success, -1 on failure
+ **********************************************************************************/
+int write_timestamp(void);
+
+/**********************************************************************************
+ * @name       listener_open()
+ *
+ * @brief      { Opens a socket bound to port 9000, the caller calls listen(). }
+ *
+ * @param[in]  reuseport { Join the SO_REUSEPORT group of the port }
+ *
+ * @return     Socket, or -1 on failure
+ **********************************************************************************/
+int listener_open(int reuseport);
+
+/**********************************************************************************
+ * @name       listener_reuseport()
+ *
+ * @brief      { Opens one more listening socket in the SO_REUSEPORT group. The
+ *               kernel spreads new connections over the group by flow hash, so
+ *               each has its own accept queue of backlog connections. }
+ *
+ * @return     Socket, or -1 on failure
+ **********************************************************************************/
+int listener_reuseport(int backlog);
+
+/**********************************************************************************
+ * @name       listener_local()
+ *
+ * @brief      { Opens a listening UNIX domain stream socket at path, replacing a
+ *               stale one. Clients on it speak the same protocol as on TCP. }
+ *
+ * @return     Socket, or -1 on failure
+ **********************************************************************************/
+int listener_local(const char *path, int backlog);
+
+/**********************************************************************************
+ * @name       thread_pin()
+ *
+ * @brief      { Pins a thread to the index-th CPU the process may use, wrapping
+ *               around when there are more threads than CPUs. }
+ **********************************************************************************/
+void thread_pin(pthread_t thread, int index);
+
+/**********************************************************************************
+ * @name       run_epoll_server()
+ *
+ * @brief      { Serves the listening socket with opts->nthreads epoll event loops,
+ *               returns once terminate is set and all loops have exited. }
+ *
+ * @param[in]  listen_fd { Bound and listening socket }
+ * @param[in]  opts      { Number of event loop threads, listener and CPU layout }
+ *
+ * @return     0 on success, -1 on failure
+ **********************************************************************************/
+int run_epoll_server(int listen_fd, const server_opts_t *opts);
+
+/**********************************************************************************
+ * @name       run_pool_server()
+ *
+ * @brief      { Serves the listening socket with one epoll dispatcher and a fixed
+ *               pool of opts->nthreads workers, returns once terminate is set. }
+ *
+ * @param[in]  listen_fd { Bound and listening socket }
+ * @param[in]  opts      { Number of worker threads and CPU layout }
+ *
+ * @return     0 on success, -1 on failure
+ **********************************************************************************/
+int run_pool_server(int listen_fd, const server_opts_t *opts);
+
+/**********************************************************************************
+ * @name       uring_supported()
+ *
+ * @brief      { Checks that the kernel allows io_uring and has every operation
+ *               the io_uring loops queue. }
+ *
+ * @return     1 when run_uring_server() can be used, 0 otherwise
+ **********************************************************************************/
+int uring_supported(void);
+
+/**********************************************************************************
+ * @name       run_uring_server()
+ *
+ * @brief      { Serves the listening socket with opts->nthreads io_uring event loop
+ *               threads, returns once terminate is set and all loops have
+ *               exited. }
+ *
+ * @param[in]  listen_fd { Bound and listening socket }
+ * @param[in]  opts      { Number of event loop threads, listener and CPU layout }
+ *
+ * @return     0 on success, -1 on failure
+ **********************************************************************************/
+int run_uring_server(int listen_fd, const server_opts_t *opts);
+
+#endif /* AESDSOCKET_H */
@@ -0,0 +1,168 @@
+ /**********************************************************************************
+ * @file    Test_index.c
+ * @brief   Unity tests of the aesdsocket command offset index.
+ *
+ *          Each test writes a data file and an index file as a crash may
+ *          have left them, opens the index and checks that every command
+ *          is found where the data says it is, and that the index file
+ *          holds only the entries that still describe the data.
+ *
+ * @author        <Li-Huan Lu>
+ * @date          <10/16/2026>
+ ***********************************************************************************/
+#include "unity.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "../../server/aesdsocket-index.h"
+
+#define TEST_DATA "a\nbb\nccc\ndddd\n"
+static const uint64_t test_ends[] = { 2, 5, 9, 14 };
+
+/**********************************************************************************
+ * @name       index_files()
+ *
+ * @brief      { Creates the data file from data and the index file from the
+ *               first len bytes of entries in a new directory. }
+ *
+ * @return     Readable fd on the data file
+ **********************************************************************************/
+static int index_files(char *dir, char *path, const char *data, const void *entries, size_t len)
+{
+	char data_path[64];
+	int fd;
+
+	strcpy(dir, "/tmp/aesdindexXXXXXX");
+	TEST_ASSERT_NOT_NULL(mkdtemp(dir));
+	snprintf(data_path, sizeof(data_path), "%s/data", dir);
+	snprintf(path, 64, "%s/index", dir);
+
+	fd = open(data_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	TEST_ASSERT_TRUE(fd != -1);
+	TEST_ASSERT_EQUAL_INT((int)strlen(data), write(fd, data, strlen(data)));
+	unlink(data_path);
+	if (len){
+		int index_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+		TEST_ASSERT_TRUE(index_fd != -1);
+		TEST_ASSERT_EQUAL_INT((int)len, write(index_fd, entries, len));
+		close(index_fd);
+	}
+	return fd;
+}
+
+/**********************************************************************************
+ * @name       index_check()
+ *
+ * @brief      { Checks every command of TEST_DATA and the entries kept in the
+ *               file, then closes the index and removes the files. }
+ **********************************************************************************/
+static void index_check(char *dir, const char *path, int fd)
+{
+	struct stat st;
+	off_t start, end;
+	unsigned int i;
+
+	for (i = 0; i < sizeof(test_ends) / sizeof(test_ends[0]); i++){
+		TEST_ASSERT_EQUAL_INT(0, index_lookup(i, &start, &end));
+		TEST_ASSERT_EQUAL_INT64(i ? test_ends[i - 1] : 0, start);
+		TEST_ASSERT_EQUAL_INT64(test_ends[i], end);
+	}
+	// Past the last command is where the next one starts
+	TEST_ASSERT_EQUAL_INT(-1, index_lookup(i + 5, &start, &end));
+	TEST_ASSERT_EQUAL_INT64(test_ends[i - 1], start);
+	TEST_ASSERT_EQUAL_INT64(test_ends[i - 1], end);
+	TEST_ASSERT_EQUAL_INT(0, stat(path, &st));
+	TEST_ASSERT_EQUAL_INT64(sizeof(test_ends), st.st_size);
+
+	index_close(1);
+	close(fd);
+	TEST_ASSERT_EQUAL_INT(0, rmdir(dir));
+}
+
+void test_index_built_from_data(void)
+{
+	char dir[64], path[64];
+	int fd = index_files(dir, path, TEST_DATA, NULL, 0);
+
+	TEST_ASSERT_EQUAL_INT(0, index_open(path, fd));
+	index_check(dir, path, fd);
+}
+
+void test_index_torn_last_entry(void)
+{
+	char dir[64], path[64];
+	int fd;
+
+	// The last entry was only partly written
+	fd = index_files(dir, path, TEST_DATA, test_ends, sizeof(test_ends) - 3);
+	TEST_ASSERT_EQUAL_INT(0, index_open(path, fd));
+	index_check(dir, path, fd);
+}
+
+void test_index_ahead_of_data(void)
+{
+	static const uint64_t ahead[] = { 2, 5, 9, 14, 20, 27 };
+	char dir[64], path[64];
+	int fd;
+
+	// The index was written, the data it describes never made it to disk
+	fd = index_files(dir, path, TEST_DATA, ahead, sizeof(ahead));
+	TEST_ASSERT_EQUAL_INT(0, index_open(path, fd));
+	index_check(dir, path, fd);
+}
+
+void test_index_not_ascending(void)
+{
+	static const uint64_t torn[] = { 2, 5, 4, 14 };
+	char dir[64], path[64];
+	int fd;
+
+	fd = index_files(dir, path, TEST_DATA, torn, sizeof(torn));
+	TEST_ASSERT_EQUAL_INT(0, index_open(path, fd));
+	index_check(dir, path, fd);
+}
+
+void test_index_foreign(void)
+{
+	static const uint64_t foreign[] = { 3, 7 };
+	char dir[64], path[64];
+	int fd;
+
+	// Ascending and within the data, but not ending on its newlines
+	fd = index_files(dir, path, TEST_DATA, foreign, sizeof(foreign));
+	TEST_ASSERT_EQUAL_INT(0, index_open(path, fd));
+	index_check(dir, path, fd);
+}
+
+void test_index_data_past_last_newline(void)
+{
+	char dir[64], path[64];
+	off_t start, end;
+	int fd;
+
+	// Commands appended after the index, the last one not finished
+	fd = index_files(dir, path, TEST_DATA "ee\nf", test_ends, 2 * sizeof(test_ends[0]));
+	TEST_ASSERT_EQUAL_INT(0, index_open(path, fd));
+	TEST_ASSERT_EQUAL_INT(0, index_lookup(4, &start, &end));
+	TEST_ASSERT_EQUAL_INT64(14, start);
+	TEST_ASSERT_EQUAL_INT64(17, end);
+	TEST_ASSERT_EQUAL_INT(-1, index_lookup(5, &start, &end));
+	TEST_ASSERT_EQUAL_INT64(17, start);
+
+	// The rest of the last command arrives
+	index_scan("ff\n", 3);
+	TEST_ASSERT_EQUAL_INT(-1, index_lookup(5, &start, &end));
+	index_commit();
+	TEST_ASSERT_EQUAL_INT(0, index_lookup(5, &start, &end));
+	TEST_ASSERT_EQUAL_INT64(17, start);
+	TEST_ASSERT_EQUAL_INT64(21, end);
+
+	index_close(1);
+	close(fd);
+	TEST_ASSERT_EQUAL_INT(0, rmdir(dir));
+}
@@ -0,0 +1,218 @@
+ /**********************************************************************************
+ * @file    Test_query.c
+ * @brief   Unity tests of the aesdsocket substring search and query scan.
+ *
+ *          The scan reads the main history through store_read(), which is
+ *          served here from a buffer, so no store or appender is needed.
+ *          The results are checked against a plain line by line search.
+ *
+ * @author        <Li-Huan Lu>
+ * @date          <10/16/2026>
+ ***********************************************************************************/
+#define _GNU_SOURCE     // memmem()
+#include "unity.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "../../server/aesdsocket-query.h"
+#include "../../server/aesdsocket-iobuf.h"
+#include "../../server/aesdsocket-store.h"
+
+#define TEST_CHUNK (64 << 10)   // QUERY_CHUNK, the overlap is at its multiples
+
+static char *history;
+static size_t history_len;
+
+/**********************************************************************************
+ * @name       store_read()
+ *
+ * @brief      { The main history, from the test buffer. }
+ **********************************************************************************/
+ssize_t store_read(void *buf, size_t len, off_t off)
+{
+	if ((size_t)off >= history_len) return 0;
+	if (len > history_len - off) len = history_len - off;
+	memcpy(buf, history + off, len);
+	return len;
+}
+
+/**********************************************************************************
+ * @name       chan_read()
+ *
+ * @brief      { No channels here. }
+ **********************************************************************************/
+ssize_t chan_read(const struct chan_s *chan, void *buf, size_t len, off_t off)
+{
+	(void)chan; (void)buf; (void)len; (void)off;
+	errno = EINVAL;
+	return -1;
+}
+
+void *iobuf_get(size_t len, size_t *cap)
+{
+	*cap = len;
+	return malloc(len);
+}
+
+void iobuf_put(void *buf, size_t cap)
+{
+	(void)cap;
+	free(buf);
+}
+
+/**********************************************************************************
+ * @name       history_set()
+ *
+ * @brief      { Makes len bytes of text the history. }
+ **********************************************************************************/
+static void history_set(const char *text, size_t len)
+{
+	free(history);
+	history = (char *) malloc(len + 1);
+	TEST_ASSERT_NOT_NULL(history);
+	memcpy(history, text, len);
+	history_len = len;
+}
+
+/**********************************************************************************
+ * @name       query_check()
+ *
+ * @brief      { Scans history [start, end) for pattern and compares every
+ *               record returned with the ones holding it in full. }
+ *
+ * @return     Number of matching records
+ **********************************************************************************/
+static size_t query_check(const char *pattern, off_t start, off_t end)
+{
+	struct query_s *query;
+	size_t plen = strlen(pattern), matches = 0;
+	const char *line = history + start, *nl, *stop = history + end;
+	off_t off, rec_end;
+	int ret;
+
+	query = query_create(NULL, pattern, plen, start, end);
+	TEST_ASSERT_NOT_NULL(query);
+
+	while ((nl = memchr(line, '\n', stop - line)) != NULL){
+		if (memmem(line, nl - line, pattern, plen)){
+			do {
+				ret = query_next(query, &off, &rec_end);
+			} while (ret == QUERY_AGAIN);
+			TEST_ASSERT_EQUAL_INT(QUERY_MATCH, ret);
+			TEST_ASSERT_EQUAL_INT64(line - history, off);
+			TEST_ASSERT_EQUAL_INT64(nl + 1 - history, rec_end);
+			matches++;
+		}
+		line = nl + 1;
+	}
+	do {
+		ret = query_next(query, &off, &rec_end);
+	} while (ret == QUERY_AGAIN);
+	TEST_ASSERT_EQUAL_INT(QUERY_DONE, ret);
+	query_free(query);
+	return matches;
+}
+
+void test_query_find_every_position(void)
+{
+	char buf[80];
+	const char *pattern = "abcd";
+	size_t plen, pos;
+
+	// Every pattern length at every offset, so the positions left after the
+	// last sixteen are covered too
+	for (plen = 1; plen <= strlen(pattern); plen++){
+		for (pos = 0; pos + plen <= sizeof(buf); pos++){
+			memset(buf, 'x', sizeof(buf));
+			memcpy(buf + pos, pattern, plen);
+			TEST_ASSERT_EQUAL_PTR(buf + pos, query_find(buf, sizeof(buf), pattern, plen));
+			TEST_ASSERT_NULL(query_find(buf, pos + plen - 1, pattern, plen));
+		}
+	}
+}
+
+void test_query_find_first_and_last_byte_only(void)
+{
+	const char *buf = "axxd axyd abcx abcd";
+
+	TEST_ASSERT_EQUAL_PTR(buf + 15, query_find(buf, strlen(buf), "abcd", 4));
+	TEST_ASSERT_NULL(query_find(buf, strlen(buf), "abzd", 4));
+	TEST_ASSERT_NULL(query_find(buf, 3, "abcd", 4));
+	TEST_ASSERT_NULL(query_find(buf, strlen(buf), "", 0));
+}
+
+void test_query_next_match_across_chunks(void)
+{
+	static const char *pattern = "needle";
+	char *text;
+	size_t len = 3 * TEST_CHUNK, at;
+
+	text = (char *) malloc(len);
+	TEST_ASSERT_NOT_NULL(text);
+	memset(text, 'x', len);
+	for (at = 99; at < len; at += 100) text[at] = '\n';
+
+	// Split by the first chunk boundary, in the overlap read again
+	memcpy(text + TEST_CHUNK - 3, pattern, strlen(pattern));
+	// In a record whose newline only comes with the next chunk
+	memset(text + 2 * TEST_CHUNK - 500, 'y', 1000);
+	memcpy(text + 2 * TEST_CHUNK - 300, pattern, strlen(pattern));
+	history_set(text, len);
+	free(text);
+
+	TEST_ASSERT_EQUAL_UINT(2, query_check(pattern, 0, len));
+}
+
+void test_query_next_record_cut_at_scan_end(void)
+{
+	const char *text = "one needle\ntwo\nthree needle";
+	off_t off, end;
+	struct query_s *query;
+
+	history_set(text, strlen(text));
+	query = query_create(NULL, "needle", 6, 0, strlen(text));
+	TEST_ASSERT_NOT_NULL(query);
+	TEST_ASSERT_EQUAL_INT(QUERY_MATCH, query_next(query, &off, &end));
+	TEST_ASSERT_EQUAL_INT64(0, off);
+	TEST_ASSERT_EQUAL_INT64(11, end);
+	TEST_ASSERT_EQUAL_INT(QUERY_DONE, query_next(query, &off, &end));
+	TEST_ASSERT_EQUAL_UINT64(11, query_bytes(query));
+	query_free(query);
+
+	// A scan that stops before the newline of a matching record
+	query = query_create(NULL, "needle", 6, 0, 8);
+	TEST_ASSERT_NOT_NULL(query);
+	TEST_ASSERT_EQUAL_INT(QUERY_DONE, query_next(query, &off, &end));
+	query_free(query);
+}
+
+void test_query_next_matches_line_search(void)
+{
+	static const char *patterns[] = { "ab", "abc", "cab", "abcabcab" };
+	uint32_t seed = 1;
+	size_t len = 5 * TEST_CHUNK / 2, i, left = 0;
+	char *text;
+
+	text = (char *) malloc(len);
+	TEST_ASSERT_NOT_NULL(text);
+	for (i = 0; i < len; i++){
+		seed = seed * 1103515245 + 12345;
+		text[i] = "abc"[(seed >> 16) % 3];
+		// Mostly short records, now and then one longer than a chunk
+		if (left == 0){
+			left = 1 + (seed >> 20) % 64 + ((seed >> 8) % 32 ? 0 : TEST_CHUNK);
+			text[i] = '\n';
+		}
+		left--;
+	}
+	history_set(text, len);
+	free(text);
+
+	for (i = 0; i < sizeof(patterns) / sizeof(patterns[0]); i++){
+		TEST_ASSERT_TRUE(query_check(patterns[i], 0, len) > 0);
+		query_check(patterns[i], 1000, len - 1000);
+	}
+	free(history);
+	history = NULL;
+	history_len = 0;
+}
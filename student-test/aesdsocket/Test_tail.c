@@ -0,0 +1,232 @@
+ /**********************************************************************************
+ * @file    Test_tail.c
+ * @brief   Unity tests of aesdsocket tail replies past the driver's capacity.
+ *
+ *          Runs the server built in ../server on port 9000 and writes more
+ *          records than the driver keeps in tail mode. A stable store
+ *          answers each with the record alone. The ring, like the driver,
+ *          numbers its bytes from the oldest command kept, so it answers
+ *          with what it keeps and refuses a binary TAIL. Skipped when the
+ *          server was not built.
+ *
+ * @author        <Li-Huan Lu>
+ * @date          <10/16/2026>
+ ***********************************************************************************/
+#define _GNU_SOURCE     // be64toh()
+#include "unity.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <poll.h>
+#include <endian.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "../../aesd-char-driver/aesd-circular-buffer.h"
+#include "../../server/aesdsocket-proto.h"
+
+#define TAIL_SERVER  "server/aesdsocket"
+#define TAIL_RECORDS (2 * AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED + 5)
+#define TAIL_WAIT_MS 2000
+
+static pid_t tail_pid = -1;
+
+/**********************************************************************************
+ * @name       tail_connect()
+ *
+ * @brief      { Connects to the server, retrying while it starts up. }
+ **********************************************************************************/
+static int tail_connect(void)
+{
+	struct sockaddr_in addr;
+	int fd, i;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(9000);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	for (i = 0; i < 50; i++){
+		fd = socket(AF_INET, SOCK_STREAM, 0);
+		TEST_ASSERT_TRUE(fd != -1);
+		if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0) return fd;
+		close(fd);
+		usleep(100 * 1000);
+	}
+	TEST_FAIL_MESSAGE("server did not come up on port 9000");
+	return -1;
+}
+
+/**********************************************************************************
+ * @name       tail_stop()
+ **********************************************************************************/
+static void tail_stop(void)
+{
+	int status;
+
+	if (tail_pid == -1) return;
+	kill(tail_pid, SIGTERM);
+	waitpid(tail_pid, &status, 0);
+	tail_pid = -1;
+}
+
+/**********************************************************************************
+ * @name       tail_start()
+ *
+ * @brief      { Runs the server with the store spec given. }
+ *
+ * @return     0 when started, -1 when it was not built
+ **********************************************************************************/
+static int tail_start(const char *store)
+{
+	tail_stop();    // left running by a failed test
+	if (access(TAIL_SERVER, X_OK)) return -1;
+	tail_pid = fork();
+	TEST_ASSERT_TRUE(tail_pid != -1);
+	if (tail_pid == 0){
+		execl(TAIL_SERVER, "aesdsocket", "-m", "epoll", "-s", store, (char *)NULL);
+		_exit(127);
+	}
+	return 0;
+}
+
+/**********************************************************************************
+ * @name       tail_recv()
+ *
+ * @brief      { Reads until len bytes are in, the server goes quiet for
+ *               TAIL_WAIT_MS or the connection ends. }
+ *
+ * @return     Bytes read
+ **********************************************************************************/
+static size_t tail_recv(int fd, char *buf, size_t len)
+{
+	struct pollfd pfd = { .fd = fd, .events = POLLIN };
+	size_t got = 0;
+	ssize_t n;
+
+	while (got < len && poll(&pfd, 1, TAIL_WAIT_MS) == 1){
+		n = recv(fd, buf + got, len - got, 0);
+		if (n <= 0) break;
+		got += n;
+	}
+	return got;
+}
+
+/**********************************************************************************
+ * @name       tail_strip()
+ *
+ * @brief      { Drops the timestamp lines a stable store adds on its own. }
+ *
+ * @return     Bytes left
+ **********************************************************************************/
+static size_t tail_strip(char *buf, size_t len)
+{
+	char *line = buf, *nl, *out = buf;
+
+	while (line < buf + len){
+		nl = memchr(line, '\n', buf + len - line);
+		nl = nl ? nl + 1 : buf + len;
+		if (strncmp(line, "timestamp:", 10)){
+			memmove(out, line, nl - line);
+			out += nl - line;
+		}
+		line = nl;
+	}
+	return out - buf;
+}
+
+/**********************************************************************************
+ * @name       tail_records()
+ *
+ * @brief      { Writes TAIL_RECORDS records in tail mode. Each reply must be
+ *               the record alone, or with whole set the last
+ *               AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED records. }
+ **********************************************************************************/
+static void tail_records(int whole)
+{
+	char records[TAIL_RECORDS][32], want[TAIL_RECORDS * 32], got[TAIL_RECORDS * 64];
+	size_t want_len, got_len, n;
+	int fd, i, j;
+
+	fd = tail_connect();
+	TEST_ASSERT_EQUAL_INT(18, send(fd, "AESDSOCKET_TAIL:1\n", 18, 0));
+	for (i = 0; i < TAIL_RECORDS; i++){
+		snprintf(records[i], sizeof(records[i]), "tail record %d\n", i);
+		TEST_ASSERT_EQUAL_INT((int)strlen(records[i]), send(fd, records[i], strlen(records[i]), 0));
+
+		want_len = 0;
+		j = whole && i >= AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED ?
+		    i + 1 - AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED : (whole ? 0 : i);
+		for (; j <= i; j++){
+			memcpy(want + want_len, records[j], strlen(records[j]));
+			want_len += strlen(records[j]);
+		}
+		got_len = 0;
+		do {
+			n = tail_recv(fd, got + got_len, want_len - got_len);
+			got_len = tail_strip(got, got_len + n);
+		} while (n && got_len < want_len);
+		TEST_ASSERT_EQUAL_UINT(want_len, got_len);
+		TEST_ASSERT_EQUAL_MEMORY(want, got, want_len);
+	}
+	close(fd);
+}
+
+/**********************************************************************************
+ * @name       tail_binary()
+ *
+ * @brief      { Sends a binary TAIL for the main history. }
+ *
+ * @return     Response status
+ **********************************************************************************/
+static int tail_binary(void)
+{
+	aesd_bin_hdr_t hdr;
+	char payload[4096];
+	size_t len;
+	int fd;
+
+	fd = tail_connect();
+	len = strlen(AESD_BIN_SWITCH);
+	TEST_ASSERT_EQUAL_INT((int)len, send(fd, AESD_BIN_SWITCH, len, 0));
+	TEST_ASSERT_EQUAL_UINT(sizeof(hdr), tail_recv(fd, (char *)&hdr, sizeof(hdr)));
+	TEST_ASSERT_EQUAL_INT(AESD_BIN_HELLO, hdr.op);
+	len = be64toh(hdr.len);
+	TEST_ASSERT_TRUE(len <= sizeof(payload));
+	TEST_ASSERT_EQUAL_UINT(len, tail_recv(fd, payload, len));
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.id = htobe32(1);
+	hdr.op = AESD_BIN_TAIL;
+	TEST_ASSERT_EQUAL_INT((int)sizeof(hdr), send(fd, &hdr, sizeof(hdr), 0));
+	TEST_ASSERT_EQUAL_UINT(sizeof(hdr), tail_recv(fd, (char *)&hdr, sizeof(hdr)));
+	TEST_ASSERT_EQUAL_INT(AESD_BIN_TAIL, hdr.op);
+	close(fd);
+	return hdr.status;
+}
+
+void test_tail_past_driver_capacity_stable(void)
+{
+	char dir[] = "/tmp/aesdtailXXXXXX", store[64];
+
+	TEST_ASSERT_NOT_NULL(mkdtemp(dir));
+	snprintf(store, sizeof(store), "file:%s/data", dir);
+	if (tail_start(store)){
+		rmdir(dir);
+		TEST_IGNORE_MESSAGE(TAIL_SERVER " not built");
+	}
+	tail_records(0);
+	TEST_ASSERT_EQUAL_INT(AESD_BIN_OK, tail_binary());
+	tail_stop();
+	rmdir(dir);
+}
+
+void test_tail_past_driver_capacity_ring(void)
+{
+	if (tail_start("ring")) TEST_IGNORE_MESSAGE(TAIL_SERVER " not built");
+	tail_records(1);
+	TEST_ASSERT_EQUAL_INT(AESD_BIN_EOP, tail_binary());
+	tail_stop();
+}
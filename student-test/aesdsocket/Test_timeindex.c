@@ -0,0 +1,83 @@
+ /**********************************************************************************
+ * @file    Test_timeindex.c
+ * @brief   Unity tests of the aesdsocket timestamp line index.
+ *
+ * @author        <Li-Huan Lu>
+ * @date          <10/16/2026>
+ ***********************************************************************************/
+#include "unity.h"
+#include "../../server/aesdsocket-timeindex.h"
+
+void test_timeindex_empty(void)
+{
+	TEST_ASSERT_EQUAL_INT64(0, timeindex_since(1000));
+	TEST_ASSERT_EQUAL_INT64(-1, timeindex_until(1000));
+}
+
+void test_timeindex_since_until(void)
+{
+	timeindex_add(100, 0);
+	timeindex_add(110, 50);
+	timeindex_add(120, 90);
+
+	// Since: the last line stamped no later than t, 0 before the first
+	TEST_ASSERT_EQUAL_INT64(0, timeindex_since(99));
+	TEST_ASSERT_EQUAL_INT64(0, timeindex_since(100));
+	TEST_ASSERT_EQUAL_INT64(0, timeindex_since(109));
+	TEST_ASSERT_EQUAL_INT64(50, timeindex_since(110));
+	TEST_ASSERT_EQUAL_INT64(50, timeindex_since(119));
+	TEST_ASSERT_EQUAL_INT64(90, timeindex_since(120));
+	TEST_ASSERT_EQUAL_INT64(90, timeindex_since(1000));
+
+	// Until: the first line stamped after t, -1 past the last
+	TEST_ASSERT_EQUAL_INT64(0, timeindex_until(99));
+	TEST_ASSERT_EQUAL_INT64(50, timeindex_until(100));
+	TEST_ASSERT_EQUAL_INT64(90, timeindex_until(110));
+	TEST_ASSERT_EQUAL_INT64(90, timeindex_until(119));
+	TEST_ASSERT_EQUAL_INT64(-1, timeindex_until(120));
+
+	timeindex_clear();
+	TEST_ASSERT_EQUAL_INT64(-1, timeindex_until(99));
+}
+
+void test_timeindex_same_second(void)
+{
+	timeindex_add(100, 0);
+	timeindex_add(100, 40);
+	timeindex_add(101, 80);
+
+	// What was written in a second starts at its first line
+	TEST_ASSERT_EQUAL_INT64(0, timeindex_since(100));
+	TEST_ASSERT_EQUAL_INT64(80, timeindex_since(101));
+	TEST_ASSERT_EQUAL_INT64(0, timeindex_until(99));
+	TEST_ASSERT_EQUAL_INT64(80, timeindex_until(100));
+	timeindex_clear();
+}
+
+void test_timeindex_clock_stepped_back(void)
+{
+	timeindex_add(200, 0);
+	timeindex_add(150, 60);    // recorded as 200
+	timeindex_add(210, 120);
+
+	TEST_ASSERT_EQUAL_INT64(0, timeindex_since(199));
+	TEST_ASSERT_EQUAL_INT64(0, timeindex_since(200));
+	TEST_ASSERT_EQUAL_INT64(120, timeindex_since(210));
+	TEST_ASSERT_EQUAL_INT64(0, timeindex_until(150));
+	TEST_ASSERT_EQUAL_INT64(120, timeindex_until(200));
+	timeindex_clear();
+}
+
+void test_timeindex_grows(void)
+{
+	unsigned int i;
+
+	// Well past the first allocation
+	for (i = 0; i < 10000; i++) timeindex_add(1000 + 10 * i, 100 * i);
+	TEST_ASSERT_EQUAL_INT64(0, timeindex_since(999));
+	TEST_ASSERT_EQUAL_INT64(100 * 4321, timeindex_since(1000 + 10 * 4321 + 9));
+	TEST_ASSERT_EQUAL_INT64(100 * 4322, timeindex_until(1000 + 10 * 4321));
+	TEST_ASSERT_EQUAL_INT64(100 * 9999, timeindex_since(1000 + 10 * 9999));
+	TEST_ASSERT_EQUAL_INT64(-1, timeindex_until(1000 + 10 * 9999));
+	timeindex_clear();
+}